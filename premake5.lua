@@ -50,4 +50,33 @@ workspace "TextEditor"
             -- fatalwarnings { "All" }
             defines {"_CRT_SECURE_NO_WARNINGS"}
 
-        filter {}
\ No newline at end of file
+        filter {}
+
+    -- The frame buffer and its terminal output on their own. The editor is still Win32 only,
+    -- so on Linux this is what builds (premake5 gmake2, then make TerminalOutput), keeping the
+    -- termios/VT side of screen_output.cpp compiling until the rest follows.
+    project "TerminalOutput"
+        kind "StaticLib"
+        language "C++"
+        cppdialect "C++20"
+        targetdir "bin/%{cfg.buildcfg}"
+        objdir "bin-int/%{cfg.buildcfg}"
+        location "."
+        warnings "Extra"
+
+        files {
+            "src/frame_buffer.cpp",
+            "src/frame_buffer.h",
+            "src/screen_output.cpp",
+            "src/screen_output.h"
+        }
+
+        includedirs {
+            "src"
+        }
+
+        filter "system:windows"
+            toolset "msc"
+            defines {"_CRT_SECURE_NO_WARNINGS"}
+
+        filter {}
@@ -5,6 +5,9 @@
 #include <iostream>
 #include <map>
 #include "lua_api.h"
+#include "atomic_file_writer.h"
+#include "text_encoding.h"
+#include "parallel_search.h"
 #include <Shlwapi.h>
 #pragma comment(lib, "Shlwapi.lib")
 
@@ -67,7 +70,6 @@ int lua_set_text_color(lua_State* L) {
     unsigned int color = get_lua_color(L, 4);
 
     editor->setTextForegroundColor(line_num, start_col, end_col, color);
-    editor->force_full_redraw_internal(); // Styling changes require redraw
     return 0;
 }
 
@@ -86,7 +88,6 @@ int lua_set_text_style(lua_State* L) {
     int style_flags = lua_tointeger(L, 4);
 
     editor->setTextStyles(line_num, start_col, end_col, style_flags);
-    editor->force_full_redraw_internal();
     return 0;
 }
 
@@ -124,7 +125,6 @@ int lua_add_decoration(lua_State* L) {
     // Add more type mappings as needed
 
     editor->addTextDecoration(id, line_num, start_col, end_col, type, tooltip, color);
-    editor->force_full_redraw_internal();
     return 0;
 }
 
@@ -146,7 +146,6 @@ int lua_clear_text_styling(lua_State* L) {
     }
 
     editor->clearLineStyling(line_num, start_col, end_col);
-    editor->force_full_redraw_internal();
     return 0;
 }
 
@@ -180,7 +179,6 @@ int lua_clear_decorations(lua_State* L) {
     }
 
     editor->clearDecorations(id_prefix);
-    editor->force_full_redraw_internal();
     return 0;
 }
 
@@ -216,7 +214,7 @@ int lua_set_tab_stop_width(lua_State* L) {
     if (width > 0 && width <= 16) {
         editor->kiloTabStop = width;
         editor->calculateLineNumberWidth();
-        editor->force_full_redraw_internal();
+        editor->damageAllRows();
         editor->statusMessage = "Tab stop width set to " + std::to_string(width);
         editor->statusMessageTime = GetTickCount64() + 2000;
     } else {
@@ -245,6 +243,408 @@ int lua_set_default_line_ending(lua_State* L) {
     return 0;
 }
 
+int lua_set_large_file_threshold(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isinteger(L, 1)) return luaL_error(L, "Argument #1 (megabytes) must be an integer.");
+    lua_Integer megabytes = lua_tointeger(L, 1);
+    if (megabytes < 1) return luaL_error(L, "Large file threshold must be at least 1 MB.");
+    editor->largeFileThreshold = (size_t)megabytes * 1024 * 1024;
+    return 0;
+}
+
+int lua_get_file_encoding(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    lua_pushstring(L, encodingName(editor->currentEncoding).c_str());
+    return 1;
+}
+
+int lua_set_file_encoding(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (encoding) must be a string.");
+    FileEncoding encoding;
+    if (!parseEncodingName(lua_tostring(L, 1), encoding)) {
+        return luaL_error(L, "Unknown encoding '%s'. Use UTF-8, UTF-8 BOM, UTF-16LE, UTF-16BE or Latin-1.", lua_tostring(L, 1));
+    }
+    editor->currentEncoding = encoding;
+    editor->dirty = true;
+    return 0;
+}
+
+int lua_reload_file(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    lua_pushboolean(L, editor->reloadFile());
+    return 1;
+}
+
+int lua_set_auto_reload(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isboolean(L, 1)) return luaL_error(L, "Argument #1 (enabled) must be a boolean.");
+    editor->autoReload = lua_toboolean(L, 1);
+    return 0;
+}
+
+int lua_set_follow_mode(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isboolean(L, 1)) return luaL_error(L, "Argument #1 (enabled) must be a boolean.");
+    if (!lua_isnoneornil(L, 2)) {
+        if (!lua_isboolean(L, 2)) return luaL_error(L, "Argument #2 (pin_to_bottom) must be a boolean.");
+        editor->followPinBottom = lua_toboolean(L, 2);
+    }
+    if (!lua_isnoneornil(L, 3)) {
+        if (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 0) return luaL_error(L, "Argument #3 (max_lines) must be a non-negative integer.");
+        editor->followMaxLines = (size_t)lua_tointeger(L, 3);
+    }
+    editor->setFollowMode(lua_toboolean(L, 1));
+    lua_pushboolean(L, editor->followMode);
+    return 1;
+}
+
+int lua_set_read_only(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isboolean(L, 1)) return luaL_error(L, "Argument #1 (read_only) must be a boolean.");
+    editor->readOnly = lua_toboolean(L, 1);
+    return 0;
+}
+
+int lua_is_read_only(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    lua_pushboolean(L, editor->readOnly);
+    return 1;
+}
+
+int lua_set_search_options(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isboolean(L, 1)) return luaL_error(L, "Argument #1 (case_sensitive) must be a boolean.");
+    if (!lua_isnoneornil(L, 2) && !lua_isboolean(L, 2)) return luaL_error(L, "Argument #2 (whole_word) must be a boolean.");
+    if (!lua_isnoneornil(L, 3) && !lua_isboolean(L, 3)) return luaL_error(L, "Argument #3 (regex) must be a boolean.");
+    editor->searchOptions.caseSensitive = lua_toboolean(L, 1);
+    if (!lua_isnoneornil(L, 2)) editor->searchOptions.wholeWord = lua_toboolean(L, 2);
+    if (!lua_isnoneornil(L, 3)) editor->searchOptions.regex = lua_toboolean(L, 3);
+    return 0;
+}
+
+// Compiles the pattern argument of a Lua regex call (raising a Lua error if it is invalid),
+// reusing the previous compilation when the pattern did not change.
+static Regex& lua_check_regex(lua_State* L, Editor* editor, int caseArg) {
+    size_t length;
+    const char* pattern = lua_tolstring(L, 1, &length);
+    bool caseSensitive = true;
+    if (!lua_isnoneornil(L, caseArg)) {
+        if (!lua_isboolean(L, caseArg)) luaL_error(L, "Argument #%d (case_sensitive) must be a boolean.", caseArg);
+        caseSensitive = lua_toboolean(L, caseArg);
+    }
+    if (!editor->luaRegex.isValid() || editor->luaRegexPattern != std::string_view(pattern, length) ||
+        editor->luaRegexCaseSensitive != caseSensitive) {
+        SearchOptions options;
+        options.caseSensitive = caseSensitive;
+        std::string error;
+        if (!editor->luaRegex.compile(std::string_view(pattern, length), options, error)) {
+            editor->luaRegexPattern.clear();
+            luaL_error(L, "Invalid pattern: %s", error.c_str());
+        }
+        editor->luaRegexPattern.assign(pattern, length);
+        editor->luaRegexCaseSensitive = caseSensitive;
+    }
+    return editor->luaRegex;
+}
+
+int lua_find_regex(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (pattern) must be a string.");
+    lua_Integer line = 1, col = 1;
+    if (!lua_isnoneornil(L, 2)) {
+        if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 1) return luaL_error(L, "Argument #2 (line_number) must be a positive integer.");
+        line = lua_tointeger(L, 2);
+    }
+    if (!lua_isnoneornil(L, 3)) {
+        if (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 1) return luaL_error(L, "Argument #3 (col_number) must be a positive integer.");
+        col = lua_tointeger(L, 3);
+    }
+    Regex& regex = lua_check_regex(L, editor, 4);
+
+    // The first line is searched from col on, the rest from their start.
+    LineSnapshot snapshot = editor->lines.snapshot();
+    size_t row = (size_t)line - 1;
+    if (row < snapshot.size()) {
+        std::string_view text = snapshot.view(row);
+        size_t from = (size_t)col - 1;
+        size_t start, end;
+        if (from <= text.size() && regex.find(text.data(), text.size(), from, start, end)) {
+            lua_pushinteger(L, (lua_Integer)line);
+            lua_pushinteger(L, (lua_Integer)start + 1);
+            lua_pushinteger(L, (lua_Integer)(end - start));
+            return 3;
+        }
+    }
+    bool found = false;
+    searchSnapshot(snapshot, regex, row + 1, snapshot.size(), [&](const SearchMatch& match) {
+        lua_pushinteger(L, (lua_Integer)match.row + 1);
+        lua_pushinteger(L, (lua_Integer)match.col + 1);
+        lua_pushinteger(L, (lua_Integer)match.length);
+        found = true;
+        return false;
+    });
+    if (found) return 3;
+    lua_pushnil(L);
+    return 1;
+}
+
+int lua_find_all_regex(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (pattern) must be a string.");
+    lua_Integer firstLine = 1, lastLine = (lua_Integer)editor->lines.size();
+    if (!lua_isnoneornil(L, 2)) {
+        if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 1) return luaL_error(L, "Argument #2 (first_line) must be a positive integer.");
+        firstLine = lua_tointeger(L, 2);
+    }
+    if (!lua_isnoneornil(L, 3)) {
+        if (!lua_isinteger(L, 3)) return luaL_error(L, "Argument #3 (last_line) must be an integer.");
+        lastLine = lua_tointeger(L, 3);
+    }
+    Regex& regex = lua_check_regex(L, editor, 4);
+
+    lua_newtable(L);
+    lua_Integer count = 0;
+    if (lastLine >= firstLine) {
+        // The chunks are searched on the worker pool; the results arrive here in order.
+        std::atomic<bool> cancel(false);
+        searchSnapshotParallel(editor->workers, editor->lines.snapshot(), regex, (size_t)firstLine - 1, (size_t)lastLine, 0, cancel,
+                               [&](size_t, size_t, const std::vector<SearchMatch>& matches) {
+            for (const SearchMatch& match : matches) {
+                lua_createtable(L, 0, 3);
+                lua_pushinteger(L, (lua_Integer)match.row + 1);
+                lua_setfield(L, -2, "line");
+                lua_pushinteger(L, (lua_Integer)match.col + 1);
+                lua_setfield(L, -2, "col");
+                lua_pushinteger(L, (lua_Integer)match.length);
+                lua_setfield(L, -2, "length");
+                lua_rawseti(L, -2, ++count);
+            }
+            return true;
+        });
+    }
+    return 1;
+}
+
+// Reads the list of strings at arg into keywords.
+static void lua_check_keywords(lua_State* L, int arg, std::vector<std::string>& keywords) {
+    if (!lua_istable(L, arg)) luaL_error(L, "Argument #%d (keywords) must be a table of strings.", arg);
+    lua_Integer count = (lua_Integer)lua_rawlen(L, arg);
+    keywords.clear();
+    keywords.reserve((size_t)count);
+    for (lua_Integer i = 1; i <= count; ++i) {
+        lua_rawgeti(L, arg, i);
+        if (lua_type(L, -1) != LUA_TSTRING) luaL_error(L, "Argument #%d (keywords) must be a table of strings.", arg);
+        size_t length;
+        const char* keyword = lua_tolstring(L, -1, &length);
+        keywords.emplace_back(keyword, length);
+        lua_pop(L, 1);
+    }
+}
+
+static SearchOptions lua_check_keyword_options(lua_State* L, int caseArg) {
+    SearchOptions options;
+    if (!lua_isnoneornil(L, caseArg)) {
+        if (!lua_isboolean(L, caseArg)) luaL_error(L, "Argument #%d (case_sensitive) must be a boolean.", caseArg);
+        options.caseSensitive = lua_toboolean(L, caseArg);
+    }
+    if (!lua_isnoneornil(L, caseArg + 1)) {
+        if (!lua_isboolean(L, caseArg + 1)) luaL_error(L, "Argument #%d (whole_word) must be a boolean.", caseArg + 1);
+        options.wholeWord = lua_toboolean(L, caseArg + 1);
+    }
+    return options;
+}
+
+int lua_find_keywords(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    std::vector<std::string> keywords;
+    lua_check_keywords(L, 1, keywords);
+    lua_Integer firstLine = 1, lastLine = (lua_Integer)editor->lines.size();
+    if (!lua_isnoneornil(L, 2)) {
+        if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 1) return luaL_error(L, "Argument #2 (first_line) must be a positive integer.");
+        firstLine = lua_tointeger(L, 2);
+    }
+    if (!lua_isnoneornil(L, 3)) {
+        if (!lua_isinteger(L, 3)) return luaL_error(L, "Argument #3 (last_line) must be an integer.");
+        lastLine = lua_tointeger(L, 3);
+    }
+    SearchOptions options = lua_check_keyword_options(L, 4);
+
+    // Building is the expensive part for long lists, so a plugin asking again with the same list reuses it.
+    if (editor->luaKeywordList != keywords || editor->luaKeywordOptions.caseSensitive != options.caseSensitive ||
+        editor->luaKeywordOptions.wholeWord != options.wholeWord) {
+        std::string error;
+        if (!editor->luaKeywords.build(keywords, options, error)) {
+            editor->luaKeywordList.clear();
+            editor->luaKeywords = KeywordMatcher();
+            return luaL_error(L, "Invalid keywords: %s", error.c_str());
+        }
+        editor->luaKeywordList = std::move(keywords);
+        editor->luaKeywordOptions = options;
+    }
+
+    lua_newtable(L);
+    lua_Integer count = 0;
+    if (lastLine >= firstLine) {
+        searchSnapshot(editor->lines.snapshot(), editor->luaKeywords, (size_t)firstLine - 1, (size_t)lastLine, [&](const KeywordMatch& match) {
+            lua_createtable(L, 0, 4);
+            lua_pushinteger(L, (lua_Integer)match.row + 1);
+            lua_setfield(L, -2, "line");
+            lua_pushinteger(L, (lua_Integer)match.col + 1);
+            lua_setfield(L, -2, "col");
+            lua_pushinteger(L, (lua_Integer)match.length);
+            lua_setfield(L, -2, "length");
+            lua_pushinteger(L, (lua_Integer)match.keyword + 1);
+            lua_setfield(L, -2, "keyword");
+            lua_rawseti(L, -2, ++count);
+            return true;
+        });
+    }
+    return 1;
+}
+
+int lua_highlight_keywords(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (id) must be a string.");
+    std::vector<std::string> keywords;
+    lua_check_keywords(L, 2, keywords);
+    if (!lua_isstring(L, 3) && !lua_isinteger(L, 3)) return luaL_error(L, "Argument #3 (color) must be a string (hex) or integer (RGB).");
+    unsigned int color = get_lua_color(L, 3);
+    SearchOptions options = lua_check_keyword_options(L, 4);
+
+    KeywordMatcher matcher;
+    std::string error;
+    if (!matcher.build(keywords, options, error)) return luaL_error(L, "Invalid keywords: %s", error.c_str());
+    editor->setKeywordHighlight(lua_tostring(L, 1), std::move(matcher), color);
+    return 0;
+}
+
+int lua_clear_keyword_highlights(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+
+    std::string id_prefix = "";
+    if (lua_isstring(L, 1)) {
+        id_prefix = lua_tostring(L, 1);
+    }
+
+    editor->clearKeywordHighlights(id_prefix);
+    return 0;
+}
+
+int lua_search_in_folder(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (pattern) must be a string.");
+    std::string root = editor->currentDirPath;
+    if (!lua_isnoneornil(L, 2)) {
+        if (!lua_isstring(L, 2)) return luaL_error(L, "Argument #2 (path) must be a string.");
+        root = lua_tostring(L, 2);
+    }
+    lua_pushboolean(L, editor->startProjectSearch(lua_tostring(L, 1), root));
+    return 1;
+}
+
+int lua_find_files(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (query) must be a string.");
+    lua_Integer limit = 50;
+    if (!lua_isnoneornil(L, 2)) {
+        if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 0) return luaL_error(L, "Argument #2 (limit) must be a non-negative integer.");
+        limit = lua_tointeger(L, 2);
+    }
+    if (editor->fileFinder.root() != editor->currentDirPath) {
+        editor->fileFinder.start(editor->currentDirPath);
+    }
+    std::vector<FileFinderResult> results = editor->fileFinder.find(editor->workers, lua_tostring(L, 1), (size_t)limit);
+    lua_createtable(L, (int)results.size(), 0);
+    for (size_t i = 0; i < results.size(); ++i) {
+        lua_pushlstring(L, results[i].path.data(), results[i].path.size());
+        lua_rawseti(L, -2, (lua_Integer)i + 1);
+    }
+    return 1;
+}
+
+int lua_index_folder(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    std::string root = editor->currentDirPath;
+    if (!lua_isnoneornil(L, 1)) {
+        if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (path) must be a string.");
+        root = lua_tostring(L, 1);
+    }
+    lua_pushboolean(L, editor->indexFolder(root));
+    return 1;
+}
+
+int lua_replace_all(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (editor->readOnly) return luaL_error(L, "Buffer is read-only.");
+    if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (pattern) must be a string.");
+    if (!lua_isstring(L, 2)) return luaL_error(L, "Argument #2 (replacement) must be a string.");
+    size_t patternLength = 0, replacementLength = 0;
+    const char* pattern = lua_tolstring(L, 1, &patternLength);
+    const char* replacement = lua_tolstring(L, 2, &replacementLength);
+    SearchOptions options = lua_check_keyword_options(L, 3);
+    if (!lua_isnoneornil(L, 5)) {
+        if (!lua_isboolean(L, 5)) return luaL_error(L, "Argument #5 (regex) must be a boolean.");
+        options.regex = lua_toboolean(L, 5);
+    }
+
+    size_t count = 0;
+    std::string error;
+    if (!editor->replaceAll(std::string(pattern, patternLength), std::string(replacement, replacementLength), options, count, error)) {
+        return luaL_error(L, "replace_all: %s", error.c_str());
+    }
+    lua_pushinteger(L, (lua_Integer)count);
+    return 1;
+}
+
+int lua_replace_in_folder(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (pattern) must be a string.");
+    if (!lua_isstring(L, 2)) return luaL_error(L, "Argument #2 (replacement) must be a string.");
+    std::string root = editor->currentDirPath;
+    if (!lua_isnoneornil(L, 3)) {
+        if (!lua_isstring(L, 3)) return luaL_error(L, "Argument #3 (path) must be a string.");
+        root = lua_tostring(L, 3);
+    }
+    bool dryRun = true;
+    if (!lua_isnoneornil(L, 4)) {
+        if (!lua_isboolean(L, 4)) return luaL_error(L, "Argument #4 (dry_run) must be a boolean.");
+        dryRun = lua_toboolean(L, 4);
+    }
+    size_t patternLength = 0, replacementLength = 0;
+    const char* pattern = lua_tolstring(L, 1, &patternLength);
+    const char* replacement = lua_tolstring(L, 2, &replacementLength);
+    lua_pushboolean(L, editor->startFolderReplace(std::string(pattern, patternLength), std::string(replacement, replacementLength),
+                                                  editor->searchOptions, root, dryRun));
+    return 1;
+}
+
+int lua_undo_replace(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    lua_pushboolean(L, editor->undoReplace());
+    return 1;
+}
+
 int lua_refresh_screen(lua_State* L) {
     Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
     if (!editor) return luaL_error(L, "Editor instance not found.");
@@ -255,6 +655,7 @@ int lua_refresh_screen(lua_State* L) {
 int lua_insert_text(lua_State* L) {
     Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
     if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (editor->readOnly) return luaL_error(L, "Buffer is read-only.");
 
     if (!lua_isstring(L, 1)) {
         return luaL_error(L, "Argument #1 (text) for insert_text must be a string.");
@@ -279,11 +680,11 @@ int lua_get_current_line_text(lua_State* L) {
     Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
     if (!editor) return luaL_error(L, "Editor instance not found.");
 
-    std::string line_text = "";
+    std::string_view line_text;
     if (editor->cursorY >= 0 && editor->cursorY < editor->lines.size()) {
-        line_text = editor->lines[editor->cursorY];
+        line_text = editor->lines.view(editor->cursorY);
     }
-    lua_pushstring(L, line_text.c_str());
+    lua_pushlstring(L, line_text.data(), line_text.size());
     return 1;
 }
 
@@ -322,7 +723,8 @@ int lua_get_line(lua_State* L) {
 
     int line_num = lua_tointeger(L, 1) - 1;
     if (line_num >= 0 && line_num < editor->lines.size()) {
-        lua_pushstring(L, editor->lines[line_num].c_str());
+        std::string_view line_text = editor->lines.view(line_num);
+        lua_pushlstring(L, line_text.data(), line_text.size());
     } else {
         lua_pushstring(L, "");
     }
@@ -332,6 +734,7 @@ int lua_get_line(lua_State* L) {
 int lua_set_line(lua_State* L) {
     Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
     if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (editor->readOnly) return luaL_error(L, "Buffer is read-only.");
     if (!lua_isinteger(L, 1)) return luaL_error(L, "Argument #1 (line_number) must be an integer.");
     if (!lua_isstring(L, 2)) return luaL_error(L, "Argument #2 (text) must be a string.");
 
@@ -339,10 +742,8 @@ int lua_set_line(lua_State* L) {
     std::string new_text = lua_tostring(L, 2);
 
     if (line_num >= 0 && line_num < editor->lines.size()) {
-        editor->lines[line_num] = new_text;
-        editor->dirty = true;
+        editor->applyEdit({ EDIT_SET_LINE, line_num, 0, new_text });
         editor->calculateLineNumberWidth();
-        editor->force_full_redraw_internal();
         editor->triggerEvent("on_buffer_changed");
     } else {
         return luaL_error(L, "Line number %d is out of bounds.", line_num + 1);
@@ -353,6 +754,7 @@ int lua_set_line(lua_State* L) {
 int lua_insert_line(lua_State* L) {
     Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
     if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (editor->readOnly) return luaL_error(L, "Buffer is read-only.");
     if (!lua_isinteger(L, 1)) return luaL_error(L, "Argument #1 (line_number) must be an integer.");
     if (!lua_isstring(L, 2)) return luaL_error(L, "Argument #2 (text) must be a string.");
 
@@ -360,10 +762,8 @@ int lua_insert_line(lua_State* L) {
     std::string text = lua_tostring(L, 2);
 
     if (line_num >= 0 && line_num <= editor->lines.size()) {
-        editor->lines.insert(editor->lines.begin() + line_num, text);
-        editor->dirty = true;
+        editor->applyEdit({ EDIT_INSERT_LINE, line_num, 0, text });
         editor->calculateLineNumberWidth();
-        editor->force_full_redraw_internal();
         editor->triggerEvent("on_buffer_changed");
     } else {
         return luaL_error(L, "Insertion line number %d is out of bounds.", line_num + 1);
@@ -374,19 +774,18 @@ int lua_insert_line(lua_State* L) {
 int lua_delete_line(lua_State* L) {
     Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
     if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (editor->readOnly) return luaL_error(L, "Buffer is read-only.");
     if (!lua_isinteger(L, 1)) return luaL_error(L, "Argument #1 (line_number) must be an integer.");
 
     int line_num = lua_tointeger(L, 1) - 1;
 
     if (editor->lines.empty()) return 0;
     if (line_num >= 0 && line_num < editor->lines.size()) {
-        editor->lines.erase(editor->lines.begin() + line_num);
+        editor->applyEdit({ EDIT_DELETE_LINE, line_num, 0, std::string(editor->lines.view(line_num)) });
         if (editor->lines.empty()) {
-            editor->lines.push_back("");
+            editor->applyEdit({ EDIT_INSERT_LINE, 0, 0, "" });
         }
-        editor->dirty = true;
         editor->calculateLineNumberWidth();
-        editor->force_full_redraw_internal();
         editor->triggerEvent("on_buffer_changed");
     } else {
         return luaL_error(L, "Deletion line number %d is out of bounds.", line_num + 1);
@@ -400,7 +799,8 @@ int lua_get_buffer_content(lua_State* L) {
 
     lua_newtable(L);
     for (int i = 0; i < editor->lines.size(); ++i) {
-        lua_pushstring(L, editor->lines[i].c_str());
+        std::string_view line_text = editor->lines.view(i);
+        lua_pushlstring(L, line_text.data(), line_text.size());
         lua_rawseti(L, -2, i + 1);
     }
     return 1;
@@ -409,20 +809,22 @@ int lua_get_buffer_content(lua_State* L) {
 int lua_set_buffer_content(lua_State* L) {
     Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
     if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (editor->readOnly) return luaL_error(L, "Buffer is read-only.");
     if (!lua_istable(L, 1)) return luaL_error(L, "Argument #1 (content) must be a table of strings.");
 
-    editor->lines.clear();
+    std::string content;
     int table_len = luaL_len(L, 1);
     for (int i = 1; i <= table_len; ++i) {
         lua_rawgeti(L, 1, i);
+        if (i > 1) content += '\n';
         if (lua_isstring(L, -1)) {
-            editor->lines.push_back(lua_tostring(L, -1));
-        } else {
-            editor->lines.push_back("");
+            size_t length;
+            const char* text = lua_tolstring(L, -1, &length);
+            content.append(text, length);
         }
         lua_pop(L, 1);
     }
-    if (editor->lines.empty()) editor->lines.push_back("");
+    editor->applyEdit({ EDIT_SET_CONTENT, 0, 0, content });
 
     editor->cursorX = 0;
     editor->cursorY = 0;
@@ -430,7 +832,6 @@ int lua_set_buffer_content(lua_State* L) {
     editor->colOffset = 0;
     editor->dirty = true;
     editor->calculateLineNumberWidth();
-    editor->force_full_redraw_internal();
     editor->triggerEvent("on_buffer_changed");
     return 0;
 }
@@ -443,8 +844,8 @@ int lua_get_char_at(lua_State* L) {
     int line = lua_tointeger(L, 1) - 1; // Lua 1-based to C++ 0-based
     int col = lua_tointeger(L, 2) - 1;
 
-    if (line >= 0 && line < editor->lines.size() && col >= 0 && col < editor->lines[line].length()) {
-        lua_pushstring(L, std::string(1, editor->lines[line][col]).c_str());
+    if (line >= 0 && line < editor->lines.size() && col >= 0 && col < editor->lines.length(line)) {
+        lua_pushlstring(L, editor->lines.view(line).data() + col, 1);
     } else {
         lua_pushnil(L); // Return nil if out of bounds
     }
@@ -472,7 +873,7 @@ int lua_set_cursor_position(lua_State* L) {
         y = 0; x = 0;
     } else {
         if (x < 0) x = 0;
-        if (x > editor->lines[y].length()) x = editor->lines[y].length();
+        if (x > editor->lines.length(y)) x = editor->lines.length(y);
     }
 
     editor->cursorX = x;
@@ -486,7 +887,6 @@ int lua_set_row_offset(lua_State* L) {
     if (!editor) return luaL_error(L, "Editor instance not found.");
     if (!lua_isinteger(L, 1)) return luaL_error(L, "Argument #1 (offset) must be an integer.");
     editor->rowOffset = std::max(0, (int)lua_tointeger(L, 1));
-    editor->force_full_redraw_internal();
     return 0;
 }
 
@@ -495,7 +895,6 @@ int lua_set_col_offset(lua_State* L) {
     if (!editor) return luaL_error(L, "Editor instance not found.");
     if (!lua_isinteger(L, 1)) return luaL_error(L, "Argument #1 (offset) must be an integer.");
     editor->colOffset = std::max(0, (int)lua_tointeger(L, 1));
-    editor->force_full_redraw_internal();
     return 0;
 }
 
@@ -689,7 +1088,6 @@ int lua_prompt_user(lua_State* L) {
     editor->searchQuery = default_val;
     editor->statusMessage = editor->promptMessage + editor->searchQuery;
     editor->statusMessageTime = GetTickCount64();
-    editor->force_full_redraw_internal();
 
     lua_pushboolean(L, true);
     return 1;
@@ -816,6 +1214,10 @@ int lua_register_event_handler(lua_State* L) {
         editor->onFileOpenedCallbacks.push_back({funcRef, L});
     } else if (event_name == "on_file_saved") {
         editor->onFileSavedCallbacks.push_back({funcRef, L});
+    } else if (event_name == "on_file_save_failed") {
+        editor->onFileSaveFailedCallbacks.push_back({funcRef, L});
+    } else if (event_name == "on_file_reloaded") {
+        editor->onFileReloadedCallbacks.push_back({funcRef, L});
     } else if (event_name == "on_buffer_changed") {
         editor->onBufferChangedCallbacks.push_back({funcRef, L});
     } else if (event_name == "on_cursor_moved") {
@@ -836,20 +1238,17 @@ int lua_is_ctrl_pressed(lua_State* L) {
     return 1;
 }
 
-static std::map<std::string, std::string> plugin_data_storage; // Use map for simplicity, convert to file IO later
-
 int lua_save_plugin_data(lua_State* L) {
     Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
     if (!editor) return luaL_error(L, "Editor instance not found.");
     if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (key) must be a string.");
     if (!lua_isstring(L, 2)) return luaL_error(L, "Argument #2 (value) must be a string.");
 
-    std::string key = lua_tostring(L, 1);
-    std::string value = lua_tostring(L, 2);
+    size_t keyLength, valueLength;
+    const char* key = lua_tolstring(L, 1, &keyLength);
+    const char* value = lua_tolstring(L, 2, &valueLength);
 
-    plugin_data_storage[key] = value;
-    editor->statusMessage = "Plugin data saved for key: " + key;
-    editor->statusMessageTime = GetTickCount64();
+    editor->pluginData.put(std::string(key, keyLength), std::string(value, valueLength));
     lua_pushboolean(L, true);
     return 1;
 }
@@ -859,14 +1258,26 @@ int lua_load_plugin_data(lua_State* L) {
     if (!editor) return luaL_error(L, "Editor instance not found.");
     if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (key) must be a string.");
 
-    std::string key = lua_tostring(L, 1);
-    if (plugin_data_storage.count(key)) {
-        lua_pushstring(L, plugin_data_storage[key].c_str());
-        return 1;
+    size_t keyLength;
+    const char* key = lua_tolstring(L, 1, &keyLength);
+    const std::string* value = editor->pluginData.get(std::string(key, keyLength));
+    if (value) {
+        lua_pushlstring(L, value->data(), value->size());
     } else {
         lua_pushnil(L);
-        return 1;
     }
+    return 1;
+}
+
+int lua_delete_plugin_data(lua_State* L) {
+    Editor* editor = (Editor*)lua_touserdata(L, lua_upvalueindex(1));
+    if (!editor) return luaL_error(L, "Editor instance not found.");
+    if (!lua_isstring(L, 1)) return luaL_error(L, "Argument #1 (key) must be a string.");
+
+    size_t keyLength;
+    const char* key = lua_tolstring(L, 1, &keyLength);
+    lua_pushboolean(L, editor->pluginData.remove(std::string(key, keyLength)));
+    return 1;
 }
 
 int lua_set_console_font(lua_State* L) {
@@ -969,6 +1380,26 @@ static const luaL_Reg editor_lib[] = {
     {"center_view_on_cursor", lua_center_view_on_cursor},
     {"open_file", lua_open_file},
     {"save_file", lua_save_file},
+    {"set_large_file_threshold", lua_set_large_file_threshold},
+    {"get_file_encoding", lua_get_file_encoding},
+    {"set_file_encoding", lua_set_file_encoding},
+    {"reload_file", lua_reload_file},
+    {"set_auto_reload", lua_set_auto_reload},
+    {"set_follow_mode", lua_set_follow_mode},
+    {"set_read_only", lua_set_read_only},
+    {"is_read_only", lua_is_read_only},
+    {"set_search_options", lua_set_search_options},
+    {"find_regex", lua_find_regex},
+    {"find_all_regex", lua_find_all_regex},
+    {"find_keywords", lua_find_keywords},
+    {"highlight_keywords", lua_highlight_keywords},
+    {"clear_keyword_highlights", lua_clear_keyword_highlights},
+    {"search_in_folder", lua_search_in_folder},
+    {"find_files", lua_find_files},
+    {"index_folder", lua_index_folder},
+    {"replace_all", lua_replace_all},
+    {"replace_in_folder", lua_replace_in_folder},
+    {"undo_replace", lua_undo_replace},
     {"is_dirty", lua_is_dirty},
     {"get_directory_path", lua_get_directory_path},
     {"set_directory_path", lua_set_directory_path},
@@ -991,6 +1422,7 @@ static const luaL_Reg editor_lib[] = {
     {"is_ctrl_pressed", lua_is_ctrl_pressed},
     {"save_plugin_data", lua_save_plugin_data},
     {"load_plugin_data", lua_load_plugin_data},
+    {"delete_plugin_data", lua_delete_plugin_data},
 
     // Font Controls
     {"set_console_font", lua_set_console_font},
@@ -1017,13 +1449,10 @@ Editor::Editor() :
     lineNumberWidth(0),
     statusMessage("HELP: Ctrl-Q = quit | Ctrl-S = save | Ctrl-O = open | Ctrl-E = explorer | Ctrl-F = find | Ctrl-L = plugins"),
     statusMessageTime(GetTickCount64()),
-    prevStatusMessage(""), 
-    prevMessageBarMessage(""), 
     dirty(false),
     mode(EDIT_MODE), 
     selectedFileIndex(0),
     fileExplorerScrollOffset(0),
-    currentMatchIndex(-1), 
     originalCursorX(0), 
     originalCursorY(0),
     originalRowOffset(0), 
@@ -1044,8 +1473,10 @@ Editor::Editor() :
     defaultBgColor(0)
 {
     lines.push_back("");
+    if (!screen.open()) {
+        std::cerr << "Error opening the screen: " << screen.lastError() << std::endl;
+    }
     updateScreenSize();
-    prevDrawnLines.resize(screenRows - 2);
 
     currentFont = getCurrentConsoleFont();
 
@@ -1063,8 +1494,6 @@ Editor::Editor() :
         }
     }
 
-    for (auto& s : prevDrawnLines) s.assign(screenCols, ' ');
-
     char buffer[MAX_PATH];
     GetCurrentDirectoryA(MAX_PATH, buffer);
     currentDirPath = buffer;
@@ -1085,6 +1514,8 @@ Editor::Editor() :
 
     clearTerminalBuffer();
 
+    // Before the plugins run, so they find their saved data.
+    loadSession();
     initializeLua();
     loadLuaPlugins();
 }
@@ -1111,14 +1542,21 @@ void Editor::initializeLua() {
 }
 
 Editor::~Editor() {
-    finalizeLua();
+    if (saveThread.joinable()) {
+        saveThread.join();
+    }
+    cancelReload();
 
+    // The references live in the registry of the state finalizeLua() closes.
     for (const auto& cb : onKeyPressCallbacks) luaL_unref(cb.L_state, LUA_REGISTRYINDEX, cb.funcRef);
     for (const auto& cb : onFileOpenedCallbacks) luaL_unref(cb.L_state, LUA_REGISTRYINDEX, cb.funcRef);
     for (const auto& cb : onFileSavedCallbacks) luaL_unref(cb.L_state, LUA_REGISTRYINDEX, cb.funcRef);
+    for (const auto& cb : onFileSaveFailedCallbacks) luaL_unref(cb.L_state, LUA_REGISTRYINDEX, cb.funcRef);
+    for (const auto& cb : onFileReloadedCallbacks) luaL_unref(cb.L_state, LUA_REGISTRYINDEX, cb.funcRef);
     for (const auto& cb : onBufferChangedCallbacks) luaL_unref(cb.L_state, LUA_REGISTRYINDEX, cb.funcRef);
     for (const auto& cb : onCursorMovedCallbacks) luaL_unref(cb.L_state, LUA_REGISTRYINDEX, cb.funcRef);
     for (const auto& cb : onModeChangedCallbacks) luaL_unref(cb.L_state, LUA_REGISTRYINDEX, cb.funcRef);
+    finalizeLua();
 
     if (hConsoleInput != INVALID_HANDLE_VALUE && originalConsoleMode != 0) {
         if (!SetConsoleMode(hConsoleInput, originalConsoleMode)) {
@@ -1203,6 +1641,8 @@ void Editor::triggerEvent(const std::string& eventName, const std::string& param
     std::vector<LuaCallback>* callbacks = nullptr;
     if (eventName == "on_file_opened") callbacks = &onFileOpenedCallbacks;
     else if (eventName == "on_file_saved") callbacks = &onFileSavedCallbacks;
+    else if (eventName == "on_file_save_failed") callbacks = &onFileSaveFailedCallbacks;
+    else if (eventName == "on_file_reloaded") callbacks = &onFileReloadedCallbacks;
 
     if (callbacks) {
         for (const auto& callback : *callbacks) {
@@ -1370,10 +1810,9 @@ void Editor::calculateLineNumberWidth()
 }
 
 void Editor::updateScreenSize() {
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
-    int newScreenRows = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
-    int newScreenCols = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+    int newScreenCols = screenCols;
+    int newScreenRows = screenRows;
+    if (!screen.size(newScreenCols, newScreenRows)) return;
 
     if (newScreenRows != screenRows || newScreenCols != screenCols)
     {
@@ -1381,46 +1820,107 @@ void Editor::updateScreenSize() {
         screenCols = newScreenCols;
         calculateLineNumberWidth();
 
-        // prevDrawnLines resized to cover the content area (screenRows - 2 lines)
-        prevDrawnLines.resize(screenRows - 2);
-        for (auto& s : prevDrawnLines)
-        {
-            s.assign(screenCols, ' ');
-        }
-        // No clearScreen() here, refreshScreen's mode check will handle it.
-        // But do force a redraw because screen size changed.
-        force_full_redraw_internal();
-    }
-}
-
-void Editor::setCursorVisibility(bool visible) {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    CONSOLE_CURSOR_INFO cursorInfo;
-    if (!GetConsoleCursorInfo(hConsole, &cursorInfo)) {
-        return;
+        // The frame buffer starts over blank, and the whole screen goes out with the next frame.
+        frame.resize(screenCols, screenRows);
     }
-    cursorInfo.bVisible = visible;
-    SetConsoleCursorInfo(hConsole, &cursorInfo);
 }
 
 void Editor::drawScreenContent() {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) {
-        std::cerr << "Error: Invalid console handle in drawScreenContent." << std::endl;
-        return;
-    }
-
     int effectiveScreenCols = screenCols - lineNumberWidth;
 
+    // Only rows marked as damaged are composed. A new gutter width, column offset or
+    // screen size moves every row; edits mark the rows the buffer says they touched.
+    // Scrolling up or down moves the rows still on screen in the frame buffer, with their
+    // marks, and leaves only the rows scrolled in to compose. The frame buffer then has the
+    // terminal move the rows too where that sends less.
+    int contentRows = std::max(0, screenRows - 2);
+    ContentView view = { rowOffset, colOffset, lineNumberWidth, screenCols };
+    if (contentDamage.size() != contentRows || !(view == drawnView)) {
+        ContentView scrolled = drawnView;
+        scrolled.rowOffset = rowOffset;
+        int delta = rowOffset - drawnView.rowOffset;
+        if (contentDamage.size() == contentRows && drawnView.rowOffset >= 0 && scrolled == view && std::abs(delta) < contentRows) {
+            frame.scroll(0, contentRows, delta);
+            contentDamage.scroll(delta);
+        }
+        else {
+            contentDamage.resize(contentRows);
+        }
+        drawnView = view;
+    }
+    size_t changedFrom, changedTo;
+    if (lines.takeChangedRows(changedFrom, changedTo)) {
+        damageFileRows(changedFrom, changedTo);
+    }
+
+    // Highlights that come or go mark the rows they were on and the rows they are on.
+    auto damageMatchRows = [this]() {
+        for (const SearchMatch& match : viewportMatches) damageFileRows(match.row, match.row + 1);
+    };
+    if (searchSession.active() != drawnSearchActive) {
+        damageMatchRows();
+        drawnSearchActive = searchSession.active();
+    }
+    if (hasCurrentMatch != drawnHasCurrentMatch || (hasCurrentMatch && (currentMatch.row != drawnCurrentMatch.row ||
+                                                                        currentMatch.col != drawnCurrentMatch.col))) {
+        if (drawnHasCurrentMatch) damageFileRows(drawnCurrentMatch.row, drawnCurrentMatch.row + 1);
+        if (hasCurrentMatch) damageFileRows(currentMatch.row, currentMatch.row + 1);
+        drawnHasCurrentMatch = hasCurrentMatch;
+        drawnCurrentMatch = currentMatch;
+    }
+
+    // Only the visible rows are searched for highlighting, and only again once they change.
+    if (searchSession.active() && (viewportMatchesVersion != lines.version() || viewportMatchesRow != rowOffset ||
+                                   viewportMatchesRows != screenRows - 2)) {
+        damageMatchRows();
+        viewportMatches = searchSession.findInRows(lines, rowOffset, rowOffset + std::max(0, screenRows - 2));
+        viewportMatchesVersion = lines.version();
+        viewportMatchesRow = rowOffset;
+        viewportMatchesRows = screenRows - 2;
+        damageMatchRows();
+    }
+
+    // Keyword highlights are matched the same way, one pass per set over the visible rows.
+    if (!keywordHighlights.empty() && (viewportKeywordsVersion != lines.version() || viewportKeywordsRow != rowOffset ||
+                                       viewportKeywordsRows != screenRows - 2)) {
+        for (const auto& keyword : viewportKeywords) damageFileRows(keyword.first.row, keyword.first.row + 1);
+        viewportKeywords.clear();
+        size_t toRow = std::min(lines.size(), (size_t)rowOffset + std::max(0, screenRows - 2));
+        for (const KeywordHighlight& highlight : keywordHighlights) {
+            for (size_t row = rowOffset; row < toRow; ++row) {
+                searchLine(highlight.matcher, lines.view(row), row, [&](const KeywordMatch& match) {
+                    viewportKeywords.push_back({ match, highlight.color });
+                    return true;
+                });
+            }
+        }
+        // Into row order for drawing; within a row the sets keep their order, later ones on top.
+        std::stable_sort(viewportKeywords.begin(), viewportKeywords.end(),
+                         [](const auto& a, const auto& b) { return a.first.row < b.first.row; });
+        viewportKeywordsVersion = lines.version();
+        viewportKeywordsRow = rowOffset;
+        viewportKeywordsRows = screenRows - 2;
+        for (const auto& keyword : viewportKeywords) damageFileRows(keyword.first.row, keyword.first.row + 1);
+    }
+
+    // Matches and keywords come in row order, so each row takes its own off the front.
+    size_t nextMatch = 0;
+    size_t nextKeyword = 0;
+    const WORD FG_BITS = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
+    const WORD BG_BITS = BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_BLUE | BACKGROUND_INTENSITY;
+    std::vector<WORD> fullLineAttributes(screenCols); // This vector holds attributes for the ENTIRE screen line
+
     for (int i = 0; i < screenRows - 2; ++i) { // Iterate through visible screen rows for content
+        if (!contentDamage.marked(i)) continue;
         int fileRow = rowOffset + i;
+        bool inFile = fileRow >= 0 && fileRow < lines.size();
         std::string fullLineContentToDraw = "";
-        std::vector<WORD> fullLineAttributes(screenCols); // This vector holds attributes for the ENTIRE screen line
+        std::fill(fullLineAttributes.begin(), fullLineAttributes.end(), (WORD)(defaultFgColor | defaultBgColor));
 
         // --- 1. Draw Line Number ---
         std::string lineNumberStr;
         std::ostringstream ss_lineNumber;
-        if (fileRow >= 0 && fileRow < lines.size()) {
+        if (inFile) {
             ss_lineNumber << std::setw(lineNumberWidth - 1) << (fileRow + 1) << " ";
         }
         else {
@@ -1429,166 +1929,83 @@ void Editor::drawScreenContent() {
         lineNumberStr = ss_lineNumber.str();
         fullLineContentToDraw += lineNumberStr;
 
-        // Apply default attributes to the line number part
-        for (int k = 0; k < lineNumberStr.length(); ++k) {
-            fullLineAttributes[k] = defaultFgColor | defaultBgColor;
-        }
-
         // --- 2. Get Rendered Text Content ---
+        // Only the visible columns are rendered; the tabs before them are found with memchr().
         std::string renderedTextContent = "";
-        if (fileRow >= 0 && fileRow < lines.size()) {
-            std::string fullRenderedLine = getRenderedLine(fileRow);
-
-            int startCharInRenderedLine = colOffset;
-            int endCharInRenderedLine = colOffset + effectiveScreenCols;
-
-            startCharInRenderedLine = std::max(0, startCharInRenderedLine);
-            startCharInRenderedLine = std::min(startCharInRenderedLine, (int)fullRenderedLine.length());
-            endCharInRenderedLine = std::max(0, endCharInRenderedLine);
-            endCharInRenderedLine = std::min(endCharInRenderedLine, (int)fullRenderedLine.length());
-
-            if (endCharInRenderedLine > startCharInRenderedLine) {
-                renderedTextContent = fullRenderedLine.substr(startCharInRenderedLine, endCharInRenderedLine - startCharInRenderedLine);
-            }
+        rowLayers.clear();
+        if (inFile) {
+            rowColumns.reset(lines.view(fileRow), KILO_TAB_STOP);
+            rowColumns.visible(colOffset, effectiveScreenCols, renderedTextContent);
         }
         fullLineContentToDraw += renderedTextContent;
 
-        // --- 3. Initialize Text Attributes (Default + Search Highlight) ---
-        // These attributes apply to the 'renderedTextContent' part of the line.
-        // Index `k` here refers to the index within `renderedTextContent` (0 to length-1)
-        for (int k = 0; k < renderedTextContent.length(); ++k) {
-            WORD current_attributes = defaultFgColor | defaultBgColor; // Start with editor defaults
-
-            // Calculate the character's absolute rendered position on the line (before screen clipping)
-            // This is needed for search highlights and custom styling ranges.
-            int charGlobalRenderedPos = colOffset + k;
-
-            // Apply search highlight
-            bool isSearchHighlight = false;
-            if (!searchQuery.empty() && currentMatchIndex != -1 && fileRow == searchResults[currentMatchIndex].first) {
-                int matchLogicalStart = searchResults[currentMatchIndex].second;
-                int matchLogicalEnd = searchResults[currentMatchIndex].second + searchQuery.length();
-
-                int matchRenderedStart = cxToRx(fileRow, matchLogicalStart);
-                int matchRenderedEnd = cxToRx(fileRow, matchLogicalEnd);
+        // --- 3. Collect the attribute layers of the row, bottom to top ---
+        // Keywords take their color on the default background.
+        for (; nextKeyword < viewportKeywords.size() && (int)viewportKeywords[nextKeyword].first.row <= fileRow; ++nextKeyword) {
+            const KeywordMatch& keyword = viewportKeywords[nextKeyword].first;
+            if ((int)keyword.row != fileRow) continue;
+            rowLayers.add(rowColumns.column(keyword.col), rowColumns.column(keyword.col + keyword.length), 0,
+                          defaultBgColor | mapRgbToConsoleColor(viewportKeywords[nextKeyword].second));
+        }
 
-                if (charGlobalRenderedPos >= matchRenderedStart && charGlobalRenderedPos < matchRenderedEnd) {
-                    isSearchHighlight = true;
-                }
-            }
-            if (isSearchHighlight) {
-                current_attributes = BG_YELLOW | BLACK; // Override with search highlight
-            }
-            // Store this initial attribute for the character
-            fullLineAttributes[lineNumberStr.length() + k] = current_attributes;
+        // Search matches; the current match stands out.
+        for (; searchSession.active() && nextMatch < viewportMatches.size() && (int)viewportMatches[nextMatch].row <= fileRow; ++nextMatch) {
+            const SearchMatch& match = viewportMatches[nextMatch];
+            if ((int)match.row != fileRow) continue;
+            bool current = hasCurrentMatch && match.row == currentMatch.row && match.col == currentMatch.col;
+            rowLayers.add(rowColumns.column(match.col), rowColumns.column(match.col + match.length), 0,
+                          current ? (BG_YELLOW | BLACK) : (BG_CYAN | BLACK));
         }
 
-        // --- 4. Apply Custom Text Styling (from lineStyling map) ---
-        // Iterate over custom stylings for this line and apply them
-        auto it_styling = lineStyling.find(fileRow);
+        // Custom text styling (from the lineStyling map): a color replaces that half of the
+        // attribute, bold adds intensity (italic and underline have no console attribute).
+        auto it_styling = inFile ? lineStyling.find(fileRow) : lineStyling.end();
         if (it_styling != lineStyling.end()) {
             for (const auto& styling : it_styling->second) {
-                // Convert styling range to rendered coordinates
-                int styleRenderedStart = cxToRx(fileRow, styling.startCol);
-                int styleRenderedEnd = cxToRx(fileRow, styling.endCol);
-
-                // Determine intersection with the *visible portion* of the rendered line (based on colOffset)
-                int intersectionStartRendered = std::max(styleRenderedStart, colOffset);
-                int intersectionEndRendered = std::min(styleRenderedEnd, colOffset + effectiveScreenCols);
-
-                // Convert intersection back to indices relative to the `renderedTextContent` string
-                // `textContentIdxStart` is the starting index within `renderedTextContent` that needs styling.
-                int textContentIdxStart = intersectionStartRendered - colOffset;
-                int textContentIdxEnd = intersectionEndRendered - colOffset;
-
-                for (int k_attr = std::max(0, textContentIdxStart); k_attr < std::min((int)renderedTextContent.length(), textContentIdxEnd); ++k_attr) {
-                    // Get the current attributes for this character from `fullLineAttributes`
-                    // We need to ensure we're accessing the correct offset within `fullLineAttributes`
-                    WORD current_attr_target_idx = lineNumberStr.length() + k_attr;
-                    if (current_attr_target_idx >= fullLineAttributes.size()) continue; // Should not happen with correct sizing
-
-                    WORD current_attr = fullLineAttributes[current_attr_target_idx];
-
-                    // Apply foreground color if specified
-                    if (styling.fgColor != 0) { // Assuming 0 means not specified or transparent (actual default might be 0xFFFFFF)
-                        current_attr = (current_attr & (BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_BLUE | BACKGROUND_INTENSITY)); // Preserve existing background
-                        current_attr |= mapRgbToConsoleColor(styling.fgColor);
-                    }
-                    // Apply background color if specified
-                    if (styling.bgColor != 0) {
-                        current_attr = (current_attr & (FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY)); // Preserve existing foreground
-                        current_attr |= (mapRgbToConsoleColor(styling.bgColor) << 4); // Shift for background
-                    }
-
-                    // Apply styles (bold, italic, underline - note: italic/underline usually not supported by default console)
-                    if (styling.styleFlags & STYLE_BOLD) {
-                        current_attr |= FOREGROUND_INTENSITY; // Bold usually maps to intensity
-                    }
-                    // Implement visual cues for italic/underline if possible (e.g., custom char set, different background, or skip)
-
-                    fullLineAttributes[current_attr_target_idx] = current_attr;
+                WORD keep = 0xFFFF;
+                WORD set = 0;
+                if (styling.fgColor != 0) { // Assuming 0 means not specified or transparent (actual default might be 0xFFFFFF)
+                    keep &= BG_BITS;
+                    set = (set & BG_BITS) | mapRgbToConsoleColor(styling.fgColor);
                 }
+                if (styling.bgColor != 0) {
+                    keep &= FG_BITS;
+                    set = (set & FG_BITS) | (mapRgbToConsoleColor(styling.bgColor) << 4); // Shift for background
+                }
+                if (styling.styleFlags & STYLE_BOLD) {
+                    set |= FOREGROUND_INTENSITY; // Bold usually maps to intensity
+                }
+                rowLayers.add(rowColumns.column(styling.startCol), rowColumns.column(styling.endCol), keep, set);
             }
         }
 
-        // --- 5. Apply Decorations (e.g., underlines) ---
-        auto it_decorations = lineDecorations.find(fileRow);
+        // Decorations (e.g., underlines): the console has no underline, so each type gets a
+        // background, and its color, if given, as the foreground.
+        auto it_decorations = inFile ? lineDecorations.find(fileRow) : lineDecorations.end();
         if (it_decorations != lineDecorations.end()) {
             for (const auto& decoration : it_decorations->second) {
-                int decorRenderedStart = cxToRx(fileRow, decoration.startCol);
-                int decorRenderedEnd = cxToRx(fileRow, decoration.endCol);
-
-                int intersectionStartRendered = std::max(decorRenderedStart, colOffset);
-                int intersectionEndRendered = std::min(decorRenderedEnd, colOffset + effectiveScreenCols);
-
-                int textContentIdxStart = intersectionStartRendered - colOffset;
-                int textContentIdxEnd = intersectionEndRendered - colOffset;
-
-                for (int k_decor = std::max(0, textContentIdxStart); k_decor < std::min((int)renderedTextContent.length(), textContentIdxEnd); ++k_decor) {
-                    WORD current_attr_target_idx = lineNumberStr.length() + k_decor;
-                    if (current_attr_target_idx >= fullLineAttributes.size()) continue;
-
-                    WORD current_attr = fullLineAttributes[current_attr_target_idx];
-
-                    // Apply decoration based on type
-                    if (decoration.type == DECORATION_ERROR_UNDERLINE) {
-                        // This is tricky for console. A common approach is to change the background color subtly,
-                        // or use a different character if you have a custom font/charset.
-                        // For a simple console, let's just make it a prominent background color.
-                        current_attr &= ~(BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_BLUE | BACKGROUND_INTENSITY); // Clear old background
-                        current_attr |= BG_RED; // Error: red background
-                        // Optionally, set intensity or foreground color based on decoration.color
-                        if (decoration.color != 0) {
-                            current_attr &= ~(FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY);
-                            current_attr |= mapRgbToConsoleColor(decoration.color);
-                        }
-                    }
-                    else if (decoration.type == DECORATION_WARNING_UNDERLINE) {
-                        current_attr &= ~(BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_BLUE | BACKGROUND_INTENSITY);
-                        current_attr |= BG_YELLOW; // Warning: yellow background
-                        if (decoration.color != 0) {
-                            current_attr &= ~(FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY);
-                            current_attr |= mapRgbToConsoleColor(decoration.color);
-                        }
-                    }
-                    else if (decoration.type == DECORATION_INFO_OVERLAY || decoration.type == DECORATION_MATCH_HIGHLIGHT) {
-                        // These might just apply a background color or a subtle dimming
-                        current_attr &= ~(BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_BLUE | BACKGROUND_INTENSITY);
-                        current_attr |= BG_CYAN; // Example: info/match with cyan background
-                        if (decoration.color != 0) {
-                            current_attr &= ~(FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY);
-                            current_attr |= mapRgbToConsoleColor(decoration.color);
-                        }
-                    }
-                    // Add more decoration types as needed
-
-                    fullLineAttributes[current_attr_target_idx] = current_attr;
+                WORD background;
+                if (decoration.type == DECORATION_ERROR_UNDERLINE) background = BG_RED;
+                else if (decoration.type == DECORATION_WARNING_UNDERLINE) background = BG_YELLOW;
+                else if (decoration.type == DECORATION_INFO_OVERLAY || decoration.type == DECORATION_MATCH_HIGHLIGHT) background = BG_CYAN;
+                else continue;
+                WORD keep = (WORD)~BG_BITS;
+                WORD set = background;
+                if (decoration.color != 0) {
+                    keep &= (WORD)~FG_BITS;
+                    set |= mapRgbToConsoleColor(decoration.color);
                 }
+                rowLayers.add(rowColumns.column(decoration.startCol), rowColumns.column(decoration.endCol), keep, set);
             }
         }
 
+        // --- 4. Merge the layers into the visible cells in one sweep ---
+        int textCells = std::min((int)renderedTextContent.length(), screenCols - (int)lineNumberStr.length());
+        if (!rowLayers.empty() && textCells > 0) {
+            rowLayers.compose(colOffset, textCells, defaultFgColor | defaultBgColor, &fullLineAttributes[lineNumberStr.length()]);
+        }
 
-        // --- 6. Pad with spaces and default attributes to fill screen width ---
+        // --- 5. Pad with spaces and default attributes to fill screen width ---
         for (int k = fullLineContentToDraw.length(); k < screenCols; ++k) {
             fullLineContentToDraw += ' ';
             // Ensure padding characters also get default attributes if they weren't explicitly styled
@@ -1600,52 +2017,23 @@ void Editor::drawScreenContent() {
         }
 
 
-        // --- 7. Output to Console (only if line changed) ---
-        // This comparison should ideally compare both content and attributes for a perfect diff.
-        // For simplicity, we check content change. force_full_redraw_internal is called
-        // when styling/decorations are added, which invalidates `prevDrawnLines`,
-        // forcing a full redraw, so this is generally acceptable.
-        if (i >= prevDrawnLines.size() || prevDrawnLines[i] != fullLineContentToDraw) {
-            COORD writePos = { 0, (SHORT)i };
-            DWORD charsWritten;
-
-            if (!WriteConsoleOutputCharacterA(hConsole, fullLineContentToDraw.c_str(), screenCols, writePos, &charsWritten)) {
-                std::cerr << "WriteConsoleOutputCharacterA failed: " << GetLastError() << std::endl;
-            }
-
-            if (!WriteConsoleOutputAttribute(hConsole, fullLineAttributes.data(), screenCols, writePos, &charsWritten)) {
-                std::cerr << "WriteConsoleOutputAttribute failed: " << GetLastError() << std::endl;
-            }
-
-            if (i < prevDrawnLines.size()) {
-                prevDrawnLines[i] = fullLineContentToDraw;
-            }
-        }
+        // --- 6. Into the frame buffer, which sends only the cells that changed ---
+        frame.write(i, 0, fullLineContentToDraw, fullLineAttributes.data());
     }
+    contentDamage.clear();
+}
 
-    drawStatusBar();
-    drawMessageBar();
-
-    SHORT screenCursorY = (SHORT)(cursorY - rowOffset);
-    int renderedCursorX = cxToRx(cursorY, cursorX); // Get the rendered position of cursorX
-    SHORT screenCursorX = (SHORT)(lineNumberWidth + renderedCursorX - colOffset);
-
-    // Clamp cursor position to valid screen coordinates
-    screenCursorX = std::max((SHORT)lineNumberWidth, screenCursorX);
-    screenCursorX = std::min((SHORT)(screenCols - 1), screenCursorX);
-    screenCursorY = std::max((SHORT)0, screenCursorY);
-    screenCursorY = std::min((SHORT)(screenRows - 3), screenCursorY);
-
-    COORD cursorPosition = { screenCursorX, screenCursorY };
-    if (!SetConsoleCursorPosition(hConsole, cursorPosition)) {
-        // Handle error, but often not critical for basic operation
-    }
+void Editor::damageFileRows(size_t fromRow, size_t toRow) {
+    // Rows are marked where they were last drawn; a scroll since moves the marks along.
+    size_t top = (size_t)std::max(0, drawnView.rowOffset);
+    if (toRow <= top || fromRow >= top + contentDamage.size()) return;
+    size_t from = fromRow > top ? fromRow - top : 0;
+    size_t to = std::min(toRow - top, (size_t)contentDamage.size());
+    contentDamage.mark((int)from, (int)to);
+}
 
-    CONSOLE_CURSOR_INFO cursorInfo;
-    if (GetConsoleCursorInfo(hConsole, &cursorInfo)) {
-        cursorInfo.bVisible = TRUE;
-        SetConsoleCursorInfo(hConsole, &cursorInfo);
-    }
+void Editor::damageAllRows() {
+    contentDamage.markAll();
 }
 
 void Editor::startSearch() {
@@ -1657,19 +2045,45 @@ void Editor::startSearch() {
     mode = PROMPT_MODE;
     promptMessage = "Search: ";
     searchQuery = "";
-    searchResults.clear();
-    currentMatchIndex = -1;
+    searchSession.clear();
+    hasCurrentMatch = false;
     statusMessage = "Enter search term. ESC to cancel, Enter to search.";
     statusMessageTime = GetTickCount64();
+}
+
+// Called as the query is typed: moves to the match nearest to where the search started,
+// or back there when there is none, and starts counting the matches of the new query.
+void Editor::updateIncrementalSearch() {
+    hasCurrentMatch = false;
+    viewportMatchesRow = -1;
+    std::string error;
+    bool valid = !searchQuery.empty() && searchSession.start(searchQuery, searchOptions, error);
+    if (valid) {
+        SearchMatch match;
+        if (searchSession.findForward(lines.snapshot(), originalCursorY, originalCursorX, match)) {
+            jumpToMatch(match);
+        }
+        refreshSearchCount();
+    } else {
+        searchSession.clear();
+    }
+    if (!hasCurrentMatch) {
+        cursorX = originalCursorX;
+        cursorY = originalCursorY;
+        rowOffset = originalRowOffset;
+        colOffset = originalColOffset;
+    }
 
-    force_full_redraw_internal(); // Invalidate cache for new mode's content
+    // A regex is often invalid halfway through typing it, so that is only reported on Enter.
+    statusMessage = promptMessage + searchQuery;
+    if (valid) statusMessage += "   (" + searchStatus() + ")";
+    statusMessageTime = GetTickCount64() + 5000;
 }
 
 void Editor::performSearch() {
-    searchResults.clear();
-    currentMatchIndex = -1;
-
     if (searchQuery.empty()) {
+        searchSession.clear();
+        hasCurrentMatch = false;
         statusMessage = "Search cancelled or empty.";
         statusMessageTime = GetTickCount64();
         mode = EDIT_MODE;
@@ -1677,77 +2091,110 @@ void Editor::performSearch() {
         cursorY = originalCursorY;
         rowOffset = originalRowOffset;
         colOffset = originalColOffset;
-        force_full_redraw_internal(); // Revert to previous state, full redraw needed
         return;
     }
 
-    for (int r = 0; r < lines.size(); ++r) {
-        size_t pos = lines[r].find(searchQuery, 0);
-        while (pos != std::string::npos) {
-            searchResults.push_back({r, (int)pos});
-            pos = lines[r].find(searchQuery, pos + 1);
-        }
+    if (searchSession.pattern() != searchQuery) {
+        updateIncrementalSearch();
+    }
+    if (!searchSession.active()) {
+        std::string error;
+        searchSession.start(searchQuery, searchOptions, error);
+        searchSession.clear();
+        show_error("Invalid pattern: " + error, 5000);
+        mode = EDIT_MODE;
+        return;
     }
 
-    if (searchResults.empty()) {
+    if (!hasCurrentMatch) {
+        searchSession.clear();
         statusMessage = "No matches found for '" + searchQuery + "'";
         statusMessageTime = GetTickCount64();
         mode = EDIT_MODE;
-        cursorX = originalCursorX;
-        cursorY = originalCursorY;
-        rowOffset = originalRowOffset;
-        colOffset = originalColOffset;
-        force_full_redraw_internal(); // Revert to previous state, full redraw needed
         return;
     }
 
-    currentMatchIndex = 0;
-    statusMessage = "Found " + std::to_string(searchResults.size()) + " matches. (N)ext (P)rev";
+    statusMessage = "'" + searchQuery + "': " + searchStatus() + ". (N)ext (P)rev";
     statusMessageTime = GetTickCount64();
-
-    cursorY = searchResults[currentMatchIndex].first;
-    cursorX = searchResults[currentMatchIndex].second;
-    scroll();
-    
     mode = EDIT_MODE; // Exit search prompt mode
-    force_full_redraw_internal();
 }
 
-void Editor::findNext() {
-    if (searchResults.empty()) return;
-
-    currentMatchIndex = (currentMatchIndex + 1) % searchResults.size();
-
-    cursorY = searchResults[currentMatchIndex].first;
-    cursorX = searchResults[currentMatchIndex].second;
+void Editor::jumpToMatch(const SearchMatch& match) {
+    currentMatch = match;
+    hasCurrentMatch = true;
+    currentMatchOrdinal = 0;
+    cursorY = (int)match.row;
+    cursorX = (int)match.col;
     scroll();
+}
 
-    statusMessage = "Match " + std::to_string(currentMatchIndex + 1) + " of " + std::to_string(searchResults.size());
+// Counts the matches of the current buffer contents in the background, unless that is already under way.
+void Editor::refreshSearchCount() {
+    if (!searchSession.active() || lines.isIndexing()) return;
+    if (searchSession.countStarted() && searchSession.countVersion() == lines.version()) return;
+    searchSession.startCount(workers, lines.snapshot(), lines.version());
+    searchCountStartTime = GetTickCount64();
+}
+
+// "match k of N", with ">=N" while the count is still running and "?" for k until the
+// counter has got past the current match.
+std::string Editor::searchStatus() {
+    if (!searchSession.active()) return "";
+    bool complete = false;
+    size_t total = searchSession.countedMatches(complete);
+    if (!searchSession.countStarted() || searchSession.countVersion() != lines.version()) {
+        return "counting matches";
+    }
+    if (!hasCurrentMatch) {
+        return complete ? "no matches" : "counting matches";
+    }
+    if (currentMatchOrdinal == 0 || currentMatchVersion != lines.version()) {
+        currentMatchOrdinal = searchSession.ordinalOf(lines, currentMatch);
+        currentMatchVersion = lines.version();
+    }
+    std::string ordinal = currentMatchOrdinal > 0 ? std::to_string(currentMatchOrdinal) : "?";
+    return "match " + ordinal + " of " + (complete ? "" : ">=") + std::to_string(total);
+}
+
+void Editor::findNext() {
+    if (!searchSession.active()) return;
+
+    // Step past the current match when the cursor is still on it, else start at the cursor.
+    size_t row = cursorY;
+    size_t col = cursorX;
+    if (hasCurrentMatch && (size_t)cursorY == currentMatch.row && (size_t)cursorX == currentMatch.col) {
+        col += std::max<size_t>(currentMatch.length, 1);
+    }
+    SearchMatch match;
+    if (!searchSession.findForward(lines.snapshot(), row, col, match)) {
+        show_message("No matches found for '" + searchSession.pattern() + "'", 2000);
+        return;
+    }
+    jumpToMatch(match);
+    refreshSearchCount();
+
+    statusMessage = "'" + searchSession.pattern() + "': " + searchStatus();
     statusMessageTime = GetTickCount64();
-    force_full_redraw_internal();
 }
 
 void Editor::findPrevious() {
-    if (searchResults.empty()) return;
+    if (!searchSession.active()) return;
 
-    currentMatchIndex--;
-    if (currentMatchIndex < 0) {
-        currentMatchIndex = searchResults.size() - 1;
+    SearchMatch match;
+    if (!searchSession.findBackward(lines.snapshot(), cursorY, cursorX, match)) {
+        show_message("No matches found for '" + searchSession.pattern() + "'", 2000);
+        return;
     }
+    jumpToMatch(match);
+    refreshSearchCount();
 
-    cursorY = searchResults[currentMatchIndex].first;
-    cursorX = searchResults[currentMatchIndex].second;
-    scroll();
-
-    statusMessage = "Match " + std::to_string(currentMatchIndex + 1) + " of " + std::to_string(searchResults.size());
+    statusMessage = "'" + searchSession.pattern() + "': " + searchStatus();
     statusMessageTime = GetTickCount64();
-    force_full_redraw_internal();
 }
 
 bool Editor::promptUser(const std::string& prompt, int input_c, std::string& result) {
     if (input_c == 13) { // Enter
         mode = EDIT_MODE;
-        force_full_redraw_internal(); // Back to edit mode, redraw content
         return true;
     } else if (input_c == 27) { // Escape
         mode = EDIT_MODE;
@@ -1758,7 +2205,6 @@ bool Editor::promptUser(const std::string& prompt, int input_c, std::string& res
         cursorY = originalCursorY;
         rowOffset = originalRowOffset;
         colOffset = originalColOffset;
-        force_full_redraw_internal(); // Restore original state, redraw content
         return false;
     } else if (input_c == 8) { // Backspace
         if (!result.empty()) {
@@ -1773,27 +2219,57 @@ bool Editor::promptUser(const std::string& prompt, int input_c, std::string& res
     return false;
 }
 void Editor::drawStatusBar() {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) return;
-
     std::string mode_display;
     switch(mode) {
         case EDIT_MODE: mode_display = " EDIT "; break;
         case FILE_EXPLORER_MODE: mode_display = " FILE_EXPLORER_MODE "; break;
         case PROMPT_MODE: mode_display = " PROMPT_MODE "; break;
         case TERMINAL_MODE: mode_display = " TERMINAL_MODE "; break;
+        case QUICK_OPEN_MODE: mode_display = " QUICK_OPEN "; break;
         default: mode_display = " UNKNOWN "; break;
     }
 
     std::string left_aligned_info = mode_display;
 
     std::string currentStatus;
-    std::string filename_display = filename.empty() ? "[No Name]" : filename;
+    std::string filename_display = filename.empty() ? (pagingStdin ? "[stdin]" : showingProjectSearch ? "[search results]" : "[No Name]") : filename;
     if (isDirty()) {
         filename_display += "*";
     }
 
-    std::string right_aligned_info = std::to_string(cursorY + 1) + "/" + std::to_string(lines.size()) +
+    std::string line_count_display = std::to_string(lines.size());
+    if (lines.isIndexing()) {
+        line_count_display += "+ (" + std::to_string(lines.indexProgress()) + "%)";
+    }
+    if (saveInProgress) {
+        uint64_t total = saveBytesTotal;
+        int percent = total > 0 ? (int)(saveBytesWritten * 100 / total) : 0;
+        filename_display += " [saving " + std::to_string(percent) + "%]";
+    }
+    if (followMode) {
+        filename_display += " [follow]";
+    }
+    if (stdinStream) {
+        filename_display += " [reading]";
+    }
+    if (projectSearchStreaming) {
+        filename_display += " [searching]";
+    }
+    if (projectReplaceStreaming) {
+        filename_display += projectReplace.dryRun() ? " [previewing replace]" : " [replacing]";
+    }
+    if (readOnly) {
+        filename_display += " [read-only]";
+    }
+    if (searchSession.active()) {
+        filename_display += " [" + searchStatus() + "]";
+    }
+
+    if (!currentEncoding.isPlainUtf8()) {
+        line_count_display += " " + encodingName(currentEncoding);
+    }
+
+    std::string right_aligned_info = std::to_string(cursorY + 1) + "/" + line_count_display +
         " Ln" + std::to_string(cursorY + 1) + " Col" + std::to_string(cursorX + 1);
 
     currentStatus = left_aligned_info + " " + filename_display;
@@ -1806,26 +2282,10 @@ void Editor::drawStatusBar() {
     }
     currentStatus += right_aligned_info;
 
-    if (currentStatus != prevStatusMessage) {
-        std::vector<WORD> attributes(screenCols);
-        for (int k = 0; k < screenCols; ++k) {
-            attributes[k] = BG_BLUE | WHITE;
-        }
-
-        COORD writePos = {0, (SHORT)(screenRows - 2)};
-        DWORD charsWritten;
-
-        WriteConsoleOutputCharacterA(hConsole, currentStatus.c_str(), screenCols, writePos, &charsWritten);
-        WriteConsoleOutputAttribute(hConsole, attributes.data(), screenCols, writePos, &charsWritten);
-
-        prevStatusMessage = currentStatus;
-    }
+    frame.write(screenRows - 2, 0, currentStatus, (WORD)(BG_BLUE | WHITE));
 }
 
 void Editor::drawMessageBar() {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) return;
-
     std::string currentMessage = "";
     ULONGLONG currentTime = GetTickCount64();
     if (currentTime < statusMessageTime) {
@@ -1838,20 +2298,7 @@ void Editor::drawMessageBar() {
         currentMessage = currentMessage.substr(0, screenCols);
     }
 
-    if (currentMessage != prevMessageBarMessage) {
-        std::vector<WORD> attributes(screenCols);
-        for (int k = 0; k < screenCols; ++k) {
-            attributes[k] = YELLOW | INTENSITY | defaultBgColor;
-        }
-
-        COORD writePos = {0, (SHORT)(screenRows - 1)};
-        DWORD charsWritten;
-
-        WriteConsoleOutputCharacterA(hConsole, currentMessage.c_str(), screenCols, writePos, &charsWritten);
-        WriteConsoleOutputAttribute(hConsole, attributes.data(), screenCols, writePos, &charsWritten);
-
-        prevMessageBarMessage = currentMessage;
-    }
+    frame.write(screenRows - 1, 0, currentMessage, (WORD)(YELLOW | INTENSITY | defaultBgColor));
 }
 
 std::string Editor::trimRight(const std::string& s) {
@@ -1893,7 +2340,6 @@ void Editor::scroll() {
 
     if (scrolledVertically || scrolledHorizontally) {
         std::cerr << "  SCROLLED: rowOffset=" << rowOffset << ", colOffset=" << colOffset << std::endl;
-        force_full_redraw_internal(); // Only invalidate cache, not clear screen
     }
 }
 
@@ -1920,12 +2366,12 @@ void Editor::moveCursor(int key_code) {
         }
         else if (cursorY > 0) { // Move to end of previous line
             cursorY--;
-            cursorX = (int)lines[cursorY].length();
+            cursorX = (int)lines.length(cursorY);
             cursorMoved = true;
         }
         break;
     case VK_RIGHT:
-        if (cursorX < lines[cursorY].length()) { // Move within current line
+        if (cursorX < lines.length(cursorY)) { // Move within current line
             cursorX++;
             cursorMoved = true;
         }
@@ -1940,14 +2386,14 @@ void Editor::moveCursor(int key_code) {
         cursorMoved = true;
         break;
     case VK_END:
-        cursorX = (int)lines[cursorY].length();
+        cursorX = (int)lines.length(cursorY);
         cursorMoved = true;
         break;
     }
 
     // Clamp cursorX to the length of the new line (important after vertical moves)
     if (cursorY >= 0 && cursorY < lines.size()) {
-        cursorX = std::min(cursorX, (int)lines[cursorY].length());
+        cursorX = std::min(cursorX, (int)lines.length(cursorY));
     }
     else {
         // If lines is empty or cursorY invalid, reset cursorX/Y to 0
@@ -1964,10 +2410,11 @@ void Editor::moveCursor(int key_code) {
 }
 
 void Editor::insertChar(int c) {
+    if (!checkWritable()) return;
     if (cursorY == lines.size()) {
-        lines.push_back("");
+        applyEdit({ EDIT_INSERT_LINE, cursorY, 0, "" });
     }
-    lines[cursorY].insert(cursorX, 1, static_cast<char>(c));
+    applyEdit({ EDIT_INSERT_TEXT, cursorY, cursorX, std::string(1, static_cast<char>(c)) });
     cursorX++;
     statusMessage = "";
     statusMessageTime = 0;
@@ -1975,95 +2422,1066 @@ void Editor::insertChar(int c) {
     dirty = true;
 }
 
-void Editor::insertNewline() {
-    if (cursorX == lines[cursorY].length()) {
-        lines.insert(lines.begin() + cursorY + 1, "");
-    }
-    else {
-        std::string remaining = lines[cursorY].substr(cursorX);
-        lines[cursorY].erase(cursorX);
-        lines.insert(lines.begin() + cursorY + 1, remaining);
+void Editor::insertNewline() {
+    if (!checkWritable()) return;
+    applyEdit({ EDIT_SPLIT_LINE, cursorY, cursorX, "" });
+    cursorY++;
+    cursorX = 0;
+    calculateLineNumberWidth();
+    statusMessage = "";
+    statusMessageTime = 0;
+    dirty = true;
+    scroll();
+}
+
+void Editor::deleteChar() {
+    if (!checkWritable()) return;
+    if (cursorY == lines.size()) return;
+    if (cursorX == 0 && cursorY == 0 && lines.length(0) == 0) {
+        return;
+    }
+
+    if (cursorX > 0) {
+        applyEdit({ EDIT_DELETE_TEXT, cursorY, cursorX - 1, std::string(1, lines.view(cursorY)[cursorX - 1]) });
+        cursorX--;
+        dirty = true;
+        scroll();
+    }
+    else {
+        cursorX = lines.length(cursorY - 1);
+        applyEdit({ EDIT_JOIN_LINE, cursorY - 1, cursorX, "" });
+        cursorY--;
+        calculateLineNumberWidth();
+    }
+    statusMessage = "";
+    statusMessageTime = 0;
+    dirty = true;
+}
+
+void Editor::deleteForwardChar() {
+    if (!checkWritable()) return;
+    if (cursorY == lines.size()) return;
+    if (cursorX == lines.length(cursorY) && cursorY == lines.size() - 1) {
+        return;
+    }
+
+    if (cursorX < lines.length(cursorY)) {
+        applyEdit({ EDIT_DELETE_TEXT, cursorY, cursorX, std::string(1, lines.view(cursorY)[cursorX]) });
+    }
+    else {
+        applyEdit({ EDIT_JOIN_LINE, cursorY, cursorX, "" });
+        calculateLineNumberWidth();
+        dirty = true; 
+        scroll();
+    }
+    statusMessage = "";
+    statusMessageTime = 0;
+    dirty = true;
+}
+
+
+static int64_t fileModificationTime(const std::string& path) {
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    return ec ? 0 : (int64_t)mtime.time_since_epoch().count();
+}
+
+// Session entries are keyed by absolute path, so a file opened by a relative name in one
+// launch is recognised in the next.
+static std::string sessionPathKey(const std::string& path) {
+    std::error_code ec;
+    std::filesystem::path absolute = std::filesystem::absolute(path, ec);
+    return ec ? path : absolute.lexically_normal().string();
+}
+
+// Reads path into target, converting it to UTF-8; files of largeThreshold bytes or more
+// are mapped, with cachedIndex as their line index if it fits. Shared by openFile() and the
+// reload thread, which loads the new copy of the file on the side, so it only uses what
+// it is given.
+bool Editor::loadFileContent(const std::string& path, LineBuffer& target, size_t largeThreshold, const SessionLineIndex* cachedIndex,
+                             FileEncoding& encoding, uint64_t& fileSize, std::string& error) {
+    std::error_code ec;
+    fileSize = std::filesystem::file_size(path, ec);
+    if (ec) {
+        error = "Could not open file '" + path + "'";
+        return false;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        error = "Could not open file '" + path + "'";
+        return false;
+    }
+
+    // Small files are read whole and their encoding is decided on all of it; for large
+    // files only the head is sniffed so opening stays instant.
+    bool largeFile = fileSize >= largeThreshold;
+    std::string content;
+    content.resize(largeFile ? std::min<size_t>((size_t)fileSize, ENCODING_SNIFF_BYTES) : (size_t)fileSize);
+    file.read(content.data(), (std::streamsize)content.size());
+    content.resize((size_t)file.gcount());
+    encoding = detectEncoding(content.data(), content.size(), !largeFile);
+    size_t bomLength = bomBytes(encoding).size();
+
+    if (encoding.encoding == ENC_UTF8 && largeFile) {
+        // Large file mode: map the file and only index the head up front; the rest
+        // of the line index is built in the background and picked up by pollBackgroundWork().
+        file.close();
+        std::string mapError;
+        bool indexed = cachedIndex && cachedIndex->skipBytes == bomLength &&
+            target.openMappedIndexed(path, mapError, bomLength, cachedIndex->slots, (size_t)cachedIndex->count,
+                                     (size_t)cachedIndex->crlfLines, (size_t)cachedIndex->lfLines);
+        if (!indexed && !target.openMapped(path, mapError, bomLength)) {
+            error = "Could not map file '" + path + "': " + mapError;
+            return false;
+        }
+    } else if (encoding.encoding == ENC_UTF8) {
+        file.close();
+        content.erase(0, bomLength);
+        target.assign(std::move(content));
+    } else {
+        // Convert to UTF-8 in chunks straight into the buffer's storage, so only the
+        // converted copy of the file is ever held in full.
+        EncodingDecoder decoder(encoding.encoding);
+        std::string decoded;
+        decoded.reserve(encoding.encoding == ENC_LATIN1 ? (size_t)fileSize + fileSize / 8 : (size_t)fileSize / 2 + fileSize / 8);
+        decoder.decode(content.data() + bomLength, content.size() - bomLength, decoded);
+        if (largeFile) {
+            std::vector<char> chunk(TRANSCODE_CHUNK_SIZE);
+            while (file.read(chunk.data(), (std::streamsize)chunk.size()) || file.gcount() > 0) {
+                decoder.decode(chunk.data(), (size_t)file.gcount(), decoded);
+            }
+        }
+        decoder.finish(decoded);
+        file.close();
+        content.clear();
+        content.shrink_to_fit();
+        target.assign(std::move(decoded));
+    }
+    return true;
+}
+
+bool Editor::openFile(const std::string& path) {
+    FileEncoding encoding;
+    uint64_t fileSize = 0;
+    std::string error;
+    cancelReload();
+    FileStamp stamp = FileStamp::of(path);
+    const SessionLineIndex* cachedIndex = session.findLineIndex(sessionPathKey(path), stamp.size, stamp.mtime);
+    if (!loadFileContent(path, lines, largeFileThreshold, cachedIndex, encoding, fileSize, error)) {
+        statusMessage = "Error: " + error;
+        statusMessageTime = GetTickCount64();
+        return false;
+    }
+    currentEncoding = encoding;
+
+    detectLineEnding();
+
+    // The buffer left behind keeps its journal if it has unsaved edits; opening its file
+    // again recovers them, like after a crash.
+    journal.stop(dirty);
+
+    // Replay edits left behind by a session that did not exit cleanly.
+    journalBaseStale = false;
+    followMode = false;
+    followDroppedLines = 0;
+    fileWatcher.setSettleDelay(FILE_WATCH_SETTLE_MS);
+    diskSize = fileSize;
+    stdinStream.reset();
+    pagingStdin = false;
+    readOnly = false;
+    projectSearch.cancel();
+    showingProjectSearch = false;
+    projectSearchStreaming = false;
+    projectReplaceIntoBuffer = false;
+    int64_t baseMtime = fileModificationTime(path);
+    std::vector<JournalEntry> recovered;
+    std::string journalError;
+    bool hasJournal = EditJournal::recover(path, fileSize, baseMtime, recovered, journalError);
+    size_t recoveredEdits = 0;
+    if (hasJournal && !recovered.empty()) {
+        lines.finishIndex();
+        for (const JournalEntry& entry : recovered) {
+            bool applied = entry.checkpoint ? lines.restoreRuns(entry.runs) : applyDelta(lines, entry.delta);
+            if (!applied) break;
+            recoveredEdits++;
+        }
+    }
+
+    if (lines.empty()) {
+        lines.push_back("");
+    }
+
+    journal.start(path, fileSize, baseMtime);
+    if (recoveredEdits > 0) {
+        journal.checkpoint(lines.snapshot().runs());
+    }
+    fileWatcher.watch(path);
+
+    filename = path;
+    cursorX = 0; // Cursor at start
+    cursorY = 0; // Cursor at first line
+    rowOffset = 0; // View at top
+    colOffset = 0; // View at left edge (this is the value scroll() might change)
+    calculateLineNumberWidth();
+    if (recoveredEdits > 0) {
+        statusMessage = "Opened '" + path + "' (recovered " + std::to_string(recoveredEdits) + " unsaved edits from journal)";
+    } else if (!journalError.empty()) {
+        statusMessage = "Opened '" + path + "' (ignored journal: " + journalError + ")";
+    } else if (lines.isIndexing()) {
+        statusMessage = "Opened '" + path + "' (large file mode, indexing...)";
+    } else {
+        statusMessage = "Opened '" + path + "'";
+    }
+    statusMessageTime = GetTickCount64();
+
+    scroll();
+
+    dirty = recoveredEdits > 0;
+    return true;
+}
+
+// Brings the buffer in line with the file after another program changed it. The new copy
+// is loaded and compared with a snapshot of the buffer on the reload thread (see
+// diffLines()); finishReload() then applies each changed stretch as an edit, so the search
+// count, redrawing, styling and the cursor only follow the rows that changed. Local edits
+// are discarded. Returns false if the reload could not be started.
+bool Editor::reloadFile() {
+    if (filename.empty()) return false;
+    if (saveInProgress) {
+        show_error("Cannot reload '" + filename + "' while it is being saved", 3000);
+        return false;
+    }
+    // The snapshot has to hold every line, and a reload under way picks up the file as it
+    // was when it started; either way another one follows.
+    if (reloadInProgress || lines.isIndexing()) {
+        reloadQueued = true;
+        return true;
+    }
+
+    reloadQueued = false;
+    reloadInProgress = true;
+    reloadDone = false;
+    reloadCancel = false;
+    reloadSucceeded = false;
+    reloadError.clear();
+    reloadVersion = lines.version();
+    reloadHunks.clear();
+    reloadFresh.clear();
+
+    reloadThread = std::thread([this, snapshot = lines.snapshot(), path = filename, largeThreshold = largeFileThreshold]() {
+        reloadStamp = FileStamp::of(path);
+        bool ok = loadFileContent(path, reloadFresh, largeThreshold, nullptr, reloadEncoding, reloadFileSize, reloadError);
+        if (ok) {
+            reloadFresh.finishIndex();
+            if (reloadFresh.empty()) {
+                reloadFresh.push_back("");
+            }
+            ok = diffLines(snapshot, reloadFresh.snapshot(), reloadCancel, reloadHunks);
+        }
+        reloadSucceeded = ok;
+        reloadDone = true;
+    });
+
+    statusMessage = "Reloading '" + filename + "'...";
+    statusMessageTime = GetTickCount64();
+    return true;
+}
+
+void Editor::finishReload() {
+    reloadThread.join();
+    reloadInProgress = false;
+
+    if (!reloadSucceeded) {
+        reloadFresh.clear();
+        show_error("Could not reload: " + reloadError, 5000);
+        return;
+    }
+    // The hunks describe the buffer as it was when the reload started.
+    if (lines.version() != reloadVersion) {
+        reloadFresh.clear();
+        show_message("'" + filename + "' changed on disk; reload_file() discards your unsaved edits", 5000);
+        return;
+    }
+
+    // Bottom up, so the rows of the hunks still to come stay where the diff found them.
+    size_t removed = 0, added = 0;
+    for (auto it = reloadHunks.rbegin(); it != reloadHunks.rend(); ++it) {
+        const LineHunk& hunk = *it;
+        if (hunk.oldRows > 0) {
+            applyEdit({ EDIT_DELETE_LINES, (int)hunk.oldRow, (int)hunk.oldRows, std::string() });
+        }
+        if (hunk.newRows > 0) {
+            std::string text;
+            for (size_t row = hunk.newRow; row < hunk.newRow + hunk.newRows; ++row) {
+                if (row > hunk.newRow) text += '\n';
+                text += reloadFresh.view(row);
+            }
+            applyEdit({ EDIT_INSERT_LINES, (int)hunk.oldRow, 0, std::move(text) });
+        }
+        shiftLineAnnotations((int)hunk.oldRow, (int)hunk.oldRows, (int)hunk.newRows);
+
+        // Anything below the hunk moves with its text.
+        int shift = (int)hunk.newRows - (int)hunk.oldRows;
+        if (cursorY >= (int)(hunk.oldRow + hunk.oldRows)) cursorY += shift;
+        if (rowOffset >= (int)(hunk.oldRow + hunk.oldRows)) rowOffset += shift;
+        removed += hunk.oldRows;
+        added += hunk.newRows;
+    }
+    cursorY = std::clamp(cursorY, 0, (int)lines.size() - 1);
+    cursorX = std::min(cursorX, (int)lines.length(cursorY));
+    rowOffset = std::clamp(rowOffset, 0, (int)lines.size() - 1);
+
+    // The lines now read as the new copy does, so its storage replaces the old file's.
+    lines.adoptBase(reloadFresh);
+    reloadFresh.clear();
+    currentEncoding = reloadEncoding;
+    detectLineEnding();
+
+    int64_t mtime = fileModificationTime(filename);
+    if (journal.isActive()) {
+        journal.rebase(reloadFileSize, mtime);
+    } else if (!followMode) {
+        journal.start(filename, reloadFileSize, mtime);
+    }
+    journalBaseStale = false;
+    fileWatcher.acknowledge();
+    // Written again while it was being loaded: that change is still to come.
+    if (FileStamp::of(filename) != reloadStamp) {
+        reloadQueued = true;
+    }
+    diskSize = reloadFileSize;
+    followDroppedLines = 0;
+    dirty = false;
+
+    if (followMode) {
+        trimFollowedLines();
+    } else {
+        calculateLineNumberWidth();
+        scroll();
+    }
+
+    if (reloadHunks.empty()) {
+        statusMessage = "Reloaded '" + filename + "' (no changes)";
+    } else {
+        statusMessage = "Reloaded '" + filename + "' (" + std::to_string(removed) + " lines replaced by " + std::to_string(added) +
+                        " in " + std::to_string(reloadHunks.size()) + (reloadHunks.size() == 1 ? " place, first" : " places, first") +
+                        " at line " + std::to_string(reloadHunks.front().oldRow + 1) + ")";
+    }
+    statusMessageTime = GetTickCount64();
+    reloadHunks.clear();
+    triggerEvent("on_file_reloaded", filename);
+}
+
+// Drops a reload under way, for a buffer that is about to be replaced.
+void Editor::cancelReload() {
+    if (reloadThread.joinable()) {
+        reloadCancel = true;
+        reloadThread.join();
+    }
+    reloadInProgress = false;
+    reloadQueued = false;
+    reloadCancel = false;
+    reloadHunks.clear();
+    reloadFresh.clear();
+}
+
+void Editor::openStdin(std::unique_ptr<StdinStream> stream) {
+    cancelReload();
+    journal.stop(dirty);  // See openFile()
+    fileWatcher.stop();
+    followMode = false;
+    followDroppedLines = 0;
+    lines.clear();
+    lines.push_back("");
+    filename.clear();
+    diskSize = 0;
+    currentEncoding = FileEncoding();
+    stdinStream = std::move(stream);
+    pagingStdin = true;
+    readOnly = true;
+    dirty = false;
+    projectSearch.cancel();
+    showingProjectSearch = false;
+    projectSearchStreaming = false;
+    projectReplaceIntoBuffer = false;
+
+    cursorX = 0;
+    cursorY = 0;
+    rowOffset = 0;
+    colOffset = 0;
+    calculateLineNumberWidth();
+    statusMessage = "Reading standard input...";
+    statusMessageTime = GetTickCount64();
+}
+
+// Takes what the stdin reader queued since the last frame into the buffer. Only the new
+// lines are indexed, so the first screen shows up long before the producer is done.
+void Editor::pollStdin() {
+    if (!stdinStream) return;
+    ULONGLONG now = GetTickCount64();
+    if (now - lastStdinPoll < PAGER_FRAME_MS) return;
+    lastStdinPoll = now;
+
+    std::string data;
+    if (stdinStream->read(data, PAGER_FRAME_BYTES) > 0) {
+        bool hadLineEnding = lines.crlfLineCount() + lines.lfLineCount() > 0;
+        lines.appendData(data.data(), data.size());
+        if (!hadLineEnding) {
+            detectLineEnding();
+        }
+        calculateLineNumberWidth();
+    }
+
+    if (stdinStream->atEnd()) {
+        std::string error = stdinStream->lastError();
+        uint64_t total = stdinStream->bytesRead();
+        stdinStream.reset();
+        detectLineEnding();
+        if (!error.empty()) {
+            show_error("Error reading standard input: " + error, 5000);
+        } else {
+            statusMessage = "Read " + std::to_string(lines.size()) + " lines (" + std::to_string(total) + " bytes) from standard input";
+            statusMessageTime = GetTickCount64();
+        }
+    }
+}
+
+bool Editor::checkWritable() {
+    if (!readOnly) return true;
+    show_message("Buffer is read-only", 2000);
+    return false;
+}
+
+void Editor::startReplacePrompt() {
+    if (!checkWritable()) return;
+    originalCursorX = cursorX;
+    originalCursorY = cursorY;
+    originalRowOffset = rowOffset;
+    originalColOffset = colOffset;
+
+    mode = PROMPT_MODE;
+    promptMessage = "Replace: ";
+    searchQuery = "";
+    statusMessage = "Enter text to replace; the search options apply. ESC to cancel.";
+    statusMessageTime = GetTickCount64();
+}
+
+// Enter in one of the replace prompts: the first asks for the replacement next, the
+// second replaces every match in the buffer, or previews the replace in the folder.
+void Editor::continueReplacePrompt() {
+    bool inFolder = promptMessage.rfind("Replace in folder", 0) == 0;
+    if (promptMessage.rfind("Replace:", 0) == 0 || promptMessage.rfind("Replace in folder:", 0) == 0) {
+        if (searchQuery.empty()) {
+            show_message("Replace cancelled or empty.", 2000);
+            return;
+        }
+        replacePattern = searchQuery;
+        mode = PROMPT_MODE;
+        promptMessage = inFolder ? "Replace in folder with: " : "Replace with: ";
+        searchQuery = "";
+        statusMessage = "Replace '" + replacePattern + "' with what? ESC to cancel.";
+        statusMessageTime = GetTickCount64();
+        return;
+    }
+    if (inFolder) {
+        startFolderReplace(replacePattern, searchQuery, searchOptions, currentDirPath, true);
+        return;
+    }
+
+    size_t count = 0;
+    std::string error;
+    if (!replaceAll(replacePattern, searchQuery, searchOptions, count, error)) {
+        show_error("Could not replace: " + error, 5000);
+    } else if (count == 0) {
+        show_message("No matches for '" + replacePattern + "'", 3000);
+    } else {
+        show_message("Replaced " + std::to_string(count) + (count == 1 ? " match" : " matches") + " of '" + replacePattern +
+                     "'; undo_replace (Ctrl-Z) reverts them", 5000);
+    }
+}
+
+// Replaces every match of pattern in one pass over the buffer (see Replacer) and applies
+// the changed lines as they are built, as EDIT_SET_LINE deltas plus an EDIT_INSERT_LINE
+// for each line break a replacement adds. The search count is redone afterwards rather
+// than followed through each delta as applyEdit() does. The cursor, the view and line
+// styling move with the text, and the inverse of the whole batch is kept for undoReplace().
+bool Editor::replaceAll(const std::string& pattern, const std::string& replacement, SearchOptions options,
+                        size_t& count, std::string& error) {
+    count = 0;
+    if (!checkWritable()) {
+        error = "the buffer is read-only";
+        return false;
+    }
+    Replacer replacer;
+    if (!replacer.prepare(pattern, replacement, options, error)) return false;
+    lines.finishIndex();
+
+    std::vector<EditDelta> undo;
+    PositionMap map;
+    size_t addedRows = 0;
+    LineSnapshot snapshot = lines.snapshot();
+    std::atomic<bool> cancel(false);
+    count = replacer.run(workers, snapshot, 0, snapshot.size(), cancel, [&](size_t row, std::string&& text) {
+        size_t target = row + addedRows;
+        undo.push_back({ EDIT_SET_LINE, (int)target, 0, std::string(snapshot.view(row)) });
+        size_t lineEnd = text.find('\n');
+        if (lineEnd == std::string::npos) {
+            EditDelta delta = { EDIT_SET_LINE, (int)target, 0, std::move(text) };
+            applyDelta(lines, delta);
+            journal.record(delta);
+            return;
+        }
+        EditDelta delta = { EDIT_SET_LINE, (int)target, 0, text.substr(0, lineEnd) };
+        applyDelta(lines, delta);
+        journal.record(delta);
+        while (lineEnd != std::string::npos) {
+            size_t start = lineEnd + 1;
+            lineEnd = text.find('\n', start);
+            ++target;
+            ++addedRows;
+            delta = { EDIT_INSERT_LINE, (int)target, 0, text.substr(start, lineEnd == std::string::npos ? std::string::npos : lineEnd - start) };
+            applyDelta(lines, delta);
+            journal.record(delta);
+            undo.push_back({ EDIT_DELETE_LINE, (int)target, 0, delta.text });
+        }
+    }, map);
+    if (count == 0) return true;
+
+    if (addedRows > 0) remapLineAnnotations([&map](int row) { return (int)map.mapRow((size_t)row); });
+    replaceUndo = std::move(undo);
+    replaceUndoMap = std::move(map);
+    replaceUndoVersion = lines.version();
+    replaceUndoCursorX = cursorX;
+    replaceUndoCursorY = cursorY;
+
+    size_t row = (size_t)cursorY, col = (size_t)cursorX;
+    replaceUndoMap.map(row, col);
+    cursorY = (int)row;
+    cursorX = (int)col;
+    rowOffset = (int)replaceUndoMap.mapRow((size_t)rowOffset);
+    hasCurrentMatch = false;
+    viewportMatchesRow = -1;
+    dirty = true;
+
+    calculateLineNumberWidth();
+    scroll();
+    triggerEvent("on_buffer_changed");
+    return true;
+}
+
+// Reverts the last replaceAll(), as long as the buffer is still exactly as it left it.
+bool Editor::undoReplace() {
+    if (replaceUndo.empty()) {
+        show_message("Nothing to undo: only the last replace can be undone", 3000);
+        return false;
+    }
+    if (lines.version() != replaceUndoVersion) {
+        replaceUndo.clear();
+        replaceUndoMap.clear();
+        show_error("The buffer changed since the last replace; it can no longer be undone", 4000);
+        return false;
+    }
+    if (!checkWritable()) return false;
+
+    for (auto it = replaceUndo.rbegin(); it != replaceUndo.rend(); ++it) {
+        applyDelta(lines, *it);
+        journal.record(*it);
+    }
+    remapLineAnnotations([this](int row) { return (int)replaceUndoMap.unmapRow((size_t)row); });
+    rowOffset = (int)replaceUndoMap.unmapRow((size_t)rowOffset);
+    size_t count = replaceUndoMap.size();
+    replaceUndo.clear();
+    replaceUndoMap.clear();
+
+    if (lines.empty()) {
+        cursorY = 0;
+        cursorX = 0;
+    } else {
+        cursorY = std::clamp(replaceUndoCursorY, 0, (int)lines.size() - 1);
+        cursorX = std::min(replaceUndoCursorX, (int)lines.length(cursorY));
+    }
+    hasCurrentMatch = false;
+    viewportMatchesRow = -1;
+    dirty = true;
+
+    calculateLineNumberWidth();
+    scroll();
+    triggerEvent("on_buffer_changed");
+    show_message("Undid " + std::to_string(count) + (count == 1 ? " replacement" : " replacements"), 3000);
+    return true;
+}
+
+void Editor::startProjectSearchPrompt() {
+    originalCursorX = cursorX;
+    originalCursorY = cursorY;
+    originalRowOffset = rowOffset;
+    originalColOffset = colOffset;
+
+    mode = PROMPT_MODE;
+    promptMessage = "Search in folder: ";
+    searchQuery = "";
+    statusMessage = "Enter text to find in the files under '" + currentDirPath + "'. ESC to cancel.";
+    statusMessageTime = GetTickCount64();
+}
+
+// Replaces the buffer with the results of searching the files under root, which
+// pollProjectSearch() takes in as they are published.
+bool Editor::startProjectSearch(const std::string& pattern, const std::string& root) {
+    if (pattern.empty()) {
+        show_message("Search cancelled or empty.", 2000);
+        return false;
+    }
+    if (isDirty()) {
+        show_error("Save your changes first: the results of a folder search replace the buffer", 5000);
+        return false;
+    }
+    if (saveInProgress) {
+        show_error("A save of '" + savePath + "' is still in progress", 3000);
+        return false;
+    }
+    // A folder that has an index keeps it between searches; it is reopened when it was rebuilt.
+    std::string indexPath = (std::filesystem::path(root) / TRIGRAM_INDEX_FILE_NAME).string();
+    std::error_code ec;
+    if (!std::filesystem::exists(indexPath, ec)) {
+        projectIndex.reset();
+    } else if (!projectIndex || projectIndex->path() != indexPath) {
+        auto index = std::make_shared<TrigramIndex>();
+        std::string indexError;
+        if (index->open(indexPath, indexError)) {
+            projectIndex = index;
+        } else {
+            projectIndex.reset();
+            show_error("Searching without the index of '" + root + "': " + indexError, 3000);
+        }
+    }
+    std::string error;
+    if (!projectSearch.start(workers, root, pattern, searchOptions, projectIndex, error)) {
+        show_error("Invalid pattern: " + error, 5000);
+        return false;
+    }
+
+    showProjectResults("Search for '" + pattern + "' in " + root + "\n\n", root);
+    projectSearchStreaming = true;
+    projectSearchStartTime = GetTickCount64();
+    statusMessage = "Searching '" + root + "'... Enter opens the result under the cursor, ESC stops the search.";
+    statusMessageTime = GetTickCount64();
+    return true;
+}
+
+// Turns the buffer into the read-only results of a folder search or replace, which then
+// stream in with appendData().
+void Editor::showProjectResults(const std::string& header, const std::string& root) {
+    cancelReload();
+    journal.stop(dirty);  // See openFile()
+    fileWatcher.stop();
+    followMode = false;
+    followDroppedLines = 0;
+    stdinStream.reset();
+    pagingStdin = false;
+    searchSession.clear();
+    hasCurrentMatch = false;
+    directoryEntries.clear();
+    lines.clear();
+    lines.push_back("");
+    lines.appendData(header.data(), header.size());
+    filename.clear();
+    diskSize = 0;
+    currentEncoding = FileEncoding();
+    currentLineEnding = LE_LF;
+    readOnly = true;
+    dirty = false;
+    showingProjectSearch = true;
+    projectSearchStreaming = false;
+    projectReplaceIntoBuffer = false;
+    projectResultsRoot = root;
+
+    mode = EDIT_MODE;
+    cursorX = 0;
+    cursorY = 0;
+    rowOffset = 0;
+    colOffset = 0;
+    calculateLineNumberWidth();
+}
+
+void Editor::startFolderReplacePrompt() {
+    originalCursorX = cursorX;
+    originalCursorY = cursorY;
+    originalRowOffset = rowOffset;
+    originalColOffset = colOffset;
+
+    mode = PROMPT_MODE;
+    promptMessage = "Replace in folder: ";
+    searchQuery = "";
+    statusMessage = "Enter text to replace in the files under '" + currentDirPath + "'; the search options apply. ESC to cancel.";
+    statusMessageTime = GetTickCount64();
+}
+
+// Starts replacing pattern in the files under root (see ProjectReplace). A dry run, and a
+// replace started from the results buffer, put their report in the buffer, which has to be
+// clean for it, as for a folder search; otherwise the replace runs in the background, leaves
+// the file open in the buffer alone and replaces it there once the rest are written.
+bool Editor::startFolderReplace(const std::string& pattern, const std::string& replacement, SearchOptions options,
+                                const std::string& root, bool dryRun) {
+    if (pattern.empty()) {
+        show_message("Replace cancelled or empty.", 2000);
+        return false;
+    }
+    if (projectReplaceStreaming) {
+        show_error("A replace in '" + projectReplace.root() + "' is still running; ESC stops it", 3000);
+        return false;
+    }
+    bool intoBuffer = dryRun || showingProjectSearch;
+    if (intoBuffer && isDirty()) {
+        show_error("Save your changes first: the report of a replace in folder replaces the buffer", 5000);
+        return false;
+    }
+    if (saveInProgress) {
+        show_error("A save of '" + savePath + "' is still in progress", 3000);
+        return false;
+    }
+    std::vector<std::string> openPaths;
+    if (!intoBuffer && !filename.empty()) openPaths.push_back(filename);
+    std::string error;
+    if (!projectReplace.start(workers, root, pattern, replacement, options, dryRun, openPaths, error)) {
+        show_error("Could not replace: " + error, 5000);
+        return false;
+    }
+
+    projectReplaceStreaming = true;
+    projectReplaceStartTime = GetTickCount64();
+    projectReplaceOpenPath = openPaths.empty() ? std::string() : filename;
+    if (intoBuffer) {
+        if (projectSearchStreaming) projectSearch.cancel();
+        std::string header = std::string(dryRun ? "Preview: replace '" : "Replace '") + pattern + "' with '" + replacement +
+            "' in " + root + "\n\n";
+        showProjectResults(header, root);
+        projectReplaceIntoBuffer = true;
+    }
+    statusMessage = dryRun ? "Previewing the replace in '" + root + "'... ESC stops it."
+                           : "Replacing in '" + root + "'... ESC stops it before any file is changed.";
+    statusMessageTime = GetTickCount64();
+    return true;
+}
+
+// Runs the replace the buffer shows the preview of on the files.
+bool Editor::applyFolderReplace() {
+    if (!showingProjectSearch || !projectReplaceIntoBuffer || projectReplaceStreaming || !projectReplace.dryRun() ||
+        projectReplace.cancelled()) {
+        show_message("Nothing to apply: preview a replace in folder first (Ctrl-Shift-H)", 3000);
+        return false;
+    }
+    if (projectReplace.stats().matches == 0) {
+        show_message("The preview found nothing to replace", 3000);
+        return false;
+    }
+    // Copies: start() overwrites the ones it holds.
+    std::string pattern = projectReplace.pattern();
+    std::string replacement = projectReplace.replacement();
+    std::string root = projectReplace.root();
+    return startFolderReplace(pattern, replacement, projectReplace.options(), root, false);
+}
+
+// Follows the replace like pollProjectSearch() does a search, then sums it up, and
+// replaces the file open in the buffer if it was left out.
+void Editor::pollProjectReplace() {
+    if (!projectReplaceStreaming) return;
+    bool finished = !projectReplace.running();
+    std::string output;
+    if (projectReplace.takeOutput(output) && projectReplaceIntoBuffer) {
+        lines.appendData(output.data(), output.size());
+        calculateLineNumberWidth();
+    }
+    if (!finished) return;
+
+    projectReplaceStreaming = false;
+    ProjectReplaceStats stats = projectReplace.stats();
+    std::string error = projectReplace.error();
+    std::string summary = std::to_string(stats.matches) + " matches in " + std::to_string(stats.filesMatched) + " of " +
+        std::to_string(stats.filesSearched) + " files";
+    if (!projectReplace.dryRun() && error.empty()) {
+        summary += ", " + std::to_string(stats.filesWritten) + " files replaced";
+    }
+    if (stats.binaryFiles > 0) {
+        summary += ", " + std::to_string(stats.binaryFiles) + " binary files skipped";
+    }
+    if (stats.unreadableFiles > 0) {
+        summary += ", " + std::to_string(stats.unreadableFiles) + " files could not be read";
+    }
+    if (projectReplace.cancelled() && projectReplace.dryRun()) {
+        summary += " (stopped)";
+    }
+
+    // The open file is only replaced along with the others.
+    if (!projectReplaceOpenPath.empty() && stats.openFiles > 0 && error.empty() && filename == projectReplaceOpenPath) {
+        size_t count = 0;
+        std::string bufferError;
+        if (replaceAll(projectReplace.pattern(), projectReplace.replacement(), projectReplace.options(), count, bufferError)) {
+            summary += ", " + std::to_string(count) + " in the buffer (not saved)";
+        } else {
+            summary += ", the buffer could not be replaced: " + bufferError;
+        }
+    }
+    projectReplaceOpenPath.clear();
+
+    if (projectReplaceIntoBuffer) {
+        std::string footer = "\n" + summary + "\n";
+        if (!error.empty()) footer += "Not replaced: " + error + "\n";
+        else if (projectReplace.dryRun() && !projectReplace.cancelled() && stats.matches > 0) {
+            footer += "Nothing was changed yet; apply_folder_replace (Ctrl-Shift-A) replaces these.\n";
+        }
+        lines.appendData(footer.data(), footer.size());
+    }
+    if (!error.empty()) {
+        show_error("Not replaced: " + error, 5000);
+    } else {
+        statusMessage = summary + " in " + std::to_string(GetTickCount64() - projectReplaceStartTime) + " ms";
+        statusMessageTime = GetTickCount64();
+    }
+}
+
+// Takes the results published since the last frame into the buffer, and adds the totals
+// once the search is over.
+void Editor::pollProjectSearch() {
+    if (!projectSearchStreaming) return;
+    // Whatever was published before the search ended comes out with this take.
+    bool finished = !projectSearch.running();
+    std::string output;
+    if (projectSearch.takeOutput(output)) {
+        lines.appendData(output.data(), output.size());
+        calculateLineNumberWidth();
+    }
+    if (!finished) return;
+
+    projectSearchStreaming = false;
+    ProjectSearchStats stats = projectSearch.stats();
+    std::string summary = std::to_string(stats.matches) + " matches in " + std::to_string(stats.filesMatched) + " of " +
+        std::to_string(stats.filesSearched) + " files";
+    if (stats.binaryFiles > 0) {
+        summary += ", " + std::to_string(stats.binaryFiles) + " binary files skipped";
+    }
+    if (stats.unreadableFiles > 0) {
+        summary += ", " + std::to_string(stats.unreadableFiles) + " files could not be read";
+    }
+    if (stats.filesRuledOut > 0) {
+        summary += ", " + std::to_string(stats.filesRuledOut) + " ruled out by the index";
+    }
+    if (projectSearch.cancelled()) {
+        summary += " (stopped)";
+    } else if (projectIndex && stats.staleFiles > 0 && !projectIndexer.busy()) {
+        projectIndexer.start(workers, projectSearch.root(), projectIndex);
+    }
+    std::string footer = "\n" + summary + "\n";
+    lines.appendData(footer.data(), footer.size());
+    statusMessage = summary + " in " + std::to_string(GetTickCount64() - projectSearchStartTime) + " ms";
+    statusMessageTime = GetTickCount64();
+}
+
+// Opens the file of the result under the cursor at its first match on that line.
+bool Editor::openProjectSearchResult() {
+    std::string path;
+    size_t row = 0, col = 0;
+    if (cursorY >= (int)lines.size() || !ProjectSearch::parseResultLine(lines.view(cursorY), path, row, col)) {
+        show_message("Move the cursor to a result to open it", 2000);
+        return false;
+    }
+    std::string fullPath = (std::filesystem::path(projectResultsRoot) / path).string();
+    if (!openFile(fullPath)) return false;
+    if (row >= lines.size()) {
+        lines.finishIndex();
+    }
+    cursorY = (int)std::min(row, lines.size() - 1);
+    cursorX = (int)std::min(col, lines.length(cursorY));
+    scroll();
+    return true;
+}
+
+// Builds the trigram index of root in the background, reusing what is still current of
+// the index it already has; pollProjectIndexer() reports when it is written.
+bool Editor::indexFolder(const std::string& root) {
+    std::error_code ec;
+    if (!std::filesystem::is_directory(root, ec)) {
+        show_error("Not a folder: '" + root + "'", 3000);
+        return false;
     }
-    cursorY++;
-    cursorX = 0;
-    calculateLineNumberWidth();
-    statusMessage = "";
-    statusMessageTime = 0;
-    dirty = true;
-    scroll();
+    std::shared_ptr<const TrigramIndex> previous;
+    std::string indexPath = (std::filesystem::path(root) / TRIGRAM_INDEX_FILE_NAME).string();
+    if (projectIndex && projectIndex->path() == indexPath) {
+        previous = projectIndex;
+    } else if (std::filesystem::exists(indexPath, ec)) {
+        auto index = std::make_shared<TrigramIndex>();
+        std::string error;
+        if (index->open(indexPath, error)) previous = index;
+    }
+    projectIndexer.start(workers, root, previous);
+    show_message("Indexing '" + root + "'...", 2000);
+    return true;
 }
 
-void Editor::deleteChar() {
-    if (cursorY == lines.size()) return;
-    if (cursorX == 0 && cursorY == 0 && lines[0].empty()) {
+void Editor::pollProjectIndexer() {
+    if (!projectIndexer.busy() || !projectIndexer.done()) return;
+    TrigramIndexStats stats;
+    std::string error;
+    if (!projectIndexer.finish(stats, error)) {
+        show_error("Could not index '" + projectIndexer.root() + "': " + error, 5000);
         return;
     }
+    // The next search of the folder picks the new index up.
+    std::string indexPath = (std::filesystem::path(projectIndexer.root()) / TRIGRAM_INDEX_FILE_NAME).string();
+    auto index = std::make_shared<TrigramIndex>();
+    if (index->open(indexPath, error)) {
+        projectIndex = index;
+    } else {
+        projectIndex.reset();
+    }
+    show_message("Indexed " + std::to_string(stats.files) + " files of '" + projectIndexer.root() + "' (" +
+                 std::to_string(stats.filesReused) + " unchanged)", 3000);
+}
 
-    if (cursorX > 0) {
-        lines[cursorY].erase(cursorX - 1, 1);
-        cursorX--;
-        dirty = true;
-        scroll();
+void Editor::setFollowMode(bool enabled) {
+    if (enabled == followMode) return;
+    if (enabled && filename.empty()) {
+        show_error("Follow mode needs an open file", 3000);
+        return;
     }
-    else {
-        cursorX = lines[cursorY - 1].length();
-        lines[cursorY - 1] += lines[cursorY];
-        lines.erase(lines.begin() + cursorY);
-        cursorY--;
-        calculateLineNumberWidth();
+
+    followMode = enabled;
+    if (enabled) {
+        // The buffer mirrors a file another program is writing, so there is nothing to
+        // journal, and a busy writer must not hold back the watcher's settle delay.
+        journal.stop();
+        fileWatcher.setSettleDelay(0);
+        statusMessage = "Following '" + filename + "'";
+        statusMessageTime = GetTickCount64();
+        followFile();
+        if (followPinBottom) {
+            cursorY = (int)lines.size() - 1;
+            cursorX = 0;
+            scroll();
+        }
+    } else {
+        fileWatcher.setSettleDelay(FILE_WATCH_SETTLE_MS);
+        if (followDroppedLines == 0) {
+            journal.start(filename, diskSize, fileModificationTime(filename));
+        }
+        statusMessage = "Stopped following '" + filename + "'";
+        statusMessageTime = GetTickCount64();
     }
-    statusMessage = "";
-    statusMessageTime = 0;
-    dirty = true;
 }
 
-void Editor::deleteForwardChar() {
-    if (cursorY == lines.size()) return;
-    if (cursorX == lines[cursorY].length() && cursorY == lines.size() - 1) {
+// Picks up what was appended to the file in follow mode. Only the bytes past the end of
+// the buffer are mapped and indexed; a file that shrank was truncated or rotated and is
+// reloaded instead, as are files in encodings other than UTF-8.
+void Editor::followFile() {
+    if (dirty) {
+        show_message("Follow mode paused: '" + filename + "' has unsaved edits", 3000);
         return;
     }
+    FileStamp stamp = FileStamp::of(filename);
+    if (!stamp.exists || stamp.size == diskSize) return;
 
-    if (cursorX < lines[cursorY].length()) {
-        lines[cursorY].erase(cursorX, 1);
+    if (stamp.size < diskSize || currentEncoding.encoding != ENC_UTF8) {
+        // finishReload() trims and pins the reloaded lines.
+        reloadFile();
+        return;
     }
-    else {
-        lines[cursorY] += lines[cursorY + 1];
-        lines.erase(lines.begin() + cursorY + 1);
-        calculateLineNumberWidth();
-        dirty = true; 
-        scroll();
+
+    std::string error;
+    size_t bomLength = bomBytes(currentEncoding).size();
+    bool hadLineEnding = lines.crlfLineCount() + lines.lfLineCount() > 0;
+    if (!lines.appendFromFile(filename, bomLength, error)) {
+        show_error("Follow mode: could not read '" + filename + "': " + error, 5000);
+        return;
     }
-    statusMessage = "";
-    statusMessageTime = 0;
-    dirty = true;
+    diskSize = lines.baseSize() + bomLength;
+    if (!hadLineEnding) {
+        detectLineEnding();
+    }
+    trimFollowedLines();
 }
 
-
-bool Editor::openFile(const std::string& path) {
-    std::ifstream file(path, std::ios::binary);
-    if (!file.is_open()) {
-        statusMessage = "Error: Could not open file '" + path + "'";
-        statusMessageTime = GetTickCount64();
-        return false;
+// Keeps a followed buffer to its last followMaxLines lines and, if pinned, the cursor on
+// the last one, after lines were appended or the file was reloaded.
+void Editor::trimFollowedLines() {
+    if (followMaxLines > 0 && lines.size() > followMaxLines) {
+        // Goes through applyEdit() like any edit so the search count and current match follow,
+        // but dropping lines does not make the buffer dirty: followDroppedLines tells it apart
+        // from the file instead, and the journal is off while following.
+        size_t drop = lines.size() - followMaxLines;
+        applyEdit({ EDIT_DELETE_LINES, 0, (int)drop, std::string() });
+        dirty = false;
+        followDroppedLines += drop;
+        shiftLineAnnotations(0, (int)drop, 0);
+        cursorY = std::max(0, cursorY - (int)drop);
+        rowOffset = std::max(0, rowOffset - (int)drop);
+    }
+    if (followPinBottom) {
+        cursorY = (int)lines.size() - 1;
+        cursorX = 0;
     }
 
-    lines.clear();
-    std::string line;
-    bool crlf_detected_in_file = false;
-    bool lf_detected_in_file = false;
-    std::vector<std::string> temp_lines;
-
-    while (std::getline(file, line)) {
-        if (!line.empty() && line.back() == '\r') {
-            line.pop_back();
-            crlf_detected_in_file = true;
-        } else {
-            lf_detected_in_file = true;
+    calculateLineNumberWidth();
+    scroll();
+}
+
+// Moves styling and decorations to the rows newRow gives for their old ones; where two
+// end up on the same row, the first one stays.
+void Editor::remapLineAnnotations(const std::function<int(int)>& newRow) {
+    auto remapMap = [&newRow](auto& byLine) {
+        std::decay_t<decltype(byLine)> moved;
+        for (auto& entry : byLine) {
+            moved.emplace(newRow(entry.first), std::move(entry.second));
         }
-        temp_lines.push_back(line);
+        byLine.swap(moved);
+    };
+    remapMap(lineStyling);
+    remapMap(lineDecorations);
+}
+
+// Styling and decorations are keyed by line number: drops the ones on the removed lines
+// and moves the ones below them by the change in line count.
+void Editor::shiftLineAnnotations(int row, int removed, int added) {
+    auto shiftMap = [row, removed, added](auto& byLine) {
+        if (removed == 0 && added == 0) return;
+        auto it = byLine.lower_bound(row);
+        std::vector<std::pair<int, typename std::decay_t<decltype(byLine)>::mapped_type>> moved;
+        while (it != byLine.end()) {
+            if (it->first >= row + removed) {
+                moved.emplace_back(it->first - removed + added, std::move(it->second));
+            }
+            it = byLine.erase(it);
+        }
+        for (auto& entry : moved) {
+            byLine.emplace(entry.first, std::move(entry.second));
+        }
+    };
+    shiftMap(lineStyling);
+    shiftMap(lineDecorations);
+}
+
+void Editor::applyEdit(const EditDelta& delta) {
+    // An active search's match count follows the edit by searching only the rows it touches.
+    size_t firstRow = 0, oldRows = 0, newRows = 0;
+    bool spanKnown = deltaRowSpan(delta, firstRow, oldRows, newRows);
+    bool trackSearch = searchSession.active() && spanKnown;
+    if (trackSearch) searchSession.beginEdit(lines, firstRow, oldRows);
+    applyDelta(lines, delta);
+    if (trackSearch) searchSession.endEdit(lines, firstRow, newRows);
+
+    // Rows below the edit move with it, and so does the current match; one on a removed row is gone.
+    if (hasCurrentMatch && spanKnown && currentMatch.row >= firstRow + oldRows) {
+        currentMatch.row = currentMatch.row + newRows - oldRows;
+    } else if (hasCurrentMatch && spanKnown && currentMatch.row >= firstRow + newRows) {
+        hasCurrentMatch = false;
     }
-    file.close();
-    lines = temp_lines;
+
+    journal.record(delta);
+    dirty = true;
+}
+
+void Editor::detectLineEnding() {
+    bool crlf_detected_in_file = lines.crlfLineCount() > 0;
+    bool lf_detected_in_file = lines.lfLineCount() > 0;
 
     if (crlf_detected_in_file && !lf_detected_in_file) {
         currentLineEnding = LE_CRLF;
@@ -2074,27 +3492,70 @@ bool Editor::openFile(const std::string& path) {
     } else {
         currentLineEnding = LE_CRLF;
     }
+}
 
-    if (lines.empty()) {
-        lines.push_back("");
+void Editor::pollBackgroundWork() {
+    pollStdin();
+    pollProjectSearch();
+    pollProjectReplace();
+    pollProjectIndexer();
+    pollQuickOpen();
+
+    // Edits keep the match count current (see applyEdit()), but reloads, appended input and
+    // edits made while it was still counting leave it stale; it is redone, though not for
+    // every change.
+    if (searchSession.active() && (!searchSession.countStarted() || searchSession.countVersion() != lines.version()) &&
+        GetTickCount64() - searchCountStartTime >= SEARCH_RECOUNT_INTERVAL_MS) {
+        refreshSearchCount();
+    }
+    // Edits of many rows leave blocks of the count to search again, one block per pass.
+    if (searchSession.active()) {
+        searchSession.recountDirty(lines);
     }
 
-    filename = path;
-    cursorX = 0; // Cursor at start
-    cursorY = 0; // Cursor at first line
-    rowOffset = 0; // View at top
-    colOffset = 0; // View at left edge (this is the value scroll() might change)
-    calculateLineNumberWidth();
-    statusMessage = "Opened '" + path + "'";
-    statusMessageTime = GetTickCount64();
+    if (saveInProgress && saveDone) {
+        finishSave();
+    }
 
-    scroll();
-    drawScreenContent();
+    if (reloadInProgress && reloadDone) {
+        finishReload();
+    }
+    if (reloadQueued && !reloadInProgress && !saveInProgress && !lines.isIndexing()) {
+        if (dirty) {
+            reloadQueued = false;
+            show_message("'" + filename + "' changed on disk; reload_file() discards your unsaved edits", 5000);
+        } else {
+            reloadFile();
+        }
+    }
 
-    force_full_redraw_internal();
+    // Our own saves acknowledge the watcher when they finish, so only other writers get here.
+    // A reload under way checks for changes made meanwhile itself.
+    if (!saveInProgress && !reloadInProgress && fileWatcher.poll()) {
+        if (followMode) {
+            followFile();
+        } else if (!dirty && autoReload) {
+            reloadFile();
+        } else {
+            show_message("'" + filename + "' changed on disk" + (dirty ? "; reload_file() discards your unsaved edits" : ""), 5000);
+        }
+    }
 
-    dirty = false;
-    return true;
+    // A checkpoint needs every line, and its base offsets are only meaningful while the
+    // buffer's base is the file the journal refers to.
+    if (!lines.isIndexing() && !journalBaseStale && journal.wantsCheckpoint()) {
+        journal.checkpoint(lines.snapshot().runs());
+    }
+
+    if (lines.isIndexing()) {
+        if (!lines.pollIndex()) return;
+        calculateLineNumberWidth();
+        if (!lines.isIndexing()) {
+            detectLineEnding();
+            statusMessage = "Indexed " + std::to_string(lines.size()) + " lines";
+            statusMessageTime = GetTickCount64();
+        }
+    }
 }
 
 bool Editor::saveFile() {
@@ -2102,35 +3563,153 @@ bool Editor::saveFile() {
         show_error("Cannot save: No filename specified. Use Ctrl-O to open/create a file.", 5000);
         return false;
     }
-
-    std::ofstream file(filename);
-    if (!file.is_open()) {
-        show_error("Could not save file '" + filename + "'", 5000); // CALL MEMBER FUNCTION
-        dirty = false;
+    if (saveInProgress) {
+        show_error("A save of '" + savePath + "' is still in progress", 3000);
+        return false;
+    }
+    if (reloadInProgress) {
+        show_error("Cannot save '" + filename + "' while it is being reloaded", 3000);
+        return false;
+    }
+    if (followDroppedLines > 0) {
+        show_error("Cannot save: follow mode dropped the first " + std::to_string(followDroppedLines) + " lines of '" + filename + "'", 5000);
         return false;
     }
 
-    for (const auto& line : lines) {
-        file << line;
-        if (currentLineEnding == LE_CRLF) {
-            file << "/r/n";
-        } else {
-            file << '\n';
+    // Lines still being indexed in large file mode would otherwise be cut off.
+    lines.finishIndex();
+
+    // The writer thread gets its own snapshot, so typing can continue while it runs.
+    LineSnapshot snapshot = lines.snapshot();
+    std::string_view lineEnding = (currentLineEnding == LE_CRLF) ? "\r\n" : "\n";
+
+    savePath = filename;
+    saveVersion = lines.version();
+    saveLineCount = snapshot.size();
+    saveSucceeded = false;
+    saveError.clear();
+    saveBytesWritten = 0;
+    saveBytesTotal = 0;
+    saveDone = false;
+    saveInProgress = true;
+    saveLineEnding = lineEnding;
+    saveRebasedOk = false;
+    journal.beginSave();
+
+    saveThread = std::thread([this, snapshot = std::move(snapshot), lineEnding, path = savePath, encoding = currentEncoding,
+                              mapped = lines.isMapped()]() {
+        saveBytesTotal = snapshot.serializedSize(lineEnding);
+
+        // A mapped buffer is rebased on the written file; any other keeps its own copy of
+        // what was written, before encoding, as gathered here.
+        std::string content;
+        if (!mapped) content.reserve((size_t)saveBytesTotal);
+
+        AtomicFileWriter writer;
+        std::string bom = bomBytes(encoding);
+        bool ok = writer.open(path);
+        if (ok) {
+            ok = writer.appendCopy(bom.data(), bom.size());
         }
-    }
-    file.close();
+        if (ok && encoding.encoding == ENC_UTF8) {
+            ok = snapshot.serialize(lineEnding, [this, &writer, &content, mapped](const char* data, size_t length) {
+                if (!writer.append(data, length)) return false;
+                if (!mapped) content.append(data, length);
+                saveBytesWritten += length;
+                return true;
+            });
+        } else if (ok) {
+            // Convert back in chunks; the writer copies each chunk before it is reused.
+            EncodingEncoder encoder(encoding.encoding);
+            std::string encoded;
+            encoded.reserve(TRANSCODE_CHUNK_SIZE + 64);
+            ok = snapshot.serialize(lineEnding, [this, &writer, &encoder, &encoded, &content, mapped](const char* data, size_t length) {
+                if (!mapped) content.append(data, length);
+                while (length > 0) {
+                    size_t take = std::min(length, TRANSCODE_CHUNK_SIZE);
+                    encoder.encode(data, take, encoded);
+                    if (encoded.size() >= TRANSCODE_CHUNK_SIZE) {
+                        if (!writer.appendCopy(encoded.data(), encoded.size())) return false;
+                        encoded.clear();
+                    }
+                    data += take;
+                    length -= take;
+                    saveBytesWritten += take;
+                }
+                return true;
+            });
+            encoder.finish(encoded);
+            ok = ok && writer.appendCopy(encoded.data(), encoded.size());
+        }
+        if (ok) {
+            ok = writer.commit();
+        }
+        if (!ok) {
+            writer.abort();
+        }
+        if (ok) {
+            std::string error;
+            saveRebasedOk = mapped ? saveRebased.rebaseMapped(snapshot, path, lineEnding, error, bom.size())
+                                   : saveRebased.rebase(snapshot, std::move(content), lineEnding);
+        }
+
+        saveSucceeded = ok;
+        if (!ok) saveError = writer.lastError();
+        saveDone = true;
+    });
 
-    statusMessage = "Saved '" + filename + "' (" + std::to_string(lines.size()) + " lines)";
+    statusMessage = "Saving '" + savePath + "'...";
     statusMessageTime = GetTickCount64();
     return true;
 }
 
+void Editor::finishSave() {
+    saveThread.join();
+    saveInProgress = false;
+
+    if (saveSucceeded) {
+        // Edits made while the save was running are not in the file.
+        bool unchanged = lines.version() == saveVersion;
+        if (unchanged) {
+            dirty = false;
+        }
+
+        if (savePath == filename) {
+            // The saved file becomes the base of the buffer and of the journal. If the buffer
+            // changed meanwhile it cannot be rebased, so checkpoints wait for the next save.
+            bool rebased = unchanged && saveRebasedOk;
+            if (rebased) {
+                lines.adoptBase(saveRebased);
+            }
+            journalBaseStale = !rebased;
+
+            std::error_code ec;
+            uint64_t savedSize = std::filesystem::file_size(savePath, ec);
+            journal.endSave(true, ec ? 0 : savedSize, fileModificationTime(savePath));
+            fileWatcher.acknowledge();
+            diskSize = ec ? 0 : savedSize;
+        }
+
+        statusMessage = "Saved '" + savePath + "' (" + std::to_string(saveLineCount) + " lines)";
+        statusMessageTime = GetTickCount64();
+        triggerEvent("on_file_saved", savePath);
+    } else {
+        if (savePath == filename) {
+            journal.endSave(false, 0, 0);
+        }
+        show_error("Could not save file '" + savePath + "': " + saveError, 5000);
+        triggerEvent("on_file_save_failed", saveError);
+    }
+    // Holds the old base now, or a copy nobody took.
+    saveRebased.clear();
+}
+
 int Editor::cxToRx(int lineIndex, int cx)
 {
     if (lineIndex < 0 || lineIndex >= lines.size()) return 0;
 
     int rx = 0;
-    const std::string& line = lines[lineIndex];
+    std::string_view line = lines.view(lineIndex);
     cx = std::min(cx, (int)line.length());
     for (int i = 0; i < cx; ++i) {
         if (line[i] == '\t') {
@@ -2149,7 +3728,7 @@ int Editor::rxToCx(int lineIndex, int rx)
 
     int currentRx = 0;
     int cx = 0;
-    const std::string& line = lines[lineIndex];
+    std::string_view line = lines.view(lineIndex);
     for (int i = 0; i < line.length(); ++i) {
         if (line[i] == '\t') {
             currentRx += (KILO_TAB_STOP - (currentRx % KILO_TAB_STOP));
@@ -2169,7 +3748,7 @@ std::string Editor::getRenderedLine(int fileRow)
         return "";
     }
     std::string renderedLine;
-    const std::string& originalLine = lines[fileRow];
+    std::string_view originalLine = lines.view(fileRow);
     for (char c : originalLine) {
         if (c == '\t') {
             int spacesToAdd = KILO_TAB_STOP - (renderedLine.length() % KILO_TAB_STOP);
@@ -2185,13 +3764,12 @@ std::string Editor::getRenderedLine(int fileRow)
 void Editor::toggleFileExplorer() {
     if (mode == EDIT_MODE) {
         mode = FILE_EXPLORER_MODE;
-        statusMessage = "File Explorer Mode: Navigate with arrows, Enter to open/CD, N for New, D for Delete.";
+        statusMessage = "File Explorer Mode: Navigate with arrows, Enter to open/CD, N for New, D for Delete, Ctrl-Shift-F to search in folder.";
         statusMessageTime = GetTickCount64();
         populateDirectoryEntries(currentDirPath);
         selectedFileIndex = 0;
         fileExplorerScrollOffset = 0;
         // No clearScreen here, refreshScreen handles it on mode change.
-        force_full_redraw_internal();
     }
     else { // FILE_EXPLORER_MODE
         mode = EDIT_MODE;
@@ -2199,7 +3777,6 @@ void Editor::toggleFileExplorer() {
         statusMessageTime = GetTickCount64();
         directoryEntries.clear();
         // No clearScreen here, refreshScreen handles it on mode change.
-        force_full_redraw_internal();
     }
 }
 
@@ -2239,16 +3816,11 @@ void Editor::populateDirectoryEntries(const std::string& path) {
     currentDirPath = path;
     statusMessage = "Viewing: " + currentDirPath;
     statusMessageTime = GetTickCount64();
-
-    force_full_redraw_internal(); // The content of the explorer has changed
 }
 
 void Editor::moveFileExplorerSelection(int key) {
     if (directoryEntries.empty()) return;
 
-    int oldSelectedFileIndex = selectedFileIndex;
-    int oldFileExplorerScrollOffset = fileExplorerScrollOffset;
-
     // IMPORTANT: Replace custom ARROW_UP, PAGE_UP, HOME_KEY etc.
     // with their Windows Virtual Key Code equivalents (VK_UP, VK_PRIOR, VK_HOME).
     // These are consistent with what's being passed from processInput.
@@ -2278,11 +3850,6 @@ void Editor::moveFileExplorerSelection(int key) {
     if (selectedFileIndex >= fileExplorerScrollOffset + (screenRows - 4)) {
         fileExplorerScrollOffset = selectedFileIndex - (screenRows - 4) + 1;
     }
-
-    if (oldSelectedFileIndex != selectedFileIndex || oldFileExplorerScrollOffset != fileExplorerScrollOffset) {
-        prevStatusMessage = "";
-        prevMessageBarMessage = "";
-    }
 }
 
 void Editor::handleFileExplorerEnter() {
@@ -2300,21 +3867,91 @@ void Editor::handleFileExplorerEnter() {
     std::string newPath = newPathBuffer;
 
     if (selectedEntry.isDirectory) {
-        populateDirectoryEntries(newPath); // This function now calls force_full_redraw_internal()
+        populateDirectoryEntries(newPath);
         selectedFileIndex = 0;
         fileExplorerScrollOffset = 0;
         // No clearScreen() here, populateDirectoryEntries and refreshScreen handles it.
     }
     else {
-        openFile(newPath); // This calls force_full_redraw_internal()
-        toggleFileExplorer(); // This calls force_full_redraw_internal()
+        openFile(newPath);
+        toggleFileExplorer();
     }
 }
 
-void Editor::drawFileExplorer() {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) return;
+// Opens the quick open list over the files under currentDirPath. They are crawled again
+// each time, in the background; until the crawl is done the list found last time is used.
+void Editor::startQuickOpen() {
+    if (!fileFinder.crawling() || fileFinder.root() != currentDirPath) {
+        fileFinder.start(currentDirPath);
+    }
+    directoryEntries.clear();
+    mode = QUICK_OPEN_MODE;
+    quickOpenQuery.clear();
+    updateQuickOpen();
+    statusMessage = "Type part of a file name. Arrows to choose, Enter to open, ESC to cancel.";
+    statusMessageTime = GetTickCount64();
+}
+
+void Editor::closeQuickOpen() {
+    mode = EDIT_MODE;
+    quickOpenQuery.clear();
+    quickOpenResults.clear();
+}
+
+// Ranks the files found so far against the query, keeping the selected file selected if
+// it is still among the results.
+void Editor::updateQuickOpen() {
+    std::string selected;
+    if (quickOpenSelected >= 0 && quickOpenSelected < (int)quickOpenResults.size()) {
+        selected = quickOpenResults[quickOpenSelected].path;
+    }
+    quickOpenResults = fileFinder.find(workers, quickOpenQuery, QUICK_OPEN_RESULTS);
+    quickOpenRankedFiles = fileFinder.fileCount();
+    quickOpenRankTime = GetTickCount64();
+
+    quickOpenSelected = 0;
+    quickOpenScrollOffset = 0;
+    for (size_t i = 0; i < quickOpenResults.size() && !selected.empty(); ++i) {
+        if (quickOpenResults[i].path == selected) {
+            quickOpenSelected = (int)i;
+            break;
+        }
+    }
+}
+
+void Editor::moveQuickOpenSelection(int key) {
+    if (quickOpenResults.empty()) return;
+    int last = (int)quickOpenResults.size() - 1;
+    int page = std::max(1, screenRows - 4);
+    if (key == VK_UP) quickOpenSelected = std::max(0, quickOpenSelected - 1);
+    else if (key == VK_DOWN) quickOpenSelected = std::min(last, quickOpenSelected + 1);
+    else if (key == VK_PRIOR) quickOpenSelected = std::max(0, quickOpenSelected - page);
+    else if (key == VK_NEXT) quickOpenSelected = std::min(last, quickOpenSelected + page);
+    else if (key == VK_HOME) quickOpenSelected = 0;
+    else if (key == VK_END) quickOpenSelected = last;
+
+    if (quickOpenSelected < quickOpenScrollOffset) quickOpenScrollOffset = quickOpenSelected;
+    if (quickOpenSelected >= quickOpenScrollOffset + page) quickOpenScrollOffset = quickOpenSelected - page + 1;
+}
+
+bool Editor::openQuickOpenSelection() {
+    if (quickOpenSelected < 0 || quickOpenSelected >= (int)quickOpenResults.size()) {
+        show_message("No file matches '" + quickOpenQuery + "'", 2000);
+        return false;
+    }
+    std::string fullPath = (std::filesystem::path(fileFinder.root()) / quickOpenResults[quickOpenSelected].path).string();
+    closeQuickOpen();
+    return openFile(fullPath);
+}
+
+// Ranks again as the crawl finds more files, though not on every frame.
+void Editor::pollQuickOpen() {
+    if (mode != QUICK_OPEN_MODE) return;
+    if (fileFinder.fileCount() == quickOpenRankedFiles || GetTickCount64() - quickOpenRankTime < QUICK_OPEN_RERANK_MS) return;
+    updateQuickOpen();
+}
 
+void Editor::drawFileExplorer() {
     int startRowForHeader = 0;
     int startRowForContent = startRowForHeader + 2;
     int visibleRowsForContent = screenRows - startRowForContent - 2;
@@ -2326,19 +3963,8 @@ void Editor::drawFileExplorer() {
         pathLine = pathLine.substr(0, screenCols);
     }
 
-    std::vector<WORD> pathAttrs(screenCols);
-    for(int k=0; k<screenCols; ++k) pathAttrs[k] = CYAN | INTENSITY | defaultBgColor;
-
-    COORD pathWritePos = {0, (SHORT)startRowForHeader};
-    DWORD charsWritten;
-    WriteConsoleOutputCharacterA(hConsole, pathLine.c_str(), screenCols, pathWritePos, &charsWritten);
-    WriteConsoleOutputAttribute(hConsole, pathAttrs.data(), screenCols, pathWritePos, &charsWritten);
-
-    std::string blankLine(screenCols, ' ');
-    std::vector<WORD> blankAttrs(screenCols, defaultFgColor | defaultBgColor);
-    COORD blankLinePos = {0, (SHORT)(startRowForHeader + 1)};
-    WriteConsoleOutputCharacterA(hConsole, blankLine.c_str(), screenCols, blankLinePos, &charsWritten);
-    WriteConsoleOutputAttribute(hConsole, blankAttrs.data(), screenCols, blankLinePos, &charsWritten);
+    frame.write(startRowForHeader, 0, pathLine, (WORD)(CYAN | INTENSITY | defaultBgColor));
+    frame.clearRow(startRowForHeader + 1, 0, defaultFgColor | defaultBgColor);
 
     for (int i = 0; i < visibleRowsForContent; ++i) {
         int entryIndex = fileExplorerScrollOffset + i;
@@ -2396,18 +4022,61 @@ void Editor::drawFileExplorer() {
                 lineAttributes[k] = defaultFgColor | defaultBgColor;
             }
         }
-        
-        COORD writePos = {0, (SHORT)currentScreenRow};
-        WriteConsoleOutputCharacterA(hConsole, lineContentToDraw.c_str(), screenCols, writePos, &charsWritten);
-        WriteConsoleOutputAttribute(hConsole, lineAttributes.data(), screenCols, writePos, &charsWritten);
+
+        frame.write(currentScreenRow, 0, lineContentToDraw, lineAttributes.data());
     }
 
     for (int i = startRowForContent + visibleRowsForContent; i < screenRows - 2; ++i) {
-        std::string emptyLine(screenCols, ' ');
-        std::vector<WORD> emptyAttrs(screenCols, defaultFgColor | defaultBgColor);
-        COORD writePos = {0, (SHORT)i};
-        WriteConsoleOutputCharacterA(hConsole, emptyLine.c_str(), screenCols, writePos, &charsWritten);
-        WriteConsoleOutputAttribute(hConsole, emptyAttrs.data(), screenCols, writePos, &charsWritten);
+        frame.clearRow(i, 0, defaultFgColor | defaultBgColor);
+    }
+}
+
+// The query on top, then the ranked files with the matched characters picked out.
+void Editor::drawQuickOpen() {
+    auto writeRow = [&](int row, std::string text, const std::vector<WORD>& attrs) {
+        text.resize(screenCols, ' ');
+        frame.write(row, 0, text, attrs.data());
+    };
+
+    std::vector<WORD> queryAttrs(screenCols, CYAN | INTENSITY | defaultBgColor);
+    writeRow(0, "OPEN: " + quickOpenQuery, queryAttrs);
+
+    std::string info = std::to_string(quickOpenResults.size()) + " shown of " + std::to_string(fileFinder.fileCount()) +
+        " files under " + fileFinder.root();
+    if (fileFinder.crawling()) info += " (still looking...)";
+    std::vector<WORD> infoAttrs(screenCols, defaultFgColor | defaultBgColor);
+    writeRow(1, info, infoAttrs);
+
+    FuzzyQuery query(quickOpenQuery);
+    std::vector<uint32_t> positions;
+    int visibleRows = std::max(0, screenRows - 4);
+    for (int i = 0; i < visibleRows; ++i) {
+        int index = quickOpenScrollOffset + i;
+        std::string text;
+        std::vector<WORD> attrs(screenCols, defaultFgColor | defaultBgColor);
+        if (index < (int)quickOpenResults.size()) {
+            bool selected = index == quickOpenSelected;
+            WORD fg = selected ? (WHITE | INTENSITY) : WHITE;
+            WORD bg = selected ? (WORD)BG_BLUE : defaultBgColor;
+            std::string path = quickOpenResults[index].path;
+            query.score(path, &positions);
+
+            // A path too long for the row loses its start, which matters least.
+            size_t room = screenCols > 2 ? (size_t)screenCols - 2 : 0;
+            size_t cut = 0;
+            if (path.size() > room) {
+                cut = path.size() - room + 3;
+                path = "..." + path.substr(std::min(cut, path.size()));
+            }
+            text = (selected ? "> " : "  ") + path;
+            for (int k = 0; k < std::min((int)text.size(), screenCols); ++k) attrs[k] = fg | bg;
+            for (uint32_t position : positions) {
+                if (position < cut) continue;
+                size_t column = 2 + (cut > 0 ? 3 + position - cut : position);
+                if (column < (size_t)screenCols) attrs[column] = YELLOW | INTENSITY | bg;
+            }
+        }
+        writeRow(2 + i, text, attrs);
     }
 }
 
@@ -2425,7 +4094,6 @@ void Editor::toggleTerminal() {
         statusMessageTime = GetTickCount64();
     }
     // No clearScreen here. refreshScreen's mode check will handle it.
-    force_full_redraw_internal();
 }
 
 void Editor::startTerminal() {
@@ -2510,8 +4178,6 @@ void Editor::startTerminal() {
     asiEscapeBuffe.clear();
 
     resizeTerminal(screenCols, screenRows - 2);
-    
-    force_full_redraw_internal(); // Invalidate cache and trigger redraw for terminal content
 }
 
 void Editor::stopTerminal() {
@@ -2663,11 +4329,6 @@ void Editor::processTerminalOutput(const std::string& data) {
             }
         }
     }
-
-    for (auto& s : prevDrawnLines)
-      s.assign(screenCols, ' ');
-    prevStatusMessage = "";
-    prevMessageBarMessage = "";
 }
 
 void Editor::resizeTerminal(int width, int height) {
@@ -2686,19 +4347,9 @@ void Editor::resizeTerminal(int width, int height) {
     ansiSGRParams.clear();
     asiEscapeBuffe.clear();
     clearTerminalBuffer();
-    
-    for (auto& s : prevDrawnLines)
-        s.assign(screenCols, ' ');
-    prevStatusMessage = "";
-    prevMessageBarMessage = "";
 }
 
 void Editor::drawTerminalScreen() {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) {
-        return;
-    }
-
     for (int y = 0; y < terminalHeight; ++y) {
         std::string lineContent;
         lineContent.reserve(terminalWidth);
@@ -2712,16 +4363,7 @@ void Editor::drawTerminalScreen() {
             lineAttributes[x] = attributes;
         }
 
-        COORD writePos = { 0, (SHORT)y };
-
-        DWORD charsWritten;
-        if (!WriteConsoleOutputCharacterA(hConsole, lineContent.c_str(), terminalWidth, writePos, &charsWritten)) {
-            std::cerr << "Terminal: WriteConsoleOutputCharacterA failed: " << GetLastError() << std::endl;
-        }
-
-        if (!WriteConsoleOutputAttribute(hConsole, lineAttributes.data(), terminalWidth, writePos, &charsWritten)) {
-            std::cerr << "Terminal: WriteConsoleOutputAttribute failed: " << GetLastError() << std::endl;
-        }
+        frame.write(y, 0, lineContent, lineAttributes.data());
     }
 }
 
@@ -2860,25 +4502,29 @@ void Editor::applyAnsiEL(int param) {
 }
 
 void Editor::refreshScreen() {
-    setCursorVisibility(false);
-
     // Check if mode has changed since last render or initial draw
     if (mode != lastRenderedMode) {
-        clearScreen(); // ONLY clear the screen if mode has just changed
-        // No explicit force_full_redraw_internal here, as it's implied by clearing
-        // and the fact that the draw function will write everything anew.
-        // However, force_full_redraw_internal is safe here if desired, as it only invalidates.
-        force_full_redraw_internal(); // Invalidate cache for new mode's content
+        // The edit view and its prompt draw the same rows. Any other switch starts the new
+        // mode on a blank frame, which the diff against the screen turns into the few cells
+        // that differ rather than a clear and a full repaint.
+        bool editView = mode == EDIT_MODE || mode == PROMPT_MODE;
+        bool wasEditView = lastRenderedMode == EDIT_MODE || lastRenderedMode == PROMPT_MODE;
+        if (!editView || !wasEditView) {
+            frame.blank(defaultFgColor | defaultBgColor);
+            damageAllRows();
+        }
         lastRenderedMode = mode; // Update last rendered mode
     }
 
-    updateScreenSize(); // Ensure dimensions are up-to-date and prevDrawnLines resized
+    updateScreenSize(); // Ensure dimensions are up-to-date and the frame buffer resized
 
     if (mode == EDIT_MODE || mode == PROMPT_MODE) {
         scroll();
         drawScreenContent();
     } else if (mode == FILE_EXPLORER_MODE) {
         drawFileExplorer();
+    } else if (mode == QUICK_OPEN_MODE) {
+        drawQuickOpen();
     } else if (mode == TERMINAL_MODE) {
         readTerminalOutput();
         drawTerminalScreen();
@@ -2906,6 +4552,9 @@ void Editor::refreshScreen() {
         finalCursorY = terminalCursorY;
         finalCursorX = std::max(0, std::min(finalCursorX, screenCols - 1));
         finalCursorY = std::max(0, std::min(finalCursorY, screenRows - 3));
+    } else if (mode == QUICK_OPEN_MODE) {
+        finalCursorX = std::min((int)(6 + quickOpenQuery.length()), screenCols - 1);
+        finalCursorY = 0;
     }
     else {
         int explorer_content_start_row = 2;
@@ -2916,57 +4565,18 @@ void Editor::refreshScreen() {
         finalCursorX = std::min(finalCursorX, screenCols - 1);
     }
 
-    setCursorPosition(finalCursorX, finalCursorY);
-    setCursorVisibility(true);
+    frame.setCursor(finalCursorX, finalCursorY, true);
+    frame.present(screen);
 }
 
 void Editor::clearScreen() {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) {
-        std::cerr << "Error: Invalid console handle in clearScreen." << std::endl;
-        return;
-    }
-
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) {
-        std::cerr << "Error: GetConsoleScreenBufferInfo failed in clearScreen. GLE: " << GetLastError() << std::endl;
-        return;
-    }
-
-    DWORD cellsCount = csbi.dwSize.X * csbi.dwSize.Y;
-    COORD homeCoords = { 0, 0 };
-    DWORD charsWritten;
-
-    if (!FillConsoleOutputCharacterA(hConsole,
-                                     (TCHAR)' ',
-                                     cellsCount,
-                                     homeCoords,
-                                     &charsWritten))
-    {
-        std::cerr << "Error: FillConsoleOutputCharacterA failed in clearScreen. GLE: " << GetLastError() << std::endl;
-        return;
-    }
-
-    if (!FillConsoleOutputAttribute(hConsole,
-                                    defaultFgColor | defaultBgColor,
-                                    cellsCount,
-                                    homeCoords,
-                                    &charsWritten))
-    {
-        std::cerr << "Error: FillConsoleOutputAttribute failed in clearScreen. GLE: " << GetLastError() << std::endl;
-        return;
-    }
-
-    SetConsoleCursorPosition(hConsole, homeCoords);
+    screen.clear(defaultFgColor | defaultBgColor);
+    frame.cleared(defaultFgColor | defaultBgColor);
 }
 
 void Editor::force_full_redraw_internal() {
-    for (auto& s : prevDrawnLines) {
-        s.assign(screenCols, ' ');
-    }
-
-    prevStatusMessage = "";
-    prevMessageBarMessage = "";
+    damageAllRows();
+    frame.invalidate();
 }
 
 bool Editor::setConsoleFont(const ConsoleFontInfo& fontInfo) {
@@ -2995,7 +4605,6 @@ bool Editor::setConsoleFont(const ConsoleFontInfo& fontInfo) {
     }
 
     updateScreenSize(); // This will recalculate screenRows/Cols based on new font size
-    force_full_redraw_internal(); // Force a full visual update with new dimensions
 
     currentFont = fontInfo;
     statusMessage = "Font set to " + fontInfo.name + " [" + std::to_string(fontInfo.fontSizeX) + "x" + std::to_string(fontInfo.fontSizeY) + "]";
@@ -3090,6 +4699,19 @@ void Editor::executeCommand(const std::string& commandName) {
 }
 
 bool Editor::loadKeybindings(const std::string& filePath) {
+    // The keymap resolved last time is reused while the file is unchanged, skipping the JSON parse.
+    FileStamp stamp = FileStamp::of(filePath);
+    if (stamp.exists && session.hasKeymap && session.keymapSource == filePath &&
+        session.keymapSourceSize == stamp.size && session.keymapSourceMtime == stamp.mtime) {
+        customKeybindings.clear();
+        for (const SessionKeyBinding& binding : session.keymap) {
+            customKeybindings[{ binding.keyCode, binding.ctrl, binding.alt, binding.shift }] = binding.command;
+        }
+        statusMessage = "Loaded keybindings from " + filePath + ".";
+        statusMessageTime = GetTickCount64() + 2000;
+        return true;
+    }
+
     std::ifstream file(filePath);
     if (!file.is_open()) {
         statusMessage = "keybindings.json not found. Using default keybindings.";
@@ -3181,6 +4803,15 @@ bool Editor::loadKeybindings(const std::string& filePath) {
             return false;
         }
 
+        session.hasKeymap = stamp.exists;
+        session.keymapSource = filePath;
+        session.keymapSourceSize = stamp.size;
+        session.keymapSourceMtime = stamp.mtime;
+        session.keymap.clear();
+        for (const auto& [combination, command] : customKeybindings) {
+            session.keymap.push_back({ combination.keyCode, combination.ctrl, combination.alt, combination.shift, command });
+        }
+
         statusMessage = "Loaded keybindings from " + filePath + ".";
         statusMessageTime = GetTickCount64() + 2000;
         return true;
@@ -3195,6 +4826,104 @@ bool Editor::loadKeybindings(const std::string& filePath) {
     }
 }
 
+void Editor::loadSession() {
+    std::string error;
+    if (!pluginData.open(PLUGIN_DATA_FILE_NAME, error)) {
+        // Plugins still get an in-memory store; it just is not kept.
+        std::cerr << "Warning: Plugin data will not be saved: " << error << std::endl;
+    }
+    if (!std::filesystem::exists(SESSION_FILE_NAME)) return;
+    if (!session.load(SESSION_FILE_NAME, error)) {
+        std::cerr << "Warning: Ignoring " << SESSION_FILE_NAME << ": " << error << std::endl;
+        return;
+    }
+}
+
+void Editor::saveSession() {
+    SessionSnapshot next;
+    if (!filename.empty()) {
+        next.buffers.push_back({ filename, cursorX, cursorY, rowOffset, colOffset });
+    } else {
+        next.buffers = session.buffers;
+    }
+    next.hasKeymap = session.hasKeymap;
+    next.keymapSource = session.keymapSource;
+    next.keymapSourceSize = session.keymapSourceSize;
+    next.keymapSourceMtime = session.keymapSourceMtime;
+    next.keymap = session.keymap;
+
+    // Only an index that describes the file on disk exactly is worth keeping.
+    std::string currentKey = filename.empty() ? std::string() : sessionPathKey(filename);
+    if (!filename.empty() && lines.isMapped() && !dirty && !journalBaseStale && followDroppedLines == 0) {
+        FileStamp stamp = FileStamp::of(filename);
+        uint64_t bomLength = bomBytes(currentEncoding).size();
+        auto index = std::make_shared<SessionLineIndex>();
+        if (stamp.exists && stamp.size == lines.baseSize() + bomLength && lines.indexSlots(index->ownedSlots)) {
+            index->path = currentKey;
+            index->fileSize = stamp.size;
+            index->mtime = stamp.mtime;
+            index->skipBytes = bomLength;
+            index->crlfLines = lines.crlfLineCount();
+            index->lfLines = lines.lfLineCount();
+            index->slots = index->ownedSlots.data();
+            index->count = index->ownedSlots.size();
+            next.lineIndexes.push_back(std::move(index));
+        }
+    }
+    for (const auto& previous : session.lineIndexes) {
+        if (next.lineIndexes.size() >= SESSION_MAX_LINE_INDEXES) break;
+        if (previous->path == currentKey) continue;
+        FileStamp stamp = FileStamp::of(previous->path);
+        const SessionLineIndex* valid = session.findLineIndex(previous->path, stamp.size, stamp.mtime);
+        if (!stamp.exists || !valid) continue;
+        auto carried = std::make_shared<SessionLineIndex>(*valid);
+        carried->ownedSlots.assign(valid->slots, valid->slots + valid->count);
+        carried->slots = carried->ownedSlots.data();
+        carried->section = nullptr;
+        next.lineIndexes.push_back(std::move(carried));
+    }
+
+    // Let go of the old session's mapping before the file is replaced.
+    session = SessionSnapshot();
+    std::string error;
+    if (!next.write(SESSION_FILE_NAME, error)) {
+        std::cerr << "Warning: Could not write " << SESSION_FILE_NAME << ": " << error << std::endl;
+    }
+    session = std::move(next);
+
+    if (!pluginData.flush()) {
+        std::cerr << "Warning: Could not write " << PLUGIN_DATA_FILE_NAME << ": " << pluginData.lastError() << std::endl;
+    }
+}
+
+// Opens the file given on the command line, or the one left open last time when there is
+// none, and puts the cursor and view back where the previous session left them.
+bool Editor::openSessionBuffer(const std::string& requestedPath) {
+    const SessionBuffer* saved = nullptr;
+    for (const SessionBuffer& buffer : session.buffers) {
+        if (requestedPath.empty() || sessionPathKey(buffer.path) == sessionPathKey(requestedPath)) {
+            saved = &buffer;
+            break;
+        }
+    }
+    if (requestedPath.empty() && (!saved || !std::filesystem::exists(saved->path))) return false;
+    SessionBuffer view = saved ? *saved : SessionBuffer();
+    if (!openFile(requestedPath.empty() ? view.path : requestedPath)) return false;
+    if (!saved) return true;
+
+    // Without a cached index the saved position may lie beyond what is indexed so far.
+    if (view.cursorY >= (int)lines.size() || view.rowOffset >= (int)lines.size()) {
+        lines.finishIndex();
+        calculateLineNumberWidth();
+    }
+    cursorY = std::clamp(view.cursorY, 0, (int)lines.size() - 1);
+    cursorX = std::clamp(view.cursorX, 0, (int)lines.length(cursorY));
+    rowOffset = std::clamp(view.rowOffset, 0, (int)lines.size() - 1);
+    colOffset = std::max(0, view.colOffset);
+    scroll();
+    return true;
+}
+
 void Editor::setupDefaultKeybindings() {
     registerEditorCommand("quit", [this]() {
         if (mode == EDIT_MODE && isDirty()) {
@@ -3208,14 +4937,44 @@ void Editor::setupDefaultKeybindings() {
         }
         });
     registerEditorCommand("save_file", [this]() { saveFile(); });
-    registerEditorCommand("open_file_prompt", [this]() {
-        show_message("Open file prompt initiated.", 1500);
+    registerEditorCommand("quick_open", [this]() {
+        if (mode == EDIT_MODE || mode == FILE_EXPLORER_MODE) startQuickOpen();
         });
+    registerEditorCommand("open_file_prompt", [this]() { executeCommand("quick_open"); });
     registerEditorCommand("toggle_explorer", [this]() { toggleFileExplorer(); });
     registerEditorCommand("find", [this]() { startSearch(); });
+    registerEditorCommand("search_in_folder", [this]() {
+        if (mode == EDIT_MODE || mode == FILE_EXPLORER_MODE) startProjectSearchPrompt();
+        });
+    registerEditorCommand("index_folder", [this]() { indexFolder(currentDirPath); });
+    registerEditorCommand("replace", [this]() {
+        if (mode == EDIT_MODE) startReplacePrompt();
+        });
+    registerEditorCommand("undo_replace", [this]() {
+        if (mode == EDIT_MODE) undoReplace();
+        });
+    registerEditorCommand("replace_in_folder", [this]() {
+        if (mode == EDIT_MODE || mode == FILE_EXPLORER_MODE) startFolderReplacePrompt();
+        });
+    registerEditorCommand("apply_folder_replace", [this]() {
+        if (mode == EDIT_MODE) applyFolderReplace();
+        });
     registerEditorCommand("find_next", [this]() { findNext(); });
     registerEditorCommand("find_previous", [this]() { findPrevious(); });
+    registerEditorCommand("toggle_search_case", [this]() {
+        searchOptions.caseSensitive = !searchOptions.caseSensitive;
+        show_message(searchOptions.caseSensitive ? "Search is case sensitive." : "Search ignores case.", 2000);
+    });
+    registerEditorCommand("toggle_search_whole_word", [this]() {
+        searchOptions.wholeWord = !searchOptions.wholeWord;
+        show_message(searchOptions.wholeWord ? "Search matches whole words only." : "Search matches anywhere.", 2000);
+    });
+    registerEditorCommand("toggle_search_regex", [this]() {
+        searchOptions.regex = !searchOptions.regex;
+        show_message(searchOptions.regex ? "Search uses regular expressions." : "Search uses plain text.", 2000);
+    });
     registerEditorCommand("toggle_terminal", [this]() { toggleTerminal(); });
+    registerEditorCommand("toggle_follow_mode", [this]() { setFollowMode(!followMode); });
 
     // UNIFIED CURSOR COMMANDS: These commands now handle behavior based on the current mode.
     // They are correctly defined.
@@ -3224,41 +4983,65 @@ void Editor::setupDefaultKeybindings() {
     registerEditorCommand("cursor_up", [this]() {
         if (mode == EDIT_MODE) moveCursor(VK_UP);
         else if (mode == FILE_EXPLORER_MODE) moveFileExplorerSelection(VK_UP); // Correctly using VK_UP here
+        else if (mode == QUICK_OPEN_MODE) moveQuickOpenSelection(VK_UP);
         });
     registerEditorCommand("cursor_down", [this]() {
         if (mode == EDIT_MODE) moveCursor(VK_DOWN);
         else if (mode == FILE_EXPLORER_MODE) moveFileExplorerSelection(VK_DOWN); // Correctly using VK_DOWN here
+        else if (mode == QUICK_OPEN_MODE) moveQuickOpenSelection(VK_DOWN);
         });
     registerEditorCommand("cursor_home", [this]() {
         if (mode == EDIT_MODE) moveCursor(VK_HOME);
         else if (mode == FILE_EXPLORER_MODE) moveFileExplorerSelection(VK_HOME); // Correctly using VK_HOME here
+        else if (mode == QUICK_OPEN_MODE) moveQuickOpenSelection(VK_HOME);
         });
     registerEditorCommand("cursor_end", [this]() {
         if (mode == EDIT_MODE) moveCursor(VK_END);
         else if (mode == FILE_EXPLORER_MODE) moveFileExplorerSelection(VK_END); // Correctly using VK_END here
+        else if (mode == QUICK_OPEN_MODE) moveQuickOpenSelection(VK_END);
         });
     registerEditorCommand("page_up", [this]() {
         if (mode == EDIT_MODE) moveCursor(VK_PRIOR);
         else if (mode == FILE_EXPLORER_MODE) moveFileExplorerSelection(VK_PRIOR); // Correctly using VK_PRIOR here
+        else if (mode == QUICK_OPEN_MODE) moveQuickOpenSelection(VK_PRIOR);
         });
     registerEditorCommand("page_down", [this]() {
         if (mode == EDIT_MODE) moveCursor(VK_NEXT);
         else if (mode == FILE_EXPLORER_MODE) moveFileExplorerSelection(VK_NEXT); // Correctly using VK_NEXT here
+        else if (mode == QUICK_OPEN_MODE) moveQuickOpenSelection(VK_NEXT);
         });
 
     // Unified Backspace, Delete, Enter, Tab, Escape commands
     registerEditorCommand("delete_char_backward", [this]() { deleteChar(); });
     registerEditorCommand("delete_char_forward", [this]() { deleteForwardChar(); });
     registerEditorCommand("insert_newline_or_action", [this]() {
-        if (mode == EDIT_MODE) insertNewline();
+        if (mode == EDIT_MODE && showingProjectSearch) openProjectSearchResult();
+        else if (mode == EDIT_MODE) insertNewline();
         else if (mode == FILE_EXPLORER_MODE) handleFileExplorerEnter();
-        else if (mode == PROMPT_MODE) promptUser(promptMessage, VK_RETURN, searchQuery);
+        else if (mode == QUICK_OPEN_MODE) openQuickOpenSelection();
+        else if (mode == PROMPT_MODE && promptUser(promptMessage, VK_RETURN, searchQuery)) {
+            if (promptMessage.rfind("Search:", 0) == 0) performSearch();
+            else if (promptMessage.rfind("Search in folder:", 0) == 0) startProjectSearch(searchQuery, currentDirPath);
+            else if (promptMessage.rfind("Replace", 0) == 0) continueReplacePrompt();
+        }
         });
     registerEditorCommand("insert_tab", [this]() { insertChar('\t'); });
     registerEditorCommand("escape_or_cancel", [this]() {
-        if (mode == EDIT_MODE) { statusMessage = ""; statusMessageTime = 0; }
+        if (mode == EDIT_MODE) {
+            if (projectSearchStreaming) projectSearch.cancel();
+            if (projectReplaceStreaming) projectReplace.cancel();
+            statusMessage = "";
+            statusMessageTime = 0;
+        }
         else if (mode == FILE_EXPLORER_MODE) toggleFileExplorer();
-        else if (mode == PROMPT_MODE) promptUser(promptMessage, VK_ESCAPE, searchQuery);
+        else if (mode == QUICK_OPEN_MODE) closeQuickOpen();
+        else if (mode == PROMPT_MODE) {
+            promptUser(promptMessage, VK_ESCAPE, searchQuery);
+            if (promptMessage.rfind("Search:", 0) == 0) {
+                searchSession.clear();
+                hasCurrentMatch = false;
+            }
+        }
         });
 
 
@@ -3302,9 +5085,14 @@ void Editor::setupDefaultKeybindings() {
 
     customKeybindings[KeyCombination{ 'S', true, false, false }] = "save_file";
     customKeybindings[KeyCombination{ 'Q', true, false, false }] = "quit";
-    customKeybindings[KeyCombination{ 'O', true, false, false }] = "open_file_prompt";
+    customKeybindings[KeyCombination{ 'O', true, false, false }] = "quick_open";
     customKeybindings[KeyCombination{ 'E', true, false, false }] = "toggle_explorer";
     customKeybindings[KeyCombination{ 'F', true, false, false }] = "find";
+    customKeybindings[KeyCombination{ 'F', true, false, true }] = "search_in_folder";
+    customKeybindings[KeyCombination{ 'H', true, false, true }] = "replace_in_folder";
+    customKeybindings[KeyCombination{ 'A', true, false, true }] = "apply_folder_replace";
+    customKeybindings[KeyCombination{ 'H', true, false, false }] = "replace";
+    customKeybindings[KeyCombination{ 'Z', true, false, false }] = "undo_replace";
     customKeybindings[KeyCombination{ 'N', true, false, false }] = "find_next";
     customKeybindings[KeyCombination{ 'P', true, false, false }] = "find_previous";
     customKeybindings[KeyCombination{ 'T', true, false, false }] = "toggle_terminal";
@@ -3344,6 +5132,23 @@ void Editor::processInput(int raw_key_code, char ascii_char, DWORD control_key_s
         return;
     }
 
+    // Quick open takes what is typed for its query ahead of the bindings, which give some
+    // plain letters to the file explorer.
+    if (mode == QUICK_OPEN_MODE && !ctrl_pressed && !alt_pressed_local) {
+        if (raw_key_code == VK_BACK) {
+            if (!quickOpenQuery.empty()) {
+                quickOpenQuery.pop_back();
+                updateQuickOpen();
+            }
+            return;
+        }
+        if (ascii_char >= 32 && ascii_char <= 126) {
+            quickOpenQuery += ascii_char;
+            updateQuickOpen();
+            return;
+        }
+    }
+
     KeyCombination current_kc = { raw_key_code, ctrl_pressed, alt_pressed_local, shift_pressed_local };
     if (customKeybindings.count(current_kc)) {
         executeCommand(customKeybindings[current_kc]);
@@ -3371,14 +5176,14 @@ void Editor::processInput(int raw_key_code, char ascii_char, DWORD control_key_s
         case VK_UP:
             if (cursorY > 0) {
                 cursorY--;
-                cursorX = std::min(cursorX, (int)lines[cursorY].length());
+                cursorX = std::min(cursorX, (int)lines.length(cursorY));
             }
             scroll();
             break;
         case VK_DOWN:
             if (cursorY < lines.size()) {
                 cursorY++;
-                cursorX = std::min(cursorX, (int)lines[cursorY].length());
+                cursorX = std::min(cursorX, (int)lines.length(cursorY));
             }
             scroll();
             break;
@@ -3388,12 +5193,12 @@ void Editor::processInput(int raw_key_code, char ascii_char, DWORD control_key_s
             }
             else if (cursorY > 0) {
                 cursorY--;
-                cursorX = (int)lines[cursorY].length();
+                cursorX = (int)lines.length(cursorY);
             }
             scroll();
             break;
         case VK_RIGHT:
-            if (cursorX < lines[cursorY].length()) {
+            if (cursorX < lines.length(cursorY)) {
                 cursorX++;
             }
             else if (cursorY < lines.size() - 1) { // Move to start of next line
@@ -3426,11 +5231,22 @@ void Editor::processInput(int raw_key_code, char ascii_char, DWORD control_key_s
         else if (ascii_char != 0 && ascii_char >= 32 && ascii_char <= 126) prompt_input_char = ascii_char;
 
         if (prompt_input_char != 0) {
+            bool isSearch = promptMessage.rfind("Search:", 0) == 0;
+            bool isFolderSearch = promptMessage.rfind("Search in folder:", 0) == 0;
+            bool isReplace = promptMessage.rfind("Replace", 0) == 0;
             if (promptUser(promptMessage, prompt_input_char, searchQuery)) {
-                if (promptMessage.rfind("Search:", 0) == 0) {
+                if (isSearch) {
                     performSearch();
+                } else if (isFolderSearch) {
+                    startProjectSearch(searchQuery, currentDirPath);
+                } else if (isReplace) {
+                    continueReplacePrompt();
                 }
-                force_full_redraw_internal();
+            } else if (isSearch && mode == PROMPT_MODE) {
+                updateIncrementalSearch();
+            } else if (isSearch) {
+                searchSession.clear();
+                hasCurrentMatch = false;
             }
         }
     }
@@ -3469,8 +5285,8 @@ void Editor::applyStylingInternal(int lineNum, int startCol, int endCol, std::fu
     int lineIndex = lineNum - 1;
 
     int internalStartCol = std::max(0, startCol - 1);
-    int internalEndCol = (endCol == -1) ? (int)lines[lineIndex].length() : std::max(0, endCol - 1);
-    internalEndCol = std::min(internalEndCol, (int)lines[lineIndex].length()); // Clamp to line length
+    int internalEndCol = (endCol == -1) ? (int)lines.length(lineIndex) : std::max(0, endCol - 1);
+    internalEndCol = std::min(internalEndCol, (int)lines.length(lineIndex)); // Clamp to line length
     if (internalEndCol >= internalEndCol) {
         return;
     }
@@ -3519,6 +5335,7 @@ void Editor::applyStylingInternal(int lineNum, int startCol, int endCol, std::fu
     });
 
     stylesOnLine = newStylesForLine;
+    damageFileRows(lineIndex, lineIndex + 1);
 }
 
 void Editor::setTextForegroundColor(int lineNum, int startCol, int endCol, unsigned int rgbColor) {
@@ -3546,8 +5363,8 @@ void Editor::clearLineStyling(int lineNum, int startCol, int endCol) {
     int lineIndex = lineNum - 1; // 0-based for internal map
 
     int internalStartCol = std::max(0, startCol - 1);
-    int internalEndCol = (endCol == -1) ? (int)lines[lineIndex].length() : std::max(0, endCol - 1);
-    internalEndCol = std::min(internalEndCol, (int)lines[lineIndex].length());
+    int internalEndCol = (endCol == -1) ? (int)lines.length(lineIndex) : std::max(0, endCol - 1);
+    internalEndCol = std::min(internalEndCol, (int)lines.length(lineIndex));
 
     if (internalStartCol >= internalEndCol) {
         return; // Empty or invalid range
@@ -3590,6 +5407,7 @@ void Editor::clearLineStyling(int lineNum, int startCol, int endCol) {
         }
     }
     stylesOnLine = newStylesForLine;
+    damageFileRows(lineIndex, lineIndex + 1);
 
     // After clearing, consolidate/remove empty lines from map
     if (stylesOnLine.empty()) {
@@ -3606,7 +5424,7 @@ void Editor::addTextDecoration(const std::string& id, int lineNum, int startCol,
     // Convert to 0-based internal indexes
     int internalStartCol = std::max(0, startCol - 1);
     int internalEndCol = std::max(0, endCol - 1); // Exclusive end for the API, so internal is also exclusive
-    internalEndCol = std::min(internalEndCol, (int)lines[lineIndex].length());
+    internalEndCol = std::min(internalEndCol, (int)lines.length(lineIndex));
 
     // Check if decoration with this ID already exists on this line, update it
     auto& decorationsOnLine = lineDecorations[lineIndex];
@@ -3632,9 +5450,12 @@ void Editor::addTextDecoration(const std::string& id, int lineNum, int startCol,
     std::sort(decorationsOnLine.begin(), decorationsOnLine.end(), [](const TextDecoration& a, const TextDecoration& b) {
         return a.startCol < b.startCol;
         });
+    damageFileRows(lineIndex, lineIndex + 1);
 }
 
 void Editor::clearDecorations(const std::string& idPrefix) {
+    // Lines that may lose a decoration are drawn again.
+    for (const auto& pair : lineDecorations) damageFileRows(pair.first, pair.first + 1);
     if (idPrefix.empty()) {
         // Clear all decorations on all lines
         lineDecorations.clear();
@@ -3661,6 +5482,30 @@ void Editor::clearDecorations(const std::string& idPrefix) {
     }
 }
 
+void Editor::setKeywordHighlight(const std::string& id, KeywordMatcher matcher, unsigned int rgbColor) {
+    auto existing = std::find_if(keywordHighlights.begin(), keywordHighlights.end(),
+        [&](const KeywordHighlight& highlight) { return highlight.id == id; });
+    if (existing != keywordHighlights.end()) {
+        existing->matcher = std::move(matcher);
+        existing->color = rgbColor;
+    }
+    else {
+        keywordHighlights.push_back({ id, std::move(matcher), rgbColor });
+    }
+    viewportKeywordsRow = -1;
+}
+
+void Editor::clearKeywordHighlights(const std::string& idPrefix) {
+    keywordHighlights.erase(std::remove_if(keywordHighlights.begin(), keywordHighlights.end(),
+        [&](const KeywordHighlight& highlight) {
+            return highlight.id.rfind(idPrefix, 0) == 0; // An empty prefix matches every id
+        }),
+        keywordHighlights.end());
+    for (const auto& keyword : viewportKeywords) damageFileRows(keyword.first.row, keyword.first.row + 1);
+    viewportKeywords.clear();
+    viewportKeywordsRow = -1;
+}
+
 void Editor::showTooltip(int screenX, int screenY, const std::string& message, ULONGLONG duration_ms) {
     // For now, let's map this to the status message.
     // A true tooltip would require more advanced console rendering (e.g., drawing on top, or a separate window).
@@ -0,0 +1,295 @@
+#include "atomic_file_writer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+static const size_t SAVE_MAX_PIECES = 512; // Pieces gathered per flush (kept below IOV_MAX)
+
+AtomicFileWriter::AtomicFileWriter() :
+    _stagingUsed(0),
+    _stagingFlushed(0),
+    _bytesWritten(0),
+    _open(false),
+    _staged(false),
+#ifdef _WIN32
+    _hFile(INVALID_HANDLE_VALUE)
+#else
+    _fd(-1)
+#endif
+{}
+
+AtomicFileWriter::~AtomicFileWriter() {
+    if (_open) {
+        abort();
+    }
+}
+
+bool AtomicFileWriter::open(const std::string& path, size_t stagingSize) {
+    if (_open) abort();
+    _path = path;
+    _tempPath = path + ".splice-tmp";
+    _error.clear();
+    _bytesWritten = 0;
+    _stagingUsed = 0;
+    _stagingFlushed = 0;
+    _pieces.clear();
+    // Pieces below SAVE_DIRECT_WRITE_MIN are copied into an emptied chunk, so it holds at least one.
+    _staging.resize(std::clamp<size_t>(stagingSize, SAVE_DIRECT_WRITE_MIN, SAVE_CHUNK_SIZE));
+
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(_tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        _error = "CreateFileA failed (GLE: " + std::to_string(GetLastError()) + ")";
+        return false;
+    }
+    _hFile = hFile;
+#else
+    int fd = ::open(_tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        _error = std::string("open failed: ") + strerror(errno);
+        return false;
+    }
+    // Keep the permissions of the file being replaced.
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
+    }
+    _fd = fd;
+#endif
+
+    _open = true;
+    return true;
+}
+
+bool AtomicFileWriter::append(const char* data, size_t length) {
+    if (!_open || _staged) return false;
+    if (length == 0) return true;
+
+    if (length >= SAVE_DIRECT_WRITE_MIN) {
+        // Seal what is staged so far to keep the output in order, then queue the span by pointer.
+        if (_stagingUsed > _stagingFlushed) {
+            _pieces.push_back({ _staging.data() + _stagingFlushed, _stagingUsed - _stagingFlushed });
+            _stagingFlushed = _stagingUsed;
+        }
+        _pieces.push_back({ data, length });
+        if (_pieces.size() >= SAVE_MAX_PIECES) {
+            return flush();
+        }
+        return true;
+    }
+
+    if (_stagingUsed + length > _staging.size()) {
+        if (!flush()) return false;
+    }
+    memcpy(_staging.data() + _stagingUsed, data, length);
+    _stagingUsed += length;
+    return true;
+}
+
+bool AtomicFileWriter::appendCopy(const char* data, size_t length) {
+    while (length > 0) {
+        size_t take = std::min(length, SAVE_DIRECT_WRITE_MIN - 1);
+        if (!append(data, take)) return false;
+        data += take;
+        length -= take;
+    }
+    return true;
+}
+
+bool AtomicFileWriter::flush() {
+    if (_stagingUsed > _stagingFlushed) {
+        _pieces.push_back({ _staging.data() + _stagingFlushed, _stagingUsed - _stagingFlushed });
+    }
+
+#ifdef _WIN32
+    for (const Piece& piece : _pieces) {
+        if (!writeRaw(piece.data, piece.length)) return false;
+    }
+#else
+    std::vector<struct iovec> iov;
+    iov.reserve(_pieces.size());
+    for (const Piece& piece : _pieces) {
+        iov.push_back({ (void*)piece.data, piece.length });
+    }
+    size_t first = 0;
+    while (first < iov.size()) {
+        ssize_t written = writev(_fd, iov.data() + first, (int)(iov.size() - first));
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            _error = std::string("writev failed: ") + strerror(errno);
+            return false;
+        }
+        _bytesWritten += (uint64_t)written;
+        // Skip the fully written entries and trim a partially written one.
+        size_t remaining = (size_t)written;
+        while (first < iov.size() && remaining >= iov[first].iov_len) {
+            remaining -= iov[first].iov_len;
+            first++;
+        }
+        if (first < iov.size()) {
+            iov[first].iov_base = (char*)iov[first].iov_base + remaining;
+            iov[first].iov_len -= remaining;
+        }
+    }
+#endif
+
+    _pieces.clear();
+    _stagingUsed = 0;
+    _stagingFlushed = 0;
+    return true;
+}
+
+bool AtomicFileWriter::writeRaw(const char* data, size_t length) {
+#ifdef _WIN32
+    while (length > 0) {
+        DWORD toWrite = (DWORD)std::min<size_t>(length, 1u << 30);
+        DWORD written = 0;
+        if (!WriteFile(_hFile, data, toWrite, &written, NULL)) {
+            _error = "WriteFile failed (GLE: " + std::to_string(GetLastError()) + ")";
+            return false;
+        }
+        data += written;
+        length -= written;
+        _bytesWritten += written;
+    }
+#else
+    while (length > 0) {
+        ssize_t written = ::write(_fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            _error = std::string("write failed: ") + strerror(errno);
+            return false;
+        }
+        data += written;
+        length -= (size_t)written;
+        _bytesWritten += (uint64_t)written;
+    }
+#endif
+    return true;
+}
+
+void AtomicFileWriter::closeHandle() {
+#ifdef _WIN32
+    if (_hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(_hFile);
+        _hFile = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+#endif
+}
+
+bool AtomicFileWriter::commit() {
+    if (!stage()) return false;
+    if (!replaceTarget()) {
+        abort();
+        return false;
+    }
+    _open = false;
+    _staged = false;
+    return true;
+}
+
+bool AtomicFileWriter::stage() {
+    if (!_open) return false;
+    if (_staged) return true;
+
+    if (!flush()) {
+        abort();
+        return false;
+    }
+
+#ifdef _WIN32
+    if (!FlushFileBuffers(_hFile)) {
+        _error = "FlushFileBuffers failed (GLE: " + std::to_string(GetLastError()) + ")";
+        abort();
+        return false;
+    }
+#else
+    if (fsync(_fd) != 0) {
+        _error = std::string("fsync failed: ") + strerror(errno);
+        abort();
+        return false;
+    }
+#endif
+
+    closeHandle();
+    _staged = true;
+    _staging.clear();
+    _staging.shrink_to_fit();
+    return true;
+}
+
+bool AtomicFileWriter::replaceTarget() {
+#ifdef _WIN32
+    if (MoveFileExA(_tempPath.c_str(), _path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        return true;
+    }
+
+    // Replacing a file that is still mapped (large file mode) is refused, but renaming it
+    // away is allowed since it was opened with FILE_SHARE_DELETE. Move the old file aside,
+    // put the new one in place and let the old one disappear once its mapping is closed.
+    DWORD replaceError = GetLastError();
+    std::string oldPath = _path + ".splice-old";
+    if (!MoveFileExA(_path.c_str(), oldPath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        _error = "MoveFileExA failed (GLE: " + std::to_string(replaceError) + ")";
+        return false;
+    }
+    if (!MoveFileExA(_tempPath.c_str(), _path.c_str(), MOVEFILE_WRITE_THROUGH)) {
+        _error = "MoveFileExA failed (GLE: " + std::to_string(GetLastError()) + ")";
+        MoveFileExA(oldPath.c_str(), _path.c_str(), 0);
+        return false;
+    }
+    DeleteFileA(oldPath.c_str());
+    return true;
+#else
+    if (rename(_tempPath.c_str(), _path.c_str()) != 0) {
+        _error = std::string("rename failed: ") + strerror(errno);
+        return false;
+    }
+
+    // Persist the directory entry as well, otherwise the rename itself can be lost on a crash.
+    std::string dir = ".";
+    size_t slash = _path.find_last_of('/');
+    if (slash != std::string::npos) {
+        dir = slash == 0 ? "/" : _path.substr(0, slash);
+    }
+    int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        ::close(dirFd);
+    }
+    return true;
+#endif
+}
+
+void AtomicFileWriter::abort() {
+    closeHandle();
+    if (_open) {
+#ifdef _WIN32
+        DeleteFileA(_tempPath.c_str());
+#else
+        unlink(_tempPath.c_str());
+#endif
+    }
+    _open = false;
+    _staged = false;
+    _pieces.clear();
+    _stagingUsed = 0;
+    _stagingFlushed = 0;
+}
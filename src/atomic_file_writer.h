@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+const size_t SAVE_CHUNK_SIZE = 4 * 1024 * 1024;      // Staging buffer for small pieces (edited lines, line endings)
+const size_t SAVE_DIRECT_WRITE_MIN = 64 * 1024;      // Spans at least this big are written straight from the caller's memory
+
+// Writes a file through a temporary sibling and renames it over the target on
+// commit(), so a crash or a failed write never leaves a truncated file behind.
+// Small appends are copied into a large staging chunk; big spans are queued by
+// pointer and written without copying (gathered with writev on POSIX), so the
+// caller's memory must stay valid until the next flush or commit(). stage() splits
+// commit() in two, so a batch of files can all be written before any of them replaces
+// its target.
+class AtomicFileWriter {
+public:
+    AtomicFileWriter();
+    ~AtomicFileWriter();
+    AtomicFileWriter(const AtomicFileWriter&) = delete;
+    AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+
+    // stagingSize bounds the staging chunk, for writers of files known to be small. It is
+    // never less than SAVE_DIRECT_WRITE_MIN.
+    bool open(const std::string& path, size_t stagingSize = SAVE_CHUNK_SIZE);
+    bool append(const char* data, size_t length);
+    // Like append(), but always copies, for data the caller is about to reuse.
+    bool appendCopy(const char* data, size_t length);
+    bool commit();
+    // Writes everything out and closes the temporary file, leaving the target alone until
+    // commit(), which then only renames; abort() still deletes it.
+    bool stage();
+    void abort();
+
+    uint64_t bytesWritten() const { return _bytesWritten; }
+    const std::string& lastError() const { return _error; }
+
+private:
+    struct Piece {
+        const char* data;
+        size_t length;
+    };
+
+    std::string _path;
+    std::string _tempPath;
+    std::string _error;
+    std::vector<char> _staging;
+    size_t _stagingUsed;
+    size_t _stagingFlushed;
+    std::vector<Piece> _pieces;
+    uint64_t _bytesWritten;
+    bool _open;
+    bool _staged;
+
+#ifdef _WIN32
+    void* _hFile;
+#else
+    int _fd;
+#endif
+
+    bool flush();
+    bool writeRaw(const char* data, size_t length);
+    void closeHandle();
+    bool replaceTarget();
+};
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (IEEE 802.3 polynomial). Pass the previous result as crc to checksum data in pieces.
+uint32_t crc32(const void* data, size_t length, uint32_t crc = 0);
@@ -0,0 +1,129 @@
+#include "edit_delta.h"
+#include <algorithm>
+
+bool applyDelta(LineBuffer& lines, const EditDelta& delta) {
+    size_t lineCount = lines.size();
+    bool rowValid = delta.row >= 0 && (size_t)delta.row < lineCount;
+    bool colValid = rowValid && delta.col >= 0 && (size_t)delta.col <= lines.length(delta.row);
+
+    switch (delta.op) {
+    case EDIT_INSERT_TEXT:
+        if (!colValid) return false;
+        lines[delta.row].insert(delta.col, delta.text);
+        return true;
+
+    case EDIT_DELETE_TEXT:
+        if (!colValid || delta.col + delta.text.size() > lines.length(delta.row)) return false;
+        lines[delta.row].erase(delta.col, delta.text.size());
+        return true;
+
+    case EDIT_SPLIT_LINE:
+        if (!colValid) return false;
+        if ((size_t)delta.col == lines.length(delta.row)) {
+            lines.insert(delta.row + 1, "");
+        } else {
+            std::string tail = lines[delta.row].substr(delta.col);
+            lines[delta.row].erase(delta.col);
+            lines.insert(delta.row + 1, std::move(tail));
+        }
+        return true;
+
+    case EDIT_JOIN_LINE:
+        if (!rowValid || (size_t)delta.row + 1 >= lineCount) return false;
+        lines[delta.row] += lines.view(delta.row + 1);
+        lines.erase(delta.row + 1);
+        return true;
+
+    case EDIT_INSERT_LINE:
+        if (delta.row < 0 || (size_t)delta.row > lineCount) return false;
+        lines.insert(delta.row, delta.text);
+        return true;
+
+    case EDIT_DELETE_LINE:
+        if (!rowValid) return false;
+        lines.erase(delta.row);
+        return true;
+
+    case EDIT_SET_LINE:
+        if (!rowValid) return false;
+        lines[delta.row] = delta.text;
+        return true;
+
+    case EDIT_DELETE_LINES:
+        if (!rowValid || delta.col <= 0 || (size_t)delta.col > lineCount - delta.row) return false;
+        lines.erase(delta.row, delta.col);
+        return true;
+
+    case EDIT_INSERT_LINES: {
+        if (delta.row < 0 || (size_t)delta.row > lineCount) return false;
+        std::vector<std::string> texts;
+        size_t start = 0;
+        while (true) {
+            size_t nl = delta.text.find('\n', start);
+            if (nl == std::string::npos) {
+                texts.push_back(delta.text.substr(start));
+                break;
+            }
+            texts.push_back(delta.text.substr(start, nl - start));
+            start = nl + 1;
+        }
+        lines.insert(delta.row, std::move(texts));
+        return true;
+    }
+
+    case EDIT_SET_CONTENT: {
+        lines.clear();
+        size_t start = 0;
+        while (true) {
+            size_t nl = delta.text.find('\n', start);
+            if (nl == std::string::npos) {
+                lines.push_back(delta.text.substr(start));
+                break;
+            }
+            lines.push_back(delta.text.substr(start, nl - start));
+            start = nl + 1;
+        }
+        return true;
+    }
+    }
+    return false;
+}
+
+bool deltaRowSpan(const EditDelta& delta, size_t& firstRow, size_t& oldRows, size_t& newRows) {
+    firstRow = delta.row >= 0 ? (size_t)delta.row : 0;
+    switch (delta.op) {
+    case EDIT_INSERT_TEXT:
+    case EDIT_DELETE_TEXT:
+    case EDIT_SET_LINE:
+        oldRows = 1;
+        newRows = 1;
+        return true;
+    case EDIT_SPLIT_LINE:
+        oldRows = 1;
+        newRows = 2;
+        return true;
+    case EDIT_JOIN_LINE:
+        oldRows = 2;
+        newRows = 1;
+        return true;
+    case EDIT_INSERT_LINE:
+        oldRows = 0;
+        newRows = 1;
+        return true;
+    case EDIT_DELETE_LINE:
+        oldRows = 1;
+        newRows = 0;
+        return true;
+    case EDIT_DELETE_LINES:
+        oldRows = delta.col > 0 ? (size_t)delta.col : 0;
+        newRows = 0;
+        return true;
+    case EDIT_INSERT_LINES:
+        oldRows = 0;
+        newRows = (size_t)std::count(delta.text.begin(), delta.text.end(), '\n') + 1;
+        return true;
+    case EDIT_SET_CONTENT:
+        break;
+    }
+    return false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include "line_buffer.h"
+
+// Every change to the buffer is expressed as one of these, so it can be journaled,
+// replayed and inverted. Rows and columns are 0-based and refer to the buffer as it
+// was right before the delta is applied.
+enum EditOp : uint8_t {
+    EDIT_INSERT_TEXT = 1,  // text inserted into row at col
+    EDIT_DELETE_TEXT,      // text (the removed characters) deleted from row at col
+    EDIT_SPLIT_LINE,       // row split at col, the tail becomes row + 1
+    EDIT_JOIN_LINE,        // row + 1 appended to row, which was col characters long
+    EDIT_INSERT_LINE,      // text inserted as a new line before row
+    EDIT_DELETE_LINE,      // row removed; text is its former content
+    EDIT_SET_LINE,         // row replaced by text
+    EDIT_SET_CONTENT,      // whole buffer replaced by text, lines separated by '\n'
+    EDIT_DELETE_LINES,     // col rows removed starting at row; their content is not kept
+    EDIT_INSERT_LINES,     // text inserted as new lines before row, lines separated by '\n'
+};
+
+struct EditDelta {
+    EditOp op;
+    int row;
+    int col;
+    std::string text;
+};
+
+// Applies delta to lines. Returns false (and leaves lines untouched) if the delta does
+// not fit the buffer, which only happens when replaying a journal that does not belong to it.
+bool applyDelta(LineBuffer& lines, const EditDelta& delta);
+
+// The rows delta touches: [firstRow, firstRow + oldRows) before it is applied become
+// [firstRow, firstRow + newRows) after it, and every other row keeps its content. False
+// for EDIT_SET_CONTENT, which replaces everything.
+bool deltaRowSpan(const EditDelta& delta, size_t& firstRow, size_t& oldRows, size_t& newRows);
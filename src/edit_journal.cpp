@@ -0,0 +1,454 @@
+#include "edit_journal.h"
+#include "checksum.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+static const char JOURNAL_MAGIC[4] = { 'S', 'P', 'L', 'J' };
+static const uint32_t JOURNAL_VERSION = 1;
+static const size_t JOURNAL_HEADER_SIZE = 24;
+static const size_t JOURNAL_RECORD_HEADER_SIZE = 8;
+
+enum JournalRecordKind : uint8_t {
+    JOURNAL_DELTAS = 1,
+    JOURNAL_CHECKPOINT = 2,
+};
+
+static void putU8(std::string& out, uint8_t v) {
+    out.push_back((char)v);
+}
+
+static void putU32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+
+static void putU64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+
+namespace {
+
+struct JournalReader {
+    const unsigned char* p;
+    size_t left;
+
+    bool u8(uint8_t& v) {
+        if (left < 1) return false;
+        v = *p++;
+        left--;
+        return true;
+    }
+    bool u32(uint32_t& v) {
+        if (left < 4) return false;
+        v = 0;
+        for (int i = 0; i < 4; ++i) v |= (uint32_t)p[i] << (8 * i);
+        p += 4;
+        left -= 4;
+        return true;
+    }
+    bool u64(uint64_t& v) {
+        if (left < 8) return false;
+        v = 0;
+        for (int i = 0; i < 8; ++i) v |= (uint64_t)p[i] << (8 * i);
+        p += 8;
+        left -= 8;
+        return true;
+    }
+    bool bytes(std::string& s, size_t n) {
+        if (left < n) return false;
+        s.assign((const char*)p, n);
+        p += n;
+        left -= n;
+        return true;
+    }
+};
+
+}
+
+static std::string encodeHeader(uint64_t baseSize, int64_t baseMtime) {
+    std::string header(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    putU32(header, JOURNAL_VERSION);
+    putU64(header, baseSize);
+    putU64(header, (uint64_t)baseMtime);
+    return header;
+}
+
+static std::string encodeDeltas(const std::vector<EditDelta>& deltas) {
+    std::string payload;
+    putU8(payload, JOURNAL_DELTAS);
+    putU32(payload, (uint32_t)deltas.size());
+    for (const EditDelta& delta : deltas) {
+        putU8(payload, delta.op);
+        putU32(payload, (uint32_t)delta.row);
+        putU32(payload, (uint32_t)delta.col);
+        putU32(payload, (uint32_t)delta.text.size());
+        payload += delta.text;
+    }
+    return payload;
+}
+
+static std::string encodeCheckpoint(const std::vector<LineRun>& runs) {
+    std::string payload;
+    putU8(payload, JOURNAL_CHECKPOINT);
+    putU32(payload, (uint32_t)runs.size());
+    for (const LineRun& run : runs) {
+        putU8(payload, run.literal ? 1 : 0);
+        if (run.literal) {
+            putU32(payload, (uint32_t)run.text.size());
+            payload += run.text;
+        } else {
+            putU64(payload, run.offset);
+            putU64(payload, run.count);
+        }
+    }
+    return payload;
+}
+
+static bool decodePayload(JournalReader reader, std::vector<JournalEntry>& entries) {
+    uint8_t kind;
+    uint32_t count;
+    if (!reader.u8(kind) || !reader.u32(count)) return false;
+
+    if (kind == JOURNAL_DELTAS) {
+        for (uint32_t i = 0; i < count; ++i) {
+            JournalEntry entry;
+            entry.checkpoint = false;
+            uint8_t op;
+            uint32_t row, col, length;
+            if (!reader.u8(op) || !reader.u32(row) || !reader.u32(col) || !reader.u32(length)) return false;
+            if (op < EDIT_INSERT_TEXT || op > EDIT_INSERT_LINES) return false;
+            entry.delta.op = (EditOp)op;
+            entry.delta.row = (int)row;
+            entry.delta.col = (int)col;
+            if (!reader.bytes(entry.delta.text, length)) return false;
+            entries.push_back(std::move(entry));
+        }
+        return true;
+    }
+
+    if (kind == JOURNAL_CHECKPOINT) {
+        JournalEntry entry;
+        entry.checkpoint = true;
+        entry.delta = { EDIT_SET_CONTENT, 0, 0, std::string() };
+        for (uint32_t i = 0; i < count; ++i) {
+            LineRun run = { false, 0, 0, std::string() };
+            uint8_t literal;
+            if (!reader.u8(literal)) return false;
+            if (literal) {
+                uint32_t length;
+                if (!reader.u32(length) || !reader.bytes(run.text, length)) return false;
+                run.literal = true;
+                run.count = 1;
+            } else if (!reader.u64(run.offset) || !reader.u64(run.count)) {
+                return false;
+            }
+            entry.runs.push_back(std::move(run));
+        }
+        entries.push_back(std::move(entry));
+        return true;
+    }
+    return false;
+}
+
+EditJournal::EditJournal() :
+    _baseSize(0),
+    _baseMtime(0),
+    _active(false),
+    _stopping(false),
+    _keepFile(false),
+    _hasCheckpoint(false),
+    _restart(false),
+    _journalBytes(0),
+    _checkpointBytes(0),
+    _checkpointRequested(false),
+    _trackingSave(false),
+    _file(nullptr)
+{}
+
+EditJournal::~EditJournal() {
+    stop();
+}
+
+std::string EditJournal::journalPathFor(const std::string& path) {
+    return path + ".splice-journal";
+}
+
+bool EditJournal::recover(const std::string& path, uint64_t baseSize, int64_t baseMtime,
+                          std::vector<JournalEntry>& entries, std::string& error) {
+    std::string journalPath = journalPathFor(path);
+    FILE* f = fopen(journalPath.c_str(), "rb");
+    if (!f) return false;
+
+    std::string data;
+    char chunk[64 * 1024];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.append(chunk, n);
+    }
+    fclose(f);
+
+    if (data.size() < JOURNAL_HEADER_SIZE || memcmp(data.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+        error = "not a journal file";
+        return false;
+    }
+    JournalReader header = { (const unsigned char*)data.data() + sizeof(JOURNAL_MAGIC), JOURNAL_HEADER_SIZE - sizeof(JOURNAL_MAGIC) };
+    uint32_t version;
+    uint64_t journalBaseSize, journalBaseMtime;
+    header.u32(version);
+    header.u64(journalBaseSize);
+    header.u64(journalBaseMtime);
+    if (version != JOURNAL_VERSION) {
+        error = "unsupported journal version";
+        return false;
+    }
+    if (journalBaseSize != baseSize || (int64_t)journalBaseMtime != baseMtime) {
+        error = "file changed since the journal was written";
+        return false;
+    }
+
+    // Records after a torn or corrupt one are unreachable; everything before it is kept.
+    size_t pos = JOURNAL_HEADER_SIZE;
+    while (pos + JOURNAL_RECORD_HEADER_SIZE <= data.size()) {
+        JournalReader framing = { (const unsigned char*)data.data() + pos, JOURNAL_RECORD_HEADER_SIZE };
+        uint32_t length, crc;
+        framing.u32(length);
+        framing.u32(crc);
+        pos += JOURNAL_RECORD_HEADER_SIZE;
+        if (length > data.size() - pos) break;
+        if (crc32(data.data() + pos, length) != crc) break;
+
+        std::vector<JournalEntry> recordEntries;
+        if (!decodePayload({ (const unsigned char*)data.data() + pos, length }, recordEntries)) break;
+        for (JournalEntry& entry : recordEntries) {
+            // A checkpoint supersedes everything recorded before it.
+            if (entry.checkpoint) entries.clear();
+            entries.push_back(std::move(entry));
+        }
+        pos += length;
+    }
+    return true;
+}
+
+void EditJournal::start(const std::string& path, uint64_t baseSize, int64_t baseMtime) {
+    stop();
+    _path = path;
+    _journalPath = journalPathFor(path);
+    _baseSize = baseSize;
+    _baseMtime = baseMtime;
+    _stopping = false;
+    _keepFile = false;
+    _hasCheckpoint = false;
+    _restart = false;
+    _journalBytes = 0;
+    _checkpointBytes = 0;
+    _checkpointRequested = false;
+    _trackingSave = false;
+    _pending.clear();
+    _sinceSave.clear();
+    _active = true;
+    _flushThread = std::thread(&EditJournal::flushMain, this);
+}
+
+void EditJournal::stop(bool keepFile) {
+    if (!_active) return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _keepFile = keepFile;
+    }
+    _wake.notify_all();
+    _flushThread.join();
+    closeFile();
+
+    std::error_code ec;
+    if (!keepFile) std::filesystem::remove(_journalPath, ec);
+    std::filesystem::remove(_journalPath + ".tmp", ec);
+
+    _active = false;
+    _pending.clear();
+    _sinceSave.clear();
+    _checkpointRuns.clear();
+}
+
+void EditJournal::record(const EditDelta& delta) {
+    if (!_active) return;
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_trackingSave) {
+        _sinceSave.push_back(delta);
+    }
+
+    // Typing and repeated backspace/delete collapse into one delta per run.
+    if (!_pending.empty()) {
+        EditDelta& last = _pending.back();
+        if (last.op == delta.op && last.row == delta.row) {
+            if (delta.op == EDIT_INSERT_TEXT && (size_t)delta.col == last.col + last.text.size()) {
+                last.text += delta.text;
+                return;
+            }
+            if (delta.op == EDIT_DELETE_TEXT && delta.col + delta.text.size() == (size_t)last.col) {
+                last.text.insert(0, delta.text);
+                last.col = delta.col;
+                return;
+            }
+            if (delta.op == EDIT_DELETE_TEXT && delta.col == last.col) {
+                last.text += delta.text;
+                return;
+            }
+        }
+    }
+    _pending.push_back(delta);
+}
+
+bool EditJournal::wantsCheckpoint() const {
+    if (!_active) return false;
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _checkpointRequested && !_hasCheckpoint;
+}
+
+void EditJournal::checkpoint(std::vector<LineRun>&& runs) {
+    if (!_active) return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.clear();
+        _checkpointRuns = std::move(runs);
+        _hasCheckpoint = true;
+        _checkpointRequested = false;
+    }
+    _wake.notify_all();
+}
+
+void EditJournal::beginSave() {
+    if (!_active) return;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _trackingSave = true;
+    _sinceSave.clear();
+}
+
+void EditJournal::endSave(bool succeeded, uint64_t baseSize, int64_t baseMtime) {
+    if (!_active) return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_trackingSave) return;
+        _trackingSave = false;
+        if (succeeded) {
+            // The saved file is the new base; only edits made while it was written still matter.
+            _baseSize = baseSize;
+            _baseMtime = baseMtime;
+            _pending = std::move(_sinceSave);
+            _hasCheckpoint = false;
+            _checkpointRuns.clear();
+            _checkpointRequested = false;
+            _restart = true;
+        }
+        _sinceSave.clear();
+    }
+    _wake.notify_all();
+}
+
+void EditJournal::rebase(uint64_t baseSize, int64_t baseMtime) {
+    if (!_active) return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _baseSize = baseSize;
+        _baseMtime = baseMtime;
+        _pending.clear();
+        _hasCheckpoint = false;
+        _checkpointRuns.clear();
+        _checkpointRequested = false;
+        _restart = true;
+    }
+    _wake.notify_all();
+}
+
+void EditJournal::flushMain() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait_for(lock, std::chrono::milliseconds(JOURNAL_FLUSH_INTERVAL_MS),
+                       [this]() { return _stopping || _hasCheckpoint || _restart; });
+        if (_stopping && !_keepFile) break;
+
+        bool stopping = _stopping;
+        bool restart = _restart;
+        bool hasCheckpoint = _hasCheckpoint;
+        // endSave() moves the base to the saved file, so it is taken along with the records.
+        uint64_t baseSize = _baseSize;
+        int64_t baseMtime = _baseMtime;
+        std::vector<LineRun> runs;
+        std::vector<EditDelta> deltas;
+        if (hasCheckpoint) runs.swap(_checkpointRuns);
+        deltas.swap(_pending);
+        _restart = false;
+        _hasCheckpoint = false;
+        lock.unlock();
+
+        if (restart) {
+            // Start over against the new base; an empty journal is just removed.
+            closeFile();
+            std::error_code ec;
+            std::filesystem::remove(_journalPath, ec);
+            _journalBytes = 0;
+            _checkpointBytes = 0;
+        }
+
+        bool ok = true;
+        if (hasCheckpoint) {
+            closeFile();
+            ok = openFile(&runs, baseSize, baseMtime);
+            _checkpointBytes = _journalBytes;
+        }
+        if (ok && !deltas.empty()) {
+            if (!_file) ok = openFile(nullptr, baseSize, baseMtime);
+            if (ok) ok = writeRecord(encodeDeltas(deltas));
+        }
+
+        lock.lock();
+        if (stopping) break;
+        if (ok && _journalBytes >= _checkpointBytes + JOURNAL_CHECKPOINT_BYTES) {
+            _checkpointRequested = true;
+        }
+    }
+}
+
+bool EditJournal::openFile(const std::vector<LineRun>* checkpointRuns, uint64_t baseSize, int64_t baseMtime) {
+    // A checkpoint is written to a temporary file first, so the old journal stays
+    // usable until the new one is complete.
+    std::string target = checkpointRuns ? _journalPath + ".tmp" : _journalPath;
+    FILE* f = fopen(target.c_str(), "wb");
+    if (!f) return false;
+
+    std::string header = encodeHeader(baseSize, baseMtime);
+    bool ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+    _file = f;
+    _journalBytes = header.size();
+
+    if (ok && checkpointRuns) {
+        ok = writeRecord(encodeCheckpoint(*checkpointRuns));
+        closeFile();
+        std::error_code ec;
+        if (ok) std::filesystem::rename(target, _journalPath, ec);
+        if (!ok || ec) return false;
+        _file = fopen(_journalPath.c_str(), "ab");
+        ok = _file != nullptr;
+    }
+    if (!ok) closeFile();
+    return ok;
+}
+
+bool EditJournal::writeRecord(const std::string& payload) {
+    std::string framing;
+    putU32(framing, (uint32_t)payload.size());
+    putU32(framing, crc32(payload.data(), payload.size()));
+    if (fwrite(framing.data(), 1, framing.size(), _file) != framing.size()) return false;
+    if (fwrite(payload.data(), 1, payload.size(), _file) != payload.size()) return false;
+    if (fflush(_file) != 0) return false;
+    _journalBytes += framing.size() + payload.size();
+    return true;
+}
+
+void EditJournal::closeFile() {
+    if (_file) {
+        fclose(_file);
+        _file = nullptr;
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include "edit_delta.h"
+
+const unsigned int JOURNAL_FLUSH_INTERVAL_MS = 1000;        // How often pending deltas are written out
+const uint64_t JOURNAL_CHECKPOINT_BYTES = 4 * 1024 * 1024;  // Journal growth since the last checkpoint that triggers a new one
+
+// One recovered journal entry: either a single delta, or a checkpoint that replaces
+// everything before it with a layout of the original file plus edited lines.
+struct JournalEntry {
+    bool checkpoint;
+    EditDelta delta;
+    std::vector<LineRun> runs;
+};
+
+// Append-only crash recovery journal for one buffer, stored next to the file as
+// "<file>.splice-journal". Deltas are queued in memory by record() and written in
+// batches by a background thread on a timer, so a keystroke costs a vector append.
+// Each batch is a length + CRC framed record, so a torn write at a crash only loses
+// that batch. Once the journal grows past JOURNAL_CHECKPOINT_BYTES the owner is asked
+// for a checkpoint and the journal is rewritten from it. The journal is tied to the
+// size and modification time of the file it was started for and is only replayed
+// against that exact file.
+class EditJournal {
+public:
+    EditJournal();
+    ~EditJournal();
+    EditJournal(const EditJournal&) = delete;
+    EditJournal& operator=(const EditJournal&) = delete;
+
+    static std::string journalPathFor(const std::string& path);
+
+    // Reads the journal left behind for path by a previous session. Returns false if there
+    // is none, it is unreadable or it was written against a different version of the file.
+    static bool recover(const std::string& path, uint64_t baseSize, int64_t baseMtime,
+                        std::vector<JournalEntry>& entries, std::string& error);
+
+    // Starts journaling edits of path. Nothing is written until the first edit is flushed.
+    void start(const std::string& path, uint64_t baseSize, int64_t baseMtime);
+    // Stops the flush thread and deletes the journal file. With keepFile, what is still
+    // pending is written out first and the file is left for recover(), for a buffer that
+    // is closed with unsaved edits.
+    void stop(bool keepFile = false);
+    bool isActive() const { return _active; }
+
+    void record(const EditDelta& delta);
+
+    // Checkpointing: when wantsCheckpoint() is true the owner passes the current layout of
+    // the buffer to checkpoint(); deltas recorded so far are dropped since it includes them.
+    bool wantsCheckpoint() const;
+    void checkpoint(std::vector<LineRun>&& runs);
+
+    // A save replaces the file the journal refers to. Deltas recorded between beginSave()
+    // and endSave() are kept so the journal can be restarted against the newly saved file.
+    void beginSave();
+    void endSave(bool succeeded, uint64_t baseSize, int64_t baseMtime);
+    // The file was replaced by one that matches the buffer, which was brought in line with
+    // it by edits (a reload): the journal starts over against it without those edits.
+    void rebase(uint64_t baseSize, int64_t baseMtime);
+
+private:
+    std::string _path;
+    std::string _journalPath;
+    uint64_t _baseSize;
+    int64_t _baseMtime;
+    bool _active;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    std::thread _flushThread;
+    bool _stopping;
+    bool _keepFile;  // Flush once more when stopping, and leave the file
+    std::vector<EditDelta> _pending;
+    bool _hasCheckpoint;
+    std::vector<LineRun> _checkpointRuns;
+    bool _restart;
+    uint64_t _journalBytes;
+    uint64_t _checkpointBytes;
+    bool _checkpointRequested;
+
+    bool _trackingSave;
+    std::vector<EditDelta> _sinceSave;
+
+    FILE* _file;
+
+    void flushMain();
+    bool openFile(const std::vector<LineRun>* checkpointRuns, uint64_t baseSize, int64_t baseMtime);
+    bool writeRecord(const std::string& payload);
+    void closeFile();
+};
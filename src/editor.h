@@ -8,13 +8,38 @@
 #include <filesystem>
 #include <map>
 #include <functional>
+#include <thread>
+#include <atomic>
+#include <memory>
 #include <nlohmann/json.hpp>
+#include "line_buffer.h"
+#include "line_diff.h"
+#include "edit_journal.h"
+#include "text_encoding.h"
+#include "file_watcher.h"
+#include "stdin_stream.h"
+#include "session_snapshot.h"
+#include "kv_store.h"
+#include "text_search.h"
+#include "text_regex.h"
+#include "search_session.h"
+#include "worker_pool.h"
+#include "project_search.h"
+#include "trigram_index.h"
+#include "keyword_matcher.h"
+#include "text_replace.h"
+#include "project_replace.h"
+#include "file_finder.h"
+#include "row_layout.h"
+#include "frame_buffer.h"
+#include "screen_output.h"
 
 enum EditorMode {
 	EDIT_MODE,
 	FILE_EXPLORER_MODE,
 	PROMPT_MODE,
-	TERMINAL_MODE
+	TERMINAL_MODE,
+	QUICK_OPEN_MODE
 };
 
 struct KeyCombination {
@@ -78,6 +103,14 @@ enum EditorCommand {
 };
 
 const int KILO_TAB_STOP = 8;
+const size_t LARGE_FILE_THRESHOLD = 64 * 1024 * 1024; // Files at least this big are memory-mapped
+const char* const SESSION_FILE_NAME = "splice.session";    // Written on exit next to keybindings.json, read on the next launch
+const char* const PLUGIN_DATA_FILE_NAME = "splice.plugindata"; // Plugin data store, next to the session file
+const ULONGLONG PAGER_FRAME_MS = 16;                   // Piped input is taken into the buffer at most once per frame
+const size_t PAGER_FRAME_BYTES = 8 * 1024 * 1024;      // and at most this much per frame, so a fast producer cannot starve the keyboard
+const ULONGLONG SEARCH_RECOUNT_INTERVAL_MS = 300;       // After edits, matches are counted again at most this often
+const ULONGLONG QUICK_OPEN_RERANK_MS = 200;             // Quick open ranks again at most this often while files are being found
+const size_t QUICK_OPEN_RESULTS = 200;                  // Best files quick open lists
 
 struct TerminalChar {
 	char c;
@@ -129,8 +162,7 @@ struct TextDecoration {
 
 struct Editor {
 public:
-    static std::map<std::string, std::string> plugin_data_storage;
-	std::vector<std::string> lines;
+	LineBuffer lines;
 	std::string filename;
 	int cursorX;
 	int cursorY;
@@ -149,6 +181,92 @@ public:
         LE_UNKNOWN // Mixed or not yet detected
     };
     LineEnding currentLineEnding = LE_CRLF;
+    FileEncoding currentEncoding;
+
+	// Background save. The writer thread only works on its own snapshot of the buffer and
+	// the save* results below; the main thread collects them in pollBackgroundWork().
+	std::thread saveThread;
+	bool saveInProgress = false;
+	std::atomic<bool> saveDone{false};
+	std::atomic<uint64_t> saveBytesWritten{0};
+	std::atomic<uint64_t> saveBytesTotal{0};
+	bool saveSucceeded = false;
+	std::string saveError;
+	std::string savePath;
+	uint64_t saveVersion = 0;
+	size_t saveLineCount = 0;
+	std::string_view saveLineEnding;
+	// The saved copy as the new base of the lines, built by the writer thread so that
+	// finishSave() only has to swap it in.
+	LineBuffer saveRebased;
+	bool saveRebasedOk = false;
+	void finishSave();
+
+	// Every buffer change goes through applyEdit() so it reaches the crash recovery journal.
+	EditJournal journal;
+	bool journalBaseStale = false;
+	void applyEdit(const EditDelta& delta);
+	void startJournal();
+
+	// Changes made to the open file by other programs are picked up by pollBackgroundWork();
+	// a clean buffer is reloaded in place, a dirty one only gets a message.
+	FileWatcher fileWatcher;
+	bool autoReload = true;
+	bool reloadFile();
+	static bool loadFileContent(const std::string& path, LineBuffer& target, size_t largeThreshold, const SessionLineIndex* cachedIndex,
+	                            FileEncoding& encoding, uint64_t& fileSize, std::string& error);
+
+	// Background reload. The reload thread loads the file into reloadFresh and diffs it
+	// against a snapshot of the buffer; the main thread applies the changed stretches in
+	// finishReload(), called from pollBackgroundWork().
+	std::thread reloadThread;
+	bool reloadInProgress = false;
+	bool reloadQueued = false;  // Another change came in, or the buffer was still indexing
+	std::atomic<bool> reloadDone{false};
+	std::atomic<bool> reloadCancel{false};
+	bool reloadSucceeded = false;
+	std::string reloadError;
+	uint64_t reloadVersion = 0;
+	FileStamp reloadStamp;
+	LineBuffer reloadFresh;
+	FileEncoding reloadEncoding;
+	uint64_t reloadFileSize = 0;
+	std::vector<LineHunk> reloadHunks;
+	void finishReload();
+	void cancelReload();
+	void shiftLineAnnotations(int row, int removed, int added);
+	void remapLineAnnotations(const std::function<int(int)>& newRow);
+	uint64_t diskSize = 0;  // Size of the file on disk the buffer was last loaded from or saved to
+
+	// Follow mode for growing files such as logs: appends are read and indexed as they
+	// happen instead of reloading. Past followMaxLines the oldest lines are dropped.
+	bool followMode = false;
+	bool followPinBottom = true;
+	size_t followMaxLines = 0;      // 0 keeps every line
+	size_t followDroppedLines = 0;  // Once lines were dropped the buffer no longer matches the file
+	void setFollowMode(bool enabled);
+	void followFile();
+	void trimFollowedLines();
+
+	// Pager mode ("producer | splice -"): the buffer fills from standard input as data
+	// arrives and is read-only.
+	std::unique_ptr<StdinStream> stdinStream;
+	bool pagingStdin = false;
+	bool readOnly = false;
+	ULONGLONG lastStdinPoll = 0;
+	void openStdin(std::unique_ptr<StdinStream> stream);
+	void pollStdin();
+	bool checkWritable();
+
+	// Session carried across launches: cursor and view of the open file, the resolved
+	// keymap and the line indexes of large files.
+	SessionSnapshot session;
+	void loadSession();
+	void saveSession();
+	bool openSessionBuffer(const std::string& requestedPath);
+
+	// Backs save_plugin_data/load_plugin_data; written behind in batches, flushed on exit.
+	KvStore pluginData;
 
 	// Keyboard events / Custom binds
 	std::map<KeyCombination, std::string> customKeybindings;
@@ -161,9 +279,25 @@ public:
 
 	lua_State* L;
 
-	std::vector<std::string> prevDrawnLines;
-	std::string prevStatusMessage;
-	std::string prevMessageBarMessage;
+	// Every draw function writes into the back buffer of frame; refreshScreen() presents
+	// it, sending screen only the cells that changed since the last frame.
+	ScreenOutput screen;
+	FrameBuffer frame;
+	// Scratch of drawScreenContent(), kept between rows and frames.
+	LineColumns rowColumns;
+	SpanLayers rowLayers;
+	// Content rows of the edit view to compose again; the others stand in the frame
+	// buffer as they were drawn. Edits, styling and highlights mark the rows they touch.
+	RowDamage contentDamage;
+	// What the content rows were composed for; when any of it changes, all of them are.
+	struct ContentView {
+		int rowOffset = -1;
+		int colOffset = -1;
+		int lineNumberWidth = -1;
+		int cols = -1;
+		bool operator==(const ContentView&) const = default;
+	};
+	ContentView drawnView;
 
 	EditorMode mode;
 	std::string currentDirPath;
@@ -171,9 +305,100 @@ public:
 	int selectedFileIndex;
 	int fileExplorerScrollOffset;
 
+	// Quick open: a fuzzy find over the files under currentDirPath, which fileFinder crawls
+	// in the background; the results are ranked again on every keystroke.
+	FileFinder fileFinder;
+	std::string quickOpenQuery;
+	std::vector<FileFinderResult> quickOpenResults;
+	int quickOpenSelected = 0;
+	int quickOpenScrollOffset = 0;
+	size_t quickOpenRankedFiles = 0;   // Files in the list when the results were ranked
+	ULONGLONG quickOpenRankTime = 0;
+
+	// Threads for searches split into chunks of the buffer; declared before the searches using it.
+	WorkerPool workers;
 	std::string searchQuery;
-	std::vector<std::pair<int, int>> searchResults;
-	int currentMatchIndex;
+	SearchOptions searchOptions;
+	// The search runs as the query is typed; see SearchSession for what is scanned when.
+	SearchSession searchSession;
+	SearchMatch currentMatch;
+	bool hasCurrentMatch = false;
+	size_t currentMatchOrdinal = 0;    // Position among all matches once the counter knows it, else 0
+	uint64_t currentMatchVersion = 0;  // Buffer version currentMatchOrdinal was worked out for
+	ULONGLONG searchCountStartTime = 0;
+	std::vector<SearchMatch> viewportMatches;  // Matches in the rows last drawn, for highlighting
+	uint64_t viewportMatchesVersion = 0;
+	int viewportMatchesRow = -1;
+	int viewportMatchesRows = 0;
+	// The search highlighting last drawn, so that a change of it marks just its rows.
+	bool drawnSearchActive = false;
+	bool drawnHasCurrentMatch = false;
+	SearchMatch drawnCurrentMatch = {};
+	// Replace all in the buffer, from the "Replace: " and "Replace with: " prompts or
+	// editor.replace_all(). The last one can be undone as a whole as long as nothing else
+	// changed the buffer since: the editor has no general undo, so this keeps just the
+	// inverse of that one batch of edits.
+	std::string replacePattern;
+	std::vector<EditDelta> replaceUndo;  // Applied last to first
+	PositionMap replaceUndoMap;
+	uint64_t replaceUndoVersion = 0;
+	int replaceUndoCursorX = 0;
+	int replaceUndoCursorY = 0;
+	void startReplacePrompt();
+	void continueReplacePrompt();
+	bool replaceAll(const std::string& pattern, const std::string& replacement, SearchOptions options, size_t& count, std::string& error);
+	bool undoReplace();
+	// Search in folder: the results replace the buffer, read-only, and stream in while
+	// the files are searched; Enter on a result opens the file there.
+	ProjectSearch projectSearch;
+	bool showingProjectSearch = false;   // The buffer holds the results of a folder search or replace
+	bool projectSearchStreaming = false; // Results are still being taken into the buffer
+	ULONGLONG projectSearchStartTime = 0;
+	void startProjectSearchPrompt();
+	bool startProjectSearch(const std::string& pattern, const std::string& root);
+	void pollProjectSearch();
+	bool openProjectSearchResult();
+	std::string projectResultsRoot;      // Folder the paths in the results are relative to
+	void showProjectResults(const std::string& header, const std::string& root);
+	// Replace in folder: the prompts run a dry run first, whose report fills the buffer
+	// like search results; applyFolderReplace() then rewrites the files. A replace started
+	// with a file open replaces that file in the buffer instead of on disk.
+	ProjectReplace projectReplace;
+	bool projectReplaceStreaming = false;   // The replace is running and pollProjectReplace() follows it
+	bool projectReplaceIntoBuffer = false;  // The results buffer shows its report
+	std::string projectReplaceOpenPath;     // File left for the buffer to replace, if any
+	ULONGLONG projectReplaceStartTime = 0;
+	void startFolderReplacePrompt();
+	bool startFolderReplace(const std::string& pattern, const std::string& replacement, SearchOptions options,
+	                        const std::string& root, bool dryRun);
+	bool applyFolderReplace();
+	void pollProjectReplace();
+	// Trigram index of the folder last searched, if it has one; once a folder is indexed,
+	// searches that find it out of date bring it up to date in the background.
+	std::shared_ptr<const TrigramIndex> projectIndex;
+	TrigramIndexer projectIndexer;
+	bool indexFolder(const std::string& root);
+	void pollProjectIndexer();
+	// Last pattern compiled for the Lua regex functions, reused while plugins keep asking for it.
+	Regex luaRegex;
+	std::string luaRegexPattern;
+	bool luaRegexCaseSensitive = true;
+	// Last keyword list built for editor.find_keywords(), reused the same way.
+	KeywordMatcher luaKeywords;
+	std::vector<std::string> luaKeywordList;
+	SearchOptions luaKeywordOptions;
+	// Keyword sets plugins have colored, in the order they were set; the visible rows are
+	// matched against each of them when drawn, and a later set wins where two overlap.
+	struct KeywordHighlight {
+		std::string id;
+		KeywordMatcher matcher;
+		unsigned int color;
+	};
+	std::vector<KeywordHighlight> keywordHighlights;
+	std::vector<std::pair<KeywordMatch, unsigned int>> viewportKeywords;  // With their color, for the rows last drawn
+	uint64_t viewportKeywordsVersion = 0;
+	int viewportKeywordsRow = -1;      // -1 after the sets change
+	int viewportKeywordsRows = 0;
 	int originalCursorX, originalCursorY;
 	int originalRowOffset, originalColOffset;
 	std::string promptMessage;
@@ -226,10 +451,21 @@ public:
 	void moveFileExplorerSelection(int key);
 	void handleFileExplorerEnter();
 
+	void startQuickOpen();
+	void closeQuickOpen();
+	void updateQuickOpen();
+	void moveQuickOpenSelection(int key);
+	bool openQuickOpenSelection();
+	void pollQuickOpen();
+
 	void startSearch();
 	void  performSearch();
+	void updateIncrementalSearch();
 	void findNext();
 	void findPrevious();
+	void jumpToMatch(const SearchMatch& match);
+	void refreshSearchCount();
+	std::string searchStatus();
 
 	bool promptUser(const std::string& prompt, int input_c, std::string& result);
 
@@ -247,15 +483,21 @@ public:
     std::vector<LuaCallback> onKeyPressCallbacks;
     std::vector<LuaCallback> onFileOpenedCallbacks;
     std::vector<LuaCallback> onFileSavedCallbacks;
+    std::vector<LuaCallback> onFileSaveFailedCallbacks;
+    std::vector<LuaCallback> onFileReloadedCallbacks;
     std::vector<LuaCallback> onBufferChangedCallbacks;
     std::vector<LuaCallback> onCursorMovedCallbacks;
     std::vector<LuaCallback> onModeChangedCallbacks;
 
     bool ctrl_pressed = false;
     std::string promptResult;
+    // Composes every row again and sends the whole screen, for when something other
+    // than the frame buffer wrote to it.
     void force_full_redraw_internal();
+    // Marks file rows [fromRow, toRow) to be composed again, as far as they are on screen.
+    void damageFileRows(size_t fromRow, size_t toRow);
+    void damageAllRows();
     void clearScreen();
-	void setCursorVisibility(bool visible);
 
 	void toggleTerminal();
 	void startTerminal();
@@ -274,12 +516,15 @@ public:
     void triggerEvent(const std::string& eventName, int param = 0);
     void triggerEvent(const std::string& eventName, const std::string& param);
 	void calculateLineNumberWidth();
+    void detectLineEnding();
 
     bool setConsoleFont(const ConsoleFontInfo& fontInfo);
     ConsoleFontInfo getCurrentConsoleFont();
     std::vector<ConsoleFontInfo> getAvailableConsoleFonts();
 
     int kiloTabStop = KILO_TAB_STOP;
+    size_t largeFileThreshold = LARGE_FILE_THRESHOLD;
+    void pollBackgroundWork();
     void show_error(const std::string& message, ULONGLONG duration_ms = 8000);
 	void show_message(const std::string& message, ULONGLONG duration_ms = 8000);
 	void processInput(int raw_key_code, char ascii_char, DWORD control_key_state);
@@ -292,6 +537,8 @@ public:
 	void clearLineStyling(int lineNum, int startCol = 1, int endCol = -1); // -1 means until end of line
 	void addTextDecoration(const std::string& id, int lineNum, int startCol, int endCol, TextDecorationType type, const std::string& tooltip = "", unsigned int color = 0);
 	void clearDecorations(const std::string& idPrefix = ""); // Clear all if prefix is empty
+	void setKeywordHighlight(const std::string& id, KeywordMatcher matcher, unsigned int rgbColor); // Replaces the set with the same id
+	void clearKeywordHighlights(const std::string& idPrefix = ""); // Clear all if prefix is empty
 	void showTooltip(int screenX, int screenY, const std::string& message, ULONGLONG duration_ms);
 
 private:
@@ -306,6 +553,7 @@ private:
 	std::string getRenderedLine(int fileRow);
 
 	void drawFileExplorer();
+	void drawQuickOpen();
 
 	void applyStylingInternal(int lineNum, int startCol, int endCol, std::function<void(TextStyling&)> applyFunc);
 };
\ No newline at end of file
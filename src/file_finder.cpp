@@ -0,0 +1,327 @@
+#include "file_finder.h"
+#include "project_search.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+
+namespace {
+
+const int SCORE_MATCH = 16;
+const int BONUS_NAME_START = 12;    // At the start of the path or after a separator
+const int BONUS_WORD_START = 9;     // After '_', '-', '.' or a space
+const int BONUS_CAMEL_CASE = 8;     // A capital after a lower case letter
+const int BONUS_CONSECUTIVE = 5;    // Right after the character before it
+const int BONUS_FILE_NAME = 3;      // In the last name of the path
+const int PENALTY_GAP_START = 3;
+const int PENALTY_GAP_EXTENSION = 1;
+const int PENALTY_GAP_MAX = 15;
+
+// Lower case for ASCII letters, '/' for '\', everything else as it is.
+struct FoldTable {
+    unsigned char map[256];
+    FoldTable() {
+        for (int c = 0; c < 256; ++c) map[c] = (unsigned char)c;
+        for (int c = 'A'; c <= 'Z'; ++c) map[c] = (unsigned char)(c - 'A' + 'a');
+        map[(unsigned char)'\\'] = '/';
+    }
+};
+const FoldTable foldTable;
+
+struct RankedPath {
+    uint32_t block;
+    uint32_t index;
+    int score;
+};
+
+}
+
+static inline unsigned char fold(char c) {
+    return foldTable.map[(unsigned char)c];
+}
+
+static inline int charBit(unsigned char folded) {
+    if (folded >= 'a' && folded <= 'z') return folded - 'a';
+    if (folded >= '0' && folded <= '9') return 26 + (folded - '0');
+    switch (folded) {
+    case '/': return 36;
+    case '.': return 37;
+    case '_': return 38;
+    case '-': return 39;
+    default: return 40 + folded % 24;
+    }
+}
+
+uint64_t fuzzyCharMask(std::string_view text) {
+    uint64_t mask = 0;
+    for (char c : text) mask |= uint64_t(1) << charBit(fold(c));
+    return mask;
+}
+
+// Bonus for a match at path[i] from the character before it.
+static int boundaryBonus(std::string_view path, size_t i) {
+    if (i == 0) return BONUS_NAME_START;
+    char before = path[i - 1];
+    if (before == '/' || before == '\\') return BONUS_NAME_START;
+    if (before == '_' || before == '-' || before == '.' || before == ' ') return BONUS_WORD_START;
+    if (before >= 'a' && before <= 'z' && path[i] >= 'A' && path[i] <= 'Z') return BONUS_CAMEL_CASE;
+    return 0;
+}
+
+FuzzyQuery::FuzzyQuery(std::string_view query) {
+    for (char c : query) {
+        if (c == ' ') continue;
+        if (_text.size() == FILE_FINDER_MAX_QUERY) break;
+        _text.push_back((char)fold(c));
+    }
+    _mask = fuzzyCharMask(_text);
+}
+
+int FuzzyQuery::score(std::string_view path, std::vector<uint32_t>* positions) const {
+    if (positions) positions->clear();
+    size_t m = _text.size();
+    size_t n = path.size();
+    if (m == 0) return 0;
+    if (m > n) return FUZZY_NO_MATCH;
+
+    // From the right, the last place the query fits: it ends at the last occurrence of its
+    // last character and starts where the scan finds its first one. Most paths that pass
+    // the mask but do not match fail here, without any scoring.
+    size_t start = 0;
+    size_t end = n;
+    size_t nameStart = 0;  // Where the last name starts, if that is after start
+    size_t q = m;
+    for (size_t i = n; i-- > 0;) {
+        unsigned char c = fold(path[i]);
+        if (c == '/' && nameStart == 0) nameStart = i + 1;
+        if (c != (unsigned char)_text[q - 1]) continue;
+        if (q == m) end = i + 1;
+        if (--q == 0) {
+            start = i;
+            break;
+        }
+    }
+    if (q != 0) return FUZZY_NO_MATCH;
+
+    // Forward from there, each character as early as it fits, which keeps the match tight.
+    int score = 0;
+    size_t previous = std::string_view::npos;
+    q = 0;
+    for (size_t i = start; i < end && q < m; ++i) {
+        if (fold(path[i]) != (unsigned char)_text[q]) continue;
+        score += SCORE_MATCH + boundaryBonus(path, i);
+        if (i >= nameStart) score += BONUS_FILE_NAME;
+        if (previous != std::string_view::npos) {
+            if (i == previous + 1) score += BONUS_CONSECUTIVE;
+            else score -= std::min(PENALTY_GAP_MAX, PENALTY_GAP_START + (int)(i - previous - 2) * PENALTY_GAP_EXTENSION);
+        }
+        if (positions) positions->push_back((uint32_t)i);
+        previous = i;
+        ++q;
+    }
+    return score;
+}
+
+// Scores the paths of block that pass the mask, only those in previous if it is given,
+// keeping the indices that matched in candidates and the best limit of them in best.
+static void rankBlock(const FileListBlock& block, uint32_t blockIndex, const FuzzyQuery& query,
+                      const std::vector<uint32_t>* previous, size_t limit, std::vector<uint32_t>& candidates,
+                      std::vector<RankedPath>& best) {
+    uint64_t mask = query.mask();
+    std::vector<uint32_t> passed;
+    if (previous) {
+        passed.reserve(previous->size());
+        for (uint32_t i : *previous) {
+            if ((block.masks[i] & mask) == mask) passed.push_back(i);
+        }
+    } else {
+        // Branch-free so the compiler can vectorize it: every index is written, and the
+        // count only moves past the ones whose mask holds the query's.
+        size_t size = block.size();
+        passed.resize(size + 1);
+        size_t count = 0;
+        const uint64_t* masks = block.masks.data();
+        for (size_t i = 0; i < size; ++i) {
+            passed[count] = (uint32_t)i;
+            count += (masks[i] & mask) == mask;
+        }
+        passed.resize(count);
+    }
+
+    // Only the best limit paths of a block can be among the best of all. They are kept in
+    // a heap with the worst on top, which most paths do not get past.
+    auto better = [&block](const RankedPath& a, const RankedPath& b) {
+        if (a.score != b.score) return a.score > b.score;
+        std::string_view pathA = block.path(a.index);
+        std::string_view pathB = block.path(b.index);
+        if (pathA.size() != pathB.size()) return pathA.size() < pathB.size();
+        return pathA < pathB;
+    };
+    candidates.reserve(passed.size());
+    for (uint32_t i : passed) {
+        int score = query.score(block.path(i));
+        if (score == FUZZY_NO_MATCH) continue;
+        candidates.push_back(i);
+        RankedPath ranked = { blockIndex, i, score };
+        if (best.size() < limit) {
+            best.push_back(ranked);
+            std::push_heap(best.begin(), best.end(), better);
+        } else if (score >= best.front().score && better(ranked, best.front())) {
+            std::pop_heap(best.begin(), best.end(), better);
+            best.back() = ranked;
+            std::push_heap(best.begin(), best.end(), better);
+        }
+    }
+}
+
+FileFinder::FileFinder() : _cancel(false), _running(false), _count(0) {}
+
+FileFinder::~FileFinder() {
+    cancel();
+}
+
+void FileFinder::start(const std::string& root) {
+    cancel();
+    bool refresh;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        refresh = root == _root && !_blocks.empty();
+        if (!refresh) {
+            _blocks.clear();
+            _count = 0;
+        }
+    }
+    _root = root;
+    _cancel = false;
+    _running = true;
+    _thread = std::thread([this, refresh]() {
+        crawl(refresh);
+        _running = false;
+    });
+}
+
+void FileFinder::cancel() {
+    if (!_thread.joinable()) return;
+    if (_running) _cancel = true;
+    _thread.join();
+}
+
+size_t FileFinder::fileCount() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _count;
+}
+
+size_t FileFinder::memoryUsed() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t bytes = 0;
+    for (const auto& block : _blocks) {
+        bytes += block->text.capacity() + block->ends.capacity() * sizeof(uint32_t) + block->masks.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+void FileFinder::crawl(bool refresh) {
+    BlockList fresh;  // The whole new list, when it replaces the old one at the end
+    size_t freshCount = 0;
+    auto block = std::make_shared<FileListBlock>();
+    auto lastPublished = std::chrono::steady_clock::now();
+
+    auto publish = [&]() {
+        if (block->size() == 0) return;
+        block->text.shrink_to_fit();
+        block->ends.shrink_to_fit();
+        block->masks.shrink_to_fit();
+        std::shared_ptr<const FileListBlock> done = std::move(block);
+        block = std::make_shared<FileListBlock>();
+        lastPublished = std::chrono::steady_clock::now();
+        if (refresh) {
+            freshCount += done->size();
+            fresh.push_back(std::move(done));
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _count += done->size();
+        _blocks.push_back(std::move(done));
+    };
+
+    walkProjectFiles(_root, _cancel, [&](ProjectFile& file) {
+        block->text += file.display;
+        block->ends.push_back((uint32_t)block->text.size());
+        block->masks.push_back(fuzzyCharMask(file.display));
+        if (block->size() >= FILE_FINDER_BLOCK_PATHS ||
+            (!refresh && std::chrono::steady_clock::now() - lastPublished >= std::chrono::milliseconds(FILE_FINDER_PUBLISH_MS))) {
+            publish();
+        }
+        return true;
+    });
+    publish();
+
+    if (refresh && !_cancel) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _blocks.swap(fresh);
+        _count = freshCount;
+    }
+}
+
+std::vector<FileFinderResult> FileFinder::find(WorkerPool& pool, std::string_view query, size_t limit) {
+    BlockList blocks;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        blocks = _blocks;
+    }
+    std::vector<FileFinderResult> results;
+    FuzzyQuery fuzzy(query);
+    if (fuzzy.empty() || limit == 0) {
+        for (size_t b = 0; b < blocks.size() && results.size() < limit; ++b) {
+            for (size_t i = 0; i < blocks[b]->size() && results.size() < limit; ++i) {
+                results.push_back({ std::string(blocks[b]->path(i)), 0 });
+            }
+        }
+        _lastQuery.clear();
+        _lastBlocks.clear();
+        _lastCandidates.clear();
+        return results;
+    }
+
+    // A query that extends the last one can only match what that matched.
+    bool narrowing = !_lastQuery.empty() && fuzzy.text().compare(0, _lastQuery.size(), _lastQuery) == 0;
+    std::vector<std::vector<uint32_t>> candidates(blocks.size());
+    std::vector<std::vector<RankedPath>> best(blocks.size());
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t running = blocks.size();
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        const std::vector<uint32_t>* previous =
+            narrowing && b < _lastBlocks.size() && _lastBlocks[b] == blocks[b] ? &_lastCandidates[b] : nullptr;
+        pool.submit([&, b, previous]() {
+            rankBlock(*blocks[b], (uint32_t)b, fuzzy, previous, limit, candidates[b], best[b]);
+            std::lock_guard<std::mutex> lock(mutex);
+            --running;
+            finished.notify_all();
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&running]() { return running == 0; });
+    }
+
+    std::vector<RankedPath> ranked;
+    for (auto& blockBest : best) ranked.insert(ranked.end(), blockBest.begin(), blockBest.end());
+    auto better = [&blocks](const RankedPath& a, const RankedPath& b) {
+        if (a.score != b.score) return a.score > b.score;
+        std::string_view pathA = blocks[a.block]->path(a.index);
+        std::string_view pathB = blocks[b.block]->path(b.index);
+        if (pathA.size() != pathB.size()) return pathA.size() < pathB.size();
+        return pathA < pathB;
+    };
+    size_t kept = std::min(limit, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end(), better);
+    results.reserve(kept);
+    for (size_t i = 0; i < kept; ++i) {
+        results.push_back({ std::string(blocks[ranked[i].block]->path(ranked[i].index)), ranked[i].score });
+    }
+
+    _lastQuery = fuzzy.text();
+    _lastBlocks = std::move(blocks);
+    _lastCandidates = std::move(candidates);
+    return results;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "worker_pool.h"
+
+const size_t FILE_FINDER_BLOCK_PATHS = 8192;  // Most paths in one block of the file list, which one task ranks
+const int FILE_FINDER_PUBLISH_MS = 50;        // Longest a partial block is held back while crawling
+const size_t FILE_FINDER_MAX_QUERY = 64;      // Characters of a query that count; the rest is ignored
+const int FUZZY_NO_MATCH = -1000000;
+
+// A run of paths of the file list, immutable once published. The paths are kept back to
+// back in one arena with where each ends, and with the character mask of each path
+// alongside, so ranking reads three contiguous arrays and never chases a pointer per path.
+struct FileListBlock {
+    std::string text;              // The paths, relative to the root with the platform's separators
+    std::vector<uint32_t> ends;    // Where each path ends in text; it starts where the one before ends
+    std::vector<uint64_t> masks;   // fuzzyCharMask() of each path
+
+    size_t size() const { return ends.size(); }
+    std::string_view path(size_t i) const {
+        uint32_t start = i == 0 ? 0 : ends[i - 1];
+        return std::string_view(text.data() + start, ends[i] - start);
+    }
+};
+
+// Bit set of the characters text contains, case folded and with '\' as '/'. A path can
+// only match a query whose mask is a subset of its own, which rules most paths out with
+// one AND before their text is looked at.
+uint64_t fuzzyCharMask(std::string_view text);
+
+// A quick-open query: its characters have to appear in a path in order but not next to
+// each other, ignoring case, and spaces in it are ignored. Matches are scored by where
+// the characters land: at the start of a name, after '_', '-' or '.', or at a capital in
+// the middle of a word score higher, runs of consecutive characters score higher, and the
+// gaps between them cost. The characters are placed as far right as they fit, so a query
+// that matches the file name beats one that only matches its folders.
+class FuzzyQuery {
+public:
+    explicit FuzzyQuery(std::string_view query);
+    bool empty() const { return _text.empty(); }
+    const std::string& text() const { return _text; }
+    uint64_t mask() const { return _mask; }
+
+    // Score of path, or FUZZY_NO_MATCH. positions, if given, gets the offsets of the
+    // matched characters.
+    int score(std::string_view path, std::vector<uint32_t>* positions = nullptr) const;
+
+private:
+    std::string _text;  // Folded
+    uint64_t _mask;
+};
+
+struct FileFinderResult {
+    std::string path;  // Relative to the root
+    int score;
+};
+
+// The files under a folder for quick open, crawled in the background with the rules of a
+// folder search (see walkProjectFiles()) and published a block at a time, so a query can
+// rank the files found so far while the crawl goes on. A crawl of the folder the list
+// already holds refreshes it: the old list stays in use until the new one is complete.
+//
+// find() ranks every block on the worker pool. It remembers which paths of each block
+// matched the last query, and a query that extends it only scores those again, so each
+// keystroke of a query looks at fewer paths than the one before.
+class FileFinder {
+public:
+    FileFinder();
+    ~FileFinder();
+    FileFinder(const FileFinder&) = delete;
+    FileFinder& operator=(const FileFinder&) = delete;
+
+    // Cancels a crawl in progress and crawls root.
+    void start(const std::string& root);
+    void cancel();
+    bool crawling() const { return _running; }
+    const std::string& root() const { return _root; }
+    // Files in the list, which grows while the first crawl of a folder runs.
+    size_t fileCount() const;
+    // Sums of the lists' arena and index sizes.
+    size_t memoryUsed() const;
+
+    // The best limit files for query, best first; an empty query lists the files in
+    // crawl order. Called from one thread only, as it keeps what the last query matched.
+    std::vector<FileFinderResult> find(WorkerPool& pool, std::string_view query, size_t limit);
+
+private:
+    using BlockList = std::vector<std::shared_ptr<const FileListBlock>>;
+
+    std::string _root;
+    std::thread _thread;
+    std::atomic<bool> _cancel;
+    std::atomic<bool> _running;
+    mutable std::mutex _mutex;  // Guards _blocks and _count
+    BlockList _blocks;
+    size_t _count;
+
+    // What the last query matched, by block: indices into the block, ascending.
+    std::string _lastQuery;
+    BlockList _lastBlocks;
+    std::vector<std::vector<uint32_t>> _lastCandidates;
+
+    void crawl(bool refresh);
+};
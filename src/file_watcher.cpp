@@ -0,0 +1,151 @@
+#include "file_watcher.h"
+
+#include <filesystem>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+FileStamp FileStamp::of(const std::string& path) {
+    FileStamp stamp;
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(path, ec);
+    if (ec) return stamp;
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    if (ec) return stamp;
+    stamp.exists = true;
+    stamp.size = size;
+    stamp.mtime = (int64_t)mtime.time_since_epoch().count();
+    return stamp;
+}
+
+FileWatcher::FileWatcher() : _watching(false), _changePending(false), _notifications(false), _settleMs(FILE_WATCH_SETTLE_MS),
+#ifdef _WIN32
+    _hChange(INVALID_HANDLE_VALUE)
+#else
+    _inotifyFd(-1), _watchDescriptor(-1)
+#endif
+{}
+
+FileWatcher::~FileWatcher() {
+    stop();
+}
+
+bool FileWatcher::watch(const std::string& path) {
+    stop();
+    _path = path;
+    _stamp = FileStamp::of(path);
+    _changePending = false;
+
+    _lastStat = std::chrono::steady_clock::now();
+    _watching = true;
+
+    std::filesystem::path filePath(path);
+    std::string directory = filePath.has_parent_path() ? filePath.parent_path().string() : ".";
+
+#ifdef _WIN32
+    HANDLE hChange = FindFirstChangeNotificationA(directory.c_str(), FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    if (hChange == INVALID_HANDLE_VALUE) return false;
+    _hChange = hChange;
+#else
+    _inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotifyFd < 0) return false;
+    _watchDescriptor = inotify_add_watch(_inotifyFd, directory.c_str(),
+        IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    if (_watchDescriptor < 0) {
+        ::close(_inotifyFd);
+        _inotifyFd = -1;
+        return false;
+    }
+    _name = filePath.filename().string();
+#endif
+    _notifications = true;
+    return true;
+}
+
+void FileWatcher::stop() {
+#ifdef _WIN32
+    if (_hChange != INVALID_HANDLE_VALUE) {
+        FindCloseChangeNotification((HANDLE)_hChange);
+        _hChange = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (_inotifyFd >= 0) {
+        ::close(_inotifyFd);
+        _inotifyFd = -1;
+        _watchDescriptor = -1;
+    }
+#endif
+    _watching = false;
+    _notifications = false;
+    _changePending = false;
+}
+
+#ifdef _WIN32
+
+bool FileWatcher::drainEvents() {
+    // The handle only says that something in the directory changed; the stamp
+    // comparison in poll() decides whether it was our file.
+    if (WaitForSingleObject((HANDLE)_hChange, 0) != WAIT_OBJECT_0) return false;
+    FindNextChangeNotification((HANDLE)_hChange);
+    return true;
+}
+
+#else
+
+bool FileWatcher::drainEvents() {
+    alignas(struct inotify_event) char events[4096];
+    bool relevant = false;
+    while (true) {
+        ssize_t count = read(_inotifyFd, events, sizeof(events));
+        if (count <= 0) break;
+        for (char* p = events; p < events + count; ) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                relevant = true;
+            } else if (event->len > 0 && _name == event->name) {
+                relevant = true;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return relevant;
+}
+
+#endif
+
+bool FileWatcher::poll() {
+    if (!_watching) return false;
+
+    auto now = std::chrono::steady_clock::now();
+    if (_notifications) {
+        if (drainEvents()) {
+            _changePending = true;
+            _lastEvent = now;
+        }
+    } else if (now - _lastStat >= std::chrono::milliseconds(FILE_WATCH_POLL_INTERVAL_MS)) {
+        _lastStat = now;
+        _changePending = true;
+        _lastEvent = now - std::chrono::milliseconds(_settleMs);
+    }
+    if (!_changePending) return false;
+    if (now - _lastEvent < std::chrono::milliseconds(_settleMs)) return false;
+
+    _changePending = false;
+    FileStamp current = FileStamp::of(_path);
+    // A file that is gone is usually about to be replaced; wait for the new copy.
+    if (!current.exists || current == _stamp) return false;
+    _stamp = current;
+    return true;
+}
+
+void FileWatcher::acknowledge() {
+    _stamp = FileStamp::of(_path);
+    _changePending = false;
+}
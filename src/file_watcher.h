@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <chrono>
+
+const unsigned int FILE_WATCH_SETTLE_MS = 100;        // Quiet time after the last change before it is reported, so half-written files are not picked up
+const unsigned int FILE_WATCH_POLL_INTERVAL_MS = 500;  // How often the file is stat'ed when no change notifications are available
+
+// Size and modification time of a file, used to tell real changes apart from
+// notifications for other files in the same directory.
+struct FileStamp {
+    bool exists = false;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+
+    static FileStamp of(const std::string& path);
+    bool operator==(const FileStamp& other) const {
+        return exists == other.exists && size == other.size && mtime == other.mtime;
+    }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+// Watches one file for changes made by other programs. The parent directory is
+// watched (inotify on Linux, a change notification handle on Windows) so editors
+// and tools that replace the file by renaming a new copy over it are seen too.
+// Where notifications cannot be set up the file is polled by size and modification time
+// instead. poll() never blocks and is meant to be called from the main loop.
+class FileWatcher {
+public:
+    FileWatcher();
+    ~FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Returns false if change notifications are unavailable; the file is still polled then.
+    bool watch(const std::string& path);
+    void stop();
+    bool isWatching() const { return _watching; }
+    const std::string& path() const { return _path; }
+
+    // True once per settled change of the file since the last poll() or acknowledge().
+    bool poll();
+    // Takes the current state of the file as seen, e.g. after the editor wrote it itself.
+    void acknowledge();
+    const FileStamp& stamp() const { return _stamp; }
+    // Writers that never pause (a busy log) would starve a settle delay; followers use 0.
+    void setSettleDelay(unsigned int milliseconds) { _settleMs = milliseconds; }
+
+private:
+    std::string _path;
+    FileStamp _stamp;
+    bool _watching;
+    bool _changePending;
+    bool _notifications;
+    unsigned int _settleMs;
+    std::chrono::steady_clock::time_point _lastEvent;
+    std::chrono::steady_clock::time_point _lastStat;
+
+#ifdef _WIN32
+    void* _hChange;
+#else
+    int _inotifyFd;
+    int _watchDescriptor;
+    std::string _name;
+#endif
+
+    bool drainEvents();
+};
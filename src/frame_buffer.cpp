@@ -0,0 +1,172 @@
+#include "frame_buffer.h"
+#include "screen_output.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// Stands in the front buffer for cells the screen holds but nobody knows what: no cell
+// drawn is ever equal to it, since colors only take four bits.
+static const Cell UNKNOWN_CELL = { '\0', 0xFF, 0xFF, 0xFF };
+
+FrameBuffer::FrameBuffer()
+    : _cols(0), _rows(0), _frontValid(false), _cursorCol(0), _cursorRow(0), _cursorVisible(true),
+      _scrollTop(0), _scrollBottom(0), _scrollDelta(0) {}
+
+void FrameBuffer::resize(int cols, int rows) {
+    _cols = std::max(0, cols);
+    _rows = std::max(0, rows);
+    _back.assign((size_t)_cols * _rows, Cell());
+    _front.assign((size_t)_cols * _rows, Cell());
+    _frontValid = false;
+    _scrollDelta = 0;
+}
+
+void FrameBuffer::write(int row, int col, std::string_view text, const uint16_t* attributes) {
+    if (row < 0 || row >= _rows || col >= _cols) return;
+    size_t skip = col < 0 ? (size_t)-col : 0;
+    if (skip >= text.size()) return;
+    col += (int)skip;
+    size_t count = std::min(text.size() - skip, (size_t)(_cols - col));
+    Cell* cells = backRow(row) + col;
+    for (size_t i = 0; i < count; ++i) cells[i] = Cell::fromAttribute(text[skip + i], attributes[skip + i]);
+}
+
+void FrameBuffer::write(int row, int col, std::string_view text, uint16_t attribute) {
+    if (row < 0 || row >= _rows || col >= _cols) return;
+    size_t skip = col < 0 ? (size_t)-col : 0;
+    if (skip >= text.size()) return;
+    col += (int)skip;
+    size_t count = std::min(text.size() - skip, (size_t)(_cols - col));
+    Cell* cells = backRow(row) + col;
+    Cell style = Cell::fromAttribute(' ', attribute);
+    for (size_t i = 0; i < count; ++i) {
+        cells[i] = style;
+        cells[i].glyph = text[skip + i];
+    }
+}
+
+void FrameBuffer::clearRow(int row, int col, uint16_t attribute) {
+    if (row < 0 || row >= _rows) return;
+    col = std::max(0, col);
+    if (col >= _cols) return;
+    std::fill(backRow(row) + col, backRow(row) + _cols, Cell::fromAttribute(' ', attribute));
+}
+
+void FrameBuffer::blank(uint16_t attribute) {
+    std::fill(_back.begin(), _back.end(), Cell::fromAttribute(' ', attribute));
+}
+
+void FrameBuffer::scroll(int top, int bottom, int delta) {
+    top = std::max(0, top);
+    bottom = std::min(bottom, _rows);
+    int height = bottom - top;
+    if (delta == 0 || height <= 0) return;
+    if (std::abs(delta) < height) {
+        Cell* first = backRow(top);
+        Cell* last = backRow(bottom);
+        size_t shift = (size_t)std::abs(delta) * _cols;
+        if (delta > 0) std::copy(first + shift, last, first);
+        else std::copy_backward(first, last - shift, last);
+    }
+
+    // Scrolls of one region in the same frame add up; scrolls of two regions are left
+    // to the diff.
+    if (_scrollDelta != 0 && (top != _scrollTop || bottom != _scrollBottom)) {
+        _scrollDelta = 0;
+        return;
+    }
+    _scrollTop = top;
+    _scrollBottom = bottom;
+    _scrollDelta += delta;
+    if (std::abs(_scrollDelta) >= height) _scrollDelta = 0;
+}
+
+void FrameBuffer::setCursor(int col, int row, bool visible) {
+    _cursorCol = std::max(0, std::min(col, _cols - 1));
+    _cursorRow = std::max(0, std::min(row, _rows - 1));
+    _cursorVisible = visible;
+}
+
+void FrameBuffer::invalidate() {
+    _frontValid = false;
+}
+
+void FrameBuffer::cleared(uint16_t attribute) {
+    std::fill(_front.begin(), _front.end(), Cell::fromAttribute(' ', attribute));
+    _back = _front;
+    _frontValid = true;
+}
+
+size_t FrameBuffer::changedCells(const Cell* back, const Cell* front) const {
+    if (!front) return _cols;
+    if (memcmp(back, front, _cols * sizeof(Cell)) == 0) return 0;
+    size_t changed = 0;
+    for (int col = 0; col < _cols; ++col) changed += back[col] != front[col];
+    return changed;
+}
+
+// Whether moving the rows on the screen and then sending what still differs costs less
+// than sending what differs where the rows are now. Cells stand in for bytes.
+bool FrameBuffer::scrollPays() {
+    size_t inPlace = 0;
+    size_t scrolled = FRAME_SCROLL_COST;
+    for (int row = _scrollTop; row < _scrollBottom; ++row) {
+        int from = row + _scrollDelta;
+        bool kept = from >= _scrollTop && from < _scrollBottom;
+        inPlace += changedCells(backRow(row), frontRow(row));
+        scrolled += changedCells(backRow(row), kept ? frontRow(from) : nullptr);
+    }
+    return scrolled < inPlace;
+}
+
+// The front buffer follows the rows the screen moved. What the screen shows in the rows
+// moved in depends on the terminal, so they are sent in full.
+void FrameBuffer::scrollFront() {
+    Cell* first = frontRow(_scrollTop);
+    Cell* last = frontRow(_scrollBottom);
+    size_t shift = (size_t)std::abs(_scrollDelta) * _cols;
+    if (_scrollDelta > 0) {
+        std::copy(first + shift, last, first);
+        std::fill(last - shift, last, UNKNOWN_CELL);
+    } else {
+        std::copy_backward(first, last - shift, last);
+        std::fill(first, first + shift, UNKNOWN_CELL);
+    }
+}
+
+size_t FrameBuffer::present(ScreenOutput& output) {
+    if (_scrollDelta != 0) {
+        if (_frontValid && scrollPays() && output.scrollRows(_scrollTop, _scrollBottom, _scrollDelta)) {
+            scrollFront();
+        }
+        _scrollDelta = 0;
+    }
+
+    size_t sent = 0;
+    for (int row = 0; row < _rows; ++row) {
+        Cell* back = backRow(row);
+        Cell* front = frontRow(row);
+        if (_frontValid && memcmp(back, front, _cols * sizeof(Cell)) == 0) continue;
+
+        int col = 0;
+        while (col < _cols) {
+            if (_frontValid && back[col] == front[col]) {
+                ++col;
+                continue;
+            }
+            // A run ends at the last changed cell before a gap of FRAME_RUN_GAP unchanged ones.
+            int start = col;
+            int end = col + 1;
+            for (int next = end; next < _cols && next - end < FRAME_RUN_GAP; ++next) {
+                if (!_frontValid || back[next] != front[next]) end = next + 1;
+            }
+            output.drawRun(row, start, back + start, end - start);
+            std::copy(back + start, back + end, front + start);
+            sent += end - start;
+            col = end;
+        }
+    }
+    _frontValid = true;
+    output.endFrame(_cursorCol, _cursorRow, _cursorVisible);
+    return sent;
+}
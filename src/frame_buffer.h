@@ -0,0 +1,142 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Colors of a cell are the sixteen of the console palette: bit 0 blue, bit 1 green, bit 2
+// red, bit 3 bright, as the low and high nibble of a console attribute hold them.
+const uint8_t CELL_UNDERLINE = 0x01;
+const uint8_t CELL_REVERSE = 0x02;
+
+const uint16_t ATTRIBUTE_REVERSE = 0x4000;    // COMMON_LVB_REVERSE_VIDEO
+const uint16_t ATTRIBUTE_UNDERLINE = 0x8000;  // COMMON_LVB_UNDERSCORE
+
+// Unchanged cells between two changed ones that are sent again rather than skipped over;
+// moving the cursor past a shorter gap costs more than the cells would.
+const int FRAME_RUN_GAP = 6;
+// What having the terminal move rows is reckoned to cost, in cells: setting the scroll
+// region, deleting or inserting the lines and resetting the region take about this many
+// bytes.
+const int FRAME_SCROLL_COST = 24;
+
+struct Cell {
+    char glyph = ' ';
+    uint8_t fg = 7;
+    uint8_t bg = 0;
+    uint8_t flags = 0;
+
+    static Cell fromAttribute(char glyph, uint16_t attribute) {
+        uint8_t flags = 0;
+        if (attribute & ATTRIBUTE_UNDERLINE) flags |= CELL_UNDERLINE;
+        if (attribute & ATTRIBUTE_REVERSE) flags |= CELL_REVERSE;
+        return { glyph, (uint8_t)(attribute & 0x0F), (uint8_t)((attribute >> 4) & 0x0F), flags };
+    }
+    uint16_t attribute() const {
+        uint16_t attribute = (uint16_t)(fg | (bg << 4));
+        if (flags & CELL_UNDERLINE) attribute |= ATTRIBUTE_UNDERLINE;
+        if (flags & CELL_REVERSE) attribute |= ATTRIBUTE_REVERSE;
+        return attribute;
+    }
+    bool sameStyle(const Cell& other) const { return fg == other.fg && bg == other.bg && flags == other.flags; }
+    bool operator==(const Cell& other) const { return glyph == other.glyph && sameStyle(other); }
+    bool operator!=(const Cell& other) const { return !(*this == other); }
+};
+
+class ScreenOutput;
+
+// The screen as a grid of cells, twice: the back buffer the editor draws the next frame
+// into, and the front buffer holding what the screen shows. present() compares the two
+// cell by cell, glyph and colors alike, and sends the output only the runs of cells that
+// changed, so a frame that changes one character costs one short run however much was
+// drawn. Drawing into the back buffer is cheap; nothing reaches the screen until present().
+// Rows that scroll are moved in the back buffer with scroll(); present() then has the
+// screen move them too, where that costs less than sending the rows that differ.
+class FrameBuffer {
+public:
+    FrameBuffer();
+
+    // Both buffers become blank, and the screen is taken to hold anything.
+    void resize(int cols, int rows);
+    int cols() const { return _cols; }
+    int rows() const { return _rows; }
+
+    // Writes text from col on, one attribute per character, clipped to the row.
+    void write(int row, int col, std::string_view text, const uint16_t* attributes);
+    void write(int row, int col, std::string_view text, uint16_t attribute);
+    // Blanks the row from col to its end.
+    void clearRow(int row, int col, uint16_t attribute);
+    // Blanks the whole back buffer.
+    void blank(uint16_t attribute);
+    void setCursor(int col, int row, bool visible);
+    // Moves rows [top, bottom) of the back buffer up by delta rows, down if delta is
+    // negative. The rows moved in keep what they held, for the caller to draw over.
+    void scroll(int top, int bottom, int delta);
+
+    // The screen may hold anything: the next present() sends every cell.
+    void invalidate();
+    // The screen was cleared to blanks of attribute, outside of present(). Both buffers
+    // become blank, so what the next frame does not draw stays blank.
+    void cleared(uint16_t attribute);
+
+    // Sends the cells that differ from the front buffer, then the cursor, and makes the
+    // back buffer the front. Returns the number of cells sent.
+    size_t present(ScreenOutput& output);
+
+private:
+    int _cols;
+    int _rows;
+    std::vector<Cell> _back;
+    std::vector<Cell> _front;
+    bool _frontValid;  // False while the screen may not match _front
+    int _cursorCol;
+    int _cursorRow;
+    bool _cursorVisible;
+    // The scroll() of the frame being drawn; no scroll while _scrollDelta is 0.
+    int _scrollTop;
+    int _scrollBottom;
+    int _scrollDelta;
+
+    Cell* backRow(int row) { return _back.data() + (size_t)row * _cols; }
+    Cell* frontRow(int row) { return _front.data() + (size_t)row * _cols; }
+    size_t changedCells(const Cell* back, const Cell* front) const;
+    bool scrollPays();
+    void scrollFront();
+};
+
+// The rows of a part of the screen that have to be composed again before the next frame.
+// Rows not marked are left alone: the back buffer still holds them from an earlier frame.
+class RowDamage {
+public:
+    int size() const { return (int)_rows.size(); }
+    // Every row is marked after a resize.
+    void resize(int rows) { _rows.assign(rows > 0 ? rows : 0, 1); }
+    void markAll() { std::fill(_rows.begin(), _rows.end(), (uint8_t)1); }
+    // Rows [from, to), clipped.
+    void mark(int from, int to) {
+        from = std::max(from, 0);
+        to = std::min(to, size());
+        if (from < to) std::fill(_rows.begin() + from, _rows.begin() + to, (uint8_t)1);
+    }
+    bool marked(int row) const { return _rows[row] != 0; }
+    // The marks move up by delta rows, down if delta is negative, with the rows they are
+    // on; the rows moved in are marked.
+    void scroll(int delta) {
+        int n = size();
+        if (delta >= n || -delta >= n) {
+            markAll();
+        } else if (delta > 0) {
+            std::move(_rows.begin() + delta, _rows.end(), _rows.begin());
+            mark(n - delta, n);
+        } else if (delta < 0) {
+            std::move_backward(_rows.begin(), _rows.end() + delta, _rows.end());
+            mark(0, -delta);
+        }
+    }
+    void clear() { std::fill(_rows.begin(), _rows.end(), (uint8_t)0); }
+
+private:
+    std::vector<uint8_t> _rows;
+};
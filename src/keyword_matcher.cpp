@@ -0,0 +1,232 @@
+#include "keyword_matcher.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPLICE_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline unsigned lowestBit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+static inline bool isAsciiLetter(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline bool isWordByte(unsigned char c) {
+    return (c >= '0' && c <= '9') || isAsciiLetter(c) || c == '_' || c >= 0x80;
+}
+
+KeywordMatcher::KeywordMatcher() : _classCount(1), _maxLength(0) {
+    memset(_classOf, 0, sizeof(_classOf));
+    memset(_canStart, 0, sizeof(_canStart));
+}
+
+bool KeywordMatcher::build(const std::vector<std::string>& keywords, SearchOptions options, std::string& error) {
+    for (size_t k = 0; k < keywords.size(); ++k) {
+        if (keywords[k].empty()) {
+            error = "keyword #" + std::to_string(k + 1) + " is empty";
+            return false;
+        }
+        if (keywords[k].find_first_of("\r\n") != std::string::npos) {
+            error = "keyword #" + std::to_string(k + 1) + " contains a line break";
+            return false;
+        }
+    }
+    *this = KeywordMatcher();
+    auto fold = [&options](unsigned char c) {
+        return (!options.caseSensitive && isAsciiLetter(c)) ? (unsigned char)(c | 0x20) : c;
+    };
+
+    // Only the bytes that occur in some keyword get a column of their own; every other byte
+    // takes any state back to where a keyword could start.
+    bool used[256] = {};
+    for (const std::string& keyword : keywords) {
+        for (char c : keyword) used[fold((unsigned char)c)] = true;
+    }
+    for (int b = 0; b < 256; ++b) {
+        if (used[b]) _classOf[b] = (uint8_t)_classCount++;
+    }
+    if (!options.caseSensitive) {
+        for (int b = 'A'; b <= 'Z'; ++b) _classOf[b] = _classOf[b | 0x20];
+    }
+
+    // The trie; a keyword that is already in it (or the same one ignoring case) keeps its first index.
+    _next.assign(_classCount, NO_STATE);
+    _output.assign(1, NO_STATE);
+    for (size_t k = 0; k < keywords.size(); ++k) {
+        uint32_t state = 0;
+        for (char c : keywords[k]) {
+            size_t slot = state * _classCount + _classOf[(unsigned char)c];
+            if (_next[slot] == NO_STATE) {
+                _next[slot] = (uint32_t)_output.size();
+                _output.push_back(NO_STATE);
+                _next.resize(_next.size() + _classCount, NO_STATE);
+            }
+            state = _next[slot];
+        }
+        if (_output[state] == NO_STATE) _output[state] = (uint32_t)k;
+
+        const std::string& keyword = keywords[k];
+        _lengths.push_back(keyword.size());
+        _maxLength = std::max(_maxLength, keyword.size());
+        unsigned char first = fold((unsigned char)keyword[0]);
+        _canStart[first] = true;
+        if (!options.caseSensitive && isAsciiLetter(first)) _canStart[first & ~0x20] = true;
+        _wordStart.push_back(options.wholeWord && isWordByte((unsigned char)keyword.front()));
+        _wordEnd.push_back(options.wholeWord && isWordByte((unsigned char)keyword.back()));
+    }
+
+    // Breadth first, so the state a failure link points to already has all of its transitions
+    // when they are copied into the states of the next depth.
+    size_t states = _output.size();
+    std::vector<uint32_t> fail(states, 0);
+    std::vector<uint32_t> queue;
+    queue.reserve(states);
+    _outputLink.assign(states, NO_STATE);
+    for (size_t c = 0; c < _classCount; ++c) {
+        if (_next[c] == NO_STATE) _next[c] = 0;
+        else queue.push_back(_next[c]);
+    }
+    for (size_t q = 0; q < queue.size(); ++q) {
+        uint32_t state = queue[q];
+        for (size_t c = 0; c < _classCount; ++c) {
+            uint32_t& target = _next[state * _classCount + c];
+            uint32_t fallback = _next[fail[state] * _classCount + c];
+            if (target == NO_STATE) {
+                target = fallback;
+                continue;
+            }
+            fail[target] = fallback;
+            _outputLink[target] = _output[fallback] != NO_STATE ? fallback : _outputLink[fallback];
+            queue.push_back(target);
+        }
+    }
+
+    _report.resize(states);
+    for (size_t state = 0; state < states; ++state) {
+        _report[state] = _output[state] != NO_STATE ? (uint32_t)state : _outputLink[state];
+    }
+
+    for (int b = 0; b < 256; ++b) {
+        if (_canStart[b]) _startBytes += (char)b;
+    }
+    if (_startBytes.size() > KEYWORD_PREFILTER_MAX_BYTES) _startBytes.clear();
+    return true;
+}
+
+size_t KeywordMatcher::skipToStart(const unsigned char* text, size_t size, size_t from) const {
+    size_t i = from;
+#ifdef SPLICE_HAVE_SSE2
+    if (!_startBytes.empty()) {
+        __m128i needles[KEYWORD_PREFILTER_MAX_BYTES];
+        size_t count = _startBytes.size();
+        for (size_t n = 0; n < count; ++n) needles[n] = _mm_set1_epi8(_startBytes[n]);
+        for (; size - i >= 16; i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i*)(text + i));
+            __m128i hits = _mm_cmpeq_epi8(block, needles[0]);
+            for (size_t n = 1; n < count; ++n) hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[n]));
+            unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+            if (mask != 0) return i + lowestBit(mask);
+        }
+    }
+#endif
+    while (i < size && !_canStart[text[i]]) ++i;
+    return i;
+}
+
+bool KeywordMatcher::find(const char* data, size_t size,
+                          const std::function<bool(size_t start, size_t length, size_t keyword)>& onMatch) const {
+    if (empty()) return true;
+    const unsigned char* text = (const unsigned char*)data;
+
+    // Matches are found by where they end, so a match is only reported once nothing found
+    // later can start at or before it: the longest match found so far for each start is
+    // held back until the scan is a whole keyword length past that start.
+    struct Candidate {
+        size_t start;
+        size_t length;
+        size_t keyword;
+    };
+    std::vector<Candidate> pending;  // Ascending starts
+    size_t taken = 0;                // End of the last match reported; later ones must not start before it
+    auto settle = [&](size_t pos) {
+        while (!pending.empty() && pending.front().start + _maxLength <= pos) {
+            Candidate match = pending.front();
+            if (!onMatch(match.start, match.length, match.keyword)) return false;
+            taken = match.start + match.length;
+            auto overlapped = std::find_if(pending.begin(), pending.end(), [taken](const Candidate& c) { return c.start >= taken; });
+            pending.erase(pending.begin(), overlapped);
+        }
+        return true;
+    };
+
+    const uint32_t* next = _next.data();
+    const uint32_t* report = _report.data();
+    uint32_t state = 0;
+    size_t pos = 0;
+    while (pos < size) {
+        if (state == 0 && !_canStart[text[pos]]) {
+            pos = skipToStart(text, size, pos);
+            if (pos == size) break;
+        }
+        if (!pending.empty() && !settle(pos)) return false;
+        state = next[state * _classCount + _classOf[text[pos]]];
+        ++pos;
+        if (report[state] == NO_STATE) continue;
+
+        // The keywords ending here, longest (so leftmost) first.
+        for (uint32_t s = report[state]; s != NO_STATE; s = _outputLink[s]) {
+            size_t keyword = _output[s];
+            size_t start = pos - _lengths[keyword];
+            if (start < taken) continue;
+            if (_wordStart[keyword] && start > 0 && isWordByte(text[start - 1])) continue;
+            if (_wordEnd[keyword] && pos < size && isWordByte(text[pos])) continue;
+            auto at = pending.end();
+            while (at != pending.begin() && (at - 1)->start >= start) --at;
+            // A match found later with the same start is the longer one.
+            if (at != pending.end() && at->start == start) *at = { start, _lengths[keyword], keyword };
+            else pending.insert(at, { start, _lengths[keyword], keyword });
+        }
+    }
+    return settle((size_t)-1 - _maxLength);
+}
+
+void searchSnapshot(const LineSnapshot& snapshot, const KeywordMatcher& matcher,
+                    size_t fromRow, size_t toRow, const std::function<bool(const KeywordMatch&)>& onMatch) {
+    if (matcher.empty()) return;
+    snapshot.forEachChunk(fromRow, toRow, [&](const TextChunk& chunk) {
+        size_t line = 0;
+        return matcher.find(chunk.data, chunk.size, [&](size_t pos, size_t length, size_t keyword) {
+            // Matches come in order, so the line is usually the one of the previous match or
+            // one shortly after it; only a far jump needs the binary search.
+            for (int step = 0; line + 1 < chunk.lineCount && pos >= chunk.lineStart(line + 1); ++step) {
+                if (step == 8) {
+                    line = chunk.lineAt(pos);
+                    break;
+                }
+                ++line;
+            }
+            return onMatch({ chunk.firstRow + line, pos - chunk.lineStart(line), length, keyword });
+        });
+    });
+}
+
+bool searchLine(const KeywordMatcher& matcher, std::string_view line, size_t row,
+                const std::function<bool(const KeywordMatch&)>& onMatch) {
+    return matcher.find(line.data(), line.size(), [&](size_t start, size_t length, size_t keyword) {
+        return onMatch({ row, start, length, keyword });
+    });
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include "line_buffer.h"
+#include "text_search.h"
+
+const size_t KEYWORD_PREFILTER_MAX_BYTES = 8;  // Most distinct first bytes the vector prefilter compares against
+
+struct KeywordMatch {
+    size_t row;
+    size_t col;
+    size_t length;
+    size_t keyword;  // Index of the keyword in the list the matcher was built from
+};
+
+// Finds any of a list of literal keywords in one pass over the text, however many there
+// are (Aho-Corasick). The keywords are compiled into a trie whose failure links are folded
+// into a full transition table over byte classes (bytes no keyword tells apart share a
+// column), so every byte of text costs one table lookup. While no keyword has begun, the
+// bytes that cannot start one are skipped 16 at a time with SSE2, or by a table lookup per
+// byte when too many bytes can start a keyword for that. Matches are reported leftmost
+// first, the longest keyword at each position, and never overlap. Case-insensitive
+// matching and whole words work as for LiteralSearcher.
+class KeywordMatcher {
+public:
+    KeywordMatcher();
+
+    // Fails for an empty keyword or one with a line break in it.
+    bool build(const std::vector<std::string>& keywords, SearchOptions options, std::string& error);
+    bool empty() const { return _lengths.empty(); }
+    size_t keywordCount() const { return _lengths.size(); }
+
+    // Passes the matches in data to onMatch in order until it returns false; returns false if it
+    // did. The ends of data count as word boundaries.
+    bool find(const char* data, size_t size, const std::function<bool(size_t start, size_t length, size_t keyword)>& onMatch) const;
+
+private:
+    static constexpr uint32_t NO_STATE = (uint32_t)-1;
+
+    uint8_t _classOf[256];                 // Byte class of each byte, letters folded when ignoring case
+    size_t _classCount;
+    std::vector<uint32_t> _next;           // State after each state and byte class
+    std::vector<uint32_t> _output;         // Keyword ending at each state, or NO_STATE
+    std::vector<uint32_t> _outputLink;     // Nearest state down the failure links with an output, or NO_STATE
+    std::vector<uint32_t> _report;         // The state itself if it has an output, else its _outputLink
+    std::vector<size_t> _lengths;          // Length of each keyword
+    size_t _maxLength;
+    bool _canStart[256];                   // Bytes a keyword can start with
+    std::string _startBytes;               // The same as a list, when it is short enough for the prefilter
+    std::vector<uint8_t> _wordStart;       // Per keyword, whether whole-word mode checks the byte before / after it
+    std::vector<uint8_t> _wordEnd;
+
+    size_t skipToStart(const unsigned char* text, size_t size, size_t from) const;
+};
+
+// Scans rows [fromRow, toRow) of snapshot a chunk of consecutive lines at a time and passes
+// the matches to onMatch in order, until it returns false. Matches never span lines.
+void searchSnapshot(const LineSnapshot& snapshot, const KeywordMatcher& matcher,
+                    size_t fromRow, size_t toRow, const std::function<bool(const KeywordMatch&)>& onMatch);
+
+// Like the literal searchLine(), for a set of keywords.
+bool searchLine(const KeywordMatcher& matcher, std::string_view line, size_t row,
+                const std::function<bool(const KeywordMatch&)>& onMatch);
@@ -0,0 +1,369 @@
+#include "kv_store.h"
+#include "checksum.h"
+#include "atomic_file_writer.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+static const char KV_MAGIC[4] = { 'S', 'P', 'L', 'K' };
+static const uint32_t KV_VERSION = 1;
+static const size_t KV_HEADER_SIZE = 8;
+static const size_t KV_RECORD_HEADER_SIZE = 8;
+
+enum KvRecordKind : uint8_t {
+    KV_PUT = 1,
+    KV_DELETE = 2,
+};
+
+static void putU8(std::string& out, uint8_t v) {
+    out.push_back((char)v);
+}
+
+static void putU32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+
+static uint32_t getU32(const unsigned char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+static std::string encodeHeader() {
+    std::string header(KV_MAGIC, sizeof(KV_MAGIC));
+    putU32(header, KV_VERSION);
+    return header;
+}
+
+static void encodeRecord(std::string& out, KvRecordKind kind, const std::string& key, const std::string* value) {
+    std::string payload;
+    putU8(payload, kind);
+    putU32(payload, (uint32_t)key.size());
+    payload += key;
+    if (value) {
+        putU32(payload, (uint32_t)value->size());
+        payload += *value;
+    }
+    putU32(out, (uint32_t)payload.size());
+    putU32(out, crc32(payload.data(), payload.size()));
+    out += payload;
+}
+
+static uint64_t putRecordSize(const std::string& key, const std::string& value) {
+    return KV_RECORD_HEADER_SIZE + 1 + 4 + key.size() + 4 + value.size();
+}
+
+KvStore::KvStore()
+    : _open(false), _entries(std::make_shared<Entries>()), _liveBytes(0), _logBytes(0), _stopping(false), _compactQueued(false),
+      _flushRequested(false), _rewriteNeeded(false), _queuedSeq(0), _writtenSeq(0),
+      _lastWriteOk(true), _file(nullptr) {}
+
+KvStore::~KvStore() {
+    close();
+}
+
+bool KvStore::open(const std::string& path, std::string& error) {
+    close();
+    _path = path;
+
+    std::string data;
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec)) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            error = "Could not open " + path;
+            return false;
+        }
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // Replay the log up to the first record that is cut off or does not check out.
+    size_t validEnd = 0;
+    if (!data.empty()) {
+        if (data.size() < KV_HEADER_SIZE || data.compare(0, sizeof(KV_MAGIC), KV_MAGIC, sizeof(KV_MAGIC)) != 0 ||
+            getU32((const unsigned char*)data.data() + 4) != KV_VERSION) {
+            error = path + " is not a plugin data file of this version";
+            return false;
+        }
+        size_t pos = KV_HEADER_SIZE;
+        validEnd = pos;
+        while (data.size() - pos >= KV_RECORD_HEADER_SIZE) {
+            const unsigned char* p = (const unsigned char*)data.data() + pos;
+            uint32_t length = getU32(p);
+            uint32_t crc = getU32(p + 4);
+            if (length > data.size() - pos - KV_RECORD_HEADER_SIZE) break;
+            const unsigned char* payload = p + KV_RECORD_HEADER_SIZE;
+            if (crc32(payload, length) != crc || length < 5) break;
+
+            uint8_t kind = payload[0];
+            uint32_t keyLength = getU32(payload + 1);
+            if (keyLength > length - 5) break;
+            std::string key((const char*)payload + 5, keyLength);
+            size_t rest = length - 5 - keyLength;
+            if (kind == KV_PUT) {
+                if (rest < 4) break;
+                uint32_t valueLength = getU32(payload + 5 + keyLength);
+                if (valueLength != rest - 4) break;
+                (*_entries)[std::move(key)].assign((const char*)payload + 9 + keyLength, valueLength);
+            } else if (kind == KV_DELETE && rest == 0) {
+                _entries->erase(key);
+            } else {
+                break;
+            }
+            pos += KV_RECORD_HEADER_SIZE + length;
+            validEnd = pos;
+        }
+    }
+
+    if (validEnd > 0) {
+        // Later records are appended after the last good one, not after the torn tail.
+        if (validEnd < data.size()) {
+            std::filesystem::resize_file(path, validEnd, ec);
+            if (ec) {
+                error = "Could not truncate " + path + ": " + ec.message();
+                _entries->clear();
+                return false;
+            }
+        }
+        _file = fopen(path.c_str(), "ab");
+        if (!_file) {
+            error = "Could not open " + path + " for writing";
+            _entries->clear();
+            return false;
+        }
+    }
+
+    _liveBytes = KV_HEADER_SIZE;
+    for (const auto& [key, value] : *_entries) _liveBytes += putRecordSize(key, value);
+    _logBytes = validEnd > 0 ? validEnd : KV_HEADER_SIZE;
+
+    _stopping = false;
+    _pending.clear();
+    _compactEntries.reset();
+    _compactQueued = false;
+    _flushRequested = false;
+    _rewriteNeeded = false;
+    _queuedSeq = 0;
+    _writtenSeq = 0;
+    _lastWriteOk = true;
+    _error.clear();
+    _open = true;
+    _flushThread = std::thread(&KvStore::flushMain, this);
+
+    // A log that is mostly dead records (say, after the last run hit its compaction
+    // threshold right before exiting) is compacted straight away.
+    maybeCompact(false);
+    return true;
+}
+
+void KvStore::close() {
+    if (!_open) return;
+    retryRewrite();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    _flushThread.join();
+    closeFile();
+    _open = false;
+    _entries = std::make_shared<Entries>();
+}
+
+std::string KvStore::lastError() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _error;
+}
+
+const std::string* KvStore::get(const std::string& key) const {
+    auto it = _entries->find(key);
+    return it != _entries->end() ? &it->second : nullptr;
+}
+
+KvStore::Entries& KvStore::mutableEntries() {
+    // A queued compaction still reading the entries keeps them; the store moves on with a copy.
+    bool shared;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        shared = _entries.use_count() > 1;
+    }
+    if (shared) {
+        _entries = std::make_shared<Entries>(*_entries);
+    }
+    return *_entries;
+}
+
+void KvStore::put(const std::string& key, const std::string& value) {
+    const std::string* old = get(key);
+    if (old) {
+        if (*old == value) return;
+        _liveBytes -= putRecordSize(key, *old);
+    }
+    mutableEntries()[key] = value;
+    _liveBytes += putRecordSize(key, value);
+
+    std::string record;
+    encodeRecord(record, KV_PUT, key, &value);
+    queueRecord(std::move(record));
+}
+
+bool KvStore::remove(const std::string& key) {
+    const std::string* old = get(key);
+    if (!old) return false;
+    _liveBytes -= putRecordSize(key, *old);
+    mutableEntries().erase(key);
+
+    std::string record;
+    encodeRecord(record, KV_DELETE, key, nullptr);
+    queueRecord(std::move(record));
+    return true;
+}
+
+bool KvStore::flush() {
+    if (!_open) return true;
+    retryRewrite();
+    std::unique_lock<std::mutex> lock(_mutex);
+    uint64_t target = _queuedSeq;
+    if (_writtenSeq < target) {
+        _flushRequested = true;
+        _wake.notify_all();
+        _flushed.wait(lock, [this, target]() { return _writtenSeq >= target; });
+    }
+    return _lastWriteOk;
+}
+
+void KvStore::queueRecord(std::string&& record) {
+    if (!_open) return;
+    _logBytes += record.size();
+    bool rewrite;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pending.empty()) _pending = std::move(record);
+        else _pending += record;
+        ++_queuedSeq;
+        rewrite = _rewriteNeeded;
+    }
+    maybeCompact(rewrite);
+}
+
+void KvStore::retryRewrite() {
+    bool rewrite;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        rewrite = _rewriteNeeded && !_compactQueued;
+    }
+    if (rewrite) maybeCompact(true);
+}
+
+void KvStore::maybeCompact(bool force) {
+    if (!force && (_logBytes < KV_COMPACT_MIN_BYTES ||
+                   (_logBytes - _liveBytes) * 100 < _logBytes * KV_COMPACT_GARBAGE_PERCENT)) {
+        return;
+    }
+
+    // The new log holds every live entry, so whatever is still queued is superseded by it.
+    // The flush thread encodes it; until then the entries are shared, not copied.
+    _logBytes = _liveBytes;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _compactEntries = _entries;
+        _compactQueued = true;
+        _pending.clear();
+        _rewriteNeeded = false;
+        ++_queuedSeq;
+    }
+    _wake.notify_all();
+}
+
+void KvStore::flushMain() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait_for(lock, std::chrono::milliseconds(KV_FLUSH_INTERVAL_MS),
+                       [this]() { return _stopping || _flushRequested; });
+        bool stopping = _stopping;
+        bool compact = _compactQueued;
+        // After a failed write only a full rewrite is trusted; queued records are part of it.
+        bool skipAppend = _rewriteNeeded;
+        std::shared_ptr<const Entries> entries = std::move(_compactEntries);
+        std::string records;
+        records.swap(_pending);
+        _compactQueued = false;
+        _flushRequested = false;
+        uint64_t seq = _queuedSeq;
+        lock.unlock();
+
+        std::string image;
+        if (compact) {
+            image = encodeHeader();
+            for (const auto& [key, value] : *entries) encodeRecord(image, KV_PUT, key, &value);
+            // Released under the lock, so mutableEntries() sees the store has them to itself again.
+            lock.lock();
+            entries.reset();
+            lock.unlock();
+        }
+
+        bool ok = true;
+        std::string error;
+        if (compact) ok = replaceLog(image, error);
+        if (ok && !records.empty() && !skipAppend) ok = appendToLog(records, error);
+
+        lock.lock();
+        if (!ok) {
+            _error = error;
+            _rewriteNeeded = true;
+        }
+        if (compact || (!records.empty() && !skipAppend)) _lastWriteOk = ok;
+        _writtenSeq = seq;
+        _flushed.notify_all();
+        if (stopping) break;
+    }
+}
+
+bool KvStore::appendToLog(const std::string& records, std::string& error) {
+    if (!_file) {
+        _file = fopen(_path.c_str(), "ab");
+        if (!_file) {
+            error = "Could not open " + _path + " for writing";
+            return false;
+        }
+        // First write to a store that had no file yet.
+        std::string header = encodeHeader();
+        if (fseek(_file, 0, SEEK_END) == 0 && ftell(_file) == 0 &&
+            fwrite(header.data(), 1, header.size(), _file) != header.size()) {
+            error = "Could not write " + _path;
+            closeFile();
+            return false;
+        }
+    }
+    if (fwrite(records.data(), 1, records.size(), _file) != records.size() || fflush(_file) != 0) {
+        error = "Could not write " + _path;
+        closeFile();
+        return false;
+    }
+    return true;
+}
+
+bool KvStore::replaceLog(const std::string& image, std::string& error) {
+    // The old log must not be held open while it is replaced (Windows refuses the rename).
+    closeFile();
+    AtomicFileWriter writer;
+    if (!writer.open(_path) || !writer.append(image.data(), image.size()) || !writer.commit()) {
+        error = writer.lastError();
+        writer.abort();
+        return false;
+    }
+    _file = fopen(_path.c_str(), "ab");
+    if (!_file) {
+        error = "Could not open " + _path + " for writing";
+        return false;
+    }
+    return true;
+}
+
+void KvStore::closeFile() {
+    if (_file) {
+        fclose(_file);
+        _file = nullptr;
+    }
+}
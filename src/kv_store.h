@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+
+const unsigned int KV_FLUSH_INTERVAL_MS = 500;          // Write-behind delay before queued updates are written out
+const uint64_t KV_COMPACT_MIN_BYTES = 256 * 1024;       // Logs smaller than this are never compacted
+const unsigned int KV_COMPACT_GARBAGE_PERCENT = 50;     // Share of overwritten or deleted records in the log that triggers compaction
+
+// Small persistent key-value store, used for plugin data. All entries are held in a hash
+// map, so lookups never touch the disk. Updates change the map at once and are appended
+// to a log file by a background thread in batches, as length + CRC framed records; a torn
+// record at the end of the log is dropped when it is opened. Once most of the log is
+// overwritten or deleted entries, it is rewritten from the live entries and renamed over
+// the old one; the flush thread encodes that copy from the entries as they were when it
+// was queued, which it shares with the store until one of them changes.
+class KvStore {
+public:
+    KvStore();
+    ~KvStore();
+    KvStore(const KvStore&) = delete;
+    KvStore& operator=(const KvStore&) = delete;
+
+    // Loads the log at path (a missing file is an empty store) and starts the flush thread.
+    bool open(const std::string& path, std::string& error);
+    // Writes out everything still queued and stops the flush thread.
+    void close();
+    bool isOpen() const { return _open; }
+
+    // Returns nullptr if key is not set. The pointer is valid until the store is next changed.
+    const std::string* get(const std::string& key) const;
+    void put(const std::string& key, const std::string& value);
+    bool remove(const std::string& key);
+    size_t size() const { return _entries->size(); }
+
+    // Blocks until everything queued so far is on disk. Returns false if writing failed.
+    bool flush();
+    std::string lastError() const;
+
+private:
+    using Entries = std::unordered_map<std::string, std::string>;
+
+    std::string _path;
+    bool _open;
+    std::shared_ptr<Entries> _entries;
+    uint64_t _liveBytes;  // Log bytes the current entries would take
+    uint64_t _logBytes;   // Log bytes written or queued, including dead records
+
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _flushed;
+    std::thread _flushThread;
+    bool _stopping;
+    std::string _pending;       // Encoded records waiting to be appended
+    std::shared_ptr<const Entries> _compactEntries;  // What the replacement log holds, when a compaction is queued
+    bool _compactQueued;
+    bool _flushRequested;
+    bool _rewriteNeeded;        // A write failed part way, so the log has to be rewritten whole
+    uint64_t _queuedSeq;
+    uint64_t _writtenSeq;
+    bool _lastWriteOk;
+    std::string _error;
+
+    FILE* _file;
+
+    Entries& mutableEntries();
+    void queueRecord(std::string&& record);
+    void maybeCompact(bool force);
+    void retryRewrite();
+    void flushMain();
+    bool appendToLog(const std::string& records, std::string& error);
+    bool replaceLog(const std::string& image, std::string& error);
+    void closeFile();
+};
@@ -0,0 +1,829 @@
+#include "line_buffer.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+static const uint64_t INDEX_SCAN_CHUNK = 4 * 1024 * 1024;
+
+// Splits [begin, end) of the base into line slots. Returns the offset just past the
+// last '\n' found, i.e. the start of an unterminated remainder (== end if none).
+static uint64_t scanLines(const char* base, uint64_t begin, uint64_t end,
+                          std::vector<LineSlot>& out, size_t& crlf, size_t& lf) {
+    uint64_t lineStart = begin;
+    const char* p = base + begin;
+    const char* stop = base + end;
+    while (p < stop) {
+        const char* nl = (const char*)memchr(p, '\n', stop - p);
+        if (!nl) break;
+        uint64_t nlOffset = nl - base;
+        uint64_t len = nlOffset - lineStart;
+        if (len > 0 && base[nlOffset - 1] == '\r') {
+            len--;
+            crlf++;
+        } else {
+            lf++;
+        }
+        // Lines longer than 4 GB are clamped; nothing else in the editor could display them anyway.
+        out.push_back({ lineStart, (uint32_t)std::min<uint64_t>(len, std::numeric_limits<uint32_t>::max()), -1 });
+        lineStart = nlOffset + 1;
+        p = nl + 1;
+    }
+    return lineStart;
+}
+
+LineBuffer::LineBuffer() :
+    _lineCount(0),
+    _version(0),
+    _changedFrom(SIZE_MAX),
+    _changedTo(0),
+    _base(nullptr),
+    _baseSize(0),
+    _crlfLines(0),
+    _lfLines(0),
+    _indexing(false),
+    _pendingCrlf(0),
+    _pendingLf(0),
+    _indexFinished(false),
+    _indexedBytes(0),
+    _cancelIndex(false)
+{}
+
+LineBuffer::~LineBuffer() {
+    stopIndexer();
+}
+
+void LineBuffer::stopIndexer() {
+    if (_indexThread.joinable()) {
+        _cancelIndex = true;
+        _indexThread.join();
+    }
+    _cancelIndex = false;
+    _indexing = false;
+    _pendingSlots.clear();
+    _indexFinished = false;
+}
+
+void LineBuffer::clear() {
+    stopIndexer();
+    _blocks.clear();
+    _blockStarts.clear();
+    _lineCount = 0;
+    _overlays.clear();
+    _freeOverlays.clear();
+    _map.reset();
+    _owned.reset();
+    _base = nullptr;
+    _baseSize = 0;
+    _crlfLines = 0;
+    _lfLines = 0;
+    _indexedBytes = 0;
+    _version++;
+    rowsChanged(0, SIZE_MAX);
+}
+
+void LineBuffer::assign(std::string&& content) {
+    clear();
+    _owned = std::make_shared<std::string>(std::move(content));
+    _base = _owned->data();
+    _baseSize = _owned->size();
+
+    std::vector<LineSlot> slots;
+    uint64_t rest = scanLines(_base, 0, _baseSize, slots, _crlfLines, _lfLines);
+    if (rest < _baseSize) {
+        slots.push_back({ rest, (uint32_t)std::min<uint64_t>(_baseSize - rest, std::numeric_limits<uint32_t>::max()), -1 });
+    }
+    appendSlots(slots);
+    _indexedBytes = _baseSize;
+}
+
+bool LineBuffer::openMapped(const std::string& path, std::string& error, uint64_t skipBytes) {
+    auto map = std::make_shared<MappedFile>();
+    if (!map->open(path)) {
+        error = map->lastError();
+        return false;
+    }
+    skipBytes = std::min(skipBytes, map->size());
+
+    clear();
+    _map = map;
+    _base = _map->data() + skipBytes;
+    _baseSize = _map->size() - skipBytes;
+
+    // Index the head of the file synchronously so the first screen can be drawn
+    // right away; the rest is handed to the background indexer.
+    uint64_t syncEnd = std::min(_baseSize, INDEX_SYNC_BYTES);
+    std::vector<LineSlot> slots;
+    uint64_t rest = scanLines(_base, 0, syncEnd, slots, _crlfLines, _lfLines);
+    appendSlots(slots);
+    _indexedBytes = rest;
+
+    if (syncEnd == _baseSize) {
+        if (rest < _baseSize) {
+            appendSlots({ { rest, (uint32_t)std::min<uint64_t>(_baseSize - rest, std::numeric_limits<uint32_t>::max()), -1 } });
+        }
+        _indexedBytes = _baseSize;
+        return true;
+    }
+
+    _indexing = true;
+    _indexFinished = false;
+    _indexThread = std::thread(&LineBuffer::indexerMain, this, rest);
+    return true;
+}
+
+void LineBuffer::indexerMain(uint64_t start) {
+    std::vector<LineSlot> batch;
+    batch.reserve(INDEX_BATCH_LINES);
+    size_t crlf = 0;
+    size_t lf = 0;
+    uint64_t pos = start;
+
+    auto publish = [&]() {
+        std::lock_guard<std::mutex> lock(_indexMutex);
+        _pendingSlots.insert(_pendingSlots.end(), batch.begin(), batch.end());
+        _pendingCrlf += crlf;
+        _pendingLf += lf;
+        batch.clear();
+        crlf = 0;
+        lf = 0;
+    };
+
+    while (pos < _baseSize && !_cancelIndex) {
+        uint64_t chunkEnd = std::min(_baseSize, pos + INDEX_SCAN_CHUNK);
+        uint64_t rest = scanLines(_base, pos, chunkEnd, batch, crlf, lf);
+        if (rest == pos && chunkEnd < _baseSize) {
+            // A single line longer than the scan chunk; widen the window until it ends.
+            chunkEnd = _baseSize;
+            rest = scanLines(_base, pos, chunkEnd, batch, crlf, lf);
+        }
+        if (rest == pos) break;
+        pos = rest;
+        _indexedBytes = pos;
+        if (batch.size() >= INDEX_BATCH_LINES) {
+            publish();
+        }
+    }
+
+    if (!_cancelIndex && pos < _baseSize) {
+        batch.push_back({ pos, (uint32_t)std::min<uint64_t>(_baseSize - pos, std::numeric_limits<uint32_t>::max()), -1 });
+    }
+    publish();
+
+    std::lock_guard<std::mutex> lock(_indexMutex);
+    _indexedBytes = _baseSize;
+    _indexFinished = true;
+}
+
+int LineBuffer::indexProgress() const {
+    if (_baseSize == 0) return 100;
+    return (int)(_indexedBytes.load() * 100 / _baseSize);
+}
+
+bool LineBuffer::pollIndex() {
+    if (!_indexing) return false;
+
+    std::vector<LineSlot> slots;
+    bool finished;
+    {
+        std::lock_guard<std::mutex> lock(_indexMutex);
+        slots.swap(_pendingSlots);
+        _crlfLines += _pendingCrlf;
+        _lfLines += _pendingLf;
+        _pendingCrlf = 0;
+        _pendingLf = 0;
+        finished = _indexFinished;
+    }
+
+    appendSlots(slots);
+
+    if (finished) {
+        if (_indexThread.joinable()) _indexThread.join();
+        _indexing = false;
+        _indexFinished = false;
+        return true;
+    }
+    return !slots.empty();
+}
+
+void LineBuffer::finishIndex() {
+    if (!_indexing) return;
+    _indexThread.join();
+    pollIndex();
+}
+
+LineSnapshot LineBuffer::snapshot() const {
+    LineSnapshot snap;
+    snap._blocks = _blocks;
+    snap._blockStarts = _blockStarts;
+    snap._overlays = _overlays;
+    if (_map) {
+        snap._keepAlive = _map;
+    } else {
+        snap._keepAlive = _owned;
+    }
+    snap._lineCount = _lineCount;
+    snap._base = _base;
+    snap._baseSize = _baseSize;
+    return snap;
+}
+
+std::string_view LineSnapshot::view(size_t row) const {
+    auto it = std::upper_bound(_blockStarts.begin(), _blockStarts.end(), row);
+    size_t b = (it - _blockStarts.begin()) - 1;
+    const LineSlot& slot = _blocks[b]->slots[row - _blockStarts[b]];
+    if (slot.overlay >= 0) {
+        return *_overlays[slot.overlay];
+    }
+    return std::string_view(_base + slot.offset, slot.length);
+}
+
+uint64_t LineSnapshot::serializedSize(std::string_view lineEnding) const {
+    uint64_t total = 0;
+    for (const auto& block : _blocks) {
+        for (const LineSlot& slot : block->slots) {
+            total += (slot.overlay >= 0 ? _overlays[slot.overlay]->size() : slot.length) + lineEnding.size();
+        }
+    }
+    return total;
+}
+
+bool LineSnapshot::serialize(std::string_view lineEnding, const std::function<bool(const char*, size_t)>& sink) const {
+    uint64_t runStart = 0;
+    uint64_t runEnd = 0;
+
+    for (const auto& block : _blocks) {
+        for (const LineSlot& slot : block->slots) {
+            if (slot.overlay < 0) {
+                uint64_t lineEnd = slot.offset + slot.length;
+                bool terminatorMatches = lineEnd + lineEnding.size() <= _baseSize &&
+                    memcmp(_base + lineEnd, lineEnding.data(), lineEnding.size()) == 0;
+                if (terminatorMatches) {
+                    if (runEnd != runStart && slot.offset != runEnd) {
+                        if (!sink(_base + runStart, (size_t)(runEnd - runStart))) return false;
+                        runStart = runEnd;
+                    }
+                    if (runEnd == runStart) runStart = slot.offset;
+                    runEnd = lineEnd + lineEnding.size();
+                    continue;
+                }
+            }
+
+            if (runEnd != runStart) {
+                if (!sink(_base + runStart, (size_t)(runEnd - runStart))) return false;
+                runStart = runEnd;
+            }
+            std::string_view text = slot.overlay >= 0 ? std::string_view(*_overlays[slot.overlay])
+                                                      : std::string_view(_base + slot.offset, slot.length);
+            if (!sink(text.data(), text.size())) return false;
+            if (!sink(lineEnding.data(), lineEnding.size())) return false;
+        }
+    }
+
+    if (runEnd != runStart) {
+        if (!sink(_base + runStart, (size_t)(runEnd - runStart))) return false;
+    }
+    return true;
+}
+
+size_t TextChunk::lineAt(size_t pos) const {
+    if (!slots) return 0;
+    uint64_t offset = slots[0].offset + pos;
+    const LineSlot* it = std::upper_bound(slots, slots + lineCount, offset,
+                                          [](uint64_t value, const LineSlot& slot) { return value < slot.offset; });
+    return (size_t)(it - slots) - 1;
+}
+
+size_t TextChunk::lineStart(size_t line) const {
+    return slots ? (size_t)(slots[line].offset - slots[0].offset) : 0;
+}
+
+size_t TextChunk::lineLength(size_t line) const {
+    return slots ? slots[line].length : size;
+}
+
+void LineSnapshot::forEachChunk(size_t fromRow, size_t toRow, const std::function<bool(const TextChunk&)>& visit) const {
+    toRow = std::min(toRow, _lineCount);
+    if (fromRow >= toRow) return;
+
+    auto it = std::upper_bound(_blockStarts.begin(), _blockStarts.end(), fromRow);
+    for (size_t b = (it - _blockStarts.begin()) - 1; b < _blocks.size() && _blockStarts[b] < toRow; ++b) {
+        const std::vector<LineSlot>& slots = _blocks[b]->slots;
+        size_t i = fromRow > _blockStarts[b] ? fromRow - _blockStarts[b] : 0;
+        size_t end = std::min(slots.size(), toRow - _blockStarts[b]);
+        while (i < end) {
+            const LineSlot& first = slots[i];
+            if (first.overlay >= 0) {
+                const std::string& text = *_overlays[first.overlay];
+                if (!visit({ text.data(), text.size(), _blockStarts[b] + i, nullptr, 1 })) return;
+                ++i;
+                continue;
+            }
+            // Extend the run while the next line starts right after this one's terminator.
+            size_t j = i + 1;
+            while (j < end && slots[j].overlay < 0) {
+                uint64_t gap = slots[j].offset - (slots[j - 1].offset + slots[j - 1].length);
+                if (slots[j].offset < slots[j - 1].offset || gap < 1 || gap > 2) break;
+                ++j;
+            }
+            const LineSlot& last = slots[j - 1];
+            size_t size = (size_t)(last.offset + last.length - first.offset);
+            if (!visit({ _base + first.offset, size, _blockStarts[b] + i, &first, j - i })) return;
+            i = j;
+        }
+    }
+}
+
+std::vector<LineRun> LineSnapshot::runs() const {
+    std::vector<LineRun> result;
+    uint64_t expectedOffset = 0;
+    bool extending = false;
+
+    for (const auto& block : _blocks) {
+        for (const LineSlot& slot : block->slots) {
+            if (slot.overlay >= 0) {
+                result.push_back({ true, 0, 1, *_overlays[slot.overlay] });
+                extending = false;
+                continue;
+            }
+            if (extending && slot.offset == expectedOffset) {
+                result.back().count++;
+            } else {
+                result.push_back({ false, slot.offset, 1, std::string() });
+            }
+            // The next base line continues the run only if it starts right after this line's terminator.
+            uint64_t lineEnd = slot.offset + slot.length;
+            extending = true;
+            if (lineEnd < _baseSize && _base[lineEnd] == '\n') {
+                expectedOffset = lineEnd + 1;
+            } else if (lineEnd + 1 < _baseSize && _base[lineEnd] == '\r' && _base[lineEnd + 1] == '\n') {
+                expectedOffset = lineEnd + 2;
+            } else {
+                extending = false;
+            }
+        }
+    }
+    return result;
+}
+
+bool LineBuffer::restoreRuns(const std::vector<LineRun>& runs) {
+    finishIndex();
+
+    std::vector<LineSlot> slots;
+    std::vector<std::string> literals;
+    for (const LineRun& run : runs) {
+        if (run.literal) {
+            slots.push_back({ 0, 0, (int32_t)literals.size() });
+            literals.push_back(run.text);
+            continue;
+        }
+        uint64_t pos = run.offset;
+        for (uint64_t i = 0; i < run.count; ++i) {
+            if (pos > _baseSize || (pos == _baseSize && i > 0)) return false;
+            const char* nl = (const char*)memchr(_base + pos, '\n', (size_t)(_baseSize - pos));
+            uint64_t end = nl ? (uint64_t)(nl - _base) : _baseSize;
+            uint64_t len = end - pos;
+            if (nl && len > 0 && _base[end - 1] == '\r') len--;
+            slots.push_back({ pos, (uint32_t)std::min<uint64_t>(len, std::numeric_limits<uint32_t>::max()), -1 });
+            pos = nl ? end + 1 : _baseSize;
+        }
+    }
+
+    _blocks.clear();
+    _blockStarts.clear();
+    _lineCount = 0;
+    _overlays.clear();
+    _freeOverlays.clear();
+    for (LineSlot& slot : slots) {
+        if (slot.overlay >= 0) {
+            slot.overlay = allocOverlay(std::move(literals[slot.overlay]));
+        }
+    }
+    appendSlots(slots);
+    _version++;
+    rowsChanged(0, SIZE_MAX);
+    return true;
+}
+
+bool LineBuffer::rebase(const LineSnapshot& snapshot, std::string&& content, std::string_view lineEnding) {
+    if (snapshot.serializedSize(lineEnding) != content.size()) return false;
+
+    clear();
+    _owned = std::make_shared<std::string>(std::move(content));
+    _base = _owned->data();
+    _baseSize = _owned->size();
+    rebaseSlots(snapshot, lineEnding);
+    return true;
+}
+
+bool LineBuffer::rebaseMapped(const LineSnapshot& snapshot, const std::string& path, std::string_view lineEnding,
+                              std::string& error, uint64_t skipBytes) {
+    auto map = std::make_shared<MappedFile>();
+    if (!map->open(path)) {
+        error = map->lastError();
+        return false;
+    }
+    if (skipBytes > map->size() || snapshot.serializedSize(lineEnding) != map->size() - skipBytes) {
+        error = "file size does not match the buffer";
+        return false;
+    }
+
+    clear();
+    _map = map;
+    _base = _map->data() + skipBytes;
+    _baseSize = _map->size() - skipBytes;
+    rebaseSlots(snapshot, lineEnding);
+    return true;
+}
+
+void LineBuffer::adoptBase(LineBuffer& rebased) {
+    finishIndex();
+    std::swap(_blocks, rebased._blocks);
+    std::swap(_blockStarts, rebased._blockStarts);
+    std::swap(_overlays, rebased._overlays);
+    std::swap(_freeOverlays, rebased._freeOverlays);
+    std::swap(_map, rebased._map);
+    std::swap(_owned, rebased._owned);
+    std::swap(_base, rebased._base);
+    std::swap(_baseSize, rebased._baseSize);
+    std::swap(_crlfLines, rebased._crlfLines);
+    std::swap(_lfLines, rebased._lfLines);
+    _indexedBytes = _baseSize;
+}
+
+bool LineBuffer::appendFromFile(const std::string& path, uint64_t skipBytes, std::string& error) {
+    finishIndex();
+    auto map = std::make_shared<MappedFile>();
+    if (!map->open(path)) {
+        error = map->lastError();
+        return false;
+    }
+    if (map->size() < skipBytes + _baseSize) {
+        error = "file is smaller than the buffer";
+        return false;
+    }
+    if (map->size() == skipBytes + _baseSize) return true;
+
+    uint64_t scanFrom = reopenLastLine();
+
+    // Offsets into the old base stay valid in the new, longer mapping; the old mapping
+    // lives on for as long as a snapshot still refers to it.
+    _owned.reset();
+    _map = map;
+    _base = _map->data() + skipBytes;
+    _baseSize = _map->size() - skipBytes;
+    indexAppended(scanFrom);
+    return true;
+}
+
+void LineBuffer::appendData(const char* data, size_t size) {
+    if (size == 0) return;
+    finishIndex();
+    uint64_t scanFrom = reopenLastLine();
+
+    // Appending within the reserved capacity leaves the bytes snapshots can see where
+    // they are. Growing moves to a bigger copy and leaves the old one to the snapshots.
+    if (!_owned || _owned->size() + size > _owned->capacity()) {
+        auto grown = std::make_shared<std::string>();
+        grown->reserve(std::max<size_t>({ (size_t)_baseSize * 2, (size_t)_baseSize + size, APPEND_MIN_CAPACITY }));
+        grown->append(_base ? _base : "", (size_t)_baseSize);
+        _map.reset();
+        _owned = grown;
+    }
+    _owned->append(data, size);
+    _base = _owned->data();
+    _baseSize = _owned->size();
+    indexAppended(scanFrom);
+}
+
+bool LineBuffer::indexSlots(std::vector<LineSlot>& out) const {
+    if (_indexing) return false;
+    out.clear();
+    out.reserve(_lineCount);
+    for (const auto& block : _blocks) {
+        for (const LineSlot& slot : block->slots) {
+            if (slot.overlay >= 0) return false;
+            out.push_back(slot);
+        }
+    }
+    return true;
+}
+
+bool LineBuffer::openMappedIndexed(const std::string& path, std::string& error, uint64_t skipBytes,
+                                   const LineSlot* slots, size_t count, size_t crlfLines, size_t lfLines) {
+    auto map = std::make_shared<MappedFile>();
+    if (!map->open(path)) {
+        error = map->lastError();
+        return false;
+    }
+    if (skipBytes > map->size()) {
+        error = "index does not match the file";
+        return false;
+    }
+    uint64_t baseSize = map->size() - skipBytes;
+
+    // The slots must be in order, inside the file and cover all of it; anything else means
+    // the index belongs to a different version of the file.
+    uint64_t end = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (slots[i].overlay != -1 || slots[i].offset < end || slots[i].offset > baseSize ||
+            slots[i].length > baseSize - slots[i].offset) {
+            error = "index does not match the file";
+            return false;
+        }
+        end = slots[i].offset + slots[i].length;
+    }
+    if (baseSize - end > 2) {
+        error = "index does not match the file";
+        return false;
+    }
+
+    clear();
+    _map = map;
+    _base = _map->data() + skipBytes;
+    _baseSize = baseSize;
+    for (size_t i = 0; i < count; i += LINE_BLOCK_SIZE) {
+        auto block = std::make_shared<LineBlock>();
+        block->slots.assign(slots + i, slots + std::min(count, i + LINE_BLOCK_SIZE));
+        _blocks.push_back(std::move(block));
+    }
+    _lineCount = count;
+    rebuildBlockStarts(0);
+    _crlfLines = crlfLines;
+    _lfLines = lfLines;
+    _indexedBytes = _baseSize;
+    return true;
+}
+
+uint64_t LineBuffer::reopenLastLine() {
+    // An unterminated last line is scanned again so its continuation joins it. The empty
+    // placeholder line of an empty file is simply replaced.
+    uint64_t scanFrom = _baseSize;
+    if (_lineCount > 0 && (_baseSize == 0 || _base[_baseSize - 1] != '\n')) {
+        size_t local;
+        size_t b = locate(_lineCount - 1, local);
+        const LineSlot& last = _blocks[b]->slots[local];
+        if (last.overlay < 0 && last.offset + last.length == _baseSize) {
+            scanFrom = last.offset;
+            erase(_lineCount - 1);
+        } else if (_lineCount == 1 && length(0) == 0) {
+            erase(0);
+        }
+    }
+    return scanFrom;
+}
+
+void LineBuffer::indexAppended(uint64_t scanFrom) {
+    std::vector<LineSlot> slots;
+    uint64_t rest = scanLines(_base, scanFrom, _baseSize, slots, _crlfLines, _lfLines);
+    if (rest < _baseSize) {
+        slots.push_back({ rest, (uint32_t)std::min<uint64_t>(_baseSize - rest, std::numeric_limits<uint32_t>::max()), -1 });
+    }
+    appendSlots(slots);
+    _indexedBytes = _baseSize;
+    _version++;
+}
+
+void LineBuffer::rebaseSlots(const LineSnapshot& snapshot, std::string_view lineEnding) {
+    uint64_t pos = 0;
+    _blocks.reserve(snapshot._blocks.size());
+    for (const auto& block : snapshot._blocks) {
+        auto rebased = std::make_shared<LineBlock>();
+        rebased->slots.reserve(block->slots.size());
+        for (const LineSlot& slot : block->slots) {
+            uint32_t length = slot.overlay >= 0 ? (uint32_t)snapshot._overlays[slot.overlay]->size() : slot.length;
+            rebased->slots.push_back({ pos, length, -1 });
+            pos += length + lineEnding.size();
+        }
+        _blocks.push_back(std::move(rebased));
+    }
+    _blockStarts = snapshot._blockStarts;
+    _lineCount = snapshot._lineCount;
+    _crlfLines = lineEnding == "\r\n" ? _lineCount : 0;
+    _lfLines = lineEnding == "\r\n" ? 0 : _lineCount;
+    _indexedBytes = _baseSize;
+}
+
+void LineBuffer::appendSlots(const std::vector<LineSlot>& slots) {
+    size_t i = 0;
+    size_t firstTouched = _blocks.empty() ? 0 : _blocks.size() - 1;
+    while (i < slots.size()) {
+        if (_blocks.empty() || _blocks.back()->slots.size() >= LINE_BLOCK_SIZE) {
+            _blocks.push_back(std::make_shared<LineBlock>());
+            _blocks.back()->slots.reserve(LINE_BLOCK_SIZE);
+        }
+        auto& target = mutableBlock(_blocks.size() - 1).slots;
+        size_t take = std::min(slots.size() - i, LINE_BLOCK_SIZE - target.size());
+        target.insert(target.end(), slots.begin() + i, slots.begin() + i + take);
+        i += take;
+    }
+    if (!slots.empty()) rowsChanged(_lineCount, SIZE_MAX);
+    _lineCount += slots.size();
+    rebuildBlockStarts(firstTouched);
+}
+
+void LineBuffer::rebuildBlockStarts(size_t fromBlock) {
+    _blockStarts.resize(_blocks.size());
+    size_t start = 0;
+    if (fromBlock > 0 && fromBlock <= _blocks.size()) {
+        start = _blockStarts[fromBlock - 1] + _blocks[fromBlock - 1]->slots.size();
+    } else {
+        fromBlock = 0;
+    }
+    for (size_t b = fromBlock; b < _blocks.size(); ++b) {
+        _blockStarts[b] = start;
+        start += _blocks[b]->slots.size();
+    }
+}
+
+size_t LineBuffer::locate(size_t row, size_t& local) const {
+    auto it = std::upper_bound(_blockStarts.begin(), _blockStarts.end(), row);
+    size_t b = (it - _blockStarts.begin()) - 1;
+    local = row - _blockStarts[b];
+    return b;
+}
+
+LineBlock& LineBuffer::mutableBlock(size_t b) {
+    // A block still referenced by a snapshot is copied before it is changed.
+    if (_blocks[b].use_count() > 1) {
+        _blocks[b] = std::make_shared<LineBlock>(*_blocks[b]);
+    }
+    return *_blocks[b];
+}
+
+int32_t LineBuffer::allocOverlay(std::string&& text) {
+    if (!_freeOverlays.empty()) {
+        int32_t index = _freeOverlays.back();
+        _freeOverlays.pop_back();
+        _overlays[index] = std::make_shared<std::string>(std::move(text));
+        return index;
+    }
+    _overlays.push_back(std::make_shared<std::string>(std::move(text)));
+    return (int32_t)_overlays.size() - 1;
+}
+
+void LineBuffer::releaseOverlay(int32_t index) {
+    if (index < 0) return;
+    _overlays[index].reset();
+    _freeOverlays.push_back(index);
+}
+
+std::string& LineBuffer::operator[](size_t row) {
+    size_t local;
+    size_t b = locate(row, local);
+    _version++;
+    rowsChanged(row, row + 1);
+    LineSlot& slot = mutableBlock(b).slots[local];
+    if (slot.overlay < 0) {
+        slot.overlay = allocOverlay(std::string(_base + slot.offset, slot.length));
+    } else if (_overlays[slot.overlay].use_count() > 1) {
+        _overlays[slot.overlay] = std::make_shared<std::string>(*_overlays[slot.overlay]);
+    }
+    return *_overlays[slot.overlay];
+}
+
+std::string_view LineBuffer::view(size_t row) const {
+    size_t local;
+    size_t b = locate(row, local);
+    const LineSlot& slot = _blocks[b]->slots[local];
+    if (slot.overlay >= 0) {
+        return *_overlays[slot.overlay];
+    }
+    return std::string_view(_base + slot.offset, slot.length);
+}
+
+size_t LineBuffer::length(size_t row) const {
+    size_t local;
+    size_t b = locate(row, local);
+    const LineSlot& slot = _blocks[b]->slots[local];
+    return slot.overlay >= 0 ? _overlays[slot.overlay]->size() : slot.length;
+}
+
+void LineBuffer::insert(size_t row, std::string text) {
+    if (row >= _lineCount) {
+        push_back(std::move(text));
+        return;
+    }
+    LineSlot slot = { 0, 0, allocOverlay(std::move(text)) };
+
+    size_t local;
+    size_t b = locate(row, local);
+    auto& slots = mutableBlock(b).slots;
+    slots.insert(slots.begin() + local, slot);
+    _lineCount++;
+    _version++;
+    rowsChanged(row, SIZE_MAX);
+
+    if (slots.size() > 2 * LINE_BLOCK_SIZE) {
+        auto tail = std::make_shared<LineBlock>();
+        tail->slots.assign(slots.begin() + LINE_BLOCK_SIZE, slots.end());
+        slots.resize(LINE_BLOCK_SIZE);
+        _blocks.insert(_blocks.begin() + b + 1, std::move(tail));
+    }
+    rebuildBlockStarts(b);
+}
+
+void LineBuffer::insert(size_t row, std::vector<std::string>&& texts) {
+    if (texts.empty()) return;
+    std::vector<LineSlot> inserted;
+    inserted.reserve(texts.size());
+    for (std::string& text : texts) {
+        inserted.push_back({ 0, 0, allocOverlay(std::move(text)) });
+    }
+    if (row >= _lineCount) {
+        appendSlots(inserted);
+        _version++;
+        return;
+    }
+
+    size_t local;
+    size_t b = locate(row, local);
+    auto& slots = mutableBlock(b).slots;
+    slots.insert(slots.begin() + local, inserted.begin(), inserted.end());
+    _lineCount += inserted.size();
+    _version++;
+    rowsChanged(row, SIZE_MAX);
+
+    // An overgrown block is cut into blocks of LINE_BLOCK_SIZE lines.
+    if (slots.size() > 2 * LINE_BLOCK_SIZE) {
+        std::vector<std::shared_ptr<LineBlock>> tails;
+        for (size_t i = LINE_BLOCK_SIZE; i < slots.size(); i += LINE_BLOCK_SIZE) {
+            auto tail = std::make_shared<LineBlock>();
+            tail->slots.assign(slots.begin() + i, slots.begin() + std::min(slots.size(), i + LINE_BLOCK_SIZE));
+            tails.push_back(std::move(tail));
+        }
+        slots.resize(LINE_BLOCK_SIZE);
+        _blocks.insert(_blocks.begin() + b + 1, tails.begin(), tails.end());
+    }
+    rebuildBlockStarts(b);
+}
+
+bool LineBuffer::takeChangedRows(size_t& from, size_t& to) {
+    if (_changedFrom >= _changedTo) return false;
+    from = _changedFrom;
+    to = _changedTo;
+    _changedFrom = SIZE_MAX;
+    _changedTo = 0;
+    return true;
+}
+
+void LineBuffer::rowsChanged(size_t from, size_t to) {
+    _changedFrom = std::min(_changedFrom, from);
+    _changedTo = std::max(_changedTo, to);
+}
+
+void LineBuffer::push_back(std::string text) {
+    appendSlots({ { 0, 0, allocOverlay(std::move(text)) } });
+    _version++;
+}
+
+void LineBuffer::erase(size_t row) {
+    if (row >= _lineCount) return;
+
+    size_t local;
+    size_t b = locate(row, local);
+    auto& slots = mutableBlock(b).slots;
+    releaseOverlay(slots[local].overlay);
+    slots.erase(slots.begin() + local);
+    _lineCount--;
+    _version++;
+    rowsChanged(row, SIZE_MAX);
+
+    if (slots.empty()) {
+        _blocks.erase(_blocks.begin() + b);
+        b = b > 0 ? b - 1 : 0;
+    }
+    rebuildBlockStarts(b);
+}
+
+void LineBuffer::erase(size_t row, size_t count) {
+    if (row >= _lineCount || count == 0) return;
+    count = std::min(count, _lineCount - row);
+
+    // Blocks that lose all their lines are dropped whole, so trimming the head of a
+    // long buffer does not shift every remaining slot.
+    size_t local;
+    size_t first = locate(row, local);
+    size_t b = first;
+    size_t remaining = count;
+    while (remaining > 0) {
+        const auto& slots = _blocks[b]->slots;
+        size_t take = std::min(remaining, slots.size() - local);
+        for (size_t i = local; i < local + take; ++i) {
+            releaseOverlay(slots[i].overlay);
+        }
+        if (take == slots.size()) {
+            _blocks[b].reset();
+        } else {
+            auto& kept = mutableBlock(b).slots;
+            kept.erase(kept.begin() + local, kept.begin() + local + take);
+        }
+        remaining -= take;
+        local = 0;
+        b++;
+    }
+    _blocks.erase(std::remove(_blocks.begin() + first, _blocks.begin() + b, nullptr), _blocks.begin() + b);
+    _lineCount -= count;
+    _version++;
+    rowsChanged(row, SIZE_MAX);
+    rebuildBlockStarts(first > 0 ? first - 1 : 0);
+}
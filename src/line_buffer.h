@@ -0,0 +1,206 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include "mapped_file.h"
+
+const size_t LINE_BLOCK_SIZE = 1024;            // Target number of line slots per block
+const size_t INDEX_BATCH_LINES = 64 * 1024;     // Lines handed from the indexer thread per batch
+const uint64_t INDEX_SYNC_BYTES = 1024 * 1024;  // Bytes indexed up front so the first screen is ready immediately
+const size_t APPEND_MIN_CAPACITY = 1024 * 1024; // Initial storage reserved for a buffer filled by appendData()
+
+// One line of the buffer. While a line is untouched it is just a window into the
+// base storage (a mapped file or a single heap copy of the file). The first
+// mutable access copies it into an overlay string, so edits never copy the base.
+struct LineSlot {
+    uint64_t offset;  // Start of the line in the base storage
+    uint32_t length;  // Length without the line terminator
+    int32_t overlay;  // Index into the overlay table, -1 while the line lives in the base
+};
+
+// A stretch of lines used to persist the buffer layout without copying the base: either
+// count consecutive lines of the base starting at offset, or a single edited line.
+struct LineRun {
+    bool literal;
+    uint64_t offset;
+    uint64_t count;
+    std::string text;
+};
+
+struct LineBlock {
+    std::vector<LineSlot> slots;
+};
+
+// Consecutive lines that lie back to back in memory, each followed by its own terminator
+// (except possibly the last), so a search can scan them in one pass instead of line by line:
+// a run of untouched lines of the base within one block, or a single edited line.
+struct TextChunk {
+    const char* data;
+    size_t size;
+    size_t firstRow;
+    const LineSlot* slots;  // The chunk's lines, or nullptr for an edited line
+    size_t lineCount;
+
+    // Index of the line that data[pos] belongs to; a terminator belongs to the line before it.
+    size_t lineAt(size_t pos) const;
+    size_t lineStart(size_t line) const;
+    size_t lineLength(size_t line) const;
+};
+
+// Immutable view of a LineBuffer at one point in time. Blocks, overlays and the base
+// storage are shared with the live buffer, which copies them before changing them,
+// so taking a snapshot only copies pointers and a snapshot is safe to read from any thread.
+class LineSnapshot {
+public:
+    LineSnapshot() : _lineCount(0), _base(nullptr), _baseSize(0) {}
+
+    size_t size() const { return _lineCount; }
+    std::string_view view(size_t row) const;
+
+    // Streams the lines to sink with lineEnding after every line. Runs of untouched
+    // lines whose terminators already match are passed as single spans of the base.
+    bool serialize(std::string_view lineEnding, const std::function<bool(const char*, size_t)>& sink) const;
+    uint64_t serializedSize(std::string_view lineEnding) const;
+    std::vector<LineRun> runs() const;
+
+    // Passes rows [fromRow, toRow) to visit as chunks, in order, until visit returns false.
+    void forEachChunk(size_t fromRow, size_t toRow, const std::function<bool(const TextChunk&)>& visit) const;
+
+private:
+    friend class LineBuffer;
+
+    std::vector<std::shared_ptr<LineBlock>> _blocks;
+    std::vector<size_t> _blockStarts;
+    std::vector<std::shared_ptr<std::string>> _overlays;
+    std::shared_ptr<const void> _keepAlive;
+    size_t _lineCount;
+    const char* _base;
+    uint64_t _baseSize;
+};
+
+class LineBuffer {
+public:
+    LineBuffer();
+    ~LineBuffer();
+    LineBuffer(const LineBuffer&) = delete;
+    LineBuffer& operator=(const LineBuffer&) = delete;
+
+    void clear();
+    void assign(std::string&& content);
+    // skipBytes leaves a prefix of the file (a byte order mark) out of the buffer.
+    bool openMapped(const std::string& path, std::string& error, uint64_t skipBytes = 0);
+
+    // Background line indexing for mapped files. pollIndex() must be called from the
+    // owning thread; it publishes whatever the indexer found since the last call.
+    bool isIndexing() const { return _indexing; }
+    int indexProgress() const;
+    bool pollIndex();
+    // Blocks until the background indexer is done and all lines are known.
+    void finishIndex();
+
+    bool isMapped() const { return _map != nullptr; }
+    uint64_t baseSize() const { return _baseSize; }
+
+    size_t size() const { return _lineCount; }
+    bool empty() const { return _lineCount == 0; }
+
+    // Bumped by every mutation, so callers can tell whether the buffer changed since they last looked.
+    uint64_t version() const { return _version; }
+    // Rows [from, to) that mutations touched since the last call, for redrawing just those.
+    // to is SIZE_MAX once lines were inserted or removed, which moves every line after
+    // them. False if nothing changed.
+    bool takeChangedRows(size_t& from, size_t& to);
+    LineSnapshot snapshot() const;
+    // Rebuilds the lines from runs taken of a buffer with the same base. Returns false if
+    // a run does not fit the base; the buffer is left unchanged in that case.
+    bool restoreRuns(const std::vector<LineRun>& runs);
+    // After snapshot was written out with lineEnding, makes this buffer hold its lines with
+    // every line pointing at the written copy (content, or the file at path mapped) and no
+    // edited line copies. Only reads the snapshot, so a save thread can build the result on
+    // a buffer of its own. Returns false if the new base does not match the lines; the
+    // buffer is unchanged then.
+    bool rebase(const LineSnapshot& snapshot, std::string&& content, std::string_view lineEnding);
+    bool rebaseMapped(const LineSnapshot& snapshot, const std::string& path, std::string_view lineEnding,
+                      std::string& error, uint64_t skipBytes = 0);
+    // Takes over the base and lines of rebased, which must read exactly as this buffer does:
+    // built by rebase() from a snapshot of it that it has not changed since, or a reloaded
+    // copy of the file it was edited to match. The lines read the same, so this is not a
+    // mutation; rebased is left with the old base.
+    void adoptBase(LineBuffer& rebased);
+    // Follows a file that is only ever appended to, such as a growing log: maps path again
+    // and indexes just the bytes past the current base, continuing an unterminated last
+    // line. The base must still be the start of that file (after skipBytes).
+    bool appendFromFile(const std::string& path, uint64_t skipBytes, std::string& error);
+    // Appends raw text to the base as it streams in (a pipe), indexing only the new lines.
+    void appendData(const char* data, size_t size);
+
+    // Line index persistence for large files. indexSlots() fails while indexing or once a
+    // line was edited, since the slots then no longer describe the file alone.
+    // openMappedIndexed() maps path with a previously saved index instead of scanning it,
+    // after checking that the slots fit the file.
+    bool indexSlots(std::vector<LineSlot>& out) const;
+    bool openMappedIndexed(const std::string& path, std::string& error, uint64_t skipBytes,
+                           const LineSlot* slots, size_t count, size_t crlfLines, size_t lfLines);
+
+    std::string& operator[](size_t row);
+    std::string_view view(size_t row) const;
+    size_t length(size_t row) const;
+
+    void insert(size_t row, std::string text);
+    // Inserts texts as consecutive lines before row, shifting the rows below only once.
+    void insert(size_t row, std::vector<std::string>&& texts);
+    void erase(size_t row);
+    void erase(size_t row, size_t count);
+    void push_back(std::string text);
+
+    size_t crlfLineCount() const { return _crlfLines; }
+    size_t lfLineCount() const { return _lfLines; }
+
+private:
+    std::vector<std::shared_ptr<LineBlock>> _blocks;
+    std::vector<size_t> _blockStarts;
+    size_t _lineCount;
+    uint64_t _version;
+    size_t _changedFrom;  // Rows touched since takeChangedRows(); none while _changedFrom >= _changedTo
+    size_t _changedTo;
+
+    std::vector<std::shared_ptr<std::string>> _overlays;
+    std::vector<int32_t> _freeOverlays;
+
+    std::shared_ptr<MappedFile> _map;
+    std::shared_ptr<std::string> _owned;
+    const char* _base;
+    uint64_t _baseSize;
+    size_t _crlfLines;
+    size_t _lfLines;
+
+    bool _indexing;
+    std::thread _indexThread;
+    std::mutex _indexMutex;
+    std::vector<LineSlot> _pendingSlots;
+    size_t _pendingCrlf;
+    size_t _pendingLf;
+    bool _indexFinished;
+    std::atomic<uint64_t> _indexedBytes;
+    std::atomic<bool> _cancelIndex;
+
+    void stopIndexer();
+    void indexerMain(uint64_t start);
+    void appendSlots(const std::vector<LineSlot>& slots);
+    size_t locate(size_t row, size_t& local) const;
+    void rebuildBlockStarts(size_t fromBlock);
+    LineBlock& mutableBlock(size_t b);
+    void rebaseSlots(const LineSnapshot& snapshot, std::string_view lineEnding);
+    uint64_t reopenLastLine();
+    void indexAppended(uint64_t scanFrom);
+    int32_t allocOverlay(std::string&& text);
+    void releaseOverlay(int32_t index);
+    void rowsChanged(size_t from, size_t to);
+};
@@ -0,0 +1,170 @@
+#include "line_diff.h"
+#include <algorithm>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+struct DiffRange {
+    size_t oldFrom, oldTo;
+    size_t newFrom, newTo;
+};
+
+struct Occurrence {
+    size_t oldCount = 0;
+    size_t newCount = 0;
+    size_t oldRow = 0;
+    size_t newRow = 0;
+};
+
+}
+
+static bool hashLines(const LineSnapshot& snapshot, const std::atomic<bool>& cancel, std::vector<size_t>& hashes) {
+    std::hash<std::string_view> hasher;
+    hashes.resize(snapshot.size());
+    for (size_t row = 0; row < hashes.size(); ++row) {
+        if ((row & 0xFFFF) == 0 && cancel) return false;
+        hashes[row] = hasher(snapshot.view(row));
+    }
+    return true;
+}
+
+// Indices of the longest run of pairs whose new rows increase, given pairs in old row order.
+static std::vector<size_t> longestIncreasing(const std::vector<std::pair<size_t, size_t>>& pairs) {
+    std::vector<size_t> tails;  // tails[k]: the pair ending the best run of k + 1 found so far
+    std::vector<size_t> previous(pairs.size(), SIZE_MAX);
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        auto it = std::lower_bound(tails.begin(), tails.end(), pairs[i].second,
+                                   [&pairs](size_t tail, size_t newRow) { return pairs[tail].second < newRow; });
+        if (it != tails.begin()) previous[i] = *(it - 1);
+        if (it == tails.end()) {
+            tails.push_back(i);
+        } else {
+            *it = i;
+        }
+    }
+    std::vector<size_t> run;
+    for (size_t i = tails.empty() ? SIZE_MAX : tails.back(); i != SIZE_MAX; i = previous[i]) {
+        run.push_back(i);
+    }
+    std::reverse(run.begin(), run.end());
+    return run;
+}
+
+bool diffLines(const LineSnapshot& before, const LineSnapshot& after, const std::atomic<bool>& cancel,
+               std::vector<LineHunk>& hunks) {
+    hunks.clear();
+    std::vector<size_t> oldHashes, newHashes;
+    if (!hashLines(before, cancel, oldHashes) || !hashLines(after, cancel, newHashes)) return false;
+
+    auto same = [&](size_t oldRow, size_t newRow) {
+        return oldHashes[oldRow] == newHashes[newRow] && before.view(oldRow) == after.view(newRow);
+    };
+
+    // Bounds the lookahead below over the whole diff, so it stays linear in the line count.
+    size_t lookaheadBudget = before.size() + after.size();
+    std::vector<DiffRange> work = { { 0, before.size(), 0, after.size() } };
+    while (!work.empty()) {
+        if (cancel) return false;
+        DiffRange range = work.back();
+        work.pop_back();
+
+        while (range.oldFrom < range.oldTo && range.newFrom < range.newTo && same(range.oldFrom, range.newFrom)) {
+            range.oldFrom++;
+            range.newFrom++;
+        }
+        while (range.oldFrom < range.oldTo && range.newFrom < range.newTo && same(range.oldTo - 1, range.newTo - 1)) {
+            range.oldTo--;
+            range.newTo--;
+        }
+        LineHunk whole = { range.oldFrom, range.oldTo - range.oldFrom, range.newFrom, range.newTo - range.newFrom };
+        if (whole.oldRows == 0 || whole.newRows == 0) {
+            if (whole.oldRows > 0 || whole.newRows > 0) hunks.push_back(whole);
+            continue;
+        }
+
+        // A map of its own per range: clearing one sized for the whole file would cost
+        // that much again for every small range after it.
+        std::unordered_map<size_t, Occurrence> occurrences;
+        occurrences.reserve(whole.oldRows);
+        for (size_t row = range.oldFrom; row < range.oldTo; ++row) {
+            Occurrence& occurrence = occurrences[oldHashes[row]];
+            occurrence.oldCount++;
+            occurrence.oldRow = row;
+        }
+        for (size_t row = range.newFrom; row < range.newTo; ++row) {
+            auto it = occurrences.find(newHashes[row]);
+            if (it == occurrences.end()) continue;
+            it->second.newCount++;
+            it->second.newRow = row;
+        }
+        std::vector<std::pair<size_t, size_t>> unique;
+        for (size_t row = range.oldFrom; row < range.oldTo; ++row) {
+            const Occurrence& occurrence = occurrences.find(oldHashes[row])->second;
+            if (occurrence.oldCount == 1 && occurrence.newCount == 1 && same(row, occurrence.newRow)) {
+                unique.emplace_back(row, occurrence.newRow);
+            }
+        }
+
+        std::vector<size_t> anchors = longestIncreasing(unique);
+        if (anchors.empty()) {
+            // Nothing unique to align on, as in a file of repeated lines. Lines inserted,
+            // removed or replaced at the head of the stretch show as the head reappearing a
+            // little way into the other side; from there on the two run together again.
+            while (range.oldFrom < range.oldTo && range.newFrom < range.newTo) {
+                size_t oldRows = range.oldTo - range.oldFrom, newRows = range.newTo - range.newFrom;
+                size_t skipOld = 0, skipNew = 0;
+                size_t window = std::min(DIFF_LOOKAHEAD_LINES, std::max(oldRows, newRows));
+                for (size_t d = 1; d < window && lookaheadBudget > 0 && skipOld + skipNew == 0; ++d, --lookaheadBudget) {
+                    if (d < oldRows && same(range.oldFrom + d, range.newFrom)) {
+                        skipOld = d;
+                    } else if (d < newRows && same(range.oldFrom, range.newFrom + d)) {
+                        skipNew = d;
+                    } else if (d < oldRows && d < newRows && same(range.oldFrom + d, range.newFrom + d)) {
+                        skipOld = d;
+                        skipNew = d;
+                    }
+                }
+                if (skipOld + skipNew == 0) break;
+                hunks.push_back({ range.oldFrom, skipOld, range.newFrom, skipNew });
+                range.oldFrom += skipOld;
+                range.newFrom += skipNew;
+                while (range.oldFrom < range.oldTo && range.newFrom < range.newTo && same(range.oldFrom, range.newFrom)) {
+                    range.oldFrom++;
+                    range.newFrom++;
+                }
+            }
+            if (range.oldFrom < range.oldTo || range.newFrom < range.newTo) {
+                hunks.push_back({ range.oldFrom, range.oldTo - range.oldFrom, range.newFrom, range.newTo - range.newFrom });
+            }
+            continue;
+        }
+        // Anchors are unchanged lines; the stretches around them are diffed in turn.
+        size_t oldFrom = range.oldFrom;
+        size_t newFrom = range.newFrom;
+        for (size_t anchor : anchors) {
+            work.push_back({ oldFrom, unique[anchor].first, newFrom, unique[anchor].second });
+            oldFrom = unique[anchor].first + 1;
+            newFrom = unique[anchor].second + 1;
+        }
+        work.push_back({ oldFrom, range.oldTo, newFrom, range.newTo });
+    }
+
+    std::sort(hunks.begin(), hunks.end(), [](const LineHunk& a, const LineHunk& b) { return a.oldRow < b.oldRow; });
+
+    // Past DIFF_MAX_HUNKS, runs of neighbouring hunks become one along with the unchanged
+    // lines between them, which keeps applying them cheap when nearly everything changed.
+    if (hunks.size() > DIFF_MAX_HUNKS) {
+        size_t group = (hunks.size() + DIFF_MAX_HUNKS - 1) / DIFF_MAX_HUNKS;
+        std::vector<LineHunk> merged;
+        for (size_t i = 0; i < hunks.size(); i += group) {
+            const LineHunk& first = hunks[i];
+            const LineHunk& last = hunks[std::min(hunks.size(), i + group) - 1];
+            merged.push_back({ first.oldRow, last.oldRow + last.oldRows - first.oldRow,
+                               first.newRow, last.newRow + last.newRows - first.newRow });
+        }
+        hunks.swap(merged);
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include "line_buffer.h"
+
+const size_t DIFF_LOOKAHEAD_LINES = 1024;  // How far a stretch with no unique line is searched for its head on the other side
+const size_t DIFF_MAX_HUNKS = 1024;        // Hunks returned at most; neighbours are merged past this
+
+// A stretch of lines that differs between two versions of a text: oldRows lines at oldRow
+// in the old version became newRows lines at newRow in the new one. Either count may be 0.
+struct LineHunk {
+    size_t oldRow;
+    size_t oldRows;
+    size_t newRow;
+    size_t newRows;
+};
+
+// Finds the stretches of lines that changed from before to after, in order, so that
+// everything between them is left alone. Lines are hashed once and compared by hash
+// before their text. The common head and tail are skipped; what is left is aligned on
+// lines that occur exactly once on each side (patience diff) and the stretches between
+// those are diffed the same way, so separate changes come out as separate hunks. A
+// stretch with nothing to align on is searched a short way for where its head continues
+// on the other side, and is one hunk past that. Returns false if cancel was set.
+bool diffLines(const LineSnapshot& before, const LineSnapshot& after, const std::atomic<bool>& cancel,
+               std::vector<LineHunk>& hunks);
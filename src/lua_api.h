@@ -77,10 +77,31 @@ int lua_is_ctrl_pressed(lua_State* L); // For checking key modifiers
 // Config
 int lua_set_tab_stop_width(lua_State* L);
 int lua_set_default_line_ending(lua_State* L);
+int lua_set_large_file_threshold(lua_State* L);
+int lua_get_file_encoding(lua_State* L);
+int lua_set_file_encoding(lua_State* L);
+int lua_reload_file(lua_State* L);
+int lua_set_auto_reload(lua_State* L);
+int lua_set_follow_mode(lua_State* L);
+int lua_set_read_only(lua_State* L);
+int lua_is_read_only(lua_State* L);
+int lua_set_search_options(lua_State* L);
+int lua_find_regex(lua_State* L);
+int lua_find_all_regex(lua_State* L);
+int lua_find_keywords(lua_State* L);
+int lua_highlight_keywords(lua_State* L);
+int lua_clear_keyword_highlights(lua_State* L);
+int lua_search_in_folder(lua_State* L);
+int lua_find_files(lua_State* L);
+int lua_index_folder(lua_State* L);
+int lua_replace_all(lua_State* L);
+int lua_replace_in_folder(lua_State* L);
+int lua_undo_replace(lua_State* L);
 
 // Plugin data persistence
 int lua_save_plugin_data(lua_State* L);
 int lua_load_plugin_data(lua_State* L);
+int lua_delete_plugin_data(lua_State* L);
 
 
 // Text Style Declaration api
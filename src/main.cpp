@@ -6,6 +6,18 @@
 // The old processKeyPress function is removed entirely as its logic is now within Editor::processInput
 
 int main(int argc, char* argv[]) {
+    // "splice -" pages whatever is piped in. The pipe is taken over before the editor sets
+    // up the console, which needs standard input to be the console again by then.
+    std::unique_ptr<StdinStream> stdinStream;
+    if (argc >= 2 && std::string(argv[1]) == "-") {
+        stdinStream = std::make_unique<StdinStream>();
+        std::string error;
+        if (!stdinStream->open(error)) {
+            std::cerr << "Could not read standard input: " << error << std::endl;
+            return 1;
+        }
+    }
+
     Editor editor; // Editor constructor handles console mode setup
 
     editor.setupDefaultKeybindings(); // Populate commandRegistry and customKeybindings
@@ -17,12 +29,15 @@ int main(int argc, char* argv[]) {
     }
     std::cerr << "------------------------" << std::endl;
 
-    if (argc >= 2) {
-        editor.openFile(argv[1]);
+    if (stdinStream) {
+        editor.openStdin(std::move(stdinStream));
+    } else {
+        editor.openSessionBuffer(argc >= 2 ? argv[1] : "");
     }
     
     bool running = true;
     while (running) {
+        editor.pollBackgroundWork();
         editor.refreshScreen();
 
         HANDLE hInput = GetStdHandle(STD_INPUT_HANDLE);
@@ -55,6 +70,7 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    editor.saveSession();
     editor.clearScreen();
     std::cout << "Exiting editor." << std::endl;
 
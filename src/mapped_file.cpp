@@ -0,0 +1,143 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+MappedFile::MappedFile() : _data(nullptr), _size(0), _open(false),
+#ifdef _WIN32
+    _hFile(INVALID_HANDLE_VALUE), _hMapping(NULL)
+#else
+    _fd(-1)
+#endif
+{}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path) {
+    close();
+    _path = path;
+
+    // FILE_SHARE_WRITE lets log writers keep appending while we look at the file,
+    // FILE_SHARE_DELETE lets a save rename over a file we still have mapped.
+    HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        _error = "CreateFileA failed (GLE: " + std::to_string(GetLastError()) + ")";
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize)) {
+        _error = "GetFileSizeEx failed (GLE: " + std::to_string(GetLastError()) + ")";
+        CloseHandle(hFile);
+        return false;
+    }
+
+    _hFile = hFile;
+    _size = (uint64_t)fileSize.QuadPart;
+    _open = true;
+
+    // Windows refuses to map an empty file; an open, zero-length view is what callers expect.
+    if (_size == 0) {
+        return true;
+    }
+
+    HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMapping == NULL) {
+        _error = "CreateFileMappingA failed (GLE: " + std::to_string(GetLastError()) + ")";
+        close();
+        return false;
+    }
+    _hMapping = hMapping;
+
+    _data = (const char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!_data) {
+        _error = "MapViewOfFile failed (GLE: " + std::to_string(GetLastError()) + ")";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close() {
+    if (_data) {
+        UnmapViewOfFile(_data);
+        _data = nullptr;
+    }
+    if (_hMapping != NULL) {
+        CloseHandle(_hMapping);
+        _hMapping = NULL;
+    }
+    if (_hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(_hFile);
+        _hFile = INVALID_HANDLE_VALUE;
+    }
+    _size = 0;
+    _open = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path) {
+    close();
+    _path = path;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        _error = std::string("open failed: ") + strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        _error = std::string("fstat failed: ") + strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    _fd = fd;
+    _size = (uint64_t)st.st_size;
+    _open = true;
+
+    if (_size == 0) {
+        return true;
+    }
+
+    void* mem = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED) {
+        _error = std::string("mmap failed: ") + strerror(errno);
+        close();
+        return false;
+    }
+    madvise(mem, _size, MADV_SEQUENTIAL);
+    _data = (const char*)mem;
+    return true;
+}
+
+void MappedFile::close() {
+    if (_data) {
+        munmap((void*)_data, _size);
+        _data = nullptr;
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    _size = 0;
+    _open = false;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file. The mapping stays valid until
+// close() or destruction, so callers can keep raw pointers into data() for
+// as long as they hold the MappedFile.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return _open; }
+    const char* data() const { return _data; }
+    uint64_t size() const { return _size; }
+    const std::string& path() const { return _path; }
+    const std::string& lastError() const { return _error; }
+
+private:
+    std::string _path;
+    std::string _error;
+    const char* _data;
+    uint64_t _size;
+    bool _open;
+
+#ifdef _WIN32
+    void* _hFile;
+    void* _hMapping;
+#else
+    int _fd;
+#endif
+};
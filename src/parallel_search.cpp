@@ -0,0 +1,125 @@
+#include "parallel_search.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+using ChunkScanner = std::function<void(size_t fromRow, size_t toRow, std::vector<SearchMatch>& matches,
+                                        const std::function<bool()>& keepGoing)>;
+
+namespace {
+
+struct ParallelJob {
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::vector<std::vector<SearchMatch>> results;  // One per chunk, filled by its task
+    std::vector<uint8_t> done;
+    size_t running = 0;                             // Tasks submitted and not finished yet
+    std::atomic<bool> stop{false};
+};
+
+}
+
+static bool runParallel(WorkerPool& pool, size_t rowCount, size_t fromRow, size_t toRow, size_t chunkRows,
+                        const std::atomic<bool>& cancel, const ChunkScanner& scanChunk, const SearchChunkVisitor& onChunk) {
+    if (chunkRows == 0) chunkRows = PARALLEL_SEARCH_CHUNK_ROWS;
+    toRow = std::min(toRow, rowCount);
+    if (fromRow >= toRow) return !cancel;
+
+    size_t chunks = (toRow - fromRow + chunkRows - 1) / chunkRows;
+    size_t ahead = std::max<size_t>(1, pool.size() * PARALLEL_SEARCH_TASKS_PER_THREAD);
+    ParallelJob job;
+    job.results.resize(chunks);
+    job.done.assign(chunks, 0);
+
+    auto keepGoing = [&job, &cancel]() { return !job.stop && !cancel; };
+    size_t submitted = 0;
+    bool completed = true;
+    for (size_t next = 0; next < chunks; ++next) {
+        // Only a window of chunks past the one being delivered is queued, so a huge buffer
+        // with many matches does not hold all of them at once.
+        while (submitted < chunks && submitted < next + ahead) {
+            size_t index = submitted++;
+            size_t from = fromRow + index * chunkRows;
+            size_t to = std::min(toRow, from + chunkRows);
+            {
+                std::lock_guard<std::mutex> lock(job.mutex);
+                ++job.running;
+            }
+            pool.submit([&job, &scanChunk, &keepGoing, index, from, to]() {
+                std::vector<SearchMatch> matches;
+                if (keepGoing()) scanChunk(from, to, matches, keepGoing);
+                std::lock_guard<std::mutex> lock(job.mutex);
+                job.results[index] = std::move(matches);
+                job.done[index] = 1;
+                --job.running;
+                job.finished.notify_all();
+            });
+        }
+
+        std::vector<SearchMatch> matches;
+        {
+            std::unique_lock<std::mutex> lock(job.mutex);
+            job.finished.wait(lock, [&job, next]() { return job.done[next] != 0; });
+            matches = std::move(job.results[next]);
+        }
+        // A chunk cut short by cancelling is incomplete, so it is not passed on.
+        if (cancel) {
+            completed = false;
+            break;
+        }
+        size_t from = fromRow + next * chunkRows;
+        if (!onChunk(from, std::min(toRow, from + chunkRows), matches)) {
+            completed = false;
+            break;
+        }
+    }
+
+    job.stop = true;
+    std::unique_lock<std::mutex> lock(job.mutex);
+    job.finished.wait(lock, [&job]() { return job.running == 0; });
+    return completed;
+}
+
+bool searchSnapshotParallel(WorkerPool& pool, const LineSnapshot& snapshot, const LiteralSearcher& searcher,
+                            size_t fromRow, size_t toRow, size_t chunkRows,
+                            const std::atomic<bool>& cancel, const SearchChunkVisitor& onChunk) {
+    if (searcher.empty()) return !cancel;
+    ChunkScanner scanChunk = [&snapshot, &searcher](size_t from, size_t to, std::vector<SearchMatch>& matches,
+                                                   const std::function<bool()>& keepGoing) {
+        searchSnapshot(snapshot, searcher, from, to, [&matches, &keepGoing](const SearchMatch& match) {
+            matches.push_back(match);
+            return keepGoing();
+        });
+    };
+    return runParallel(pool, snapshot.size(), fromRow, toRow, chunkRows, cancel, scanChunk, onChunk);
+}
+
+bool searchSnapshotParallel(WorkerPool& pool, const LineSnapshot& snapshot, const Regex& regex,
+                            size_t fromRow, size_t toRow, size_t chunkRows,
+                            const std::atomic<bool>& cancel, const SearchChunkVisitor& onChunk) {
+    if (!regex.isValid()) return !cancel;
+    // A regex keeps its DFA cache in the object, so tasks borrow copies from here instead
+    // of each chunk starting with a cold cache.
+    std::mutex idleMutex;
+    std::vector<std::unique_ptr<Regex>> idle;
+    ChunkScanner scanChunk = [&snapshot, &regex, &idleMutex, &idle](size_t from, size_t to, std::vector<SearchMatch>& matches,
+                                                                    const std::function<bool()>& keepGoing) {
+        std::unique_ptr<Regex> own;
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            if (!idle.empty()) {
+                own = std::move(idle.back());
+                idle.pop_back();
+            }
+        }
+        if (!own) own = std::make_unique<Regex>(regex);
+        searchSnapshot(snapshot, *own, from, to, [&matches, &keepGoing](const SearchMatch& match) {
+            matches.push_back(match);
+            return keepGoing();
+        });
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idle.push_back(std::move(own));
+    };
+    return runParallel(pool, snapshot.size(), fromRow, toRow, chunkRows, cancel, scanChunk, onChunk);
+}
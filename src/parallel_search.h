@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include "line_buffer.h"
+#include "text_search.h"
+#include "text_regex.h"
+#include "worker_pool.h"
+
+const size_t PARALLEL_SEARCH_CHUNK_ROWS = 16384;     // Rows per task unless the caller asks for another size
+const size_t PARALLEL_SEARCH_TASKS_PER_THREAD = 4;   // Chunks queued ahead per pool thread, which bounds the results held at once
+
+// Receives the matches of rows [fromRow, toRow); returning false stops the search.
+using SearchChunkVisitor = std::function<bool(size_t fromRow, size_t toRow, const std::vector<SearchMatch>& matches)>;
+
+// Splits rows [fromRow, toRow) of snapshot into chunks of chunkRows rows (0 for the
+// default), searches the chunks on the pool's threads and passes their matches to onChunk
+// on the calling thread, in row order, as soon as each chunk and every chunk before it is
+// done. Chunks always end at line boundaries and matches never span lines, so merging is
+// just concatenation. Returns false if cancel was set or onChunk stopped the search;
+// either way it only returns once no task is using snapshot or the searcher anymore.
+// Must not be called from a task of the same pool.
+bool searchSnapshotParallel(WorkerPool& pool, const LineSnapshot& snapshot, const LiteralSearcher& searcher,
+                            size_t fromRow, size_t toRow, size_t chunkRows,
+                            const std::atomic<bool>& cancel, const SearchChunkVisitor& onChunk);
+
+// The same for a regular expression; each pool thread searches with its own copy of regex.
+bool searchSnapshotParallel(WorkerPool& pool, const LineSnapshot& snapshot, const Regex& regex,
+                            size_t fromRow, size_t toRow, size_t chunkRows,
+                            const std::atomic<bool>& cancel, const SearchChunkVisitor& onChunk);
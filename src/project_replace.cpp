@@ -0,0 +1,309 @@
+#include "project_replace.h"
+#include "project_search.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <cstring>
+
+struct ProjectReplace::FileResult {
+    std::string display;
+    std::string text;  // Report line of the file
+    size_t matches = 0;
+    bool binary = false;
+    bool unreadable = false;
+    bool open = false;
+    bool failed = false;
+    std::unique_ptr<AtomicFileWriter> writer;  // Staged rewrite of the file
+    bool done = false;
+};
+
+static std::string canonicalPath(const std::string& path) {
+    std::error_code ec;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+    return ec ? path : canonical.string();
+}
+
+// "path:line:col: N matches", then what became of the file.
+static void appendReportLine(std::string& out, const std::string& path, size_t row, size_t col, size_t matches,
+                             const std::string& note) {
+    out += path;
+    out += ':';
+    out += std::to_string(row + 1);
+    out += ':';
+    out += std::to_string(col + 1);
+    out += ": ";
+    out += std::to_string(matches);
+    out += matches == 1 ? " match" : " matches";
+    if (!note.empty()) {
+        out += ", ";
+        out += note;
+    }
+    out += '\n';
+}
+
+ProjectReplace::ProjectReplace() : _dryRun(true), _cancel(false), _running(false) {}
+
+ProjectReplace::~ProjectReplace() {
+    cancel();
+}
+
+bool ProjectReplace::start(WorkerPool& pool, const std::string& root, const std::string& pattern, const std::string& replacement,
+                           SearchOptions options, bool dryRun, const std::vector<std::string>& openPaths, std::string& error) {
+    cancel();
+    if (!_replacer.prepare(pattern, replacement, options, error)) return false;
+    _idleRegexes.clear();
+    _root = root;
+    _pattern = pattern;
+    _replacement = replacement;
+    _options = options;
+    _dryRun = dryRun;
+    _openPaths.clear();
+    for (const std::string& path : openPaths) _openPaths.push_back(canonicalPath(path));
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _output.clear();
+        _stats = ProjectReplaceStats();
+        _error.clear();
+    }
+
+    _cancel = false;
+    _running = true;
+    _thread = std::thread([this, &pool]() {
+        run(pool);
+        _running = false;
+    });
+    return true;
+}
+
+void ProjectReplace::cancel() {
+    if (!_thread.joinable()) return;
+    if (_running) _cancel = true;
+    _thread.join();
+}
+
+bool ProjectReplace::takeOutput(std::string& out) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_output.empty()) return false;
+    out += _output;
+    _output.clear();
+    return true;
+}
+
+ProjectReplaceStats ProjectReplace::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+std::string ProjectReplace::error() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _error;
+}
+
+void ProjectReplace::run(WorkerPool& pool) {
+    // Files handed to the pool and not published yet, in the order they were found.
+    std::deque<std::shared_ptr<FileResult>> pending;
+    size_t ahead = std::max<size_t>(1, pool.size() * PROJECT_SEARCH_FILES_PER_THREAD);
+
+    // Publishes the finished files at the front, waiting for the front one only while more than keep are pending.
+    auto publish = [this, &pending](size_t keep) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!pending.empty()) {
+            FileResult& file = *pending.front();
+            if (!file.done) {
+                if (pending.size() <= keep) return;
+                _fileDone.wait(lock, [&file]() { return file.done; });
+            }
+            if (!_cancel) {
+                _output += file.text;
+                _stats.filesSearched += !file.binary && !file.unreadable;
+                _stats.filesMatched += file.matches > 0;
+                _stats.matches += file.matches;
+                _stats.binaryFiles += file.binary;
+                _stats.unreadableFiles += file.unreadable;
+                _stats.openFiles += file.open;
+                _stats.failedFiles += file.failed;
+            }
+            if (file.writer) {
+                _staged.push_back(std::move(file.writer));
+                _stagedPaths.push_back(file.display);
+            }
+            pending.pop_front();
+        }
+    };
+
+    walkProjectFiles(_root, _cancel, [&](ProjectFile& found) {
+        auto file = std::make_shared<FileResult>();
+        pending.push_back(file);
+        pool.submit([this, file, path = std::move(found.path), display = std::move(found.display)]() {
+            if (!_cancel) replaceFile(path, display, *file);
+            std::lock_guard<std::mutex> lock(_mutex);
+            file->done = true;
+            _fileDone.notify_all();
+        });
+        publish(ahead);
+        return true;
+    });
+
+    // Even a cancelled replace waits for its tasks, which use this object.
+    publish(0);
+    commit();
+}
+
+void ProjectReplace::replaceFile(const std::string& path, const std::string& displayPath, FileResult& result) {
+    MappedFile file;
+    if (!file.open(path)) {
+        result.unreadable = true;
+        return;
+    }
+    const char* data = file.data();
+    size_t size = (size_t)file.size();
+    if (size == 0) return;
+    if (memchr(data, 0, std::min(size, PROJECT_SEARCH_BINARY_PROBE))) {
+        result.binary = true;
+        return;
+    }
+    result.display = displayPath;
+
+    std::unique_ptr<Regex> regex;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_idleRegexes.empty()) {
+            regex = std::move(_idleRegexes.back());
+            _idleRegexes.pop_back();
+        }
+    }
+    if (!regex) regex = std::make_unique<Regex>(_replacer.regex());
+    const LiteralSearcher* skipTo = _replacer.requiredLiteral();
+
+    // The file is copied to the writer up to written; changed lines go in as they are found.
+    std::unique_ptr<AtomicFileWriter> writer;
+    size_t written = 0;
+    bool writeFailed = false;
+    std::string writeError;
+    size_t firstRow = 0;
+    size_t firstCol = 0;
+    std::string replaced;
+    std::string crlfReplaced;
+
+    size_t row = 0;
+    size_t lineStart = 0;
+    while (lineStart < size && !_cancel && !writeFailed) {
+        if (skipTo) {
+            // Jump straight to the line holding the next occurrence of the literal, counting the lines on the way.
+            size_t hit = skipTo->find(data, size, lineStart);
+            if (hit == LiteralSearcher::npos) break;
+            while (const char* newline = (const char*)memchr(data + lineStart, '\n', hit - lineStart)) {
+                lineStart = newline - data + 1;
+                ++row;
+            }
+        }
+        const char* newline = (const char*)memchr(data + lineStart, '\n', size - lineStart);
+        size_t lineEnd = newline ? newline - data : size;
+        size_t length = lineEnd - lineStart;
+        bool crlf = length > 0 && data[lineEnd - 1] == '\r';
+        if (crlf) --length;
+        std::string_view line(data + lineStart, length);
+
+        size_t col = 0;
+        size_t count = _replacer.replaceLine(*regex, line, replaced, &col);
+        if (count > 0) {
+            if (result.matches == 0) {
+                firstRow = row;
+                firstCol = col;
+                result.open = !_dryRun && std::find(_openPaths.begin(), _openPaths.end(), canonicalPath(path)) != _openPaths.end();
+            }
+            result.matches += count;
+
+            if (!_dryRun && !result.open) {
+                if (!writer) {
+                    writer = std::make_unique<AtomicFileWriter>();
+                    if (!writer->open(path, size + SAVE_DIRECT_WRITE_MIN)) {
+                        writeFailed = true;
+                        writeError = writer->lastError();
+                        break;
+                    }
+                }
+                // Line breaks the replacement added follow the line's own ending.
+                const std::string* text = &replaced;
+                if (crlf && replaced.find('\n') != std::string::npos) {
+                    crlfReplaced.clear();
+                    for (char c : replaced) {
+                        if (c == '\n') crlfReplaced += '\r';
+                        crlfReplaced += c;
+                    }
+                    text = &crlfReplaced;
+                }
+                writeFailed = !writer->append(data + written, lineStart - written) ||
+                              !writer->appendCopy(text->data(), text->size());
+                written = lineStart + length;
+            }
+        }
+        lineStart = lineEnd + 1;
+        ++row;
+    }
+
+    if (writer && !writeFailed && !_cancel) {
+        // The rest of the file goes out from the mapping, which has to stay open until it is written.
+        writeFailed = !writer->append(data + written, size - written) || !writer->stage();
+    }
+    if (writer && (writeFailed || _cancel)) {
+        if (writeError.empty()) writeError = writer->lastError();
+        writer->abort();
+        writer.reset();
+    }
+
+    if (result.matches > 0) {
+        std::string note;
+        if (result.open) note = "open in the editor, replaced there";
+        else if (writeFailed) note = "could not be written: " + writeError;
+        result.failed = writeFailed;
+        appendReportLine(result.text, displayPath, firstRow, firstCol, result.matches, note);
+    }
+    result.writer = std::move(writer);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _idleRegexes.push_back(std::move(regex));
+}
+
+// Renames every rewritten file over its original, once all of them were written.
+void ProjectReplace::commit() {
+    std::vector<std::unique_ptr<AtomicFileWriter>> staged;
+    std::vector<std::string> paths;
+    size_t failed;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        staged.swap(_staged);
+        paths.swap(_stagedPaths);
+        failed = _stats.failedFiles;
+    }
+    if (_dryRun) return;
+
+    if (_cancel || failed > 0) {
+        for (auto& writer : staged) writer->abort();
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_cancel) _error = "stopped before the files were replaced; none was changed";
+        else _error = std::to_string(failed) + (failed == 1 ? " file" : " files") + " could not be written, so none was changed";
+        return;
+    }
+
+    // From here on it runs to the end even if cancelled: stopping half way would leave
+    // the folder half replaced.
+    size_t renamed = 0;
+    std::string report;
+    for (size_t i = 0; i < staged.size(); ++i) {
+        if (staged[i]->commit()) {
+            ++renamed;
+        } else {
+            ++failed;
+            report += paths[i] + ":1:1: not replaced: " + staged[i]->lastError() + "\n";
+        }
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _output += report;
+    _stats.filesWritten = renamed;
+    _stats.failedFiles = failed;
+    if (failed > 0) {
+        _error = std::to_string(failed) + (failed == 1 ? " file" : " files") + " could not be replaced; the others were";
+    }
+}
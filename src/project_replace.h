@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+#include "text_search.h"
+#include "text_replace.h"
+#include "worker_pool.h"
+#include "atomic_file_writer.h"
+
+struct ProjectReplaceStats {
+    size_t filesSearched = 0;
+    size_t filesMatched = 0;
+    size_t matches = 0;
+    size_t binaryFiles = 0;      // Skipped
+    size_t unreadableFiles = 0;  // Could not be opened or mapped
+    size_t openFiles = 0;        // Matched but left to the editor, which has them open
+    size_t failedFiles = 0;      // Could not be written or renamed
+    size_t filesWritten = 0;     // Replaced on disk
+};
+
+// Replace in folder: every match of a pattern in the files under a folder. The files are
+// walked as for ProjectSearch and each is handed to the worker pool, where it is
+// memory-mapped and rewritten into a temporary sibling (see AtomicFileWriter) in one pass:
+// the text between changed lines goes out straight from the mapping and only the changed
+// lines are built. No file is replaced until every file has been written; then the
+// temporary files are renamed over them one by one, or all deleted if any file could not
+// be written or the replace was cancelled, so a failure part way leaves the folder as it
+// was. A dry run writes nothing and only reports.
+//
+// The report comes out like the results of a folder search, one "path:line:col: N
+// matches" line per matching file in walk order, pointing at its first match. Files the
+// editor has open (openPaths) are counted but not written: the caller replaces them in
+// its buffer once the rest is committed.
+class ProjectReplace {
+public:
+    ProjectReplace();
+    ~ProjectReplace();
+    ProjectReplace(const ProjectReplace&) = delete;
+    ProjectReplace& operator=(const ProjectReplace&) = delete;
+
+    // Cancels a replace in progress and starts the next on pool, which must outlive it.
+    // Fails for an empty pattern or an invalid regex or replacement.
+    bool start(WorkerPool& pool, const std::string& root, const std::string& pattern, const std::string& replacement,
+               SearchOptions options, bool dryRun, const std::vector<std::string>& openPaths, std::string& error);
+    // Stops the replace; unless it already started renaming, no file is changed.
+    void cancel();
+    bool running() const { return _running; }
+    bool cancelled() const { return _cancel; }
+    bool dryRun() const { return _dryRun; }
+    const std::string& root() const { return _root; }
+    const std::string& pattern() const { return _pattern; }
+    const std::string& replacement() const { return _replacement; }
+    SearchOptions options() const { return _options; }
+
+    // Appends the report lines published since the last call to out; false if there were none.
+    bool takeOutput(std::string& out);
+    ProjectReplaceStats stats() const;
+    // Once it is over: why the files were left unchanged, or empty if they were replaced
+    // (or, for a dry run, counted).
+    std::string error() const;
+
+private:
+    struct FileResult;
+
+    std::string _root;
+    std::string _pattern;
+    std::string _replacement;
+    SearchOptions _options;
+    bool _dryRun;
+    std::vector<std::string> _openPaths;  // Canonical
+    Replacer _replacer;
+    std::vector<std::unique_ptr<Regex>> _idleRegexes;  // Copies of the pattern not in use by a task
+
+    std::thread _thread;
+    std::atomic<bool> _cancel;
+    std::atomic<bool> _running;
+    mutable std::mutex _mutex;  // Guards the file results, the regex copies, _output, _stats and _error
+    std::condition_variable _fileDone;
+    std::string _output;
+    ProjectReplaceStats _stats;
+    std::string _error;
+    std::vector<std::unique_ptr<AtomicFileWriter>> _staged;  // Written, waiting for the rename
+    std::vector<std::string> _stagedPaths;                   // Display paths of the same
+
+    void run(WorkerPool& pool);
+    void replaceFile(const std::string& path, const std::string& displayPath, FileResult& result);
+    void commit();
+};
@@ -0,0 +1,412 @@
+#include "project_search.h"
+#include "trigram_index.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+
+// '*' and '?' do not match a slash, "**" matches anything and "**/" also matches no directory at all.
+static bool globMatch(const char* g, const char* gEnd, const char* t, const char* tEnd) {
+    while (g < gEnd) {
+        if (*g == '*') {
+            bool crossesSlash = g + 1 < gEnd && g[1] == '*';
+            g += crossesSlash ? 2 : 1;
+            if (crossesSlash && g < gEnd && *g == '/' && globMatch(g + 1, gEnd, t, tEnd)) return true;
+            for (const char* p = t;; ++p) {
+                if (globMatch(g, gEnd, p, tEnd)) return true;
+                if (p == tEnd || (!crossesSlash && *p == '/')) return false;
+            }
+        }
+        if (t == tEnd) return false;
+        if (*g == '?') {
+            if (*t == '/') return false;
+        } else {
+            if (*g == '\\' && g + 1 < gEnd) ++g;
+            if (*g != *t) return false;
+        }
+        ++g;
+        ++t;
+    }
+    return t == tEnd;
+}
+
+IgnoreList::IgnoreList() {
+    add(".git/");
+    add(".hg/");
+    add(".svn/");
+    add(".vs/");
+    add("node_modules/");
+    add(std::string("/") + TRIGRAM_INDEX_FILE_NAME);
+    add("*.splice-tmp");  // Files being written by a save or a replace in folder
+}
+
+bool IgnoreList::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        add(line);
+    }
+    return true;
+}
+
+void IgnoreList::add(std::string_view pattern) {
+    while (!pattern.empty() && (pattern.back() == '\r' || pattern.back() == ' ' || pattern.back() == '\t')) {
+        pattern.remove_suffix(1);
+    }
+    if (pattern.empty() || pattern[0] == '#') return;
+
+    Rule rule = { "", false, false, false };
+    if (pattern[0] == '!') {
+        rule.negate = true;
+        pattern.remove_prefix(1);
+    }
+    if (!pattern.empty() && pattern.back() == '/') {
+        rule.directoryOnly = true;
+        pattern.remove_suffix(1);
+    }
+    if (!pattern.empty() && pattern[0] == '/') {
+        rule.anchored = true;
+        pattern.remove_prefix(1);
+    }
+    if (pattern.empty()) return;
+    rule.anchored = rule.anchored || pattern.find('/') != std::string_view::npos;
+    rule.glob = pattern;
+    _rules.push_back(std::move(rule));
+}
+
+bool IgnoreList::ignored(std::string_view relativePath, bool isDirectory) const {
+    size_t slash = relativePath.rfind('/');
+    std::string_view name = slash == std::string_view::npos ? relativePath : relativePath.substr(slash + 1);
+    bool ignore = false;
+    for (const Rule& rule : _rules) {
+        // Only a rule that would flip the answer needs to be tried.
+        if (rule.negate != ignore || (rule.directoryOnly && !isDirectory)) continue;
+        std::string_view text = rule.anchored ? relativePath : name;
+        const char* glob = rule.glob.data();
+        if (globMatch(glob, glob + rule.glob.size(), text.data(), text.data() + text.size())) {
+            ignore = !rule.negate;
+        }
+    }
+    return ignore;
+}
+
+void walkProjectFiles(const std::string& root, const std::atomic<bool>& cancel, const std::function<bool(ProjectFile&)>& onFile) {
+    namespace fs = std::filesystem;
+    fs::path rootPath(root);
+    IgnoreList ignore;
+    ignore.load((rootPath / PROJECT_SEARCH_IGNORE_FILE).string());
+
+    std::error_code ec;
+    fs::recursive_directory_iterator it(rootPath, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (cancel) return;
+        const fs::directory_entry& entry = *it;
+        std::error_code typeError;
+        bool isDirectory = entry.is_directory(typeError);
+        ProjectFile file;
+        try {
+            fs::path relativePath = entry.path().lexically_relative(rootPath);
+            file.relative = relativePath.generic_string();
+            file.display = relativePath.string();
+            file.path = entry.path().string();
+        } catch (const std::exception&) {
+            continue;  // A name the narrow strings cannot hold
+        }
+        if (ignore.ignored(file.relative, isDirectory)) {
+            if (isDirectory) it.disable_recursion_pending();
+            continue;
+        }
+        if (isDirectory || !entry.is_regular_file(typeError)) continue;
+
+        // On Windows both come with the directory listing; elsewhere they cost a stat.
+        std::error_code statError;
+        file.size = entry.file_size(statError);
+        auto mtime = entry.last_write_time(statError);
+        file.mtime = statError ? 0 : (int64_t)mtime.time_since_epoch().count();
+        if (!onFile(file)) return;
+    }
+}
+
+struct ProjectSearch::FileResult {
+    std::string text;    // Result lines of the file
+    size_t matches = 0;
+    bool binary = false;
+    bool unreadable = false;
+    bool done = false;
+};
+
+// "path:line:col: text", with a long line cut down to the part around the match.
+static void appendResultLine(std::string& out, const std::string& path, size_t row, size_t col, std::string_view line) {
+    out += path;
+    out += ':';
+    out += std::to_string(row + 1);
+    out += ':';
+    out += std::to_string(col + 1);
+    out += ": ";
+
+    size_t from = 0;
+    size_t to = line.size();
+    if (line.size() > PROJECT_SEARCH_PREVIEW_BYTES) {
+        from = col > PROJECT_SEARCH_PREVIEW_BYTES / 4 ? col - PROJECT_SEARCH_PREVIEW_BYTES / 4 : 0;
+        to = std::min(line.size(), from + PROJECT_SEARCH_PREVIEW_BYTES);
+        while (from > 0 && ((unsigned char)line[from] & 0xC0) == 0x80) --from;
+        while (to < line.size() && to > from && ((unsigned char)line[to] & 0xC0) == 0x80) --to;
+    }
+    if (from > 0) out += "...";
+    out.append(line.data() + from, to - from);
+    if (to < line.size()) out += "...";
+    out += '\n';
+}
+
+ProjectSearch::ProjectSearch() : _cancel(false), _running(false) {}
+
+ProjectSearch::~ProjectSearch() {
+    cancel();
+}
+
+bool ProjectSearch::start(WorkerPool& pool, const std::string& root, const std::string& pattern, SearchOptions options,
+                          std::shared_ptr<const TrigramIndex> index, std::string& error) {
+    cancel();
+    if (pattern.empty()) {
+        error = "empty pattern";
+        return false;
+    }
+    _literal.reset();
+    _regex = Regex();
+    _idleRegexes.clear();
+    if (options.regex) {
+        if (!_regex.compile(pattern, options, error)) return false;
+    } else {
+        _literal = std::make_unique<LiteralSearcher>(pattern, options);
+    }
+    _root = root;
+    _pattern = pattern;
+    _index = std::move(index);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _output.clear();
+        _stats = ProjectSearchStats();
+    }
+
+    _cancel = false;
+    _running = true;
+    _thread = std::thread([this, &pool]() {
+        walk(pool);
+        _running = false;
+    });
+    return true;
+}
+
+void ProjectSearch::cancel() {
+    if (!_thread.joinable()) return;
+    if (_running) _cancel = true;
+    _thread.join();
+}
+
+bool ProjectSearch::takeOutput(std::string& out) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_output.empty()) return false;
+    out += _output;
+    _output.clear();
+    return true;
+}
+
+ProjectSearchStats ProjectSearch::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void ProjectSearch::walk(WorkerPool& pool) {
+    namespace fs = std::filesystem;
+
+    // Files handed to the pool and not published yet, in the order they were found.
+    std::deque<std::shared_ptr<FileResult>> pending;
+    size_t ahead = std::max<size_t>(1, pool.size() * PROJECT_SEARCH_FILES_PER_THREAD);
+
+    // Publishes the finished files at the front, waiting for the front one only while more than keep are pending.
+    auto publish = [this, &pending](size_t keep) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!pending.empty()) {
+            FileResult& file = *pending.front();
+            if (!file.done) {
+                if (pending.size() <= keep) return;
+                _fileDone.wait(lock, [&file]() { return file.done; });
+            }
+            if (!_cancel) {
+                _output += file.text;
+                _stats.filesSearched += !file.binary && !file.unreadable;
+                _stats.filesMatched += file.matches > 0;
+                _stats.matches += file.matches;
+                _stats.binaryFiles += file.binary;
+                _stats.unreadableFiles += file.unreadable;
+            }
+            pending.pop_front();
+        }
+    };
+    auto search = [&](std::string path, std::string display) {
+        auto file = std::make_shared<FileResult>();
+        pending.push_back(file);
+        pool.submit([this, file, path = std::move(path), display = std::move(display)]() {
+            if (!_cancel) searchFile(path, display, *file);
+            std::lock_guard<std::mutex> lock(_mutex);
+            file->done = true;
+            _fileDone.notify_all();
+        });
+        publish(ahead);
+    };
+
+    // Every match contains the literal, so only files holding all of its trigrams can match.
+    const LiteralSearcher* required = _literal ? _literal.get() : _regex.prefilter();
+    std::vector<uint32_t> candidates;
+    bool useIndex = _index && required && _index->candidates(required->pattern(), candidates);
+    std::vector<uint8_t> searched;  // By index file id
+    if (useIndex) {
+        searched.assign(_index->fileCount(), 0);
+        size_t next = 0;
+        for (uint32_t id = 0; id < _index->fileCount() && !_cancel; ++id) {
+            TrigramIndex::FileEntry entry = _index->file(id);
+            bool candidate;
+            if (entry.flags & TrigramIndex::FILE_INDEXED) {
+                while (next < candidates.size() && candidates[next] < id) ++next;
+                candidate = next < candidates.size() && candidates[next] == id;
+            } else {
+                candidate = !(entry.flags & TrigramIndex::FILE_BINARY);
+            }
+            if (!candidate) continue;
+            searched[id] = 1;
+            fs::path relative(std::string(entry.relative));
+            search((fs::path(_root) / relative).string(), relative.make_preferred().string());
+        }
+    }
+
+    // Without an index this searches everything; with one, what changed since it was built.
+    size_t ruledOut = 0;
+    size_t stale = 0;
+    std::vector<uint8_t> seen(useIndex ? _index->fileCount() : 0, 0);
+    walkProjectFiles(_root, _cancel, [&](ProjectFile& file) {
+        if (useIndex) {
+            int64_t id = _index->findFile(file.relative);
+            if (id >= 0) {
+                seen[id] = 1;
+                TrigramIndex::FileEntry entry = _index->file((uint32_t)id);
+                if (entry.size == file.size && entry.mtime == file.mtime) {
+                    ruledOut += !searched[id];
+                    return true;
+                }
+                ++stale;
+                if (searched[id]) return true;
+            } else {
+                ++stale;
+            }
+        }
+        search(std::move(file.path), std::move(file.display));
+        return true;
+    });
+    if (useIndex && !_cancel) {
+        stale += std::count(seen.begin(), seen.end(), 0);
+    }
+
+    // Even a cancelled search waits for its tasks, which use this object.
+    publish(0);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats.filesRuledOut = ruledOut;
+    _stats.staleFiles = stale;
+}
+
+void ProjectSearch::searchFile(const std::string& path, const std::string& displayPath, FileResult& result) {
+    MappedFile file;
+    if (!file.open(path)) {
+        result.unreadable = true;
+        return;
+    }
+    const char* data = file.data();
+    size_t size = (size_t)file.size();
+    if (size == 0) return;
+    if (memchr(data, 0, std::min(size, PROJECT_SEARCH_BINARY_PROBE))) {
+        result.binary = true;
+        return;
+    }
+
+    std::unique_ptr<Regex> regex;
+    if (!_literal) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_idleRegexes.empty()) {
+                regex = std::move(_idleRegexes.back());
+                _idleRegexes.pop_back();
+            }
+        }
+        if (!regex) regex = std::make_unique<Regex>(_regex);
+    }
+    const LiteralSearcher* skipTo = _literal ? _literal.get() : regex->prefilter();
+
+    size_t row = 0;
+    size_t lineStart = 0;
+    size_t lineMatches = 0;
+    size_t firstCol = 0;
+    auto onMatch = [&lineMatches, &firstCol](const SearchMatch& match) {
+        if (lineMatches++ == 0) firstCol = match.col;
+        return true;
+    };
+    while (lineStart < size && !_cancel) {
+        if (skipTo) {
+            // Jump straight to the line holding the next occurrence of the literal, counting the lines on the way.
+            size_t hit = skipTo->find(data, size, lineStart);
+            if (hit == LiteralSearcher::npos) break;
+            while (const char* newline = (const char*)memchr(data + lineStart, '\n', hit - lineStart)) {
+                lineStart = newline - data + 1;
+                ++row;
+            }
+        }
+        const char* newline = (const char*)memchr(data + lineStart, '\n', size - lineStart);
+        size_t lineEnd = newline ? newline - data : size;
+        size_t length = lineEnd - lineStart;
+        if (length > 0 && data[lineEnd - 1] == '\r') --length;
+        std::string_view line(data + lineStart, length);
+
+        lineMatches = 0;
+        if (_literal) searchLine(*_literal, line, row, onMatch);
+        else searchLine(*regex, line, row, onMatch);
+        if (lineMatches > 0) {
+            result.matches += lineMatches;
+            appendResultLine(result.text, displayPath, row, firstCol, line);
+        }
+        lineStart = lineEnd + 1;
+        ++row;
+    }
+
+    if (regex) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _idleRegexes.push_back(std::move(regex));
+    }
+}
+
+bool ProjectSearch::parseResultLine(std::string_view line, std::string& path, size_t& row, size_t& col) {
+    // The path can hold colons of its own, so take the first ":line:col: " that follows some of it.
+    for (size_t colon = line.find(':', 1); colon != std::string_view::npos; colon = line.find(':', colon + 1)) {
+        size_t numbers[2] = { 0, 0 };
+        size_t pos = colon + 1;
+        bool valid = true;
+        for (size_t& number : numbers) {
+            size_t digits = 0;
+            while (pos < line.size() && line[pos] >= '0' && line[pos] <= '9' && digits < 12) {
+                number = number * 10 + (line[pos++] - '0');
+                ++digits;
+            }
+            if (digits == 0 || number == 0 || pos >= line.size() || line[pos] != ':') {
+                valid = false;
+                break;
+            }
+            ++pos;
+        }
+        if (!valid) continue;
+        path = line.substr(0, colon);
+        row = numbers[0] - 1;
+        col = numbers[1] - 1;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include "text_search.h"
+#include "text_regex.h"
+#include "worker_pool.h"
+
+const size_t PROJECT_SEARCH_FILES_PER_THREAD = 32;    // Files queued ahead per pool thread, which bounds the results held back for ordering
+const size_t PROJECT_SEARCH_BINARY_PROBE = 8000;      // Leading bytes checked for a NUL byte, which marks a file as binary
+const size_t PROJECT_SEARCH_PREVIEW_BYTES = 200;      // Most of a matching line shown in a result
+const char* const PROJECT_SEARCH_IGNORE_FILE = ".gitignore";  // Read from the root of the search for more paths to skip
+
+// Paths a folder search leaves out: version control and dependency directories, and the
+// patterns of the ignore file at the root of the search. Patterns follow .gitignore: a
+// pattern without a slash matches a name at any depth, one with a slash matches the path
+// from the root, a trailing slash matches directories only, '!' re-includes, and the last
+// pattern that matches wins. '*' and '?' stop at slashes, "**" does not.
+class IgnoreList {
+public:
+    IgnoreList();
+
+    // Adds the patterns of a .gitignore style file; false if it could not be read.
+    bool load(const std::string& path);
+    void add(std::string_view pattern);
+    // relativePath is relative to the root of the search and uses '/' between names.
+    bool ignored(std::string_view relativePath, bool isDirectory) const;
+
+private:
+    struct Rule {
+        std::string glob;
+        bool anchored;       // Matched against the whole relative path instead of the last name
+        bool directoryOnly;
+        bool negate;
+    };
+    std::vector<Rule> _rules;
+};
+
+// A file found by walkProjectFiles().
+struct ProjectFile {
+    std::string path;      // Full path
+    std::string relative;  // Relative to the root, with '/' between names
+    std::string display;   // Relative to the root, with the platform's separators
+    uint64_t size;
+    int64_t mtime;         // As FileStamp has it
+};
+
+// Calls onFile for every regular file under root, in directory order, leaving out what the
+// default IgnoreList and root's ignore file exclude, until onFile returns false or cancel is set.
+void walkProjectFiles(const std::string& root, const std::atomic<bool>& cancel, const std::function<bool(ProjectFile&)>& onFile);
+
+class TrigramIndex;
+
+struct ProjectSearchStats {
+    size_t filesSearched = 0;
+    size_t filesMatched = 0;
+    size_t matches = 0;
+    size_t binaryFiles = 0;      // Skipped
+    size_t unreadableFiles = 0;  // Could not be opened or mapped
+    size_t filesRuledOut = 0;    // Not opened because the index showed they cannot match
+    size_t staleFiles = 0;       // Added, changed or removed since the index was built
+};
+
+// Searches every file under a folder for one pattern. A walker thread goes through the
+// folder recursively and hands each file to the worker pool, where it is memory-mapped,
+// skipped if it looks binary and otherwise searched a line at a time (with the literal
+// jumping straight to the lines that can match). Results come out as text, one line
+// "path:line:col: text" per matching line with the path relative to the folder, in the
+// order the walker found the files: a file's results are published as soon as it and
+// every file before it are done, so the first hits show up while the rest is still being
+// searched, and only a window of files past the oldest unfinished one is in flight.
+//
+// With a trigram index of the folder (see TrigramIndex) the files that cannot contain
+// the literal every match needs are never opened: the files the index cannot rule out are
+// searched first, in index order, and the walk that follows only compares sizes and
+// modification times to search the files added or changed since the index was built.
+class ProjectSearch {
+public:
+    ProjectSearch();
+    ~ProjectSearch();
+    ProjectSearch(const ProjectSearch&) = delete;
+    ProjectSearch& operator=(const ProjectSearch&) = delete;
+
+    // Cancels a search in progress and starts searching root for pattern on pool, which
+    // must outlive the search. index, if given, must be the index of root. Fails only for
+    // an empty pattern or an invalid regex.
+    bool start(WorkerPool& pool, const std::string& root, const std::string& pattern, SearchOptions options,
+               std::shared_ptr<const TrigramIndex> index, std::string& error);
+    void cancel();
+    // Whether files are still being walked or searched. Once this is false, one more
+    // takeOutput() gets everything that is left.
+    bool running() const { return _running; }
+    bool cancelled() const { return _cancel; }
+    const std::string& root() const { return _root; }
+    const std::string& pattern() const { return _pattern; }
+
+    // Appends the result lines published since the last call to out; false if there were none.
+    bool takeOutput(std::string& out);
+    ProjectSearchStats stats() const;
+
+    // Splits a result line back into its path (relative to root()) and 0-based position.
+    static bool parseResultLine(std::string_view line, std::string& path, size_t& row, size_t& col);
+
+private:
+    struct FileResult;
+
+    std::string _root;
+    std::string _pattern;
+    std::unique_ptr<LiteralSearcher> _literal;  // Set for plain text, otherwise _regex is compiled
+    Regex _regex;
+    std::vector<std::unique_ptr<Regex>> _idleRegexes;  // Copies of _regex not in use by a task, each with its own DFA cache
+    std::shared_ptr<const TrigramIndex> _index;
+
+    std::thread _thread;
+    std::atomic<bool> _cancel;
+    std::atomic<bool> _running;
+    mutable std::mutex _mutex;         // Guards the file results, the regex copies, _output and _stats
+    std::condition_variable _fileDone;
+    std::string _output;
+    ProjectSearchStats _stats;
+
+    void walk(WorkerPool& pool);
+    void searchFile(const std::string& path, const std::string& displayPath, FileResult& result);
+};
@@ -0,0 +1,102 @@
+#include "row_layout.h"
+#include <algorithm>
+#include <cstring>
+
+void LineColumns::reset(std::string_view line, int tabStop) {
+    _line = line;
+    _tabStop = std::max(1, tabStop);
+    _tabs.clear();
+    size_t col = 0;
+    int rendered = 0;  // Column of the character at col
+    while (col < line.size()) {
+        const char* tab = (const char*)memchr(line.data() + col, '\t', line.size() - col);
+        if (!tab) break;
+        size_t tabCol = tab - line.data();
+        rendered += (int)(tabCol - col);
+        rendered += _tabStop - rendered % _tabStop;
+        _tabs.push_back({ tabCol, rendered });
+        col = tabCol + 1;
+    }
+}
+
+int LineColumns::column(size_t col) const {
+    col = std::min(col, _line.size());
+    // The last tab before col; the characters after it take one column each.
+    auto after = std::upper_bound(_tabs.begin(), _tabs.end(), col, [](size_t c, const Tab& tab) { return c <= tab.col; });
+    if (after == _tabs.begin()) return (int)col;
+    const Tab& tab = *(after - 1);
+    return tab.renderedEnd + (int)(col - tab.col - 1);
+}
+
+void LineColumns::visible(int from, int count, std::string& out) const {
+    if (count <= 0) return;
+    from = std::max(0, from);
+    int to = from + count;
+
+    // Start at the last tab that ends at or before from.
+    auto after = std::upper_bound(_tabs.begin(), _tabs.end(), from, [](int rendered, const Tab& tab) { return rendered < tab.renderedEnd; });
+    size_t col = 0;
+    int rendered = 0;
+    if (after != _tabs.begin()) {
+        col = (after - 1)->col + 1;
+        rendered = (after - 1)->renderedEnd;
+    }
+    // Plain characters up to from are skipped at once.
+    size_t plainEnd = after == _tabs.end() ? _line.size() : after->col;
+    size_t skip = std::min(plainEnd - col, (size_t)(from - rendered));
+    col += skip;
+    rendered += (int)skip;
+
+    for (; col < _line.size() && rendered < to; ++col) {
+        if (_line[col] != '\t') {
+            if (rendered >= from) out += _line[col];
+            ++rendered;
+            continue;
+        }
+        int width = _tabStop - rendered % _tabStop;
+        for (int k = 0; k < width && rendered < to; ++k, ++rendered) {
+            if (rendered >= from) out += ' ';
+        }
+    }
+}
+
+void SpanLayers::add(int start, int end, uint16_t keep, uint16_t set) {
+    if (end > start) _spans.push_back({ start, end, keep, set });
+}
+
+void SpanLayers::compose(int from, int count, uint16_t base, uint16_t* out) {
+    if (count <= 0) return;
+    int to = from + count;
+    _edges.clear();
+    for (uint32_t i = 0; i < _spans.size(); ++i) {
+        int start = std::max(_spans[i].start, from);
+        int end = std::min(_spans[i].end, to);
+        if (start >= end) continue;
+        _edges.push_back({ start, i, true });
+        _edges.push_back({ end, i, false });
+    }
+    std::sort(_edges.begin(), _edges.end(), [](const Edge& a, const Edge& b) { return a.col < b.col; });
+
+    _active.clear();
+    int col = from;
+    size_t e = 0;
+    while (col < to) {
+        for (; e < _edges.size() && _edges[e].col == col; ++e) {
+            if (_edges[e].opens) {
+                _active.insert(std::upper_bound(_active.begin(), _active.end(), _edges[e].span), _edges[e].span);
+            } else {
+                _active.erase(std::lower_bound(_active.begin(), _active.end(), _edges[e].span));
+            }
+        }
+        int next = e < _edges.size() ? _edges[e].col : to;
+        uint16_t keep = 0xFFFF;
+        uint16_t set = 0;
+        for (uint32_t span : _active) {
+            keep &= _spans[span].keep;
+            set = (uint16_t)((set & _spans[span].keep) | _spans[span].set);
+        }
+        uint16_t attribute = (uint16_t)((base & keep) | set);
+        std::fill(out + (col - from), out + (next - from), attribute);
+        col = next;
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Where the characters of one line land on screen, with each tab taking the line to the
+// next tab stop. Only the tabs are recorded, found with memchr(), so mapping a column or
+// cutting out the visible part costs a binary search over the tabs plus the visible cells,
+// however long the line is.
+class LineColumns {
+public:
+    void reset(std::string_view line, int tabStop);
+
+    // Rendered column of the character at col; col is clamped to the end of the line.
+    int column(size_t col) const;
+    // Appends rendered columns [from, from + count) of the line to out, tabs as spaces.
+    void visible(int from, int count, std::string& out) const;
+
+private:
+    struct Tab {
+        size_t col;       // Of the tab in the line
+        int renderedEnd;  // Rendered column just past it
+    };
+    std::string_view _line;
+    int _tabStop = 8;
+    std::vector<Tab> _tabs;
+};
+
+// The attribute layers painted over one row of cells. Each span changes the cells it
+// covers to (attribute & keep) | set, so it can replace the attribute, or only its
+// foreground or background, or add a flag; later spans paint over earlier ones. compose()
+// sorts the span edges once and sweeps the row, folding the spans that cover each stretch
+// between two edges into one change, so a row costs its cells plus its spans instead of
+// every cell looking at every span.
+class SpanLayers {
+public:
+    void clear() { _spans.clear(); }
+    bool empty() const { return _spans.empty(); }
+    // Rendered columns [start, end).
+    void add(int start, int end, uint16_t keep, uint16_t set);
+
+    // Writes the attributes of columns [from, from + count) to out, starting from base.
+    void compose(int from, int count, uint16_t base, uint16_t* out);
+
+private:
+    struct Span {
+        int start;
+        int end;
+        uint16_t keep;
+        uint16_t set;
+    };
+    struct Edge {
+        int col;
+        uint32_t span;
+        bool opens;
+    };
+    std::vector<Span> _spans;
+    std::vector<Edge> _edges;      // Reused between rows
+    std::vector<uint32_t> _active; // Spans covering the current stretch, in layer order
+};
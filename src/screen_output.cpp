@@ -0,0 +1,294 @@
+#include "screen_output.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+#ifdef _WIN32
+
+ScreenOutput::ScreenOutput() : _lastFrameBytes(0), _hConsole(INVALID_HANDLE_VALUE) {}
+
+ScreenOutput::~ScreenOutput() {
+    close();
+}
+
+bool ScreenOutput::open() {
+    _hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (_hConsole == INVALID_HANDLE_VALUE || _hConsole == NULL) {
+        _error = "no console output handle, error " + std::to_string(GetLastError());
+        return false;
+    }
+    return true;
+}
+
+void ScreenOutput::close() {}
+
+bool ScreenOutput::size(int& cols, int& rows) {
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (!GetConsoleScreenBufferInfo((HANDLE)_hConsole, &csbi)) return false;
+    cols = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+    rows = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+    return true;
+}
+
+void ScreenOutput::clear(uint16_t attribute) {
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (!GetConsoleScreenBufferInfo((HANDLE)_hConsole, &csbi)) return;
+    DWORD cellsCount = csbi.dwSize.X * csbi.dwSize.Y;
+    COORD homeCoords = { 0, 0 };
+    DWORD charsWritten;
+    FillConsoleOutputCharacterA((HANDLE)_hConsole, ' ', cellsCount, homeCoords, &charsWritten);
+    FillConsoleOutputAttribute((HANDLE)_hConsole, attribute, cellsCount, homeCoords, &charsWritten);
+    SetConsoleCursorPosition((HANDLE)_hConsole, homeCoords);
+}
+
+void ScreenOutput::drawRun(int row, int col, const Cell* cells, int count) {
+    _glyphs.resize(count);
+    _attributes.resize(count);
+    for (int i = 0; i < count; ++i) {
+        _glyphs[i] = cells[i].glyph;
+        _attributes[i] = cells[i].attribute();
+    }
+    COORD writePos = { (SHORT)col, (SHORT)row };
+    DWORD charsWritten;
+    WriteConsoleOutputCharacterA((HANDLE)_hConsole, _glyphs.data(), count, writePos, &charsWritten);
+    WriteConsoleOutputAttribute((HANDLE)_hConsole, (const WORD*)_attributes.data(), count, writePos, &charsWritten);
+}
+
+bool ScreenOutput::scrollRows(int top, int bottom, int delta) {
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (!GetConsoleScreenBufferInfo((HANDLE)_hConsole, &csbi)) return false;
+    // Clipped to the rows themselves, so nothing outside them moves or is filled.
+    SMALL_RECT rows = { 0, (SHORT)top, (SHORT)(csbi.dwSize.X - 1), (SHORT)(bottom - 1) };
+    COORD destination = { 0, (SHORT)(top - delta) };
+    CHAR_INFO fill;
+    fill.Char.AsciiChar = ' ';
+    fill.Attributes = csbi.wAttributes;
+    return ScrollConsoleScreenBufferA((HANDLE)_hConsole, &rows, &rows, destination, &fill) != 0;
+}
+
+void ScreenOutput::endFrame(int cursorCol, int cursorRow, bool cursorVisible) {
+    COORD cursorPosition = { (SHORT)cursorCol, (SHORT)cursorRow };
+    SetConsoleCursorPosition((HANDLE)_hConsole, cursorPosition);
+    CONSOLE_CURSOR_INFO cursorInfo;
+    if (GetConsoleCursorInfo((HANDLE)_hConsole, &cursorInfo) && (bool)cursorInfo.bVisible != cursorVisible) {
+        cursorInfo.bVisible = cursorVisible;
+        SetConsoleCursorInfo((HANDLE)_hConsole, &cursorInfo);
+    }
+}
+
+#else
+
+// Alternate screen, no wrapping at the right margin.
+static const char ENTER_SEQUENCE[] = "\x1b[?1049h\x1b[?7l";
+// Default colors, wrapping and cursor back, main screen.
+static const char LEAVE_SEQUENCE[] = "\x1b[0m\x1b[?7h\x1b[?25h\x1b[?1049l";
+
+// SGR color numbers count red, green, blue from bit 0; the console counts them the other way.
+static int vtColor(uint8_t color) {
+    return ((color & 1) << 2) | (color & 2) | ((color & 4) >> 2);
+}
+
+static void appendNumber(std::string& out, int value) {
+    char digits[12];
+    int length = 0;
+    do {
+        digits[length++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (length > 0) out += digits[--length];
+}
+
+static int digitCount(int value) {
+    int count = 1;
+    while (value >= 10) {
+        value /= 10;
+        ++count;
+    }
+    return count;
+}
+
+ScreenOutput::ScreenOutput()
+    : _lastFrameBytes(0), _fd(STDOUT_FILENO), _raw(false), _savedMode(), _cols(0), _col(-1), _row(-1),
+      _cursorVisible(-1), _styleKnown(false) {}
+
+ScreenOutput::~ScreenOutput() {
+    close();
+}
+
+bool ScreenOutput::open() {
+    if (!isatty(STDIN_FILENO) || !isatty(_fd)) {
+        _error = "standard input and output have to be a terminal";
+        return false;
+    }
+    if (tcgetattr(STDIN_FILENO, &_savedMode) != 0) {
+        _error = std::string("tcgetattr failed: ") + strerror(errno);
+        return false;
+    }
+    struct termios raw = _savedMode;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_oflag &= ~OPOST;
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 1;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) != 0) {
+        _error = std::string("tcsetattr failed: ") + strerror(errno);
+        return false;
+    }
+    _raw = true;
+    _frame += ENTER_SEQUENCE;
+    _col = _row = -1;
+    _cursorVisible = -1;
+    _styleKnown = false;
+    flush();
+    return true;
+}
+
+void ScreenOutput::close() {
+    if (!_raw) return;
+    _frame += LEAVE_SEQUENCE;
+    flush();
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &_savedMode);
+    _raw = false;
+}
+
+bool ScreenOutput::size(int& cols, int& rows) {
+    struct winsize ws;
+    if (ioctl(_fd, TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0) return false;
+    cols = _cols = ws.ws_col;
+    rows = ws.ws_row;
+    return true;
+}
+
+void ScreenOutput::clear(uint16_t attribute) {
+    // Erasing fills with the background color in effect.
+    setStyle(Cell::fromAttribute(' ', attribute));
+    _frame += "\x1b[2J\x1b[H";
+    _col = _row = 0;
+}
+
+void ScreenOutput::moveTo(int col, int row) {
+    if (col == _col && row == _row) return;
+    if (col == 0 && _row >= 0 && row == _row + 1) {
+        _frame += "\r\n";
+    } else if (row == _row && _col >= 0 && col > _col && 3 + digitCount(col - _col) < 4 + digitCount(row + 1) + digitCount(col + 1)) {
+        _frame += "\x1b[";
+        appendNumber(_frame, col - _col);
+        _frame += 'C';
+    } else {
+        _frame += "\x1b[";
+        appendNumber(_frame, row + 1);
+        if (col > 0) {
+            _frame += ';';
+            appendNumber(_frame, col + 1);
+        }
+        _frame += 'H';
+    }
+    _col = col;
+    _row = row;
+}
+
+void ScreenOutput::setStyle(const Cell& cell) {
+    if (_styleKnown && cell.sameStyle(_style)) return;
+    // Flags can only be turned off by a reset, which takes the colors with it.
+    bool reset = !_styleKnown || (_style.flags & ~cell.flags) != 0;
+    _frame += "\x1b[";
+    bool first = true;
+    auto parameter = [this, &first](int value) {
+        if (!first) _frame += ';';
+        appendNumber(_frame, value);
+        first = false;
+    };
+    if (reset) parameter(0);
+    if (reset || cell.fg != _style.fg) parameter((cell.fg & 8 ? 90 : 30) + vtColor(cell.fg));
+    if (reset || cell.bg != _style.bg) parameter((cell.bg & 8 ? 100 : 40) + vtColor(cell.bg));
+    uint8_t added = reset ? cell.flags : (uint8_t)(cell.flags & ~_style.flags);
+    if (added & CELL_UNDERLINE) parameter(4);
+    if (added & CELL_REVERSE) parameter(7);
+    _frame += 'm';
+    _style = cell;
+    _styleKnown = true;
+}
+
+void ScreenOutput::drawRun(int row, int col, const Cell* cells, int count) {
+    if (count <= 0) return;
+    // Hidden while the frame is drawn, so it is not seen jumping from run to run.
+    if (_cursorVisible != 0) {
+        _frame += "\x1b[?25l";
+        _cursorVisible = 0;
+    }
+    moveTo(col, row);
+    for (int i = 0; i < count; ++i) {
+        setStyle(cells[i]);
+        unsigned char glyph = (unsigned char)cells[i].glyph;
+        _frame += glyph < 0x20 || glyph == 0x7F ? '?' : (char)glyph;
+    }
+    _col += count;
+    // At the right margin the cursor stays on the last column, or not, depending on the terminal.
+    if (_cols <= 0 || _col >= _cols) _col = -1;
+}
+
+bool ScreenOutput::scrollRows(int top, int bottom, int delta) {
+    if (_cursorVisible != 0) {
+        _frame += "\x1b[?25l";
+        _cursorVisible = 0;
+    }
+    // The rows become the scroll region (DECSTBM), and deleting lines at its top (DL)
+    // pulls the rows below up, inserting lines (IL) pushes them down; the lines leaving
+    // the region are gone and the rest of the screen stays. Setting and resetting the
+    // region both home the cursor.
+    _frame += "\x1b[";
+    appendNumber(_frame, top + 1);
+    _frame += ';';
+    appendNumber(_frame, bottom);
+    _frame += 'r';
+    _col = _row = 0;
+    moveTo(0, top);
+    _frame += "\x1b[";
+    appendNumber(_frame, delta > 0 ? delta : -delta);
+    _frame += delta > 0 ? 'M' : 'L';
+    _frame += "\x1b[r";
+    _col = _row = 0;
+    return true;
+}
+
+void ScreenOutput::endFrame(int cursorCol, int cursorRow, bool cursorVisible) {
+    if (cursorVisible) {
+        moveTo(cursorCol, cursorRow);
+        if (_cursorVisible != 1) {
+            _frame += "\x1b[?25h";
+            _cursorVisible = 1;
+        }
+    } else if (_cursorVisible != 0) {
+        _frame += "\x1b[?25l";
+        _cursorVisible = 0;
+    }
+    flush();
+}
+
+void ScreenOutput::flush() {
+    _lastFrameBytes = _frame.size();
+    size_t written = 0;
+    while (written < _frame.size()) {
+        ssize_t n = ::write(_fd, _frame.data() + written, _frame.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            // What reached the terminal is unknown; the next frame sets everything again.
+            _col = _row = -1;
+            _cursorVisible = -1;
+            _styleKnown = false;
+            break;
+        }
+        written += n;
+    }
+    _frame.clear();
+}
+
+#endif
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "frame_buffer.h"
+
+#ifndef _WIN32
+#include <termios.h>
+#endif
+
+// Where FrameBuffer::present() sends a frame. On Windows the runs go to the console with
+// WriteConsoleOutputCharacterA()/WriteConsoleOutputAttribute(). Elsewhere the terminal is
+// put in raw mode with termios, and the runs become VT escape sequences gathered into one
+// string that goes out in a single write() when the frame ends: the cursor only moves
+// where a run does not start where the last one stopped, and only the colors that change
+// from one cell to the next are set again. Rows that scrolled are moved by the console, or
+// by the terminal within a scroll region, rather than sent again.
+class ScreenOutput {
+public:
+    ScreenOutput();
+    ~ScreenOutput();
+    ScreenOutput(const ScreenOutput&) = delete;
+    ScreenOutput& operator=(const ScreenOutput&) = delete;
+
+    bool open();
+    void close();
+    const std::string& lastError() const { return _error; }
+
+    // Size of the visible window, in cells.
+    bool size(int& cols, int& rows);
+    // Blanks the whole screen in the colors of attribute and homes the cursor.
+    void clear(uint16_t attribute);
+
+    void drawRun(int row, int col, const Cell* cells, int count);
+    // Moves rows [top, bottom) up by delta rows, down if delta is negative. What the rows
+    // moved in show is up to the console or terminal. False if nothing moved.
+    bool scrollRows(int top, int bottom, int delta);
+    // Places the cursor and sends the frame.
+    void endFrame(int cursorCol, int cursorRow, bool cursorVisible);
+
+    // Bytes sent to the terminal by the last frame (VT output only).
+    size_t lastFrameBytes() const { return _lastFrameBytes; }
+
+private:
+    std::string _error;
+    size_t _lastFrameBytes;
+
+#ifdef _WIN32
+    void* _hConsole;
+    std::string _glyphs;          // Reused between runs
+    std::vector<uint16_t> _attributes;
+#else
+    int _fd;
+    bool _raw;
+    struct termios _savedMode;
+    std::string _frame;           // The escape sequences of the frame so far
+    int _cols;
+    // What the terminal is known to have; -1 where it is not known.
+    int _col;
+    int _row;
+    int _cursorVisible;
+    Cell _style;
+    bool _styleKnown;
+
+    void moveTo(int col, int row);
+    void setStyle(const Cell& cell);
+    void flush();
+#endif
+};
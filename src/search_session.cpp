@@ -0,0 +1,357 @@
+#include "search_session.h"
+#include "parallel_search.h"
+#include <algorithm>
+
+SearchSession::SearchSession()
+    : _active(false), _cancelCount(false), _countedTotal(0), _dirtyBlocks(0), _countComplete(false), _countStarted(false),
+      _countVersion(0), _editTracked(false), _editBlock(0) {}
+
+SearchSession::~SearchSession() {
+    stopCount();
+}
+
+bool SearchSession::start(const std::string& pattern, SearchOptions options, std::string& error) {
+    clear();
+    if (options.regex) {
+        if (!_regex.compile(pattern, options, error)) return false;
+    } else {
+        _literal = std::make_unique<LiteralSearcher>(pattern, options);
+    }
+    _pattern = pattern;
+    _options = options;
+    _active = !pattern.empty();
+    return true;
+}
+
+void SearchSession::clear() {
+    stopCount();
+    _active = false;
+    _pattern.clear();
+    _literal.reset();
+    _regex = Regex();
+    _countStarted = false;
+    _editTracked = false;
+    std::lock_guard<std::mutex> lock(_countMutex);
+    _blocks.clear();
+    _countedTotal = 0;
+    _dirtyBlocks = 0;
+    _countComplete = false;
+}
+
+void SearchSession::scan(const LineSnapshot& snapshot, size_t fromRow, size_t toRow,
+                         const std::function<bool(const SearchMatch&)>& onMatch) {
+    if (_literal) searchSnapshot(snapshot, *_literal, fromRow, toRow, onMatch);
+    else searchSnapshot(snapshot, _regex, fromRow, toRow, onMatch);
+}
+
+void SearchSession::scanLines(const LineBuffer& lines, size_t fromRow, size_t toRow,
+                              const std::function<bool(const SearchMatch&)>& onMatch) {
+    toRow = std::min(toRow, lines.size());
+    for (size_t row = fromRow; row < toRow; ++row) {
+        bool more = _literal ? searchLine(*_literal, lines.view(row), row, onMatch) : searchLine(_regex, lines.view(row), row, onMatch);
+        if (!more) return;
+    }
+}
+
+bool SearchSession::findForward(const LineSnapshot& snapshot, size_t row, size_t col, SearchMatch& match) {
+    if (!_active || snapshot.size() == 0) return false;
+    if (row >= snapshot.size()) {
+        row = 0;
+        col = 0;
+    }
+    bool found = false;
+    scan(snapshot, row, snapshot.size(), [&](const SearchMatch& m) {
+        if (m.row == row && m.col < col) return true;
+        match = m;
+        found = true;
+        return false;
+    });
+    if (found) return true;
+
+    // Wrap around; the part of row before col is the last place left to look.
+    scan(snapshot, 0, row + 1, [&](const SearchMatch& m) {
+        match = m;
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+bool SearchSession::findBackward(const LineSnapshot& snapshot, size_t row, size_t col, SearchMatch& match) {
+    if (!_active || snapshot.size() == 0) return false;
+    if (row >= snapshot.size()) {
+        row = snapshot.size() - 1;
+        col = (size_t)-1;
+    }
+    bool found = false;
+    auto keepLast = [&](const SearchMatch& m) {
+        match = m;
+        found = true;
+        return true;
+    };
+
+    // Matches only come in order, so scan windows of rows going up, each twice as tall as the
+    // one before, and take the last match of the first window that has any.
+    size_t end = row + 1;
+    size_t window = SEARCH_BACKWARD_WINDOW_ROWS;
+    while (true) {
+        size_t begin = end > window ? end - window : 0;
+        scan(snapshot, begin, end, [&](const SearchMatch& m) {
+            if (m.row == row && m.col >= col) return false;
+            return keepLast(m);
+        });
+        if (found) return true;
+        if (begin == 0) break;
+        end = begin;
+        window *= 2;
+    }
+
+    // Wrap around to the bottom, down to the rest of row.
+    end = snapshot.size();
+    window = SEARCH_BACKWARD_WINDOW_ROWS;
+    while (end > row) {
+        size_t begin = end - row > window ? end - window : row;
+        scan(snapshot, begin, end, keepLast);
+        if (found) return true;
+        end = begin;
+        window *= 2;
+    }
+    return false;
+}
+
+std::vector<SearchMatch> SearchSession::findInRows(const LineBuffer& lines, size_t fromRow, size_t toRow) {
+    std::vector<SearchMatch> matches;
+    if (!_active) return matches;
+    scanLines(lines, fromRow, toRow, [&](const SearchMatch& m) {
+        matches.push_back(m);
+        return true;
+    });
+    return matches;
+}
+
+void SearchSession::startCount(WorkerPool& pool, LineSnapshot snapshot, uint64_t version) {
+    stopCount();
+    {
+        std::lock_guard<std::mutex> lock(_countMutex);
+        _blocks.clear();
+        _countedTotal = 0;
+        _dirtyBlocks = 0;
+        _countComplete = false;
+    }
+    _countStarted = true;
+    _countVersion = version;
+    _editTracked = false;
+    if (!_active) return;
+
+    // The thread gets its own searcher, since the session's may be replaced while it runs.
+    std::shared_ptr<LiteralSearcher> literal;
+    if (_literal) literal = std::make_shared<LiteralSearcher>(*_literal);
+    _cancelCount = false;
+    _countThread = std::thread([this, &pool, snapshot = std::move(snapshot), literal, regex = _regex]() {
+        // One chunk per block, so every chunk delivered completes the next block count.
+        auto onChunk = [this](size_t fromRow, size_t toRow, const std::vector<SearchMatch>& matches) {
+            std::lock_guard<std::mutex> lock(_countMutex);
+            _blocks.push_back({ toRow - fromRow, matches.size(), false });
+            _countedTotal += matches.size();
+            return true;
+        };
+        bool complete = literal
+            ? searchSnapshotParallel(pool, snapshot, *literal, 0, snapshot.size(), SEARCH_COUNT_BLOCK_ROWS, _cancelCount, onChunk)
+            : searchSnapshotParallel(pool, snapshot, regex, 0, snapshot.size(), SEARCH_COUNT_BLOCK_ROWS, _cancelCount, onChunk);
+        if (!complete) return;
+        std::lock_guard<std::mutex> lock(_countMutex);
+        _countComplete = true;
+    });
+}
+
+void SearchSession::stopCount() {
+    if (_countThread.joinable()) {
+        _cancelCount = true;
+        _countThread.join();
+    }
+}
+
+size_t SearchSession::countedMatches(bool& complete) const {
+    std::lock_guard<std::mutex> lock(_countMutex);
+    complete = _countComplete && _dirtyBlocks == 0;
+    return _countedTotal;
+}
+
+size_t SearchSession::ordinalOf(const LineBuffer& lines, const SearchMatch& match) {
+    size_t blockStart = 0;
+    size_t before = 0;
+    {
+        std::lock_guard<std::mutex> lock(_countMutex);
+        size_t b = 0;
+        while (b < _blocks.size() && match.row >= blockStart + _blocks[b].rows) {
+            if (_blocks[b].dirty) return 0;
+            blockStart += _blocks[b].rows;
+            before += _blocks[b].matches;
+            ++b;
+        }
+        if (b == _blocks.size() || _blocks[b].dirty) return 0;
+    }
+    // Within its own block the match is placed by counting again up to it.
+    size_t ordinal = before;
+    scanLines(lines, blockStart, match.row + 1, [&](const SearchMatch& m) {
+        if (m.row == match.row && m.col > match.col) return false;
+        ++ordinal;
+        return true;
+    });
+    return ordinal;
+}
+
+size_t SearchSession::countRows(const LineBuffer& lines, size_t fromRow, size_t toRow) {
+    size_t count = 0;
+    scanLines(lines, fromRow, toRow, [&count](const SearchMatch&) {
+        ++count;
+        return true;
+    });
+    return count;
+}
+
+void SearchSession::markDirty(CountBlock& block) {
+    if (block.dirty) return;
+    _countedTotal -= block.matches;
+    block.matches = 0;
+    block.dirty = true;
+    ++_dirtyBlocks;
+}
+
+void SearchSession::beginEdit(const LineBuffer& lines, size_t firstRow, size_t oldRows) {
+    _editTracked = false;
+    if (!_active || !_countStarted || _countVersion != lines.version()) return;
+    std::unique_lock<std::mutex> lock(_countMutex);
+    if (!_countComplete) return;
+    // The counter is done, so only this thread changes the blocks now: they are read
+    // without the lock, and the rows are searched without holding it.
+    lock.unlock();
+
+    size_t blockStart = 0;
+    size_t b = 0;
+    while (b < _blocks.size() && firstRow >= blockStart + _blocks[b].rows) {
+        blockStart += _blocks[b].rows;
+        ++b;
+    }
+
+    // The old rows cover the end of one block, whole blocks and the start of another.
+    // Blocks covered whole go with their counts. The rows taken from the others are
+    // searched again, unless there are too many; then the block's count is dropped.
+    struct Cut {
+        size_t block;
+        size_t rows;
+        size_t matches;
+        bool drop;
+    };
+    std::vector<Cut> cuts;
+    size_t row = firstRow;
+    size_t left = oldRows;
+    for (; left > 0 && b < _blocks.size(); ++b) {
+        const CountBlock& block = _blocks[b];
+        size_t take = std::min(left, blockStart + block.rows - row);
+        bool whole = take == block.rows;
+        bool drop = !whole && !block.dirty && take > SEARCH_EDIT_RECOUNT_ROWS;
+        size_t matches = whole ? block.matches : (drop || block.dirty ? 0 : countRows(lines, row, row + take));
+        cuts.push_back({ b, take, matches, drop });
+        row += take;
+        left -= take;
+        blockStart += block.rows;
+    }
+    if (left > 0) return;
+
+    lock.lock();
+    size_t eraseFrom = _blocks.size();
+    size_t eraseTo = 0;
+    for (const Cut& cut : cuts) {
+        CountBlock& block = _blocks[cut.block];
+        if (cut.drop) markDirty(block);
+        block.rows -= cut.rows;
+        if (!block.dirty) {
+            block.matches -= cut.matches;
+            _countedTotal -= cut.matches;
+        }
+        if (block.rows == 0) {
+            if (block.dirty) --_dirtyBlocks;
+            eraseFrom = std::min(eraseFrom, cut.block);
+            eraseTo = cut.block + 1;
+        }
+    }
+    // Only the blocks covered whole are emptied, and they are next to each other.
+    if (eraseFrom < eraseTo) _blocks.erase(_blocks.begin() + eraseFrom, _blocks.begin() + eraseTo);
+
+    // The new rows go into the block now holding firstRow, or the last one when they are appended.
+    blockStart = 0;
+    _editBlock = 0;
+    while (_editBlock < _blocks.size() && firstRow >= blockStart + _blocks[_editBlock].rows) {
+        blockStart += _blocks[_editBlock].rows;
+        ++_editBlock;
+    }
+    if (_editBlock == _blocks.size()) {
+        if (_blocks.empty() || firstRow > blockStart) return;
+        --_editBlock;
+    }
+    _editTracked = true;
+}
+
+void SearchSession::endEdit(const LineBuffer& lines, size_t firstRow, size_t newRows) {
+    if (!_editTracked) return;
+    _editTracked = false;
+    bool drop = newRows > SEARCH_EDIT_RECOUNT_ROWS;
+    bool counted = !drop && (_blocks.empty() || !_blocks[_editBlock].dirty);
+    size_t added = counted ? countRows(lines, firstRow, firstRow + newRows) : 0;
+
+    std::unique_lock<std::mutex> lock(_countMutex);
+    if (_blocks.empty()) _blocks.push_back({ 0, 0, false });
+    if (drop) markDirty(_blocks[_editBlock]);
+    _blocks[_editBlock].rows += newRows;
+    if (counted) {
+        _blocks[_editBlock].matches += added;
+        _countedTotal += added;
+    }
+
+    // Lines pasted into one place would otherwise make a single block as long as the
+    // paste, and placing a match inside it as slow as counting the whole paste. A block
+    // without a count is just cut; recountDirty() counts the pieces.
+    while (_blocks[_editBlock].rows >= 2 * SEARCH_COUNT_BLOCK_ROWS) {
+        CountBlock& block = _blocks[_editBlock];
+        CountBlock tail = { block.rows - SEARCH_COUNT_BLOCK_ROWS, 0, block.dirty };
+        if (block.dirty) {
+            ++_dirtyBlocks;
+        } else {
+            size_t blockStart = 0;
+            for (size_t b = 0; b < _editBlock; ++b) blockStart += _blocks[b].rows;
+            lock.unlock();
+            size_t headMatches = countRows(lines, blockStart, blockStart + SEARCH_COUNT_BLOCK_ROWS);
+            lock.lock();
+            tail.matches = block.matches - headMatches;
+            block.matches = headMatches;
+        }
+        block.rows = SEARCH_COUNT_BLOCK_ROWS;
+        _blocks.insert(_blocks.begin() + _editBlock + 1, tail);
+        ++_editBlock;
+    }
+    if (_blocks[_editBlock].rows == 0) {
+        if (_blocks[_editBlock].dirty) --_dirtyBlocks;
+        _blocks.erase(_blocks.begin() + _editBlock);
+    }
+    _countVersion = lines.version();
+}
+
+bool SearchSession::recountDirty(const LineBuffer& lines) {
+    // Blocks only go dirty once the count is complete, and a stale count is redone anyway.
+    if (_dirtyBlocks == 0 || _countVersion != lines.version()) return false;
+    size_t blockStart = 0;
+    size_t b = 0;
+    while (!_blocks[b].dirty) {
+        blockStart += _blocks[b].rows;
+        ++b;
+    }
+    size_t matches = countRows(lines, blockStart, blockStart + _blocks[b].rows);
+
+    std::lock_guard<std::mutex> lock(_countMutex);
+    _blocks[b].matches = matches;
+    _blocks[b].dirty = false;
+    _countedTotal += matches;
+    --_dirtyBlocks;
+    return true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include "line_buffer.h"
+#include "text_search.h"
+#include "text_regex.h"
+#include "worker_pool.h"
+
+const size_t SEARCH_COUNT_BLOCK_ROWS = 4096;      // Rows per partial count kept by the background counter
+const size_t SEARCH_BACKWARD_WINDOW_ROWS = 256;   // Rows a backward search scans first; the window doubles after each miss
+const size_t SEARCH_EDIT_RECOUNT_ROWS = 1024;     // Rows of one block an edit searches again itself; more are left to recountDirty()
+
+// One search query as the user types it and steps through its matches. Nothing on the
+// main thread scans the whole buffer: the match nearest the cursor is found by scanning
+// away from it until the first hit, so it costs the same in a small file as in a huge
+// one, and the visible rows are scanned on their own for highlighting. Counting every
+// match runs on a background thread over a snapshot and keeps one count per block of
+// rows, so the position of a match among all of them is known as soon as the counter has
+// passed its block, long before the count is complete. The blocks are searched in
+// parallel (see searchSnapshotParallel()) and their counts published in order. Once the
+// count is done, edits keep it up to date by searching only the rows they touched.
+class SearchSession {
+public:
+    SearchSession();
+    ~SearchSession();
+    SearchSession(const SearchSession&) = delete;
+    SearchSession& operator=(const SearchSession&) = delete;
+
+    // Prepares pattern and cancels the count of the previous one. Fails only for an invalid regex.
+    bool start(const std::string& pattern, SearchOptions options, std::string& error);
+    void clear();
+    bool active() const { return _active; }
+    const std::string& pattern() const { return _pattern; }
+
+    // The first match at or after (row, col), wrapping around to the top.
+    bool findForward(const LineSnapshot& snapshot, size_t row, size_t col, SearchMatch& match);
+    // The last match that starts before (row, col), wrapping around to the bottom.
+    bool findBackward(const LineSnapshot& snapshot, size_t row, size_t col, SearchMatch& match);
+    // Every match in rows [fromRow, toRow), read line by line from the live buffer; meant for a screenful.
+    std::vector<SearchMatch> findInRows(const LineBuffer& lines, size_t fromRow, size_t toRow);
+
+    // Counts the matches of snapshot on a background thread that spreads the blocks over
+    // pool, cancelling a count in progress. version identifies the buffer contents the
+    // snapshot was taken from. pool must outlive the session.
+    void startCount(WorkerPool& pool, LineSnapshot snapshot, uint64_t version);
+    bool countStarted() const { return _countStarted; }
+    uint64_t countVersion() const { return _countVersion; }
+    // Matches counted so far; complete is set once that is all of them.
+    size_t countedMatches(bool& complete) const;
+    // 1-based position of match among all matches, or 0 while the counter has not got past
+    // it. lines must still hold what was counted (countVersion() is its version).
+    size_t ordinalOf(const LineBuffer& lines, const SearchMatch& match);
+
+    // Keeps a finished count current through an edit that replaces rows [firstRow,
+    // firstRow + oldRows) with newRows rows. Matches never span lines, so only those rows
+    // are searched again, straight from the buffer: call beginEdit() right before the edit
+    // and endEdit() right after it. If the count was still running or already behind the
+    // buffer, nothing is updated and countVersion() stays behind, so it has to be redone.
+    // An edit of many rows only drops the counts of the blocks it touches; those are
+    // searched again by recountDirty(), and the count is incomplete until then.
+    void beginEdit(const LineBuffer& lines, size_t firstRow, size_t oldRows);
+    void endEdit(const LineBuffer& lines, size_t firstRow, size_t newRows);
+    // Searches the rows of one block whose count an edit dropped. Meant to be called once
+    // per pass of the owner's loop until it returns false, when none is left.
+    bool recountDirty(const LineBuffer& lines);
+
+private:
+    std::string _pattern;
+    SearchOptions _options;
+    std::unique_ptr<LiteralSearcher> _literal;  // Set for plain text, otherwise _regex is compiled
+    Regex _regex;
+    bool _active;
+
+    std::thread _countThread;
+    std::atomic<bool> _cancelCount;
+    mutable std::mutex _countMutex;
+    // Consecutive blocks of rows from the top and the matches in each, for the blocks counted
+    // so far. The counter makes them SEARCH_COUNT_BLOCK_ROWS rows each; edits then grow and
+    // shrink them, and split one that gets too big.
+    struct CountBlock {
+        size_t rows;
+        size_t matches;
+        bool dirty;  // An edit dropped the count; matches is 0 and not in _countedTotal
+    };
+    std::vector<CountBlock> _blocks;
+    size_t _countedTotal;
+    size_t _dirtyBlocks;
+    bool _countComplete;
+    bool _countStarted;
+    uint64_t _countVersion;
+    bool _editTracked;  // beginEdit() found the count current
+    size_t _editBlock;  // Block that receives the rows of the edit in endEdit()
+
+    void scan(const LineSnapshot& snapshot, size_t fromRow, size_t toRow, const std::function<bool(const SearchMatch&)>& onMatch);
+    void scanLines(const LineBuffer& lines, size_t fromRow, size_t toRow, const std::function<bool(const SearchMatch&)>& onMatch);
+    void stopCount();
+    size_t countRows(const LineBuffer& lines, size_t fromRow, size_t toRow);
+    void markDirty(CountBlock& block);
+};
@@ -0,0 +1,287 @@
+#include "session_snapshot.h"
+#include "atomic_file_writer.h"
+#include "checksum.h"
+#include <cstring>
+
+static const char SESSION_MAGIC[4] = { 'S', 'P', 'L', 'S' };
+static const uint32_t SESSION_VERSION = 1;
+static const size_t SESSION_HEADER_SIZE = 16;
+static const size_t SESSION_TABLE_ENTRY_SIZE = 24;
+
+enum SessionSectionKind : uint32_t {
+    SESSION_BUFFERS = 1,
+    SESSION_KEYMAP = 2,
+    // 3 held plugin data, which now lives in its own store (kv_store.h).
+    SESSION_LINE_INDEX = 4,
+};
+
+// Line index slots are written and read as raw memory.
+static_assert(sizeof(LineSlot) == 16, "LineSlot layout is part of the session format");
+
+static void putU8(std::string& out, uint8_t v) {
+    out.push_back((char)v);
+}
+
+static void putU32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+
+static void putU64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+
+static void putString(std::string& out, const std::string& s) {
+    putU32(out, (uint32_t)s.size());
+    out += s;
+}
+
+static void padTo8(std::string& out) {
+    while (out.size() % 8 != 0) out.push_back('\0');
+}
+
+namespace {
+
+struct SessionReader {
+    const unsigned char* p;
+    size_t left;
+
+    bool u8(uint8_t& v) {
+        if (left < 1) return false;
+        v = *p++;
+        left--;
+        return true;
+    }
+    bool u32(uint32_t& v) {
+        if (left < 4) return false;
+        v = 0;
+        for (int i = 0; i < 4; ++i) v |= (uint32_t)p[i] << (8 * i);
+        p += 4;
+        left -= 4;
+        return true;
+    }
+    bool u64(uint64_t& v) {
+        if (left < 8) return false;
+        v = 0;
+        for (int i = 0; i < 8; ++i) v |= (uint64_t)p[i] << (8 * i);
+        p += 8;
+        left -= 8;
+        return true;
+    }
+    bool i32(int& v) {
+        uint32_t u;
+        if (!u32(u)) return false;
+        v = (int)u;
+        return true;
+    }
+    bool string(std::string& s) {
+        uint32_t length;
+        if (!u32(length) || left < length) return false;
+        s.assign((const char*)p, length);
+        p += length;
+        left -= length;
+        return true;
+    }
+    bool skip(size_t n) {
+        if (left < n) return false;
+        p += n;
+        left -= n;
+        return true;
+    }
+};
+
+struct Section {
+    uint32_t kind;
+    std::string head;
+    const void* bulk;
+    size_t bulkSize;
+};
+
+}
+
+bool SessionSnapshot::write(const std::string& path, std::string& error) const {
+    std::vector<Section> sections;
+
+    std::string buffersHead;
+    putU32(buffersHead, (uint32_t)buffers.size());
+    for (const SessionBuffer& buffer : buffers) {
+        putString(buffersHead, buffer.path);
+        putU32(buffersHead, (uint32_t)buffer.cursorX);
+        putU32(buffersHead, (uint32_t)buffer.cursorY);
+        putU32(buffersHead, (uint32_t)buffer.rowOffset);
+        putU32(buffersHead, (uint32_t)buffer.colOffset);
+    }
+    sections.push_back({ SESSION_BUFFERS, std::move(buffersHead), nullptr, 0 });
+
+    if (hasKeymap) {
+        std::string keymapHead;
+        putString(keymapHead, keymapSource);
+        putU64(keymapHead, keymapSourceSize);
+        putU64(keymapHead, (uint64_t)keymapSourceMtime);
+        putU32(keymapHead, (uint32_t)keymap.size());
+        for (const SessionKeyBinding& binding : keymap) {
+            putU32(keymapHead, (uint32_t)binding.keyCode);
+            putU8(keymapHead, (binding.ctrl ? 1 : 0) | (binding.alt ? 2 : 0) | (binding.shift ? 4 : 0));
+            putString(keymapHead, binding.command);
+        }
+        sections.push_back({ SESSION_KEYMAP, std::move(keymapHead), nullptr, 0 });
+    }
+
+    for (const auto& index : lineIndexes) {
+        std::string indexHead;
+        putU64(indexHead, index->fileSize);
+        putU64(indexHead, (uint64_t)index->mtime);
+        putU64(indexHead, index->skipBytes);
+        putU64(indexHead, index->crlfLines);
+        putU64(indexHead, index->lfLines);
+        putU64(indexHead, index->count);
+        putString(indexHead, index->path);
+        padTo8(indexHead);
+        sections.push_back({ SESSION_LINE_INDEX, std::move(indexHead), index->slots, (size_t)index->count * sizeof(LineSlot) });
+    }
+
+    std::string header(SESSION_MAGIC, sizeof(SESSION_MAGIC));
+    putU32(header, SESSION_VERSION);
+    putU32(header, (uint32_t)sections.size());
+    putU32(header, 0);
+    uint64_t offset = SESSION_HEADER_SIZE + sections.size() * SESSION_TABLE_ENTRY_SIZE;
+    for (const Section& section : sections) {
+        uint64_t size = section.head.size() + section.bulkSize;
+        uint32_t crc = crc32(section.head.data(), section.head.size());
+        crc = crc32(section.bulk, section.bulkSize, crc);
+        putU32(header, section.kind);
+        putU32(header, crc);
+        putU64(header, offset);
+        putU64(header, size);
+        offset += (size + 7) & ~(uint64_t)7;
+    }
+
+    // Slot arrays are handed to the writer by pointer; they stay alive until commit().
+    static const char padding[8] = {};
+    AtomicFileWriter writer;
+    bool ok = writer.open(path) && writer.appendCopy(header.data(), header.size());
+    for (const Section& section : sections) {
+        if (!ok) break;
+        size_t size = section.head.size() + section.bulkSize;
+        ok = writer.appendCopy(section.head.data(), section.head.size()) &&
+             writer.append((const char*)section.bulk, section.bulkSize) &&
+             writer.appendCopy(padding, ((size + 7) & ~(size_t)7) - size);
+    }
+    ok = ok && writer.commit();
+    if (!ok) {
+        error = writer.lastError();
+        writer.abort();
+    }
+    return ok;
+}
+
+bool SessionSnapshot::load(const std::string& path, std::string& error) {
+    auto map = std::make_shared<MappedFile>();
+    if (!map->open(path)) {
+        error = map->lastError();
+        return false;
+    }
+    const unsigned char* data = (const unsigned char*)map->data();
+    uint64_t size = map->size();
+    if (size < SESSION_HEADER_SIZE || memcmp(data, SESSION_MAGIC, sizeof(SESSION_MAGIC)) != 0) {
+        error = "not a session file";
+        return false;
+    }
+    SessionReader header = { data + sizeof(SESSION_MAGIC), SESSION_HEADER_SIZE - sizeof(SESSION_MAGIC) };
+    uint32_t version, sectionCount, reserved;
+    header.u32(version);
+    header.u32(sectionCount);
+    header.u32(reserved);
+    if (version != SESSION_VERSION) {
+        error = "unsupported session version";
+        return false;
+    }
+    if (sectionCount > (size - SESSION_HEADER_SIZE) / SESSION_TABLE_ENTRY_SIZE) {
+        error = "truncated section table";
+        return false;
+    }
+
+    SessionSnapshot loaded;
+    SessionReader table = { data + SESSION_HEADER_SIZE, (size_t)sectionCount * SESSION_TABLE_ENTRY_SIZE };
+    for (uint32_t i = 0; i < sectionCount; ++i) {
+        uint32_t kind, crc;
+        uint64_t offset, length;
+        table.u32(kind);
+        table.u32(crc);
+        table.u64(offset);
+        table.u64(length);
+        if (offset % 8 != 0 || offset > size || length > size - offset) {
+            error = "section out of bounds";
+            return false;
+        }
+        SessionReader reader = { data + offset, (size_t)length };
+
+        // Line indexes are large and only checked when one is actually used.
+        if (kind != SESSION_LINE_INDEX && crc32(data + offset, (size_t)length) != crc) {
+            error = "section checksum mismatch";
+            return false;
+        }
+
+        bool ok = true;
+        if (kind == SESSION_BUFFERS) {
+            uint32_t count;
+            ok = reader.u32(count);
+            for (uint32_t b = 0; ok && b < count; ++b) {
+                SessionBuffer buffer;
+                ok = reader.string(buffer.path) && reader.i32(buffer.cursorX) && reader.i32(buffer.cursorY) &&
+                     reader.i32(buffer.rowOffset) && reader.i32(buffer.colOffset);
+                if (ok) loaded.buffers.push_back(std::move(buffer));
+            }
+        } else if (kind == SESSION_KEYMAP) {
+            uint64_t sourceSize, sourceMtime;
+            uint32_t count;
+            ok = reader.string(loaded.keymapSource) && reader.u64(sourceSize) && reader.u64(sourceMtime) && reader.u32(count);
+            loaded.keymapSourceSize = sourceSize;
+            loaded.keymapSourceMtime = (int64_t)sourceMtime;
+            for (uint32_t k = 0; ok && k < count; ++k) {
+                SessionKeyBinding binding;
+                uint8_t modifiers;
+                ok = reader.i32(binding.keyCode) && reader.u8(modifiers) && reader.string(binding.command);
+                binding.ctrl = (modifiers & 1) != 0;
+                binding.alt = (modifiers & 2) != 0;
+                binding.shift = (modifiers & 4) != 0;
+                if (ok) loaded.keymap.push_back(std::move(binding));
+            }
+            loaded.hasKeymap = ok;
+        } else if (kind == SESSION_LINE_INDEX) {
+            auto index = std::make_shared<SessionLineIndex>();
+            uint64_t mtime;
+            ok = reader.u64(index->fileSize) && reader.u64(mtime) && reader.u64(index->skipBytes) &&
+                 reader.u64(index->crlfLines) && reader.u64(index->lfLines) && reader.u64(index->count) &&
+                 reader.string(index->path);
+            size_t headSize = (size_t)length - reader.left;
+            ok = ok && reader.skip(((headSize + 7) & ~(size_t)7) - headSize) &&
+                 index->count <= reader.left / sizeof(LineSlot);
+            if (ok) {
+                index->mtime = (int64_t)mtime;
+                index->slots = (const LineSlot*)reader.p;
+                index->section = (const char*)data + offset;
+                index->sectionSize = length;
+                index->crc = crc;
+                loaded.lineIndexes.push_back(std::move(index));
+            }
+        }
+        // Unknown section kinds come from newer versions of the format and are skipped.
+        if (!ok) {
+            error = "malformed section";
+            return false;
+        }
+    }
+
+    *this = std::move(loaded);
+    _map = map;
+    return true;
+}
+
+const SessionLineIndex* SessionSnapshot::findLineIndex(const std::string& path, uint64_t fileSize, int64_t mtime) const {
+    for (const auto& index : lineIndexes) {
+        if (index->path != path || index->fileSize != fileSize || index->mtime != mtime) continue;
+        if (index->section && crc32(index->section, (size_t)index->sectionSize) != index->crc) return nullptr;
+        return index.get();
+    }
+    return nullptr;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "line_buffer.h"
+#include "mapped_file.h"
+
+const size_t SESSION_MAX_LINE_INDEXES = 8;  // Line indexes of large files carried from one session to the next
+
+// Where a buffer was left: reopened with the cursor and view in place on the next launch.
+struct SessionBuffer {
+    std::string path;
+    int cursorX = 0;
+    int cursorY = 0;
+    int rowOffset = 0;
+    int colOffset = 0;
+};
+
+struct SessionKeyBinding {
+    int keyCode;
+    bool ctrl;
+    bool alt;
+    bool shift;
+    std::string command;
+};
+
+// The line index of a large file, valid only while the file keeps this size and mtime.
+// Slots are stored exactly as LineBuffer keeps them, so after loading they point
+// straight into the mapped session file and are copied into the buffer without parsing.
+struct SessionLineIndex {
+    std::string path;
+    uint64_t fileSize = 0;
+    int64_t mtime = 0;
+    uint64_t skipBytes = 0;
+    uint64_t crlfLines = 0;
+    uint64_t lfLines = 0;
+    const LineSlot* slots = nullptr;
+    uint64_t count = 0;
+    std::vector<LineSlot> ownedSlots;  // Backing store for slots when the index is being written
+
+    // Where the index sits in the loaded session file, so its checksum can be verified on first use.
+    const char* section = nullptr;
+    uint64_t sectionSize = 0;
+    uint32_t crc = 0;
+};
+
+// State carried from one run of the editor to the next, written on exit. The file is a
+// versioned header and a table of CRC-checked sections; sections are 8-byte aligned so
+// the line index slots can be used in place from the mapping. Each part is only used if
+// its input is unchanged: the keymap while keybindings.json has the same size and mtime,
+// a line index while its file does.
+class SessionSnapshot {
+public:
+    std::vector<SessionBuffer> buffers;
+
+    std::string keymapSource;
+    uint64_t keymapSourceSize = 0;
+    int64_t keymapSourceMtime = 0;
+    bool hasKeymap = false;
+    std::vector<SessionKeyBinding> keymap;
+
+    std::vector<std::shared_ptr<SessionLineIndex>> lineIndexes;
+
+    bool load(const std::string& path, std::string& error);
+    bool write(const std::string& path, std::string& error) const;
+
+    // Returns the cached index for path if it was taken of exactly this version of the file.
+    const SessionLineIndex* findLineIndex(const std::string& path, uint64_t fileSize, int64_t mtime) const;
+
+private:
+    std::shared_ptr<MappedFile> _map;
+};
@@ -0,0 +1,184 @@
+#include "stdin_stream.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+StdinStream::StdinStream() : _queuedBytes(0), _eof(false), _stopping(false), _bytesRead(0),
+#ifdef _WIN32
+    _hPipe(INVALID_HANDLE_VALUE)
+#else
+    _fd(-1)
+#endif
+{}
+
+StdinStream::~StdinStream() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool StdinStream::open(std::string& error) {
+    HANDLE hPipe = GetStdHandle(STD_INPUT_HANDLE);
+    if (hPipe == INVALID_HANDLE_VALUE || hPipe == NULL) {
+        error = "no standard input";
+        return false;
+    }
+    HANDLE hConsole = CreateFileA("CONIN$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                  NULL, OPEN_EXISTING, 0, NULL);
+    if (hConsole == INVALID_HANDLE_VALUE) {
+        error = "could not open the console for keyboard input (GLE: " + std::to_string(GetLastError()) + ")";
+        return false;
+    }
+    SetStdHandle(STD_INPUT_HANDLE, hConsole);
+    _hPipe = hPipe;
+    _thread = std::thread(&StdinStream::readerMain, this);
+    return true;
+}
+
+long StdinStream::readPipe(char* buffer, size_t size) {
+    DWORD bytesRead = 0;
+    if (!ReadFile((HANDLE)_hPipe, buffer, (DWORD)size, &bytesRead, NULL)) {
+        DWORD error = GetLastError();
+        // The write end being closed is how a pipe reports end of input.
+        if (error == ERROR_BROKEN_PIPE || error == ERROR_HANDLE_EOF) return 0;
+        if (error != ERROR_OPERATION_ABORTED) _error = "ReadFile failed (GLE: " + std::to_string(error) + ")";
+        return -1;
+    }
+    return (long)bytesRead;
+}
+
+void StdinStream::close() {
+    if (_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _space.notify_all();
+        // A read blocked on an idle producer has to be cancelled explicitly.
+        CancelSynchronousIo((HANDLE)_thread.native_handle());
+        _thread.join();
+    }
+    if (_hPipe != INVALID_HANDLE_VALUE) {
+        CloseHandle((HANDLE)_hPipe);
+        _hPipe = INVALID_HANDLE_VALUE;
+    }
+}
+
+#else
+
+bool StdinStream::open(std::string& error) {
+    int fd = dup(STDIN_FILENO);
+    if (fd < 0) {
+        error = std::string("dup failed: ") + strerror(errno);
+        return false;
+    }
+    int tty = ::open("/dev/tty", O_RDONLY | O_CLOEXEC);
+    if (tty < 0) {
+        error = std::string("could not open /dev/tty for keyboard input: ") + strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    dup2(tty, STDIN_FILENO);
+    ::close(tty);
+    _fd = fd;
+    _thread = std::thread(&StdinStream::readerMain, this);
+    return true;
+}
+
+long StdinStream::readPipe(char* buffer, size_t size) {
+    // Polled with a timeout so close() does not have to wait for the producer.
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stopping) return -1;
+        }
+        struct pollfd pfd = { _fd, POLLIN, 0 };
+        int ready = ::poll(&pfd, 1, 100);
+        if (ready < 0 && errno != EINTR) {
+            _error = std::string("poll failed: ") + strerror(errno);
+            return -1;
+        }
+        if (ready <= 0) continue;
+        ssize_t count = ::read(_fd, buffer, size);
+        if (count < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (count < 0) {
+            _error = std::string("read failed: ") + strerror(errno);
+            return -1;
+        }
+        return (long)count;
+    }
+}
+
+void StdinStream::close() {
+    if (_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _space.notify_all();
+        _thread.join();
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+#endif
+
+void StdinStream::readerMain() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _space.wait(lock, [this]() { return _stopping || _queuedBytes < STDIN_QUEUE_MAX_BYTES; });
+            if (_stopping) break;
+        }
+
+        std::string chunk(STDIN_READ_SIZE, '\0');
+        long count = readPipe(chunk.data(), chunk.size());
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (count <= 0) {
+            _eof = true;
+            break;
+        }
+        chunk.resize((size_t)count);
+        _queuedBytes += chunk.size();
+        _bytesRead += chunk.size();
+        _chunks.push_back(std::move(chunk));
+    }
+}
+
+size_t StdinStream::read(std::string& out, size_t maxBytes) {
+    size_t moved = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        while (!_chunks.empty() && moved < maxBytes) {
+            std::string& chunk = _chunks.front();
+            size_t take = std::min(chunk.size(), maxBytes - moved);
+            out.append(chunk.data(), take);
+            moved += take;
+            if (take == chunk.size()) {
+                _chunks.pop_front();
+            } else {
+                chunk.erase(0, take);
+            }
+        }
+        _queuedBytes -= moved;
+    }
+    if (moved > 0) _space.notify_one();
+    return moved;
+}
+
+bool StdinStream::atEnd() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _eof && _chunks.empty();
+}
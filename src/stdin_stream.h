@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+const size_t STDIN_READ_SIZE = 64 * 1024;               // Bytes asked for per read from the pipe
+const size_t STDIN_QUEUE_MAX_BYTES = 16 * 1024 * 1024;  // Data read ahead of the editor before the reader stops pulling from the pipe
+
+// Streams whatever is piped into standard input ("producer | splice -"). open() hands
+// the pipe to a reader thread and points standard input back at the console, so
+// keyboard input keeps working. The reader fills a bounded queue; once the editor
+// falls behind by STDIN_QUEUE_MAX_BYTES it stops reading and the producer blocks.
+class StdinStream {
+public:
+    StdinStream();
+    ~StdinStream();
+    StdinStream(const StdinStream&) = delete;
+    StdinStream& operator=(const StdinStream&) = delete;
+
+    // Must run before the console is set up, since it swaps the standard input handle.
+    bool open(std::string& error);
+    void close();
+
+    // Moves up to maxBytes of queued data to the end of out without blocking.
+    size_t read(std::string& out, size_t maxBytes);
+    // True once the producer closed the pipe and everything it wrote was read.
+    bool atEnd() const;
+    uint64_t bytesRead() const { return _bytesRead; }
+    const std::string& lastError() const { return _error; }
+
+private:
+    std::thread _thread;
+    mutable std::mutex _mutex;
+    std::condition_variable _space;
+    std::deque<std::string> _chunks;
+    size_t _queuedBytes;
+    bool _eof;
+    bool _stopping;
+    std::atomic<uint64_t> _bytesRead;
+    std::string _error;
+
+#ifdef _WIN32
+    void* _hPipe;
+#else
+    int _fd;
+#endif
+
+    void readerMain();
+    // Blocks until data arrives; returns 0 at end of input, -1 on error or when stopping.
+    long readPipe(char* buffer, size_t size);
+};
@@ -0,0 +1,341 @@
+#include "text_encoding.h"
+#include <algorithm>
+#include <cctype>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPLICE_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+static const uint32_t REPLACEMENT_CHARACTER = 0xFFFD;
+static const size_t UTF16_SNIFF_BYTES = 4096;
+
+static void appendUtf8(uint32_t cp, std::string& out) {
+    if (cp < 0x80) {
+        out.push_back((char)cp);
+    } else if (cp < 0x800) {
+        out.push_back((char)(0xC0 | (cp >> 6)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back((char)(0xE0 | (cp >> 12)));
+        out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back((char)(0xF0 | (cp >> 18)));
+        out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+// Length of the UTF-8 sequence started by lead, or 0 if lead cannot start one.
+static int sequenceLength(unsigned char lead) {
+    if (lead < 0x80) return 1;
+    if (lead >= 0xC2 && lead <= 0xDF) return 2;
+    if (lead >= 0xE0 && lead <= 0xEF) return 3;
+    if (lead >= 0xF0 && lead <= 0xF4) return 4;
+    return 0;
+}
+
+// Decodes a complete sequence of length len, rejecting overlong forms, surrogates and
+// code points above U+10FFFF.
+static bool decodeSequence(const unsigned char* s, int len, uint32_t& cp) {
+    static const uint32_t minimum[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+    cp = len == 1 ? s[0] : len == 2 ? (s[0] & 0x1F) : len == 3 ? (s[0] & 0x0F) : (s[0] & 0x07);
+    for (int k = 1; k < len; ++k) {
+        if ((s[k] & 0xC0) != 0x80) return false;
+        cp = (cp << 6) | (s[k] & 0x3F);
+    }
+    return cp >= minimum[len] && cp <= 0x10FFFF && (cp < 0xD800 || cp > 0xDFFF);
+}
+
+std::string encodingName(const FileEncoding& encoding) {
+    switch (encoding.encoding) {
+    case ENC_UTF8: return encoding.bom ? "UTF-8 BOM" : "UTF-8";
+    case ENC_UTF16LE: return "UTF-16LE";
+    case ENC_UTF16BE: return "UTF-16BE";
+    case ENC_LATIN1: return "Latin-1";
+    }
+    return "UTF-8";
+}
+
+bool parseEncodingName(const std::string& name, FileEncoding& encoding) {
+    std::string key;
+    for (char c : name) {
+        if (c != '-' && c != '_' && c != ' ') key.push_back((char)std::tolower((unsigned char)c));
+    }
+
+    if (key == "utf8") encoding = { ENC_UTF8, false };
+    else if (key == "utf8bom") encoding = { ENC_UTF8, true };
+    else if (key == "utf16le" || key == "utf16") encoding = { ENC_UTF16LE, true };
+    else if (key == "utf16be") encoding = { ENC_UTF16BE, true };
+    else if (key == "latin1" || key == "iso88591") encoding = { ENC_LATIN1, false };
+    else return false;
+    return true;
+}
+
+std::string bomBytes(const FileEncoding& encoding) {
+    if (!encoding.bom) return std::string();
+    switch (encoding.encoding) {
+    case ENC_UTF8: return "\xEF\xBB\xBF";
+    case ENC_UTF16LE: return "\xFF\xFE";
+    case ENC_UTF16BE: return "\xFE\xFF";
+    default: return std::string();
+    }
+}
+
+FileEncoding detectEncoding(const char* data, size_t size, bool complete) {
+    const unsigned char* p = (const unsigned char*)data;
+    if (size >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF) return { ENC_UTF8, true };
+    if (size >= 2 && p[0] == 0xFF && p[1] == 0xFE) return { ENC_UTF16LE, true };
+    if (size >= 2 && p[0] == 0xFE && p[1] == 0xFF) return { ENC_UTF16BE, true };
+
+    // Text in UTF-16 without a BOM is mostly ASCII with a NUL in every other byte.
+    size_t sample = std::min(size, UTF16_SNIFF_BYTES) & ~(size_t)1;
+    if (sample >= 2) {
+        size_t evenZeros = 0, oddZeros = 0;
+        for (size_t i = 0; i < sample; i += 2) {
+            if (p[i] == 0) evenZeros++;
+            if (p[i + 1] == 0) oddZeros++;
+        }
+        size_t units = sample / 2;
+        if (oddZeros * 10 >= units * 3 && evenZeros * 4 <= oddZeros) return { ENC_UTF16LE, false };
+        if (evenZeros * 10 >= units * 3 && oddZeros * 4 <= evenZeros) return { ENC_UTF16BE, false };
+    }
+
+    if (isValidUtf8(data, size, !complete)) return { ENC_UTF8, false };
+    return { ENC_LATIN1, false };
+}
+
+bool isValidUtf8(const char* data, size_t size, bool allowTruncatedTail) {
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+
+    while (p < end) {
+#ifdef SPLICE_HAVE_SSE2
+        // Skip ASCII in 64 and then 16 byte steps; only bytes with the high bit set need the state machine.
+        while (end - p >= 64) {
+            __m128i a = _mm_loadu_si128((const __m128i*)p);
+            __m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+            __m128i c = _mm_loadu_si128((const __m128i*)(p + 32));
+            __m128i d = _mm_loadu_si128((const __m128i*)(p + 48));
+            if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) != 0) break;
+            p += 64;
+        }
+        while (end - p >= 16 && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p)) == 0) {
+            p += 16;
+        }
+        if (p >= end) break;
+#endif
+        if (*p < 0x80) {
+            p++;
+            continue;
+        }
+
+        int len = sequenceLength(*p);
+        if (len == 0) return false;
+        if (end - p < len) {
+            if (!allowTruncatedTail) return false;
+            for (const unsigned char* q = p + 1; q < end; ++q) {
+                if ((*q & 0xC0) != 0x80) return false;
+            }
+            return true;
+        }
+        uint32_t cp;
+        if (!decodeSequence(p, len, cp)) return false;
+        p += len;
+    }
+    return true;
+}
+
+EncodingDecoder::EncodingDecoder(TextEncoding encoding) :
+    _encoding(encoding),
+    _carry(0),
+    _hasCarry(false),
+    _highSurrogate(0)
+{}
+
+void EncodingDecoder::decode(const char* data, size_t size, std::string& out) {
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+
+    if (_encoding == ENC_UTF8) {
+        out.append(data, size);
+        return;
+    }
+
+    if (_encoding == ENC_LATIN1) {
+        while (p < end) {
+            // Copy ASCII runs in one go; everything above 0x7F maps to a two byte sequence.
+            const unsigned char* run = p;
+            while (p < end && *p < 0x80) p++;
+            out.append((const char*)run, p - run);
+            if (p < end) {
+                appendUtf8(*p, out);
+                p++;
+            }
+        }
+        return;
+    }
+
+    bool littleEndian = _encoding == ENC_UTF16LE;
+    while (p < end) {
+        unsigned char first, second;
+        if (_hasCarry) {
+            first = _carry;
+            second = *p++;
+            _hasCarry = false;
+        } else if (end - p >= 2) {
+            first = p[0];
+            second = p[1];
+            p += 2;
+        } else {
+            _carry = *p++;
+            _hasCarry = true;
+            break;
+        }
+        uint32_t unit = littleEndian ? (first | (second << 8)) : ((first << 8) | second);
+
+        if (_highSurrogate) {
+            if (unit >= 0xDC00 && unit <= 0xDFFF) {
+                appendUtf8(0x10000 + ((_highSurrogate - 0xD800) << 10) + (unit - 0xDC00), out);
+                _highSurrogate = 0;
+                continue;
+            }
+            appendUtf8(REPLACEMENT_CHARACTER, out);
+            _highSurrogate = 0;
+        }
+        if (unit >= 0xD800 && unit <= 0xDBFF) {
+            _highSurrogate = unit;
+        } else if (unit >= 0xDC00 && unit <= 0xDFFF) {
+            appendUtf8(REPLACEMENT_CHARACTER, out);
+        } else {
+            appendUtf8(unit, out);
+        }
+    }
+}
+
+void EncodingDecoder::finish(std::string& out) {
+    if (_hasCarry || _highSurrogate) {
+        appendUtf8(REPLACEMENT_CHARACTER, out);
+    }
+    _hasCarry = false;
+    _highSurrogate = 0;
+}
+
+EncodingEncoder::EncodingEncoder(TextEncoding encoding) :
+    _encoding(encoding),
+    _pendingLength(0)
+{}
+
+void EncodingEncoder::emit(uint32_t codePoint, std::string& out) {
+    switch (_encoding) {
+    case ENC_UTF8:
+        appendUtf8(codePoint, out);
+        break;
+    case ENC_LATIN1:
+        out.push_back(codePoint <= 0xFF ? (char)codePoint : '?');
+        break;
+    case ENC_UTF16LE:
+    case ENC_UTF16BE: {
+        uint16_t units[2];
+        int count = 1;
+        if (codePoint >= 0x10000) {
+            codePoint -= 0x10000;
+            units[0] = (uint16_t)(0xD800 + (codePoint >> 10));
+            units[1] = (uint16_t)(0xDC00 + (codePoint & 0x3FF));
+            count = 2;
+        } else {
+            units[0] = (uint16_t)codePoint;
+        }
+        for (int i = 0; i < count; ++i) {
+            if (_encoding == ENC_UTF16LE) {
+                out.push_back((char)(units[i] & 0xFF));
+                out.push_back((char)(units[i] >> 8));
+            } else {
+                out.push_back((char)(units[i] >> 8));
+                out.push_back((char)(units[i] & 0xFF));
+            }
+        }
+        break;
+    }
+    }
+}
+
+void EncodingEncoder::encode(const char* data, size_t size, std::string& out) {
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+
+    if (_encoding == ENC_UTF8) {
+        out.append(data, size);
+        return;
+    }
+
+    // Complete a sequence left over from the previous call.
+    if (_pendingLength > 0) {
+        int need = sequenceLength(_pending[0]);
+        while ((int)_pendingLength < need && p < end && (*p & 0xC0) == 0x80) {
+            _pending[_pendingLength++] = *p++;
+        }
+        if ((int)_pendingLength == need) {
+            uint32_t cp;
+            emit(decodeSequence(_pending, need, cp) ? cp : REPLACEMENT_CHARACTER, out);
+            _pendingLength = 0;
+        } else if (p < end) {
+            emit(REPLACEMENT_CHARACTER, out);
+            _pendingLength = 0;
+        } else {
+            return;
+        }
+    }
+
+    while (p < end) {
+        if (*p < 0x80) {
+            if (_encoding == ENC_LATIN1) {
+                const unsigned char* run = p;
+                while (p < end && *p < 0x80) p++;
+                out.append((const char*)run, p - run);
+            } else {
+                emit(*p++, out);
+            }
+            continue;
+        }
+
+        int len = sequenceLength(*p);
+        if (len == 0) {
+            emit(REPLACEMENT_CHARACTER, out);
+            p++;
+            continue;
+        }
+        if (end - p < len) {
+            bool continuation = true;
+            for (const unsigned char* q = p + 1; q < end; ++q) {
+                if ((*q & 0xC0) != 0x80) continuation = false;
+            }
+            if (continuation) {
+                _pendingLength = end - p;
+                std::copy(p, end, _pending);
+                return;
+            }
+            emit(REPLACEMENT_CHARACTER, out);
+            p++;
+            continue;
+        }
+
+        uint32_t cp;
+        if (decodeSequence(p, len, cp)) {
+            emit(cp, out);
+            p += len;
+        } else {
+            emit(REPLACEMENT_CHARACTER, out);
+            p++;
+        }
+    }
+}
+
+void EncodingEncoder::finish(std::string& out) {
+    if (_pendingLength > 0) {
+        emit(REPLACEMENT_CHARACTER, out);
+        _pendingLength = 0;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+const size_t ENCODING_SNIFF_BYTES = 1024 * 1024;   // How much of a large file is looked at to pick its encoding
+const size_t TRANSCODE_CHUNK_SIZE = 1024 * 1024;   // Chunk size for streaming conversion on load and save
+
+// The buffer always holds UTF-8. Files in other encodings are converted on load and
+// converted back on save.
+enum TextEncoding {
+    ENC_UTF8,
+    ENC_UTF16LE,
+    ENC_UTF16BE,
+    ENC_LATIN1
+};
+
+struct FileEncoding {
+    TextEncoding encoding = ENC_UTF8;
+    bool bom = false;
+
+    bool isPlainUtf8() const { return encoding == ENC_UTF8 && !bom; }
+};
+
+std::string encodingName(const FileEncoding& encoding);
+bool parseEncodingName(const std::string& name, FileEncoding& encoding);
+std::string bomBytes(const FileEncoding& encoding);
+
+// Picks the encoding of data: a BOM wins, then UTF-16 is sniffed from the NUL byte
+// pattern, then UTF-8 if the data validates, otherwise Latin-1. Pass complete = false
+// when data is only the head of the file, so a sequence cut off at the end is accepted.
+FileEncoding detectEncoding(const char* data, size_t size, bool complete);
+
+// UTF-8 validation with an SSE2 fast path that skips runs of ASCII 16 bytes at a time.
+bool isValidUtf8(const char* data, size_t size, bool allowTruncatedTail = false);
+
+// Streaming conversion to UTF-8. Code units split across calls are carried over;
+// invalid input becomes U+FFFD.
+class EncodingDecoder {
+public:
+    explicit EncodingDecoder(TextEncoding encoding);
+    void decode(const char* data, size_t size, std::string& out);
+    void finish(std::string& out);
+
+private:
+    TextEncoding _encoding;
+    unsigned char _carry;
+    bool _hasCarry;
+    uint32_t _highSurrogate;
+};
+
+// Streaming conversion from UTF-8. Sequences split across calls are carried over;
+// characters the target cannot represent become '?' (Latin-1) or U+FFFD.
+class EncodingEncoder {
+public:
+    explicit EncodingEncoder(TextEncoding encoding);
+    void encode(const char* data, size_t size, std::string& out);
+    void finish(std::string& out);
+
+private:
+    TextEncoding _encoding;
+    unsigned char _pending[4];
+    size_t _pendingLength;
+
+    void emit(uint32_t codePoint, std::string& out);
+};
@@ -0,0 +1,1176 @@
+#include "text_regex.h"
+#include <bitset>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+typedef std::bitset<256> ByteSet;
+
+static const size_t REGEX_MAX_NESTING = 250;   // Group depth the recursive parser accepts
+static const int REGEX_MAX_REPEAT = 1000;       // Largest count in {n,m}
+static const size_t REGEX_MIN_PREFILTER = 3;    // Shorter required literals are not worth a separate scan
+
+enum RegexOp : uint8_t {
+    OP_CLASS,   // Consumes a byte of class y, then continues at x
+    OP_SPLIT,   // Continues at x and, with lower priority, at y
+    OP_ASSERT,  // Continues at x if the assertion holds at the current position
+    OP_SAVE,    // Records the current position in capture slot y, then continues at x
+    OP_MATCH,
+};
+
+enum RegexAssertion : uint8_t {
+    ASSERT_LINE_START,
+    ASSERT_LINE_END,
+    ASSERT_WORD_BOUNDARY,
+    ASSERT_NOT_WORD_BOUNDARY,
+    ASSERT_NOT_AFTER_WORD,   // Whole-word search: no word character right before
+    ASSERT_NOT_BEFORE_WORD,  // and none right after
+};
+
+// What is on one side of a position, for evaluating assertions.
+enum RegexContext : uint8_t {
+    CTX_EDGE,  // The start or end of the line
+    CTX_WORD,
+    CTX_OTHER,
+};
+
+struct RegexInst {
+    RegexOp op;
+    uint8_t assertion;
+    int32_t x;
+    int32_t y;
+};
+
+struct RegexProgram {
+    std::vector<RegexInst> forward;   // Unanchored, for finding where the leftmost match ends
+    int32_t forwardStart = 0;
+    std::vector<RegexInst> reverse;   // The pattern reversed, anchored at the end of a match
+    int32_t reverseStart = 0;
+    std::vector<RegexInst> capture;   // Anchored at the start of a match, with OP_SAVE around each group
+    int32_t captureStart = 0;
+    size_t groupCount = 0;
+    std::vector<ByteSet> classes;
+    bool hasAssertions = false;
+
+    // Bytes no class tells apart share one input symbol, which keeps DFA states small.
+    // The last symbol stands for the edge of the line.
+    uint8_t symbolOf[256];
+    std::vector<uint8_t> representative;
+    std::vector<uint8_t> symbolContext;
+    int symbolCount = 0;
+
+    std::unique_ptr<LiteralSearcher> prefilter;
+};
+
+// Bytes of multi-byte UTF-8 characters count as word characters, as in LiteralSearcher.
+static bool isWordByte(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80;
+}
+
+static bool isAsciiLetter(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static bool assertionHolds(uint8_t assertion, uint8_t before, uint8_t after) {
+    switch (assertion) {
+    case ASSERT_LINE_START: return before == CTX_EDGE;
+    case ASSERT_LINE_END: return after == CTX_EDGE;
+    case ASSERT_WORD_BOUNDARY: return (before == CTX_WORD) != (after == CTX_WORD);
+    case ASSERT_NOT_WORD_BOUNDARY: return (before == CTX_WORD) == (after == CTX_WORD);
+    case ASSERT_NOT_AFTER_WORD: return before != CTX_WORD;
+    case ASSERT_NOT_BEFORE_WORD: return after != CTX_WORD;
+    }
+    return false;
+}
+
+static size_t utf8SequenceLength(unsigned char lead) {
+    if (lead < 0x80) return 1;
+    if (lead >= 0xC2 && lead <= 0xDF) return 2;
+    if (lead >= 0xE0 && lead <= 0xEF) return 3;
+    if (lead >= 0xF0 && lead <= 0xF4) return 4;
+    return 0;
+}
+
+namespace {
+
+struct RegexNode {
+    enum Kind { EMPTY, BYTES, CONCAT, ALT, REPEAT, ASSERT, CAPTURE };
+
+    Kind kind = EMPTY;
+    ByteSet bytes;
+    std::vector<RegexNode> children;
+    int min = 0;
+    int max = -1;  // -1 for no upper bound
+    bool greedy = true;
+    uint8_t assertion = 0;
+    size_t group = 0;  // Of a capture, numbered from 1 by its '('
+};
+
+RegexNode bytesNode(const ByteSet& bytes) {
+    RegexNode node;
+    node.kind = RegexNode::BYTES;
+    node.bytes = bytes;
+    return node;
+}
+
+RegexNode rangeNode(unsigned lo, unsigned hi) {
+    ByteSet bytes;
+    for (unsigned b = lo; b <= hi; ++b) bytes.set(b);
+    return bytesNode(bytes);
+}
+
+RegexNode listNode(RegexNode::Kind kind, std::vector<RegexNode>&& children) {
+    if (children.size() == 1) return std::move(children[0]);
+    RegexNode node;
+    node.kind = kind;
+    node.children = std::move(children);
+    return node;
+}
+
+RegexNode assertNode(RegexAssertion assertion) {
+    RegexNode node;
+    node.kind = RegexNode::ASSERT;
+    node.assertion = assertion;
+    return node;
+}
+
+// One whole UTF-8 encoded character outside ASCII.
+RegexNode multibyteNode() {
+    std::vector<RegexNode> two, three, four;
+    two.push_back(rangeNode(0xC2, 0xDF));
+    two.push_back(rangeNode(0x80, 0xBF));
+    three.push_back(rangeNode(0xE0, 0xEF));
+    for (int i = 0; i < 2; ++i) three.push_back(rangeNode(0x80, 0xBF));
+    four.push_back(rangeNode(0xF0, 0xF4));
+    for (int i = 0; i < 3; ++i) four.push_back(rangeNode(0x80, 0xBF));
+
+    std::vector<RegexNode> alternatives;
+    alternatives.push_back(listNode(RegexNode::CONCAT, std::move(two)));
+    alternatives.push_back(listNode(RegexNode::CONCAT, std::move(three)));
+    alternatives.push_back(listNode(RegexNode::CONCAT, std::move(four)));
+    return listNode(RegexNode::ALT, std::move(alternatives));
+}
+
+// The members of a character class before it is turned into nodes.
+struct ClassItems {
+    ByteSet ascii;
+    bool nonAscii = false;            // Every character outside ASCII
+    std::vector<std::string> chars;   // Individual characters outside ASCII
+};
+
+class RegexParser {
+public:
+    RegexParser(std::string_view pattern, bool caseSensitive)
+        : _p(pattern), _pos(0), _caseSensitive(caseSensitive), _depth(0), _groups(0) {}
+
+    bool parse(RegexNode& out, std::string& error) {
+        bool ok = parseAlternation(out);
+        if (ok && _pos < _p.size()) ok = fail("unmatched ')'");
+        if (!ok) error = _error;
+        return ok;
+    }
+
+    size_t groupCount() const { return _groups; }
+
+private:
+    std::string_view _p;
+    size_t _pos;
+    bool _caseSensitive;
+    size_t _depth;
+    size_t _groups;
+    std::string _error;
+
+    bool fail(const std::string& message) {
+        if (_error.empty()) _error = message + " at position " + std::to_string(_pos + 1);
+        return false;
+    }
+
+    bool atEnd() const { return _pos >= _p.size(); }
+
+    bool parseAlternation(RegexNode& out) {
+        std::vector<RegexNode> alternatives(1);
+        if (!parseConcat(alternatives.back())) return false;
+        while (!atEnd() && _p[_pos] == '|') {
+            _pos++;
+            alternatives.emplace_back();
+            if (!parseConcat(alternatives.back())) return false;
+        }
+        out = listNode(RegexNode::ALT, std::move(alternatives));
+        return true;
+    }
+
+    bool parseConcat(RegexNode& out) {
+        std::vector<RegexNode> items;
+        while (!atEnd() && _p[_pos] != '|' && _p[_pos] != ')') {
+            items.emplace_back();
+            if (!parseRepeat(items.back())) return false;
+        }
+        if (items.empty()) {
+            out = RegexNode();
+        } else {
+            out = listNode(RegexNode::CONCAT, std::move(items));
+        }
+        return true;
+    }
+
+    bool parseRepeat(RegexNode& out) {
+        if (!parseAtom(out)) return false;
+        while (!atEnd()) {
+            int min, max;
+            char c = _p[_pos];
+            if (c == '*') {
+                min = 0, max = -1;
+                _pos++;
+            } else if (c == '+') {
+                min = 1, max = -1;
+                _pos++;
+            } else if (c == '?') {
+                min = 0, max = 1;
+                _pos++;
+            } else if (c == '{') {
+                size_t save = _pos;
+                if (!parseCount(min, max)) {
+                    if (!_error.empty()) return false;
+                    _pos = save;  // Not a count, so the '{' is a literal
+                    break;
+                }
+            } else {
+                break;
+            }
+
+            RegexNode repeat;
+            repeat.kind = RegexNode::REPEAT;
+            repeat.min = min;
+            repeat.max = max;
+            if (!atEnd() && _p[_pos] == '?') {
+                repeat.greedy = false;
+                _pos++;
+            }
+            repeat.children.push_back(std::move(out));
+            out = std::move(repeat);
+        }
+        return true;
+    }
+
+    bool parseNumber(int& value) {
+        size_t begin = _pos;
+        value = 0;
+        while (!atEnd() && _p[_pos] >= '0' && _p[_pos] <= '9') {
+            value = value * 10 + (_p[_pos] - '0');
+            if (value > REGEX_MAX_REPEAT) return fail("repetition count over " + std::to_string(REGEX_MAX_REPEAT));
+            _pos++;
+        }
+        return _pos > begin;
+    }
+
+    // {n}, {n,} or {n,m}. Returns false without an error if the text is not a count at all.
+    bool parseCount(int& min, int& max) {
+        _pos++;
+        if (!parseNumber(min)) return false;
+        max = min;
+        if (!atEnd() && _p[_pos] == ',') {
+            _pos++;
+            max = -1;
+            if (!atEnd() && _p[_pos] != '}' && !parseNumber(max)) return false;
+        }
+        if (atEnd() || _p[_pos] != '}') return false;
+        _pos++;
+        if (max >= 0 && max < min) return fail("repetition range out of order");
+        return true;
+    }
+
+    bool parseAtom(RegexNode& out) {
+        char c = _p[_pos];
+        switch (c) {
+        case '(': {
+            if (++_depth > REGEX_MAX_NESTING) return fail("groups nested too deeply");
+            _pos++;
+            size_t group = 0;
+            if (_p.substr(_pos, 2) == "?:") {
+                _pos += 2;
+            } else if (!atEnd() && _p[_pos] == '?') {
+                return fail("unsupported group type");
+            } else {
+                group = ++_groups;
+            }
+            if (!parseAlternation(out)) return false;
+            if (atEnd() || _p[_pos] != ')') return fail("missing ')'");
+            _pos++;
+            _depth--;
+            if (group > 0) {
+                RegexNode capture;
+                capture.kind = RegexNode::CAPTURE;
+                capture.group = group;
+                capture.children.push_back(std::move(out));
+                out = std::move(capture);
+            }
+            return true;
+        }
+        case '[':
+            return parseClass(out);
+        case '.': {
+            _pos++;
+            ClassItems items;
+            items.ascii.set();
+            for (unsigned b = 0x80; b < 256; ++b) items.ascii.reset(b);
+            items.ascii.reset('\n');
+            items.nonAscii = true;
+            out = classNode(items);
+            return true;
+        }
+        case '^':
+            _pos++;
+            out = assertNode(ASSERT_LINE_START);
+            return true;
+        case '$':
+            _pos++;
+            out = assertNode(ASSERT_LINE_END);
+            return true;
+        case '*':
+        case '+':
+        case '?':
+            return fail("nothing to repeat");
+        case '\\': {
+            _pos++;
+            if (atEnd()) return fail("trailing backslash");
+            if (_p[_pos] == 'b' || _p[_pos] == 'B') {
+                out = assertNode(_p[_pos] == 'b' ? ASSERT_WORD_BOUNDARY : ASSERT_NOT_WORD_BOUNDARY);
+                _pos++;
+                return true;
+            }
+            ClassItems items;
+            if (addShorthand(_p[_pos], items)) {
+                _pos++;
+                out = classNode(items);
+                return true;
+            }
+            std::string ch;
+            if (!readEscapedChar(ch)) return false;
+            out = literalNode(ch);
+            return true;
+        }
+        default: {
+            std::string ch;
+            if (!readChar(ch)) return false;
+            out = literalNode(ch);
+            return true;
+        }
+        }
+    }
+
+    bool parseClass(RegexNode& out) {
+        _pos++;
+        bool negate = false;
+        if (!atEnd() && _p[_pos] == '^') {
+            negate = true;
+            _pos++;
+        }
+
+        ClassItems items;
+        bool first = true;
+        while (true) {
+            if (atEnd()) return fail("missing ']'");
+            if (_p[_pos] == ']' && !first) {
+                _pos++;
+                break;
+            }
+            first = false;
+
+            std::string lo;
+            if (_p[_pos] == '\\') {
+                _pos++;
+                if (atEnd()) return fail("trailing backslash");
+                if (addShorthand(_p[_pos], items)) {
+                    _pos++;
+                    continue;
+                }
+                if (!readEscapedChar(lo)) return false;
+            } else if (!readChar(lo)) {
+                return false;
+            }
+
+            if (_pos + 1 < _p.size() && _p[_pos] == '-' && _p[_pos + 1] != ']') {
+                _pos++;
+                std::string hi;
+                if (_p[_pos] == '\\') {
+                    _pos++;
+                    if (atEnd()) return fail("trailing backslash");
+                    if (!readEscapedChar(hi)) return false;
+                } else if (!readChar(hi)) {
+                    return false;
+                }
+                if (lo.size() != 1 || hi.size() != 1 || (unsigned char)lo[0] >= 0x80 || (unsigned char)hi[0] >= 0x80) {
+                    return fail("ranges of non-ASCII characters are not supported");
+                }
+                if (lo[0] > hi[0]) return fail("range out of order");
+                for (int b = lo[0]; b <= hi[0]; ++b) items.ascii.set(b);
+            } else if (lo.size() == 1 && (unsigned char)lo[0] < 0x80) {
+                items.ascii.set((unsigned char)lo[0]);
+            } else {
+                items.chars.push_back(lo);
+            }
+        }
+
+        foldCase(items);
+        if (negate) {
+            if (!items.chars.empty()) return fail("non-ASCII characters cannot be excluded from a class");
+            for (unsigned b = 0; b < 0x80; ++b) items.ascii.flip(b);
+            items.ascii.reset('\n');
+            items.nonAscii = !items.nonAscii;
+        }
+        out = classNode(items);
+        return true;
+    }
+
+    bool addShorthand(char c, ClassItems& items) {
+        ByteSet set;
+        bool nonAscii = false;
+        switch (c) {
+        case 'd': case 'D':
+            for (int b = '0'; b <= '9'; ++b) set.set(b);
+            break;
+        case 'w': case 'W':
+            for (unsigned b = 0; b < 0x80; ++b) {
+                if (isWordByte((unsigned char)b)) set.set(b);
+            }
+            nonAscii = true;
+            break;
+        case 's': case 'S':
+            for (char b : { ' ', '\t', '\r', '\f', '\v' }) set.set((unsigned char)b);
+            break;
+        default:
+            return false;
+        }
+        if (c >= 'A' && c <= 'Z') {
+            for (unsigned b = 0; b < 0x80; ++b) set.flip(b);
+            set.reset('\n');
+            nonAscii = !nonAscii;
+        }
+        items.ascii |= set;
+        items.nonAscii = items.nonAscii || nonAscii;
+        return true;
+    }
+
+    bool readEscapedChar(std::string& out) {
+        char c = _p[_pos];
+        switch (c) {
+        case 't': out = "\t"; break;
+        case 'n': out = "\n"; break;
+        case 'r': out = "\r"; break;
+        case 'f': out = "\f"; break;
+        case 'v': out = "\v"; break;
+        case 'x': {
+            int value = 0;
+            for (int i = 1; i <= 2; ++i) {
+                char h = _pos + i < _p.size() ? _p[_pos + i] : '\0';
+                int digit = (h >= '0' && h <= '9') ? h - '0' : (h >= 'a' && h <= 'f') ? h - 'a' + 10 : (h >= 'A' && h <= 'F') ? h - 'A' + 10 : -1;
+                if (digit < 0) return fail("\\x needs two hex digits");
+                value = value * 16 + digit;
+            }
+            out = std::string(1, (char)value);
+            _pos += 3;
+            return true;
+        }
+        default:
+            if ((unsigned char)c < 0x80 && !isWordByte((unsigned char)c)) {
+                out = std::string(1, c);
+                break;
+            }
+            return fail(std::string("unknown escape \\") + c);
+        }
+        _pos++;
+        return true;
+    }
+
+    bool readChar(std::string& out) {
+        size_t length = utf8SequenceLength((unsigned char)_p[_pos]);
+        if (length == 0 || _pos + length > _p.size()) return fail("invalid UTF-8 in pattern");
+        for (size_t i = 1; i < length; ++i) {
+            if (((unsigned char)_p[_pos + i] & 0xC0) != 0x80) return fail("invalid UTF-8 in pattern");
+        }
+        out = std::string(_p.substr(_pos, length));
+        _pos += length;
+        return true;
+    }
+
+    void foldCase(ClassItems& items) const {
+        if (_caseSensitive) return;
+        for (unsigned b = 0; b < 0x80; ++b) {
+            if (items.ascii[b] && isAsciiLetter((unsigned char)b)) items.ascii.set(b ^ 0x20);
+        }
+    }
+
+    RegexNode literalNode(const std::string& ch) const {
+        std::vector<RegexNode> bytes;
+        for (char c : ch) {
+            ByteSet set;
+            set.set((unsigned char)c);
+            if (!_caseSensitive && isAsciiLetter((unsigned char)c)) set.set((unsigned char)c ^ 0x20);
+            bytes.push_back(bytesNode(set));
+        }
+        return listNode(RegexNode::CONCAT, std::move(bytes));
+    }
+
+    RegexNode classNode(const ClassItems& items) const {
+        std::vector<RegexNode> alternatives;
+        if (items.ascii.any() || (!items.nonAscii && items.chars.empty())) {
+            alternatives.push_back(bytesNode(items.ascii));
+        }
+        if (items.nonAscii) {
+            alternatives.push_back(multibyteNode());
+        } else {
+            for (const std::string& ch : items.chars) alternatives.push_back(literalNode(ch));
+        }
+        return listNode(RegexNode::ALT, std::move(alternatives));
+    }
+};
+
+// Emits Thompson NFA instructions. Nodes are compiled back to front: each is given the
+// instruction to continue at and returns its own entry point. Groups only record where
+// they matched in the capture program; the DFAs treat them as plain groups.
+class RegexCompiler {
+public:
+    RegexCompiler(std::vector<RegexInst>& insts, std::vector<ByteSet>& classes, bool reverse, bool captures = false)
+        : overflow(false), _insts(insts), _classes(classes), _reverse(reverse), _captures(captures) {}
+
+    int32_t emit(RegexOp op, int32_t x, int32_t y, uint8_t assertion = 0) {
+        if (_insts.size() >= REGEX_MAX_PROGRAM) {
+            overflow = true;
+            return 0;
+        }
+        _insts.push_back({ op, assertion, x, y });
+        return (int32_t)_insts.size() - 1;
+    }
+
+    int32_t classIndex(const ByteSet& bytes) {
+        std::string key = bytes.to_string();
+        auto it = _classIds.find(key);
+        if (it != _classIds.end()) return it->second;
+        _classes.push_back(bytes);
+        int32_t id = (int32_t)_classes.size() - 1;
+        _classIds.emplace(std::move(key), id);
+        return id;
+    }
+
+    int32_t compile(const RegexNode& node, int32_t next) {
+        if (overflow) return next;
+        switch (node.kind) {
+        case RegexNode::EMPTY:
+            return next;
+        case RegexNode::BYTES:
+            return emit(OP_CLASS, next, classIndex(node.bytes));
+        case RegexNode::ASSERT:
+            return emit(OP_ASSERT, next, 0, _reverse ? mirror(node.assertion) : node.assertion);
+        case RegexNode::CAPTURE:
+            if (!_captures) return compile(node.children[0], next);
+            next = emit(OP_SAVE, next, (int32_t)(2 * node.group + 1));
+            next = compile(node.children[0], next);
+            return emit(OP_SAVE, next, (int32_t)(2 * node.group));
+        case RegexNode::CONCAT:
+            if (_reverse) {
+                for (const RegexNode& child : node.children) next = compile(child, next);
+            } else {
+                for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) next = compile(*it, next);
+            }
+            return next;
+        case RegexNode::ALT: {
+            std::vector<int32_t> starts;
+            for (const RegexNode& child : node.children) starts.push_back(compile(child, next));
+            int32_t entry = starts.back();
+            for (size_t i = starts.size() - 1; i-- > 0;) entry = emit(OP_SPLIT, starts[i], entry);
+            return entry;
+        }
+        case RegexNode::REPEAT: {
+            const RegexNode& child = node.children[0];
+            int32_t entry = next;
+            if (node.max < 0) {
+                int32_t loop = emit(OP_SPLIT, 0, 0);
+                int32_t body = compile(child, loop);
+                if (overflow) return next;
+                _insts[loop].x = node.greedy ? body : next;
+                _insts[loop].y = node.greedy ? next : body;
+                entry = loop;
+            } else {
+                // x{0,3} is laid out as (x(x(x)?)?)?, so there is only one way to match.
+                for (int i = node.min; i < node.max; ++i) {
+                    int32_t body = compile(child, entry);
+                    entry = node.greedy ? emit(OP_SPLIT, body, next) : emit(OP_SPLIT, next, body);
+                }
+            }
+            for (int i = 0; i < node.min; ++i) entry = compile(child, entry);
+            return entry;
+        }
+        }
+        return next;
+    }
+
+    bool overflow;
+
+private:
+    std::vector<RegexInst>& _insts;
+    std::vector<ByteSet>& _classes;
+    std::unordered_map<std::string, int32_t> _classIds;
+    bool _reverse;
+    bool _captures;
+
+    // Scanning backwards swaps what lies before and after a position.
+    static uint8_t mirror(uint8_t assertion) {
+        switch (assertion) {
+        case ASSERT_LINE_START: return ASSERT_LINE_END;
+        case ASSERT_LINE_END: return ASSERT_LINE_START;
+        case ASSERT_NOT_AFTER_WORD: return ASSERT_NOT_BEFORE_WORD;
+        case ASSERT_NOT_BEFORE_WORD: return ASSERT_NOT_AFTER_WORD;
+        default: return assertion;
+        }
+    }
+};
+
+// A byte node that is one exact byte, or one ASCII letter in either case. Appends its
+// (lowered) byte to literal and returns true if so.
+bool literalByte(const RegexNode& node, bool caseSensitive, std::string& literal) {
+    if (node.kind != RegexNode::BYTES) return false;
+    size_t count = node.bytes.count();
+    for (unsigned b = 0; b < 256; ++b) {
+        if (!node.bytes[b]) continue;
+        if (count == 1 && (caseSensitive || !isAsciiLetter((unsigned char)b))) {
+            literal.push_back((char)b);
+            return true;
+        }
+        if (count == 2 && !caseSensitive && isAsciiLetter((unsigned char)b) && node.bytes[b ^ 0x20]) {
+            literal.push_back((char)(b | 0x20));
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+// Finds the longest run of literal bytes that every match must contain.
+void requiredLiteral(const RegexNode& node, bool caseSensitive, std::string& run, std::string& best) {
+    auto endRun = [&]() {
+        if (run.size() > best.size()) best = run;
+        run.clear();
+    };
+    switch (node.kind) {
+    case RegexNode::EMPTY:
+    case RegexNode::ASSERT:
+        break;
+    case RegexNode::BYTES:
+        if (!literalByte(node, caseSensitive, run)) endRun();
+        break;
+    case RegexNode::CONCAT:
+        for (const RegexNode& child : node.children) requiredLiteral(child, caseSensitive, run, best);
+        break;
+    case RegexNode::CAPTURE:
+        requiredLiteral(node.children[0], caseSensitive, run, best);
+        break;
+    case RegexNode::REPEAT:
+        endRun();
+        if (node.min > 0) {
+            requiredLiteral(node.children[0], caseSensitive, run, best);
+            endRun();
+        }
+        break;
+    case RegexNode::ALT:
+        endRun();
+        break;
+    }
+}
+
+}
+
+// The lazily built DFA for one direction. State 0 is the dead state. A state is a list of
+// NFA instructions that continue after the bytes consumed so far, in priority order,
+// plus what kind of byte came before (needed only for assertions). Its match flag means
+// a match ended right before the byte that led into it, so assertions can look at the
+// byte after the match before it is reported.
+struct Regex::Dfa {
+    const RegexProgram& program;
+    const std::vector<RegexInst>& insts;
+    int32_t startPc;
+    bool longest;  // Keep every thread alive rather than cutting the ones behind a match
+    int stride;
+
+    std::vector<int32_t> table;  // stride transitions per state, -1 until computed
+    std::vector<uint8_t> matched;
+    std::vector<uint8_t> contexts;
+    std::vector<std::vector<int32_t>> kernels;
+    std::unordered_map<std::string, int32_t> ids;
+    int32_t starts[3];
+
+    std::vector<int32_t> stack;
+    std::vector<int32_t> closure;
+    std::vector<int32_t> nextKernel;
+    std::vector<uint32_t> seen;
+    uint32_t generation;
+
+    Dfa(const RegexProgram& p, bool reverse)
+        : program(p), insts(reverse ? p.reverse : p.forward), startPc(reverse ? p.reverseStart : p.forwardStart),
+          longest(reverse), stride(p.symbolCount), seen(insts.size(), 0), generation(0) {
+        clear();
+    }
+
+    void clear() {
+        table.assign(stride, 0);
+        matched.assign(1, 0);
+        contexts.assign(1, CTX_EDGE);
+        kernels.assign(1, std::vector<int32_t>());
+        ids.clear();
+        starts[0] = starts[1] = starts[2] = -1;
+    }
+
+    int32_t start(uint8_t context) {
+        if (starts[context] < 0) {
+            nextKernel.assign(1, startPc);
+            bool flushed;
+            starts[context] = intern(context, false, flushed);
+        }
+        return starts[context];
+    }
+
+    int32_t step(int32_t state, int symbol) {
+        int32_t next = table[(size_t)state * stride + symbol];
+        return next >= 0 ? next : transition(state, symbol);
+    }
+
+    void nextGeneration() {
+        if (++generation == 0) {
+            std::fill(seen.begin(), seen.end(), 0);
+            generation = 1;
+        }
+    }
+
+    // Follows the empty transitions from kernel in priority order, collecting the
+    // instructions that consume a byte. Returns whether the match instruction was reached.
+    bool computeClosure(const std::vector<int32_t>& kernel, uint8_t before, uint8_t after) {
+        closure.clear();
+        nextGeneration();
+        bool isMatch = false;
+        for (int32_t first : kernel) {
+            stack.push_back(first);
+            while (!stack.empty()) {
+                int32_t pc = stack.back();
+                stack.pop_back();
+                if (seen[pc] == generation) continue;
+                seen[pc] = generation;
+                const RegexInst& inst = insts[pc];
+                switch (inst.op) {
+                case OP_SPLIT:
+                    stack.push_back(inst.y);
+                    stack.push_back(inst.x);
+                    break;
+                case OP_ASSERT:
+                    if (assertionHolds(inst.assertion, before, after)) stack.push_back(inst.x);
+                    break;
+                case OP_SAVE:
+                    stack.push_back(inst.x);
+                    break;
+                case OP_CLASS:
+                    closure.push_back(pc);
+                    break;
+                case OP_MATCH:
+                    isMatch = true;
+                    if (!longest) {
+                        // Everything after the match has lower priority and can only lose to it.
+                        stack.clear();
+                        return true;
+                    }
+                    break;
+                }
+            }
+        }
+        return isMatch;
+    }
+
+    int32_t transition(int32_t state, int symbol) {
+        uint8_t after = program.symbolContext[symbol];
+        bool isMatch = computeClosure(kernels[state], contexts[state], after);
+
+        nextKernel.clear();
+        if (symbol != program.symbolCount - 1) {
+            nextGeneration();
+            unsigned char byte = program.representative[symbol];
+            for (int32_t pc : closure) {
+                const RegexInst& inst = insts[pc];
+                if (program.classes[inst.y][byte] && seen[inst.x] != generation) {
+                    seen[inst.x] = generation;
+                    nextKernel.push_back(inst.x);
+                }
+            }
+            if (longest) std::sort(nextKernel.begin(), nextKernel.end());
+        }
+
+        bool flushed;
+        int32_t next = intern(after, isMatch, flushed);
+        if (!flushed) table[(size_t)state * stride + symbol] = next;
+        return next;
+    }
+
+    // Returns the state for nextKernel, adding it if it is new. When the cache is full it
+    // is flushed first; state numbers from before are then invalid.
+    int32_t intern(uint8_t context, bool isMatch, bool& flushed) {
+        flushed = false;
+        if (nextKernel.empty() && !isMatch) return 0;
+        if (!program.hasAssertions) context = CTX_EDGE;
+
+        std::string key;
+        key.reserve(2 + nextKernel.size() * sizeof(int32_t));
+        key.push_back((char)context);
+        key.push_back(isMatch ? 1 : 0);
+        key.append((const char*)nextKernel.data(), nextKernel.size() * sizeof(int32_t));
+        auto it = ids.find(key);
+        if (it != ids.end()) return it->second;
+
+        if (kernels.size() >= REGEX_DFA_MAX_STATES) {
+            clear();
+            flushed = true;
+        }
+        int32_t id = (int32_t)kernels.size();
+        kernels.push_back(nextKernel);
+        matched.push_back(isMatch ? 1 : 0);
+        contexts.push_back(context);
+        table.resize(table.size() + stride, -1);
+        ids.emplace(std::move(key), id);
+        return id;
+    }
+};
+
+Regex::Regex() {}
+
+Regex::~Regex() {}
+
+Regex::Regex(const Regex& other) : _program(other._program) {
+    resetCaches();
+}
+
+Regex& Regex::operator=(const Regex& other) {
+    if (this != &other) {
+        _program = other._program;
+        resetCaches();
+    }
+    return *this;
+}
+
+void Regex::resetCaches() {
+    if (_program) {
+        _forward = std::make_unique<Dfa>(*_program, false);
+        _reverse = std::make_unique<Dfa>(*_program, true);
+    } else {
+        _forward.reset();
+        _reverse.reset();
+    }
+}
+
+const LiteralSearcher* Regex::prefilter() const {
+    return _program ? _program->prefilter.get() : nullptr;
+}
+
+bool Regex::compile(std::string_view pattern, SearchOptions options, std::string& error) {
+    _program.reset();
+    resetCaches();
+
+    RegexNode root;
+    RegexParser parser(pattern, options.caseSensitive);
+    if (!parser.parse(root, error)) return false;
+    if (options.wholeWord) {
+        std::vector<RegexNode> parts;
+        parts.push_back(assertNode(ASSERT_NOT_AFTER_WORD));
+        parts.push_back(std::move(root));
+        parts.push_back(assertNode(ASSERT_NOT_BEFORE_WORD));
+        root = listNode(RegexNode::CONCAT, std::move(parts));
+    }
+
+    auto program = std::make_shared<RegexProgram>();
+
+    // Forward: an unanchored search is the pattern behind a lazy "any byte" loop, which
+    // has the lowest priority and so stops starting new matches once one is found.
+    RegexCompiler forward(program->forward, program->classes, false);
+    int32_t body = forward.compile(root, forward.emit(OP_MATCH, 0, 0));
+    int32_t loop = forward.emit(OP_SPLIT, body, 0);
+    ByteSet any;
+    any.set();
+    int32_t skip = forward.emit(OP_CLASS, loop, forward.classIndex(any));
+    if (!forward.overflow) program->forward[loop].y = skip;
+    program->forwardStart = loop;
+
+    RegexCompiler reverse(program->reverse, program->classes, true);
+    program->reverseStart = reverse.compile(root, reverse.emit(OP_MATCH, 0, 0));
+
+    if (forward.overflow || reverse.overflow) {
+        error = "pattern is too large";
+        return false;
+    }
+
+    for (const RegexInst& inst : program->forward) {
+        if (inst.op == OP_ASSERT) program->hasAssertions = true;
+    }
+
+    // Partition the bytes by the classes they belong to (and word or not, for \b).
+    std::map<std::string, uint8_t> symbols;
+    for (unsigned b = 0; b < 256; ++b) {
+        std::string signature(1, isWordByte((unsigned char)b) ? 'w' : '-');
+        for (const ByteSet& set : program->classes) signature.push_back(set[b] ? '1' : '0');
+        auto it = symbols.find(signature);
+        if (it == symbols.end()) {
+            uint8_t symbol = (uint8_t)symbols.size();
+            it = symbols.emplace(std::move(signature), symbol).first;
+            program->representative.push_back((uint8_t)b);
+            program->symbolContext.push_back(isWordByte((unsigned char)b) ? CTX_WORD : CTX_OTHER);
+        }
+        program->symbolOf[b] = it->second;
+    }
+    program->representative.push_back(0);
+    program->symbolContext.push_back(CTX_EDGE);
+    program->symbolCount = (int)program->representative.size();
+
+    // Compiled after the partition: its classes repeat ones the DFAs already have.
+    program->groupCount = parser.groupCount();
+    if (program->groupCount > 0) {
+        RegexCompiler capture(program->capture, program->classes, false, true);
+        program->captureStart = capture.compile(root, capture.emit(OP_MATCH, 0, 0));
+        if (capture.overflow) {
+            error = "pattern is too large";
+            return false;
+        }
+    }
+
+    std::string run, literal;
+    requiredLiteral(root, options.caseSensitive, run, literal);
+    if (run.size() > literal.size()) literal = run;
+    if (literal.size() >= REGEX_MIN_PREFILTER) {
+        SearchOptions literalOptions;
+        literalOptions.caseSensitive = options.caseSensitive;
+        program->prefilter = std::make_unique<LiteralSearcher>(literal, literalOptions);
+    }
+
+    _program = std::move(program);
+    resetCaches();
+    return true;
+}
+
+bool Regex::find(const char* line, size_t size, size_t from, size_t& matchStart, size_t& matchEnd) {
+    if (!_program || from > size) return false;
+    const RegexProgram& program = *_program;
+    const unsigned char* text = (const unsigned char*)line;
+    const int edge = program.symbolCount - 1;
+    const size_t stride = (size_t)program.symbolCount;
+    const size_t none = (size_t)-1;
+
+    // Forward to the end of the leftmost match: keep going while higher priority threads
+    // (a longer greedy repetition, say) are alive, remembering the last match seen.
+    Dfa& forward = *_forward;
+    int32_t state = forward.start(from > 0 ? program.symbolContext[program.symbolOf[text[from - 1]]] : (uint8_t)CTX_EDGE);
+    size_t end = none;
+    size_t i = from;
+    const uint8_t* symbolOf = program.symbolOf;
+    const int32_t* table = forward.table.data();
+    const uint8_t* matched = forward.matched.data();
+    for (; i < size; ++i) {
+        int symbol = symbolOf[text[i]];
+        int32_t next = table[(size_t)state * stride + symbol];
+        if (next < 0) {
+            // Adding a state may reallocate the tables.
+            next = forward.transition(state, symbol);
+            table = forward.table.data();
+            matched = forward.matched.data();
+        }
+        state = next;
+        if (matched[state]) {
+            end = i;
+        } else if (state == 0) {
+            break;
+        }
+    }
+    if (i == size) {
+        state = forward.step(state, edge);
+        if (forward.matched[state]) end = size;
+    }
+    if (end == none) return false;
+
+    // Backward from there: the furthest point back from which the reversed pattern
+    // matches is the start of the leftmost match, since no match starts before it.
+    Dfa& reverse = *_reverse;
+    state = reverse.start(end < size ? program.symbolContext[program.symbolOf[text[end]]] : (uint8_t)CTX_EDGE);
+    size_t start = end;
+    size_t j = end;
+    table = reverse.table.data();
+    matched = reverse.matched.data();
+    for (; j > from; --j) {
+        int symbol = symbolOf[text[j - 1]];
+        int32_t next = table[(size_t)state * stride + symbol];
+        if (next < 0) {
+            next = reverse.transition(state, symbol);
+            table = reverse.table.data();
+            matched = reverse.matched.data();
+        }
+        state = next;
+        if (matched[state]) {
+            start = j;
+        } else if (state == 0) {
+            break;
+        }
+    }
+    if (j == from) {
+        state = reverse.step(state, from > 0 ? program.symbolOf[text[from - 1]] : edge);
+        if (reverse.matched[state]) start = from;
+    }
+
+    matchStart = start;
+    matchEnd = end;
+    return true;
+}
+
+size_t Regex::groupCount() const {
+    return _program ? _program->groupCount : 0;
+}
+
+// A Pike VM over the capture program: threads run in lockstep from the start of the match,
+// in priority order, each with its own copy of the capture slots. Only the match's own
+// bytes are run, so the cost is proportional to its length times the program size.
+bool Regex::captures(const char* line, size_t size, size_t matchStart, size_t matchEnd, std::vector<size_t>& groups) const {
+    if (!_program || matchStart > matchEnd || matchEnd > size) return false;
+    const RegexProgram& program = *_program;
+    size_t slotCount = 2 * (program.groupCount + 1);
+    groups.assign(slotCount, REGEX_NO_GROUP);
+    groups[0] = matchStart;
+    groups[1] = matchEnd;
+    if (program.groupCount == 0) return true;
+
+    const std::vector<RegexInst>& insts = program.capture;
+    const unsigned char* text = (const unsigned char*)line;
+    auto contextAt = [&](size_t pos) -> uint8_t {
+        if (pos >= size) return CTX_EDGE;
+        return isWordByte(text[pos]) ? CTX_WORD : CTX_OTHER;
+    };
+
+    struct ThreadList {
+        std::vector<int32_t> pcs;
+        std::vector<size_t> slots;  // slotCount per thread
+    };
+    struct Frame {
+        int32_t pc;       // -1 to restore slot to value instead
+        int32_t slot;
+        size_t value;
+    };
+    thread_local ThreadList current, next;
+    thread_local std::vector<Frame> stack;
+    thread_local std::vector<size_t> work;
+    thread_local std::vector<uint32_t> seen;
+    thread_local uint32_t generation = 0;
+    if (seen.size() < insts.size()) seen.resize(insts.size(), 0);
+    auto nextGeneration = [&]() {
+        if (++generation == 0) {
+            std::fill(seen.begin(), seen.end(), 0);
+            generation = 1;
+        }
+    };
+
+    // Follows the empty transitions from pc at pos, adding the threads that consume a byte
+    // or match to list with the slots they have then.
+    auto add = [&](ThreadList& list, int32_t first, size_t pos) {
+        uint8_t before = pos > 0 ? contextAt(pos - 1) : (uint8_t)CTX_EDGE;
+        uint8_t after = contextAt(pos);
+        stack.push_back({ first, 0, 0 });
+        while (!stack.empty()) {
+            Frame frame = stack.back();
+            stack.pop_back();
+            if (frame.pc < 0) {
+                work[frame.slot] = frame.value;
+                continue;
+            }
+            int32_t pc = frame.pc;
+            if (seen[pc] == generation) continue;
+            seen[pc] = generation;
+            const RegexInst& inst = insts[pc];
+            switch (inst.op) {
+            case OP_SPLIT:
+                stack.push_back({ inst.y, 0, 0 });
+                stack.push_back({ inst.x, 0, 0 });
+                break;
+            case OP_ASSERT:
+                if (assertionHolds(inst.assertion, before, after)) stack.push_back({ inst.x, 0, 0 });
+                break;
+            case OP_SAVE:
+                stack.push_back({ -1, inst.y, work[inst.y] });
+                work[inst.y] = pos;
+                stack.push_back({ inst.x, 0, 0 });
+                break;
+            case OP_CLASS:
+            case OP_MATCH:
+                list.pcs.push_back(pc);
+                list.slots.insert(list.slots.end(), work.begin(), work.end());
+                break;
+            }
+        }
+    };
+
+    current.pcs.clear();
+    current.slots.clear();
+    work.assign(slotCount, REGEX_NO_GROUP);
+    nextGeneration();
+    add(current, program.captureStart, matchStart);
+    for (size_t pos = matchStart; !current.pcs.empty(); ++pos) {
+        next.pcs.clear();
+        next.slots.clear();
+        nextGeneration();
+        for (size_t t = 0; t < current.pcs.size(); ++t) {
+            const RegexInst& inst = insts[current.pcs[t]];
+            const size_t* slots = current.slots.data() + t * slotCount;
+            if (inst.op == OP_MATCH) {
+                if (pos == matchEnd) {
+                    for (size_t s = 2; s < slotCount; ++s) groups[s] = slots[s];
+                    return true;
+                }
+                // Every thread behind a match has lower priority and can only lose to it.
+                break;
+            }
+            if (pos < matchEnd && program.classes[inst.y][text[pos]]) {
+                work.assign(slots, slots + slotCount);
+                add(next, inst.x, pos + 1);
+            }
+        }
+        if (pos == matchEnd) break;
+        std::swap(current, next);
+    }
+    return false;
+}
+
+bool searchLine(Regex& regex, std::string_view line, size_t row, const std::function<bool(const SearchMatch&)>& onMatch) {
+    const char* text = line.data();
+    size_t length = line.size();
+    size_t from = 0;
+    size_t start, end;
+    while (from <= length && regex.find(text, length, from, start, end)) {
+        if (!onMatch({ row, start, end - start })) return false;
+        if (end > start) {
+            from = end;
+        } else {
+            // Step over an empty match by a whole character.
+            from = end + 1;
+            while (from < length && ((unsigned char)text[from] & 0xC0) == 0x80) from++;
+        }
+    }
+    return true;
+}
+
+void searchSnapshot(const LineSnapshot& snapshot, Regex& regex,
+                    size_t fromRow, size_t toRow, const std::function<bool(const SearchMatch&)>& onMatch) {
+    if (!regex.isValid()) return;
+    const LiteralSearcher* prefilter = regex.prefilter();
+    snapshot.forEachChunk(fromRow, toRow, [&](const TextChunk& chunk) {
+        size_t line = 0;
+        while (line < chunk.lineCount) {
+            if (prefilter) {
+                // Jump straight to the next line that contains the required literal.
+                size_t hit = prefilter->find(chunk.data, chunk.size, chunk.lineStart(line));
+                if (hit == LiteralSearcher::npos) return true;
+                line = chunk.lineAt(hit);
+            }
+
+            std::string_view text(chunk.data + chunk.lineStart(line), chunk.lineLength(line));
+            if (!searchLine(regex, text, chunk.firstRow + line, onMatch)) return false;
+            ++line;
+        }
+        return true;
+    });
+}
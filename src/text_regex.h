@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+#include "line_buffer.h"
+#include "text_search.h"
+
+const size_t REGEX_MAX_PROGRAM = 100000;   // Instructions a pattern may compile to, after counted repetition is expanded
+const size_t REGEX_DFA_MAX_STATES = 4096;  // DFA states cached per direction before the cache is flushed and rebuilt
+const size_t REGEX_NO_GROUP = (size_t)-1;  // Capture slot of a group that took no part in the match
+
+struct RegexProgram;
+
+// Regular expressions for searching the buffer. A pattern is compiled to an NFA, and
+// matching runs a DFA that is built lazily from it, one state and one transition at a
+// time as the text needs them, so every byte costs a table lookup and there is no
+// backtracking: matching is linear in the text for any pattern. The forward DFA finds
+// where the leftmost match ends (alternatives and greedy repetition take priority in
+// the usual order), then a DFA of the reversed pattern runs back from there to find
+// where it starts. Matches are confined to one line. When every match has to contain a
+// literal, lines without it are skipped with LiteralSearcher before the DFA runs.
+//
+// Supported syntax: literals, '.', [classes] with ranges and negation, \d \w \s and
+// their negations, \t \n \r \xHH, escaped punctuation, groups (...) and (?:...),
+// alternation, * + ? {n} {n,} {n,m} and their lazy forms, ^ $ \b \B. Classes and case
+// folding are ASCII; other characters count as word characters and '.' matches one
+// whole UTF-8 character. Groups (...) capture, numbered from 1 by their '(', and
+// captures() reports where they matched.
+//
+// The DFA cache makes find() non-const; copies share the compiled pattern but build
+// their own cache, so each thread searching with the same pattern needs its own copy.
+class Regex {
+public:
+    Regex();
+    ~Regex();
+    Regex(const Regex& other);
+    Regex& operator=(const Regex& other);
+
+    bool compile(std::string_view pattern, SearchOptions options, std::string& error);
+    bool isValid() const { return _program != nullptr; }
+
+    // Finds the leftmost match in line (without its terminator) that starts at or after from.
+    bool find(const char* line, size_t size, size_t from, size_t& matchStart, size_t& matchEnd);
+
+    // Number of capturing groups in the pattern.
+    size_t groupCount() const;
+
+    // Where each group of a match that find() returned took part in it: groups gets a start
+    // and an end offset per group, group 0 being the whole match, or REGEX_NO_GROUP for both
+    // when a group did not take part. Only the match itself is rerun, not the line. Safe to
+    // call from several threads on the same Regex.
+    bool captures(const char* line, size_t size, size_t matchStart, size_t matchEnd, std::vector<size_t>& groups) const;
+
+    // A literal every match contains, for skipping text that cannot match; nullptr if there is none.
+    const LiteralSearcher* prefilter() const;
+
+private:
+    struct Dfa;
+
+    std::shared_ptr<const RegexProgram> _program;
+    std::unique_ptr<Dfa> _forward;
+    std::unique_ptr<Dfa> _reverse;
+
+    void resetCaches();
+};
+
+// Like the literal searchSnapshot(), for a regular expression. Empty matches are reported
+// too; the search then moves on by one character.
+void searchSnapshot(const LineSnapshot& snapshot, Regex& regex,
+                    size_t fromRow, size_t toRow, const std::function<bool(const SearchMatch&)>& onMatch);
+
+// Like the literal searchLine(), for a regular expression.
+bool searchLine(Regex& regex, std::string_view line, size_t row, const std::function<bool(const SearchMatch&)>& onMatch);
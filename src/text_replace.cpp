@@ -0,0 +1,207 @@
+#include "text_replace.h"
+#include "parallel_search.h"
+#include <algorithm>
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool ReplaceTemplate::parse(std::string_view replacement, bool regex, size_t groupCount, std::string& error) {
+    _pieces.clear();
+    _usesGroups = false;
+    if (!regex) {
+        _pieces.push_back({ std::string(replacement), REGEX_NO_GROUP });
+        return true;
+    }
+
+    std::string text;
+    for (size_t i = 0; i < replacement.size(); ++i) {
+        char c = replacement[i];
+        if (c == '\\') {
+            char next = i + 1 < replacement.size() ? replacement[i + 1] : '\0';
+            if (next == 'n') text.push_back('\n');
+            else if (next == 't') text.push_back('\t');
+            else if (next == '\\') text.push_back('\\');
+            else {
+                error = "replacement: '\\' must be followed by n, t or '\\'";
+                return false;
+            }
+            ++i;
+            continue;
+        }
+        if (c != '$') {
+            text.push_back(c);
+            continue;
+        }
+
+        size_t group = 0;
+        if (i + 1 < replacement.size() && replacement[i + 1] == '$') {
+            text.push_back('$');
+            ++i;
+            continue;
+        } else if (i + 1 < replacement.size() && isDigit(replacement[i + 1])) {
+            group = (size_t)(replacement[i + 1] - '0');
+            ++i;
+        } else if (i + 1 < replacement.size() && replacement[i + 1] == '{') {
+            size_t end = i + 2;
+            while (end < replacement.size() && isDigit(replacement[end]) && end - i < 8) ++end;
+            if (end == i + 2 || end >= replacement.size() || replacement[end] != '}') {
+                error = "replacement: '${' must be followed by a group number and '}'";
+                return false;
+            }
+            group = (size_t)std::stoul(std::string(replacement.substr(i + 2, end - i - 2)));
+            i = end;
+        } else {
+            error = "replacement: '$' must be followed by a group number, {n} or '$'";
+            return false;
+        }
+        if (group > groupCount) {
+            error = "replacement: the pattern has no group " + std::to_string(group);
+            return false;
+        }
+        if (group > 0) _usesGroups = true;
+        _pieces.push_back({ std::move(text), group });
+        text.clear();
+    }
+    if (!text.empty() || _pieces.empty()) _pieces.push_back({ std::move(text), REGEX_NO_GROUP });
+    return true;
+}
+
+void ReplaceTemplate::expand(std::string_view line, const std::vector<size_t>& groups, std::string& out) const {
+    for (const Piece& piece : _pieces) {
+        out += piece.text;
+        if (piece.group == REGEX_NO_GROUP || 2 * piece.group + 1 >= groups.size()) continue;
+        size_t start = groups[2 * piece.group];
+        size_t end = groups[2 * piece.group + 1];
+        if (start != REGEX_NO_GROUP && end >= start && end <= line.size()) out.append(line.substr(start, end - start));
+    }
+}
+
+void PositionMap::map(size_t& row, size_t& col) const {
+    // The last replacement that starts at or before the position decides where it goes.
+    auto after = std::upper_bound(_spans.begin(), _spans.end(), std::make_pair(row, col),
+                                  [](const std::pair<size_t, size_t>& pos, const ReplacedSpan& span) {
+                                      return pos.first < span.row || (pos.first == span.row && pos.second < span.col);
+                                  });
+    if (after == _spans.begin()) return;
+    const ReplacedSpan& span = *(after - 1);
+    if (row > span.row) {
+        row += span.endRow - span.row;
+    } else if (col < span.col + span.length) {
+        row = span.newRow;
+        col = span.newCol;
+    } else {
+        col = span.endCol + (col - span.col - span.length);
+        row = span.endRow;
+    }
+}
+
+size_t PositionMap::mapRow(size_t row) const {
+    size_t col = 0;
+    map(row, col);
+    return row;
+}
+
+size_t PositionMap::unmapRow(size_t newRow) const {
+    auto after = std::upper_bound(_spans.begin(), _spans.end(), newRow,
+                                  [](size_t row, const ReplacedSpan& span) { return row < span.newRow; });
+    if (after == _spans.begin()) return newRow;
+    const ReplacedSpan& span = *(after - 1);
+    return newRow <= span.endRow ? span.row : newRow - (span.endRow - span.row);
+}
+
+bool Replacer::prepare(const std::string& pattern, const std::string& replacement, SearchOptions options, std::string& error) {
+    _ready = false;
+    _literal.reset();
+    _regex = Regex();
+    if (pattern.empty()) {
+        error = "nothing to replace";
+        return false;
+    }
+    if (options.regex) {
+        if (!_regex.compile(pattern, options, error)) return false;
+    } else {
+        _literal = std::make_unique<LiteralSearcher>(pattern, options);
+    }
+    if (!_template.parse(replacement, options.regex, _regex.groupCount(), error)) return false;
+    _ready = true;
+    return true;
+}
+
+size_t Replacer::run(WorkerPool& pool, const LineSnapshot& snapshot, size_t fromRow, size_t toRow,
+                     const std::atomic<bool>& cancel, const std::function<void(size_t row, std::string&& text)>& onLine,
+                     PositionMap& map) {
+    map.clear();
+    if (!_ready) return 0;
+
+    size_t replaced = 0;
+    size_t addedRows = 0;  // Line breaks the replacements so far have added
+    std::vector<size_t> groups;
+    std::string text;
+    SearchChunkVisitor onChunk = [&](size_t, size_t, const std::vector<SearchMatch>& matches) {
+        // Chunks end at line boundaries, so every row's matches arrive together.
+        for (size_t i = 0; i < matches.size();) {
+            size_t row = matches[i].row;
+            std::string_view line = snapshot.view(row);
+            size_t newRow = row + addedRows;
+            size_t lineStart = 0;  // Where the last line of the new text starts in it
+            size_t copied = 0;
+            text.clear();
+            for (; i < matches.size() && matches[i].row == row; ++i) {
+                const SearchMatch& match = matches[i];
+                text.append(line.substr(copied, match.col - copied));
+                ReplacedSpan span = { row, match.col, match.length, newRow, text.size() - lineStart, 0, 0 };
+                size_t expanded = text.size();
+                expandMatch(line, match.col, match.length, groups, text);
+                for (size_t pos = text.find('\n', expanded); pos != std::string::npos; pos = text.find('\n', pos + 1)) {
+                    ++newRow;
+                    lineStart = pos + 1;
+                }
+                span.endRow = newRow;
+                span.endCol = text.size() - lineStart;
+                map.add(span);
+
+                copied = match.col + match.length;
+                ++replaced;
+            }
+            text.append(line.substr(copied));
+            addedRows = newRow - row;
+            onLine(row, std::move(text));
+        }
+        return true;
+    };
+
+    if (_literal) searchSnapshotParallel(pool, snapshot, *_literal, fromRow, toRow, 0, cancel, onChunk);
+    else searchSnapshotParallel(pool, snapshot, _regex, fromRow, toRow, 0, cancel, onChunk);
+    return replaced;
+}
+
+size_t Replacer::replaceLine(Regex& regex, std::string_view line, std::string& out, size_t* firstCol) const {
+    size_t count = 0;
+    size_t copied = 0;
+    std::vector<size_t> groups;
+    auto onMatch = [&](const SearchMatch& match) {
+        if (count++ == 0) {
+            out.clear();
+            if (firstCol) *firstCol = match.col;
+        }
+        out.append(line.substr(copied, match.col - copied));
+        expandMatch(line, match.col, match.length, groups, out);
+        copied = match.col + match.length;
+        return true;
+    };
+    if (!_ready) return 0;
+    if (_literal) searchLine(*_literal, line, 0, onMatch);
+    else searchLine(regex, line, 0, onMatch);
+    if (count > 0) out.append(line.substr(copied));
+    return count;
+}
+
+void Replacer::expandMatch(std::string_view line, size_t col, size_t length, std::vector<size_t>& groups, std::string& out) const {
+    if (_template.usesGroups()) {
+        _regex.captures(line.data(), line.size(), col, col + length, groups);
+    } else {
+        groups.assign({ col, col + length });
+    }
+    _template.expand(line, groups, out);
+}
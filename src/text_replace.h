@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include "line_buffer.h"
+#include "text_search.h"
+#include "text_regex.h"
+#include "worker_pool.h"
+
+// The replacement text of a replace, split into literal text and the groups of the match
+// to insert between it. For a regular expression $0 to $9 and ${n} insert a group ($0 is
+// the whole match), $$ a dollar sign, and \n, \t and \\ a line break, a tab and a
+// backslash; a plain replacement is inserted as it is. A group that did not take part in
+// the match inserts nothing.
+class ReplaceTemplate {
+public:
+    // Fails for a group the pattern does not have, or a '$' or '\' that starts nothing.
+    bool parse(std::string_view replacement, bool regex, size_t groupCount, std::string& error);
+    // Whether any group other than the whole match is inserted, so the match needs Regex::captures().
+    bool usesGroups() const { return _usesGroups; }
+    // Appends the replacement for a match in line to out; groups as Regex::captures() returns them.
+    void expand(std::string_view line, const std::vector<size_t>& groups, std::string& out) const;
+
+private:
+    struct Piece {
+        std::string text;
+        size_t group;  // Inserted after text, or REGEX_NO_GROUP for none
+    };
+    std::vector<Piece> _pieces;
+    bool _usesGroups = false;
+};
+
+// Where one replacement went: the text at (row, col) and length chars long in the buffer
+// before the replace became the text from (newRow, newCol) to (endRow, endCol) after it.
+struct ReplacedSpan {
+    size_t row;
+    size_t col;
+    size_t length;
+    size_t newRow;
+    size_t newCol;
+    size_t endRow;
+    size_t endCol;
+};
+
+// Maps positions in the buffer before a replace to where the same text is after it, for
+// the cursor and anything else that points into the buffer. A position inside replaced
+// text moves to the start of its replacement.
+class PositionMap {
+public:
+    void clear() { _spans.clear(); }
+    // Spans must be added in buffer order.
+    void add(const ReplacedSpan& span) { _spans.push_back(span); }
+    size_t size() const { return _spans.size(); }
+    bool empty() const { return _spans.empty(); }
+    const std::vector<ReplacedSpan>& spans() const { return _spans; }
+
+    void map(size_t& row, size_t& col) const;
+    // The row the start of row is on afterwards.
+    size_t mapRow(size_t row) const;
+    // The other way: the row newRow came from. The rows a replacement added come from the row it was in.
+    size_t unmapRow(size_t newRow) const;
+
+private:
+    std::vector<ReplacedSpan> _spans;
+};
+
+// Replace all: a pattern and its replacement, applied to a snapshot in one pass. The rows
+// are searched in parallel (see searchSnapshotParallel()) and the changed lines built in
+// row order as the matches of each chunk come in, so only the lines that change are ever
+// copied and a huge buffer costs one scan however many matches it has.
+class Replacer {
+public:
+    // Fails for an invalid regex or replacement.
+    bool prepare(const std::string& pattern, const std::string& replacement, SearchOptions options, std::string& error);
+    bool ready() const { return _ready; }
+
+    // Replaces the matches in rows [fromRow, toRow) of snapshot, passing each row that
+    // changes to onLine in order with its new text, where a '\n' is a line break the
+    // replacement added. map gets where every replacement went. Returns the number of
+    // replacements, counting only the rows passed on if cancel was set.
+    size_t run(WorkerPool& pool, const LineSnapshot& snapshot, size_t fromRow, size_t toRow,
+               const std::atomic<bool>& cancel, const std::function<void(size_t row, std::string&& text)>& onLine,
+               PositionMap& map);
+
+    // Writes line (without its terminator) with every match replaced to out, searching with
+    // regex, which must be a copy of regex() that the calling thread owns (it is ignored for
+    // plain text). Returns the number of matches; out is left alone when there are none.
+    // firstCol, if given, gets where the first match starts.
+    size_t replaceLine(Regex& regex, std::string_view line, std::string& out, size_t* firstCol = nullptr) const;
+    const Regex& regex() const { return _regex; }
+    // A literal every match contains, for skipping to the lines that can match; nullptr if there is none.
+    const LiteralSearcher* requiredLiteral() const { return _literal ? _literal.get() : _regex.prefilter(); }
+
+private:
+    std::unique_ptr<LiteralSearcher> _literal;  // Set for plain text, otherwise _regex is compiled
+    Regex _regex;
+    ReplaceTemplate _template;
+    bool _ready = false;
+
+    void expandMatch(std::string_view line, size_t col, size_t length, std::vector<size_t>& groups, std::string& out) const;
+};
@@ -0,0 +1,160 @@
+#include "text_search.h"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPLICE_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline unsigned lowestBit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+static inline bool isAsciiLetter(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// Bytes of multi-byte UTF-8 characters count as word characters, so a word is not split at an accented letter.
+static inline bool isWordByte(unsigned char c) {
+    return (c >= '0' && c <= '9') || isAsciiLetter(c) || c == '_' || c >= 0x80;
+}
+
+LiteralSearcher::LiteralSearcher(std::string_view pattern, SearchOptions options)
+    : _pattern(pattern), _foldMask(pattern.size(), '\0'), _options(options), _wordStart(false), _wordEnd(false) {
+    if (!options.caseSensitive) {
+        for (size_t i = 0; i < _pattern.size(); ++i) {
+            if (isAsciiLetter((unsigned char)_pattern[i])) {
+                _pattern[i] = (char)(_pattern[i] | 0x20);
+                _foldMask[i] = 0x20;
+            }
+        }
+    }
+    // A pattern that starts or ends with punctuation already marks a boundary on that side.
+    if (options.wholeWord && !_pattern.empty()) {
+        _wordStart = isWordByte((unsigned char)_pattern.front());
+        _wordEnd = isWordByte((unsigned char)_pattern.back());
+    }
+}
+
+size_t LiteralSearcher::find(const char* data, size_t size, size_t from) const {
+    const unsigned char* text = (const unsigned char*)data;
+    size_t n = _pattern.size();
+    while (n != 0 && from <= size && size - from >= n) {
+        size_t candidate = findCandidate(text, size, from);
+        if (candidate == npos) return npos;
+        bool boundaryBefore = !_wordStart || candidate == 0 || !isWordByte(text[candidate - 1]);
+        bool boundaryAfter = !_wordEnd || candidate + n == size || !isWordByte(text[candidate + n]);
+        if (boundaryBefore && boundaryAfter) return candidate;
+        from = candidate + 1;
+    }
+    return npos;
+}
+
+size_t LiteralSearcher::findCandidate(const unsigned char* text, size_t size, size_t from) const {
+    size_t n = _pattern.size();
+    size_t lastStart = size - n;
+    size_t i = from;
+
+#ifdef SPLICE_HAVE_SSE2
+    const __m128i first = _mm_set1_epi8(_pattern[0]);
+    const __m128i firstFold = _mm_set1_epi8(_foldMask[0]);
+    const __m128i last = _mm_set1_epi8(_pattern[n - 1]);
+    const __m128i lastFold = _mm_set1_epi8(_foldMask[n - 1]);
+    // Each step tests the 16 start positions i..i+15 at once.
+    while (i <= lastStart && lastStart - i >= 15) {
+        __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i)), firstFold);
+        __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i + n - 1)), lastFold);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            unsigned bit = lowestBit(mask);
+            if (matchesAt(text + i + bit)) return i + bit;
+            mask &= mask - 1;
+        }
+        i += 16;
+    }
+#else
+    if (_options.caseSensitive) {
+        while (i <= lastStart) {
+            const void* hit = memchr(text + i, (unsigned char)_pattern[0], lastStart - i + 1);
+            if (!hit) return npos;
+            i = (const unsigned char*)hit - text;
+            if (matchesAt(text + i)) return i;
+            ++i;
+        }
+        return npos;
+    }
+#endif
+
+    for (; i <= lastStart; ++i) {
+        if (matchesAt(text + i)) return i;
+    }
+    return npos;
+}
+
+bool LiteralSearcher::matchesAt(const unsigned char* p) const {
+    const unsigned char* pattern = (const unsigned char*)_pattern.data();
+    const unsigned char* fold = (const unsigned char*)_foldMask.data();
+    size_t n = _pattern.size();
+    size_t k = 0;
+#ifdef SPLICE_HAVE_SSE2
+    for (; k + 16 <= n; k += 16) {
+        __m128i t = _mm_or_si128(_mm_loadu_si128((const __m128i*)(p + k)), _mm_loadu_si128((const __m128i*)(fold + k)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(t, _mm_loadu_si128((const __m128i*)(pattern + k)))) != 0xFFFF) return false;
+    }
+#endif
+    for (; k < n; ++k) {
+        if ((p[k] | fold[k]) != pattern[k]) return false;
+    }
+    return true;
+}
+
+void searchSnapshot(const LineSnapshot& snapshot, const LiteralSearcher& searcher,
+                    size_t fromRow, size_t toRow, const std::function<bool(const SearchMatch&)>& onMatch) {
+    if (searcher.empty()) return;
+    size_t length = searcher.length();
+    snapshot.forEachChunk(fromRow, toRow, [&](const TextChunk& chunk) {
+        size_t pos = 0;
+        size_t line = 0;
+        while ((pos = searcher.find(chunk.data, chunk.size, pos)) != LiteralSearcher::npos) {
+            // Matches come in order, so the line is usually the one of the previous match or
+            // one shortly after it; only a far jump needs the binary search.
+            for (int step = 0; line + 1 < chunk.lineCount && pos >= chunk.lineStart(line + 1); ++step) {
+                if (step == 8) {
+                    line = chunk.lineAt(pos);
+                    break;
+                }
+                ++line;
+            }
+            size_t col = pos - chunk.lineStart(line);
+            // Only a pattern containing a line break can run past the end of its line.
+            if (col + length > chunk.lineLength(line)) {
+                pos++;
+                continue;
+            }
+            if (!onMatch({ chunk.firstRow + line, col, length })) return false;
+            pos += length;
+        }
+        return true;
+    });
+}
+
+bool searchLine(const LiteralSearcher& searcher, std::string_view line, size_t row,
+                const std::function<bool(const SearchMatch&)>& onMatch) {
+    if (searcher.empty()) return true;
+    size_t pos = 0;
+    while ((pos = searcher.find(line.data(), line.size(), pos)) != LiteralSearcher::npos) {
+        if (!onMatch({ row, pos, searcher.length() })) return false;
+        pos += searcher.length();
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <cstddef>
+#include "line_buffer.h"
+
+struct SearchOptions {
+    bool caseSensitive = true;
+    bool wholeWord = false;   // Matches must not continue a word on either side
+    bool regex = false;       // The pattern is a regular expression (see text_regex.h)
+};
+
+struct SearchMatch {
+    size_t row;
+    size_t col;
+    size_t length;
+};
+
+// A literal pattern prepared for scanning raw text. Candidates are found 16 positions at
+// a time with SSE2 by comparing the first and the last byte of the pattern, and only
+// positions where both agree are compared in full. Case-insensitive search folds ASCII
+// letters in the same vector compares (bytes above 0x7F are compared exactly), so it
+// costs no more than a case-sensitive one.
+class LiteralSearcher {
+public:
+    LiteralSearcher(std::string_view pattern, SearchOptions options);
+
+    bool empty() const { return _pattern.empty(); }
+    size_t length() const { return _pattern.size(); }
+    // The pattern, with its letters lowered when searching case-insensitively.
+    const std::string& pattern() const { return _pattern; }
+
+    // Position of the first match in data at or after from, or npos. The ends of data
+    // count as word boundaries.
+    size_t find(const char* data, size_t size, size_t from = 0) const;
+
+    static const size_t npos = (size_t)-1;
+
+private:
+    std::string _pattern;   // Letters lowered when searching case-insensitively
+    std::string _foldMask;  // 0x20 at letters when searching case-insensitively, else 0
+    SearchOptions _options;
+    bool _wordStart;        // Whether whole-word mode checks the byte before / after a match
+    bool _wordEnd;
+
+    size_t findCandidate(const unsigned char* text, size_t size, size_t from) const;
+    bool matchesAt(const unsigned char* p) const;
+};
+
+// Scans rows [fromRow, toRow) of snapshot a chunk of consecutive lines at a time and passes
+// the matches to onMatch in order, until it returns false. Matches do not overlap and
+// never span lines.
+void searchSnapshot(const LineSnapshot& snapshot, const LiteralSearcher& searcher,
+                    size_t fromRow, size_t toRow, const std::function<bool(const SearchMatch&)>& onMatch);
+
+// Passes the matches in line (without its terminator) to onMatch as they would be reported
+// for row by searchSnapshot(), for searching a few lines of the live buffer without taking
+// a snapshot. Returns false if onMatch stopped the search.
+bool searchLine(const LiteralSearcher& searcher, std::string_view line, size_t row,
+                const std::function<bool(const SearchMatch&)>& onMatch);
@@ -0,0 +1,382 @@
+#include "trigram_index.h"
+#include "project_search.h"
+#include "atomic_file_writer.h"
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+
+static const char TRIGRAM_INDEX_MAGIC[4] = { 'S', 'P', 'L', 'T' };
+static const uint32_t TRIGRAM_INDEX_VERSION = 1;
+static const uint32_t NOT_REUSED = (uint32_t)-1;
+
+namespace {
+
+struct IndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t fileCount;
+    uint32_t trigramCount;
+    uint64_t postingCount;
+    uint64_t pathsSize;
+};
+
+}
+
+struct TrigramIndex::FileRecord {
+    uint64_t size;
+    int64_t mtime;
+    uint64_t pathOffset;
+    uint32_t pathLength;
+    uint32_t flags;
+};
+
+struct TrigramIndex::TrigramRecord {
+    uint32_t trigram;
+    uint32_t count;
+    uint64_t offset;  // In posting list entries
+};
+
+static inline unsigned char foldByte(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + 32) : c;
+}
+
+// The distinct trigrams of the lines in data, folded, in ascending order. seen is a bitmap
+// over every possible trigram that starts and is left cleared.
+static void collectTrigrams(const char* data, size_t size, std::vector<uint64_t>& seen, std::vector<uint32_t>& out) {
+    out.clear();
+    uint32_t trigram = 0;
+    size_t run = 0;
+    for (size_t i = 0; i < size; ++i) {
+        unsigned char c = (unsigned char)data[i];
+        if (c == '\n') {
+            run = 0;
+            continue;
+        }
+        trigram = ((trigram << 8) | foldByte(c)) & 0xFFFFFF;
+        if (++run < 3) continue;
+        uint64_t bit = 1ull << (trigram & 63);
+        uint64_t& word = seen[trigram >> 6];
+        if (word & bit) continue;
+        word |= bit;
+        out.push_back(trigram);
+    }
+    for (uint32_t t : out) seen[t >> 6] = 0;
+    std::sort(out.begin(), out.end());
+}
+
+TrigramIndex::TrigramIndex()
+    : _fileCount(0), _trigramCount(0), _files(nullptr), _trigrams(nullptr), _postings(nullptr), _postingCount(0), _paths(nullptr) {}
+
+bool TrigramIndex::open(const std::string& path, std::string& error) {
+    // The records are used in place from the mapping.
+    static_assert(sizeof(IndexHeader) == 32, "IndexHeader layout is part of the index format");
+    static_assert(sizeof(FileRecord) == 32, "FileRecord layout is part of the index format");
+    static_assert(sizeof(TrigramRecord) == 16, "TrigramRecord layout is part of the index format");
+
+    _byPath.clear();
+    _fileCount = 0;
+    _trigramCount = 0;
+    if (!_file.open(path)) {
+        error = _file.lastError();
+        return false;
+    }
+    auto fail = [this, &error](const char* message) {
+        error = message;
+        _file.close();
+        _byPath.clear();
+        _fileCount = 0;
+        _trigramCount = 0;
+        return false;
+    };
+
+    uint64_t size = _file.size();
+    const char* data = _file.data();
+    IndexHeader header;
+    if (size < sizeof(header)) return fail("index is truncated");
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, TRIGRAM_INDEX_MAGIC, sizeof(TRIGRAM_INDEX_MAGIC)) != 0 || header.version != TRIGRAM_INDEX_VERSION) {
+        return fail("not a trigram index of this version");
+    }
+    uint64_t trigramsOffset = sizeof(IndexHeader) + (uint64_t)header.fileCount * sizeof(FileRecord);
+    uint64_t postingsOffset = trigramsOffset + (uint64_t)header.trigramCount * sizeof(TrigramRecord);
+    if (header.postingCount > size || header.pathsSize > size ||
+        postingsOffset + header.postingCount * sizeof(uint32_t) + header.pathsSize != size) {
+        return fail("index size does not match its header");
+    }
+    _files = (const FileRecord*)(data + sizeof(IndexHeader));
+    _trigrams = (const TrigramRecord*)(data + trigramsOffset);
+    _postings = (const uint32_t*)(data + postingsOffset);
+    _postingCount = header.postingCount;
+    _paths = data + postingsOffset + header.postingCount * sizeof(uint32_t);
+
+    // Everything lookups rely on is checked once here; posting list entries are checked as they are read.
+    _byPath.reserve(header.fileCount);
+    for (uint32_t id = 0; id < header.fileCount; ++id) {
+        const FileRecord& record = _files[id];
+        if (record.pathOffset > header.pathsSize || record.pathLength > header.pathsSize - record.pathOffset) {
+            return fail("index has a path out of range");
+        }
+        _byPath.emplace(std::string_view(_paths + record.pathOffset, record.pathLength), id);
+    }
+    for (uint32_t i = 0; i < header.trigramCount; ++i) {
+        const TrigramRecord& record = _trigrams[i];
+        if ((i > 0 && record.trigram <= _trigrams[i - 1].trigram) || record.offset > _postingCount ||
+            record.count > _postingCount - record.offset) {
+            return fail("index has a damaged trigram table");
+        }
+    }
+    _fileCount = header.fileCount;
+    _trigramCount = header.trigramCount;
+    return true;
+}
+
+TrigramIndex::FileEntry TrigramIndex::file(uint32_t id) const {
+    const FileRecord& record = _files[id];
+    return { std::string_view(_paths + record.pathOffset, record.pathLength), record.size, record.mtime, record.flags };
+}
+
+int64_t TrigramIndex::findFile(std::string_view relative) const {
+    auto it = _byPath.find(relative);
+    return it == _byPath.end() ? -1 : (int64_t)it->second;
+}
+
+const uint32_t* TrigramIndex::postings(uint32_t trigram, size_t& count) const {
+    const TrigramRecord* end = _trigrams + _trigramCount;
+    const TrigramRecord* record = std::lower_bound(_trigrams, end, trigram,
+                                                   [](const TrigramRecord& r, uint32_t t) { return r.trigram < t; });
+    if (record == end || record->trigram != trigram) {
+        count = 0;
+        return nullptr;
+    }
+    count = record->count;
+    return _postings + record->offset;
+}
+
+bool TrigramIndex::candidates(std::string_view literal, std::vector<uint32_t>& ids) const {
+    ids.clear();
+    if (literal.size() < 3) return false;
+
+    std::vector<uint32_t> trigrams;
+    for (size_t i = 2; i < literal.size(); ++i) {
+        trigrams.push_back(((uint32_t)foldByte(literal[i - 2]) << 16) | ((uint32_t)foldByte(literal[i - 1]) << 8) | foldByte(literal[i]));
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+    struct List {
+        const uint32_t* ids;
+        size_t count;
+    };
+    std::vector<List> lists;
+    for (uint32_t trigram : trigrams) {
+        size_t count;
+        const uint32_t* list = postings(trigram, count);
+        if (count == 0) return true;  // No file has it, so none can match
+        lists.push_back({ list, count });
+    }
+
+    // Start from the rarest trigram and look the survivors up in the longer lists.
+    std::sort(lists.begin(), lists.end(), [](const List& a, const List& b) { return a.count < b.count; });
+    for (size_t i = 0; i < lists[0].count; ++i) {
+        if (lists[0].ids[i] < _fileCount) ids.push_back(lists[0].ids[i]);
+    }
+    for (size_t l = 1; l < lists.size() && !ids.empty(); ++l) {
+        const uint32_t* p = lists[l].ids;
+        const uint32_t* end = p + lists[l].count;
+        size_t kept = 0;
+        for (uint32_t id : ids) {
+            p = std::lower_bound(p, end, id);
+            if (p == end) break;
+            if (*p == id) ids[kept++] = id;
+        }
+        ids.resize(kept);
+    }
+    return true;
+}
+
+void TrigramIndex::forEachPostingList(const std::function<void(uint32_t trigram, const uint32_t* ids, size_t count)>& visit) const {
+    for (uint32_t i = 0; i < _trigramCount; ++i) {
+        visit(_trigrams[i].trigram, _postings + _trigrams[i].offset, _trigrams[i].count);
+    }
+}
+
+bool TrigramIndex::build(WorkerPool& pool, const std::string& root, const TrigramIndex* previous,
+                         const std::atomic<bool>& cancel, TrigramIndexStats& stats, std::string& error) {
+    struct BuildFile {
+        std::string relative;
+        uint64_t size;
+        int64_t mtime;
+        uint32_t flags;
+    };
+    stats = TrigramIndexStats();
+    // A deque, so the tasks can hold on to their file while the walk adds more.
+    std::deque<BuildFile> files;
+    std::vector<uint32_t> reused;  // New id of each file of previous, or NOT_REUSED
+    if (previous) reused.assign(previous->fileCount(), NOT_REUSED);
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t running = 0;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings;
+    size_t ahead = std::max<size_t>(1, pool.size() * TRIGRAM_INDEX_FILES_PER_THREAD);
+
+    walkProjectFiles(root, cancel, [&](ProjectFile& file) {
+        uint32_t id = (uint32_t)files.size();
+        if (previous) {
+            int64_t old = previous->findFile(file.relative);
+            if (old >= 0) {
+                FileEntry entry = previous->file((uint32_t)old);
+                if (entry.size == file.size && entry.mtime == file.mtime) {
+                    files.push_back({ std::move(file.relative), file.size, file.mtime, entry.flags });
+                    reused[old] = id;
+                    ++stats.filesReused;
+                    return true;
+                }
+            }
+        }
+        files.push_back({ std::move(file.relative), file.size, file.mtime, 0 });
+        ++stats.filesRead;
+        if (file.size > TRIGRAM_INDEX_MAX_FILE_SIZE) return true;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&]() { return running < ahead; });
+            ++running;
+        }
+        BuildFile* target = &files.back();
+        pool.submit([&, id, target, path = std::move(file.path)]() {
+            thread_local std::vector<uint64_t> seen(((size_t)1 << 24) / 64);
+            uint32_t flags = 0;
+            std::vector<uint32_t> trigrams;
+            MappedFile mapped;
+            if (!cancel && mapped.open(path)) {
+                size_t size = (size_t)mapped.size();
+                if (size > 0 && memchr(mapped.data(), 0, std::min(size, PROJECT_SEARCH_BINARY_PROBE))) {
+                    flags = FILE_BINARY;
+                } else {
+                    collectTrigrams(mapped.data(), size, seen, trigrams);
+                    flags = FILE_INDEXED;
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            target->flags = flags;
+            for (uint32_t trigram : trigrams) {
+                postings[trigram].push_back(id);
+            }
+            --running;
+            finished.notify_all();
+        });
+        return true;
+    });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return running == 0; });
+    }
+    if (cancel) {
+        error = "cancelled";
+        return false;
+    }
+
+    // Unchanged files keep the trigrams they had.
+    if (previous) {
+        previous->forEachPostingList([&](uint32_t trigram, const uint32_t* ids, size_t count) {
+            std::vector<uint32_t>* list = nullptr;
+            for (size_t i = 0; i < count; ++i) {
+                if (ids[i] >= reused.size() || reused[ids[i]] == NOT_REUSED) continue;
+                if (!list) list = &postings[trigram];
+                list->push_back(reused[ids[i]]);
+            }
+        });
+    }
+
+    std::vector<uint32_t> trigrams;
+    trigrams.reserve(postings.size());
+    for (auto& entry : postings) {
+        std::sort(entry.second.begin(), entry.second.end());
+        trigrams.push_back(entry.first);
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+
+    std::string head;
+    IndexHeader header;
+    memcpy(header.magic, TRIGRAM_INDEX_MAGIC, sizeof(header.magic));
+    header.version = TRIGRAM_INDEX_VERSION;
+    header.fileCount = (uint32_t)files.size();
+    header.trigramCount = (uint32_t)trigrams.size();
+    header.postingCount = 0;
+    header.pathsSize = 0;
+    std::vector<FileRecord> fileRecords;
+    fileRecords.reserve(files.size());
+    for (const BuildFile& file : files) {
+        fileRecords.push_back({ file.size, file.mtime, header.pathsSize, (uint32_t)file.relative.size(), file.flags });
+        header.pathsSize += file.relative.size();
+    }
+    std::vector<TrigramRecord> trigramRecords;
+    trigramRecords.reserve(trigrams.size());
+    for (uint32_t trigram : trigrams) {
+        const std::vector<uint32_t>& list = postings[trigram];
+        trigramRecords.push_back({ trigram, (uint32_t)list.size(), header.postingCount });
+        header.postingCount += list.size();
+    }
+
+    AtomicFileWriter writer;
+    std::string path = (std::filesystem::path(root) / TRIGRAM_INDEX_FILE_NAME).string();
+    bool ok = writer.open(path) &&
+              writer.appendCopy((const char*)&header, sizeof(header)) &&
+              writer.append((const char*)fileRecords.data(), fileRecords.size() * sizeof(FileRecord)) &&
+              writer.append((const char*)trigramRecords.data(), trigramRecords.size() * sizeof(TrigramRecord));
+    for (size_t i = 0; ok && i < trigrams.size(); ++i) {
+        const std::vector<uint32_t>& list = postings[trigrams[i]];
+        ok = writer.append((const char*)list.data(), list.size() * sizeof(uint32_t));
+    }
+    for (size_t i = 0; ok && i < files.size(); ++i) {
+        ok = writer.append(files[i].relative.data(), files[i].relative.size());
+    }
+    ok = ok && writer.commit();
+    if (!ok) {
+        error = writer.lastError();
+        writer.abort();
+        return false;
+    }
+
+    stats.files = files.size();
+    stats.trigrams = trigrams.size();
+    stats.postings = header.postingCount;
+    return true;
+}
+
+TrigramIndexer::TrigramIndexer() : _cancel(false), _done(false), _succeeded(false) {}
+
+TrigramIndexer::~TrigramIndexer() {
+    cancel();
+}
+
+void TrigramIndexer::start(WorkerPool& pool, const std::string& root, std::shared_ptr<const TrigramIndex> previous) {
+    cancel();
+    _root = root;
+    _cancel = false;
+    _done = false;
+    _succeeded = false;
+    _stats = TrigramIndexStats();
+    _error.clear();
+    _thread = std::thread([this, &pool, root, previous = std::move(previous)]() {
+        _succeeded = TrigramIndex::build(pool, root, previous.get(), _cancel, _stats, _error);
+        _done = true;
+    });
+}
+
+void TrigramIndexer::cancel() {
+    if (!_thread.joinable()) return;
+    _cancel = true;
+    _thread.join();
+}
+
+bool TrigramIndexer::finish(TrigramIndexStats& stats, std::string& error) {
+    if (_thread.joinable()) _thread.join();
+    stats = _stats;
+    error = _error;
+    return _succeeded;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include "mapped_file.h"
+#include "worker_pool.h"
+
+const char* const TRIGRAM_INDEX_FILE_NAME = ".splice-index";    // Kept at the root of the indexed folder
+const uint64_t TRIGRAM_INDEX_MAX_FILE_SIZE = 64 * 1024 * 1024;  // Bigger files are left out of the index and always searched
+const size_t TRIGRAM_INDEX_FILES_PER_THREAD = 16;               // Files read ahead per pool thread while building
+
+struct TrigramIndexStats {
+    size_t files = 0;
+    size_t filesRead = 0;     // Read because they were new or changed
+    size_t filesReused = 0;   // Carried over from the previous index unchanged
+    size_t trigrams = 0;
+    uint64_t postings = 0;
+};
+
+// Index of which files of a folder contain which trigrams (three consecutive bytes of a
+// line, ASCII letters folded to lower case), for narrowing a folder search down to the
+// files that can match before any of them is opened. The index is a single file at the
+// root of the folder, memory-mapped and used in place: a header, one record per file
+// (relative path, size, modification time), the trigrams in sorted order with where their
+// posting list starts, then the posting lists themselves as ascending file ids. Nothing
+// is parsed on open except a path lookup table, so opening and querying take
+// milliseconds however big the folder is. Records are written in native byte order; the
+// index is a cache for this machine, rebuilt whenever it does not check out.
+class TrigramIndex {
+public:
+    enum FileFlags : uint32_t {
+        FILE_INDEXED = 1,  // Its trigrams are in the index
+        FILE_BINARY = 2,   // Left out because it looks binary; searches skip it while it is unchanged
+        // Neither: too big or unreadable when the index was built, so searches always look at it.
+    };
+
+    struct FileEntry {
+        std::string_view relative;  // Relative to the folder, with '/' between names
+        uint64_t size;
+        int64_t mtime;              // As FileStamp has it
+        uint32_t flags;
+    };
+
+    TrigramIndex();
+    TrigramIndex(const TrigramIndex&) = delete;
+    TrigramIndex& operator=(const TrigramIndex&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    const std::string& path() const { return _file.path(); }
+
+    uint32_t fileCount() const { return _fileCount; }
+    FileEntry file(uint32_t id) const;
+    // Id of the file at relative, or -1 if the index does not know it.
+    int64_t findFile(std::string_view relative) const;
+
+    // Ids of the indexed files that contain every trigram of literal, in ascending order.
+    // Returns false if literal is too short to have a trigram, so nothing can be ruled out.
+    bool candidates(std::string_view literal, std::vector<uint32_t>& ids) const;
+    // Every trigram with the ids of the files that contain it, in ascending order.
+    void forEachPostingList(const std::function<void(uint32_t trigram, const uint32_t* ids, size_t count)>& visit) const;
+
+    // Writes the index of root to root/TRIGRAM_INDEX_FILE_NAME, reading the files on pool.
+    // Files previous already has with the same size and modification time are not read
+    // again; their trigrams are carried over from its posting lists. Stops without
+    // writing anything if cancel is set.
+    static bool build(WorkerPool& pool, const std::string& root, const TrigramIndex* previous,
+                      const std::atomic<bool>& cancel, TrigramIndexStats& stats, std::string& error);
+
+private:
+    struct FileRecord;
+    struct TrigramRecord;
+
+    MappedFile _file;
+    uint32_t _fileCount;
+    uint32_t _trigramCount;
+    const FileRecord* _files;
+    const TrigramRecord* _trigrams;
+    const uint32_t* _postings;
+    uint64_t _postingCount;
+    const char* _paths;
+    std::unordered_map<std::string_view, uint32_t> _byPath;
+
+    // The posting list of trigram, or an empty one.
+    const uint32_t* postings(uint32_t trigram, size_t& count) const;
+};
+
+// Runs TrigramIndex::build() on a thread of its own, so the editor can keep going while a
+// folder is indexed.
+class TrigramIndexer {
+public:
+    TrigramIndexer();
+    ~TrigramIndexer();
+    TrigramIndexer(const TrigramIndexer&) = delete;
+    TrigramIndexer& operator=(const TrigramIndexer&) = delete;
+
+    // Starts indexing root; previous, if given, is the index being brought up to date and
+    // is kept alive until the build is over. pool must outlive the indexer.
+    void start(WorkerPool& pool, const std::string& root, std::shared_ptr<const TrigramIndex> previous);
+    void cancel();
+    bool busy() const { return _thread.joinable(); }
+    bool done() const { return _done; }
+    const std::string& root() const { return _root; }
+    // Joins a build that is done; true if it wrote the index.
+    bool finish(TrigramIndexStats& stats, std::string& error);
+
+private:
+    std::thread _thread;
+    std::atomic<bool> _cancel;
+    std::atomic<bool> _done;
+    std::string _root;
+    bool _succeeded;
+    TrigramIndexStats _stats;
+    std::string _error;
+};
@@ -0,0 +1,43 @@
+#include "worker_pool.h"
+
+WorkerPool::WorkerPool(size_t threads) : _stopping(false) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 2;
+    _threads.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        _threads.emplace_back(&WorkerPool::workerMain, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push_back(std::move(task));
+    }
+    _wake.notify_one();
+}
+
+void WorkerPool::workerMain() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock, [this]() { return _stopping || !_tasks.empty(); });
+        // Queued tasks still run on shutdown; whoever submitted them may be waiting for them.
+        if (_tasks.empty()) return;
+        std::function<void()> task = std::move(_tasks.front());
+        _tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
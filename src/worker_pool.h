@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstddef>
+
+// A fixed set of threads that run submitted tasks in the order they were submitted. Tasks
+// must not wait on other tasks of the same pool; the threads that hand out work and
+// collect the results (the main thread, a background counter) are never pool threads.
+class WorkerPool {
+public:
+    // threads == 0 starts one thread per hardware thread.
+    explicit WorkerPool(size_t threads = 0);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    size_t size() const { return _threads.size(); }
+    void submit(std::function<void()> task);
+
+private:
+    std::vector<std::thread> _threads;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stopping;
+
+    void workerMain();
+};